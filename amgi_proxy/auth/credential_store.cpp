@@ -0,0 +1,175 @@
+#include "credential_store.h"
+#include "logger/logger.h"
+#include "metrics/metrics.h"
+
+#include <openssl/crypto.h>
+#include <openssl/rand.h>
+#include <openssl/sha.h>
+
+#include <atomic>
+#include <fstream>
+
+namespace
+{
+    enum : std::size_t { kMaxSaltLength = 64, kMaxPasswordLength = 255 };
+
+    auto& g_auth_verified = metrics::make_counter("auth.verified");
+    auto& g_auth_failed = metrics::make_counter("auth.failed");
+
+    bool from_hex(std::string_view hex, std::vector<std::uint8_t>& out)
+    {
+        if (hex.size() % 2)
+            return false;
+
+        const auto nibble = [](char c) -> int {
+            if (c >= '0' && c <= '9') return c - '0';
+            if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+            if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+            return -1;
+        };
+
+        out.clear();
+        for (std::size_t i = 0; i < hex.size(); i += 2) {
+            const auto hi = nibble(hex[i]);
+            const auto lo = nibble(hex[i + 1]);
+            if (hi < 0 || lo < 0)
+                return false;
+            out.push_back(static_cast<std::uint8_t>((hi << 4) | lo));
+        }
+
+        return true;
+    }
+
+    std::string_view trim(std::string_view str)
+    {
+        while (!str.empty() && (str.back() == '\r' || str.back() == ' ' || str.back() == '\t'))
+            str.remove_suffix(1);
+        while (!str.empty() && (str.front() == ' ' || str.front() == '\t'))
+            str.remove_prefix(1);
+        return str;
+    }
+}
+
+credential_index_ptr credential_index::load(const std::string& path, std::string& error)
+{
+    std::ifstream file{path};
+    if (!file) {
+        error = "unable to open credentials file: " + path;
+        return {};
+    }
+
+    auto index = std::make_shared<credential_index>();
+
+    std::string line;
+    std::size_t line_no{0};
+    while (std::getline(file, line)) {
+        ++line_no;
+        const auto str = trim(line);
+        if (str.empty() || str.front() == '#')
+            continue;
+
+        const auto first = str.find(':');
+        const auto second = (first == std::string_view::npos) ? first : str.find(':', first + 1);
+        if (second == std::string_view::npos) {
+            error = "credentials file line " + std::to_string(line_no) + ": expected <user>:<salt>:<hash>";
+            return {};
+        }
+
+        entry e{};
+        std::vector<std::uint8_t> hash;
+        if (!from_hex(str.substr(first + 1, second - first - 1), e.salt) || e.salt.size() > kMaxSaltLength ||
+            !from_hex(str.substr(second + 1), hash) || hash.size() != e.hash.size()) {
+            error = "credentials file line " + std::to_string(line_no) + ": bad salt or hash";
+            return {};
+        }
+
+        std::copy(hash.begin(), hash.end(), e.hash.begin());
+        if (index->dummy_.salt.empty())
+            index->dummy_.salt.resize(e.salt.size());
+        index->entries_[std::string{str.substr(0, first)}] = std::move(e);
+    }
+
+    // Sized like a real salt so the digest of a miss takes as long as that of a hit
+    if (!index->dummy_.salt.empty() && RAND_bytes(index->dummy_.salt.data(), static_cast<int>(index->dummy_.salt.size())) != 1) {
+        error = "unable to generate a dummy salt";
+        return {};
+    }
+
+    return index;
+}
+
+bool credential_index::verify(std::string_view user, std::string_view password) const
+{
+    if (password.size() > kMaxPasswordLength)
+        return false;
+
+    // A missing user is hashed and compared all the same, the reply time doesn't tell which names exist
+    const auto it = entries_.find(std::string{user});
+    const auto known = it != entries_.end();
+    const auto& e = known ? it->second : dummy_;
+
+    std::array<std::uint8_t, kMaxSaltLength + kMaxPasswordLength> input;
+    std::copy(e.salt.begin(), e.salt.end(), input.begin());
+    std::copy(password.begin(), password.end(), input.begin() + e.salt.size());
+
+    digest hash;
+    SHA256(input.data(), e.salt.size() + password.size(), hash.data());
+    OPENSSL_cleanse(input.data(), input.size());
+
+    const auto match = CRYPTO_memcmp(hash.data(), e.hash.data(), hash.size()) == 0;
+    return known && match;
+}
+
+credential_store& credential_store::get()
+{
+    static credential_store instance;
+    return instance;
+}
+
+bool credential_store::load(const std::string& path)
+{
+    {
+        std::lock_guard lock{reload_mutex_};
+        path_ = path;
+    }
+    return reload();
+}
+
+bool credential_store::reload()
+{
+    std::lock_guard lock{reload_mutex_};
+    if (path_.empty())
+        return false;
+
+    std::string error;
+    auto index = credential_index::load(path_, error);
+    if (!index) {
+        logging::logger::error("credentials not loaded, " + error);
+        return false;
+    }
+
+    logging::logger::info("credentials loaded: " + std::to_string(index->size()) + " users");
+    std::atomic_store(&index_, std::move(index));
+    return true;
+}
+
+bool credential_store::enabled() const
+{
+    return static_cast<bool>(std::atomic_load(&index_));
+}
+
+bool credential_store::verify(std::string_view user, std::string_view password)
+{
+    const auto index = std::atomic_load(&index_);
+    if (!index)
+        return false;
+
+    // One salted digest per handshake, cheap enough that no password has to be kept around to skip it
+    if (!index->verify(user, password)) {
+        g_auth_failed.add();
+        return false;
+    }
+
+    g_auth_verified.add();
+    return true;
+}
@@ -0,0 +1,57 @@
+#ifndef CREDENTIAL_STORE_H
+#define CREDENTIAL_STORE_H
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Immutable user -> salted SHA-256 index built from a credentials file.
+// File format, one user per line: <user>:<hex salt>:<hex sha256(salt || password)>
+class credential_index
+{
+public:
+    using digest = std::array<std::uint8_t, 32>;
+
+    static std::shared_ptr<const credential_index> load(const std::string& path, std::string& error);
+
+    [[nodiscard]] bool verify(std::string_view user, std::string_view password) const;
+    [[nodiscard]] std::size_t size() const { return entries_.size(); }
+
+private:
+    struct entry {
+        std::vector<std::uint8_t> salt;
+        digest hash;
+    };
+
+    std::unordered_map<std::string, entry> entries_;
+    // Unknown users are checked against this so that a miss costs as much as a wrong password
+    entry dummy_{};
+};
+
+using credential_index_ptr = std::shared_ptr<const credential_index>;
+
+class credential_store
+{
+public:
+    static credential_store& get();
+
+    bool load(const std::string& path);
+    bool reload();
+
+    [[nodiscard]] bool enabled() const;
+    bool verify(std::string_view user, std::string_view password);
+
+private:
+    credential_store() = default;
+
+    std::mutex reload_mutex_;
+    std::string path_;
+    credential_index_ptr index_;
+};
+
+#endif // CREDENTIAL_STORE_H
@@ -0,0 +1,246 @@
+// Relay benchmark: connections through a running socks5 proxy to an echo origin served from here,
+// each one sending a message and waiting for its echo in a loop. Run it against the proxy started
+// with each --backend to compare them
+//
+//   $ amgi_proxy -p 1080 -m socks5 --backend uring
+//   $ amgi_proxy_bench -p 1080 -c 64 -s 16384 -d 10
+
+#include <asio.hpp>
+#include <boost/program_options.hpp>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace net = asio;
+namespace po = boost::program_options;
+using tcp = asio::ip::tcp;
+using clock_type = std::chrono::steady_clock;
+
+namespace
+{
+    struct bench_options {
+        std::uint16_t proxy_port{1080};
+        std::uint16_t origin_port{18200};
+        std::size_t connections{64};
+        std::size_t size{0x4000};
+        std::chrono::seconds duration{10};
+    };
+
+    class echo_session : public std::enable_shared_from_this<echo_session>
+    {
+    public:
+        explicit echo_session(tcp::socket socket) : socket_{std::move(socket)} {}
+
+        void start() { read(); }
+
+    private:
+        void read()
+        {
+            socket_.async_read_some(
+                net::buffer(buffer_),
+                [this, self{shared_from_this()}](const net::error_code& ec, std::size_t length) {
+                    if (ec)
+                        return;
+
+                    net::async_write(
+                        socket_, net::buffer(buffer_, length),
+                        [this, self](const net::error_code& ec, std::size_t) {
+                            if (!ec)
+                                read();
+                        });
+                });
+        }
+
+        tcp::socket socket_;
+        std::array<std::uint8_t, 0x10000> buffer_{};
+    };
+
+    void accept_echo(tcp::acceptor& acceptor)
+    {
+        acceptor.async_accept(
+            [&acceptor](const net::error_code& ec, tcp::socket socket) {
+                if (ec)
+                    return;
+
+                socket.set_option(tcp::no_delay(true));
+                std::make_shared<echo_session>(std::move(socket))->start();
+                accept_echo(acceptor);
+            });
+    }
+
+    class client : public std::enable_shared_from_this<client>
+    {
+    public:
+        client(net::io_context& ctx, const bench_options& options, clock_type::time_point deadline)
+            : socket_{ctx}, options_{options}, deadline_{deadline}
+            , message_(options.size, 0x5a), echo_(options.size)
+        {}
+
+        void start()
+        {
+            socket_.async_connect(
+                tcp::endpoint{net::ip::address_v4::loopback(), options_.proxy_port},
+                [this, self{shared_from_this()}](const net::error_code& ec) {
+                    if (ec)
+                        return fail("connect", ec);
+
+                    socket_.set_option(tcp::no_delay(true));
+                    handshake();
+                });
+        }
+
+        [[nodiscard]] const std::vector<std::uint32_t>& samples() const { return samples_; }
+        [[nodiscard]] bool failed() const { return failed_; }
+
+    private:
+        // Greeting without authentication and the connect request to the origin in one go, the
+        // method selection and the connect reply come back together
+        void handshake()
+        {
+            const auto port = options_.origin_port;
+            request_ = {0x05, 0x01, 0x00,
+                        0x05, 0x01, 0x00, 0x01, 127, 0, 0, 1,
+                        static_cast<std::uint8_t>(port >> 8), static_cast<std::uint8_t>(port & 0xff)};
+            net::async_write(
+                socket_, net::buffer(request_),
+                [this, self{shared_from_this()}](const net::error_code& ec, std::size_t) {
+                    if (ec)
+                        return fail("handshake", ec);
+
+                    net::async_read(
+                        socket_, net::buffer(reply_),
+                        [this, self](const net::error_code& ec, std::size_t) {
+                            if (ec || reply_[1] != 0x00 || reply_[3] != 0x00)
+                                return fail("handshake", ec);
+                            ping();
+                        });
+                });
+        }
+
+        void ping()
+        {
+            sent_ = clock_type::now();
+            if (sent_ >= deadline_) {
+                net::error_code ignored_ec;
+                socket_.close(ignored_ec);
+                return;
+            }
+
+            net::async_write(
+                socket_, net::buffer(message_),
+                [this, self{shared_from_this()}](const net::error_code& ec, std::size_t) {
+                    if (ec)
+                        return fail("write", ec);
+
+                    net::async_read(
+                        socket_, net::buffer(echo_),
+                        [this, self](const net::error_code& ec, std::size_t) {
+                            if (ec)
+                                return fail("read", ec);
+
+                            const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(clock_type::now() - sent_);
+                            samples_.push_back(static_cast<std::uint32_t>(elapsed.count()));
+                            ping();
+                        });
+                });
+        }
+
+        void fail(const char* what, const net::error_code& ec)
+        {
+            if (!failed_)
+                std::cerr << what << " failed: " << (ec ? ec.message() : "bad socks5 reply") << "\n";
+            failed_ = true;
+        }
+
+        tcp::socket socket_;
+        const bench_options& options_;
+        clock_type::time_point deadline_;
+        std::array<std::uint8_t, 13> request_{};
+        std::array<std::uint8_t, 12> reply_{};
+        std::vector<std::uint8_t> message_;
+        std::vector<std::uint8_t> echo_;
+        clock_type::time_point sent_{};
+        std::vector<std::uint32_t> samples_;
+        bool failed_{false};
+    };
+
+    bench_options parse_command_line_arguments(int argc, char* argv[])
+    {
+        bench_options options;
+        std::size_t seconds{0};
+
+        po::options_description desc("Allowed options");
+        desc.add_options()
+            ("proxy-port,p", po::value<std::uint16_t>(&options.proxy_port)->default_value(options.proxy_port), "port of the socks5 proxy on the loopback")
+            ("origin-port,o", po::value<std::uint16_t>(&options.origin_port)->default_value(options.origin_port), "port of the echo origin served by the benchmark")
+            ("connections,c", po::value<std::size_t>(&options.connections)->default_value(options.connections), "concurrent connections")
+            ("size,s", po::value<std::size_t>(&options.size)->default_value(options.size), "message size in bytes")
+            ("duration,d", po::value<std::size_t>(&seconds)->default_value(10), "seconds to run")
+            ("help,h", "show help message");
+
+        po::variables_map vm;
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+        po::notify(vm);
+        if (vm.count("help")) {
+            std::cout << desc << "\n";
+            exit(EXIT_SUCCESS);
+        }
+
+        options.duration = std::chrono::seconds{seconds};
+        return options;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    const auto options = parse_command_line_arguments(argc, argv);
+
+    // The origin runs on its own thread so it doesn't share a core with the clients
+    net::io_context origin_ctx;
+    tcp::acceptor acceptor{origin_ctx, tcp::endpoint{net::ip::address_v4::loopback(), options.origin_port}};
+    accept_echo(acceptor);
+    std::thread origin{[&origin_ctx] { origin_ctx.run(); }};
+
+    net::io_context ctx;
+    const auto started = clock_type::now();
+    std::vector<std::shared_ptr<client>> clients;
+    for (std::size_t i = 0; i < options.connections; ++i) {
+        clients.push_back(std::make_shared<client>(ctx, options, started + options.duration));
+        clients.back()->start();
+    }
+    ctx.run();
+    const auto elapsed = std::chrono::duration<double>(clock_type::now() - started).count();
+
+    origin_ctx.stop();
+    origin.join();
+
+    std::vector<std::uint32_t> samples;
+    std::size_t failed{0};
+    for (const auto& c : clients) {
+        samples.insert(samples.end(), c->samples().begin(), c->samples().end());
+        failed += c->failed();
+    }
+    if (samples.empty()) {
+        std::cout << "no round trips completed\n";
+        return EXIT_FAILURE;
+    }
+
+    std::sort(samples.begin(), samples.end());
+    const auto percentile = [&samples](double p) {
+        return samples[std::min(samples.size() - 1, static_cast<std::size_t>(p * static_cast<double>(samples.size())))];
+    };
+
+    const auto rate = static_cast<double>(samples.size()) / elapsed;
+    std::cout << std::fixed << std::setprecision(1)
+              << "connections " << options.connections << " (" << failed << " failed), message " << options.size << " bytes\n"
+              << "round trips/s " << rate << ", relayed " << rate * static_cast<double>(options.size) / (1 << 20) << " MiB/s each way\n"
+              << "latency us p50 " << percentile(0.5) << ", p99 " << percentile(0.99) << ", p99.9 " << percentile(0.999) << "\n";
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -1,11 +1,13 @@
 #include "http_session.h"
 #include "http_stream_manager.h"
 
+#include <algorithm>
 #include <utility>
 
-http_session::http_session(int id, stream_manager_ptr mgr)
+http_session::http_session(int id, stream_manager_ptr mgr, bool optimistic_connect)
     : context_{id}, manager_{std::move(mgr)}
 {
+    context_.optimistic_connect = optimistic_connect;
     state_ = http_wait_request::instance();
 }
 
@@ -26,11 +28,20 @@ void http_session::handle_client_read(io_buffer &event)
 
 void http_session::handle_server_write(io_buffer &event)
 {
+    context().buffers.release(std::exchange(context().server_write_bytes, 0));
+    if (!context().queued_output.empty()) {
+        context().server_write_bytes = context().queued_output.size();
+        manager().write_server(id(), std::exchange(context().queued_output, {}));
+        return;
+    }
+
+    context().server_write_pending = false;
     state_->handle_server_write(this, event);
 }
 
 void http_session::handle_client_write(io_buffer &event)
 {
+    context().buffers.release(std::exchange(context().client_write_bytes, 0));
     state_->handle_client_write(this, event);
 }
 
@@ -49,6 +60,31 @@ void http_session::handle_client_error(net::error_code ec)
     state_->handle_client_error(this, ec);
 }
 
+void http_session::append_input(io_buffer buffer)
+{
+	context().buffers.hold(buffer.size());
+
+	auto& input = context().input;
+	if (input.empty())
+		input = std::move(buffer);
+	else
+		input.insert(input.end(), buffer.begin(), buffer.end());
+}
+
+void http_session::consume_input(std::size_t count)
+{
+	auto& input = context().input;
+	count = std::min(count, input.size());
+	context().buffers.release(count);
+	input.erase(input.begin(), input.begin() + count);
+}
+
+io_buffer http_session::take_input()
+{
+	context().buffers.release(context().input.size());
+	return std::exchange(context().input, {});
+}
+
 void http_session::update_bytes_sent_to_remote(std::size_t count)
 {
 	context().transferred_bytes_to_remote += count;
@@ -59,38 +95,90 @@ void http_session::update_bytes_sent_to_local(std::size_t count)
 	context().transferred_bytes_to_local += count;
 }
 
-stream_manager_ptr http_session::manager() 
+void http_session::set_client_address(const net::ip::address& address)
+{
+	context().limiter = session_limiter{address};
+}
+
+void http_session::set_relay_context(net::io_context& ctx)
+{
+	context().flow = relay_flow{ctx};
+	context().buffers = buffer_account{ctx, [manager{manager_}, id{id()}] { manager->stop(id); }};
+}
+
+void http_session::throttle_server_read(std::size_t count)
+{
+	context().server_read_delay = context().limiter.consume(count);
+	context().flow.charge(count);
+}
+
+void http_session::throttle_client_read(std::size_t count)
+{
+	context().client_read_delay = context().limiter.consume(count);
+	context().flow.charge(count);
+}
+
+stream_manager& http_session::manager() 
 {
-    return manager_;
+    return *manager_;
 }
 
 void http_session::connect()
 {
-	manager()->connect(id(), std::string{ host() }, std::string{ service() });
+	// The buffered request goes out with the connect, in the SYN when fast open is on
+	auto early_data = take_input();
+	update_bytes_sent_to_remote(early_data.size());
+	throttle_server_read(early_data.size());
+	manager().connect(id(), std::string{ host() }, std::string{ service() }, std::move(early_data));
 }
 
 void http_session::stop()
 {
-	manager()->stop(id());
+	manager().stop(id());
 }
 
 void http_session::read_from_server()
 {
-	manager()->read_server(id());
+	if (const auto delay = std::exchange(context().server_read_delay, {}); delay > delay.zero())
+		manager().defer_read_server(id(), delay);
+	else if (!context().buffers.below_watermark())
+		context().buffers.wait_for_drain([manager{manager_}, id{id()}] { manager->read_server(id); });
+	else if (!context().flow.has_credit())
+		context().flow.wait_for_credit([manager{manager_}, id{id()}] { manager->read_server(id); });
+	else
+		manager().read_server(id());
 }
 
 void http_session::read_from_client()
 {
-	manager()->read_client(id());
+	if (const auto delay = std::exchange(context().client_read_delay, {}); delay > delay.zero())
+		manager().defer_read_client(id(), delay);
+	else if (!context().buffers.below_watermark())
+		context().buffers.wait_for_drain([manager{manager_}, id{id()}] { manager->read_client(id); });
+	else if (!context().flow.has_credit())
+		context().flow.wait_for_credit([manager{manager_}, id{id()}] { manager->read_client(id); });
+	else
+		manager().read_client(id());
 }
 
 void http_session::write_to_client(io_buffer buffer)
 {
-	manager()->write_client(id(), std::move(buffer));
+	context().client_write_bytes = buffer.size();
+	context().buffers.hold(buffer.size());
+	manager().write_client(id(), std::move(buffer));
 }
 
 void http_session::write_to_server(io_buffer buffer)
 {
-	manager()->write_server(id(), std::move(buffer));
+	context().buffers.hold(buffer.size());
+	if (context().server_write_pending) {
+		auto& queued = context().queued_output;
+		queued.insert(queued.end(), buffer.begin(), buffer.end());
+		return;
+	}
+
+	context().server_write_pending = true;
+	context().server_write_bytes = buffer.size();
+	manager().write_server(id(), std::move(buffer));
 }
 
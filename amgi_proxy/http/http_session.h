@@ -2,6 +2,9 @@
 #define HTTP_SESSION_H
 
 #include "http_state.h"
+#include "transport/rate_limiter.h"
+#include "transport/relay_scheduler.h"
+#include "transport/memory_governor.h"
 
 #include <string>
 
@@ -17,10 +20,23 @@ class http_session
         std::string service;
         std::size_t transferred_bytes_to_remote;
         std::size_t transferred_bytes_to_local;
+        session_limiter limiter;
+        relay_flow flow;
+        buffer_account buffers;
+        std::size_t server_write_bytes;
+        std::size_t client_write_bytes;
+        std::chrono::steady_clock::duration server_read_delay;
+        std::chrono::steady_clock::duration client_read_delay;
+        io_buffer input;
+        io_buffer queued_output;
+        bool server_write_pending;
+        bool server_read_pending;
+        bool client_connected;
+        bool optimistic_connect;
     };
 
 public:
-    http_session(int id, stream_manager_ptr manager);
+    http_session(int id, stream_manager_ptr manager, bool optimistic_connect = false);
     void change_state(std::unique_ptr<http_state> state);
     void handle_server_read(io_buffer& event);
     void handle_client_read(io_buffer& event);
@@ -33,14 +49,26 @@ public:
     auto& context() { return context_; }
     const auto& context() const { return context_; }
 
+	// Client bytes received before the tunnel is up that no state has consumed yet
+	void append_input(io_buffer buffer);
+	void consume_input(std::size_t count);
+	io_buffer take_input();
+	const io_buffer& input() const { return context().input; }
+
 	void update_bytes_sent_to_remote(std::size_t count);
 	void update_bytes_sent_to_local(std::size_t count);
 
+	void set_client_address(const net::ip::address& address);
+	void set_relay_context(net::io_context& ctx);
+	void throttle_server_read(std::size_t count);
+	void throttle_client_read(std::size_t count);
+
 	int id() { return context().id; }
 	std::string_view host() const { return context().host; }
 	std::string_view service() const { return context().service; }
 	std::uint64_t transfered_bytes_to_local() const { return context().transferred_bytes_to_local; }
 	std::uint64_t transfered_bytes_to_remote() const { return context().transferred_bytes_to_remote; }
+	bool optimistic_connect() const { return context().optimistic_connect; }
 
     const std::vector<uint8_t>& get_response() const { return context().response; }
 
@@ -59,7 +87,7 @@ public:
 	void write_to_client(io_buffer buffer);
 	void write_to_server(io_buffer buffer);
 
-    stream_manager_ptr manager();
+    stream_manager& manager();
 
 private:
     http_ctx context_;
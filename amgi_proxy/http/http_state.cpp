@@ -2,10 +2,14 @@
 #include "http_state.h"
 #include "http_session.h"
 #include "logger/logger.h"
+#include "transport/stream.h"
 #include "transport/stream_manager.h"
 
 #include <boost/format.hpp>
 
+#include <algorithm>
+#include <string_view>
+
 using fmt = boost::format;
 using logger = logging::logger;
 
@@ -20,6 +24,8 @@ namespace
         "HTTP/1.1 200 OK\r\n"
         "\r\n";
 
+    constexpr std::string_view kHeaderEnd = "\r\n\r\n";
+
     void log_error(http_session* session, net::error_code ec, std::string_view participant)
     {
         const auto error = ec.value();
@@ -40,6 +46,29 @@ namespace
             }
         }
     }
+
+    // Forwards buffered request bytes in stream sized chunks, false once nothing is left
+    bool flush_input(http_session* session)
+    {
+        const auto& input = session->input();
+        if (input.empty())
+            return false;
+
+        const auto chunk = std::min<std::size_t>(input.size(), stream::max_buffer_size);
+        io_buffer data(input.begin(), input.begin() + chunk);
+        session->consume_input(chunk);
+        session->update_bytes_sent_to_remote(chunk);
+        session->throttle_server_read(chunk);
+        session->write_to_client(std::move(data));
+        return true;
+    }
+
+    void start_data_transfer(http_session* session)
+    {
+        session->change_state(http_data_transfer_mode::instance());
+        if (!flush_input(session))
+            session->read_from_server();
+    }
 }
 
 void http_state::handle_server_read(http_session* session, io_buffer buffer) {}
@@ -63,61 +92,122 @@ void http_state::handle_client_error(http_session* session, net::error_code ec)
 void http_wait_request::handle_server_read(http_session* session, io_buffer buffer)
 {
     const auto sid = session->id();
-    const auto* req_str = reinterpret_cast<const char*>(buffer.data());
 
-    auto http_req = http::get_headers(std::string_view{req_str, buffer.size()});
+    session->append_input(std::move(buffer));
+    const auto& input = session->input();
+    const std::string_view request{reinterpret_cast<const char*>(input.data()), input.size()};
+
+    const auto header_end = request.find(kHeaderEnd);
+    if (header_end == std::string_view::npos) {
+        if (input.size() < stream::max_buffer_size) {
+            session->read_from_server();
+            return;
+        }
+
+        logger::warning((fmt("[%1%] http protocol: request header too large") % sid).str());
+        session->write_to_server(io_buffer{kHttpError500.begin(), kHttpError500.end()});
+        session->change_state(http_reply_and_close::instance());
+        return;
+    }
+
+    const auto header_length = header_end + kHeaderEnd.size();
+    auto http_req = http::get_headers(request.substr(0, header_length));
     const auto host = http_req.get_host();
     const auto service = http_req.get_service();
 
     if (host.empty()) {
         logger::warning((fmt("[%1%] http protocol: bad request packet") % sid).str());
         session->write_to_server(io_buffer{kHttpError500.begin(), kHttpError500.end()});
-        session->stop();
+        session->change_state(http_reply_and_close::instance());
         return;
     }
 
     if (service.empty()) {
         logger::warning((fmt("[%1%] http protocol: bad remote address format") % sid).str());
         session->write_to_server(io_buffer{kHttpError500.begin(), kHttpError500.end()});
-        session->stop();
+        session->change_state(http_reply_and_close::instance());
         return;
     }
 
-    if (http_req.method == http::kConnect)
+    // A plain request is relayed as is, for CONNECT only what follows the header goes upstream
+    const bool tunnel = http_req.method == http::kConnect;
+    if (tunnel) {
         session->set_response(io_buffer{kHttpDone.begin(), kHttpDone.end()});
-    else
-        session->set_response(std::move(buffer));
+        session->consume_input(header_length);
+    }
 
     session->set_endpoint_info(host, service);
 
     logger::info((fmt("[%1%] requested [%2%:%3%]") % sid % host % service).str());
     session->connect();
-    session->change_state(http_connection_established::instance());
+
+    if (!tunnel || !session->optimistic_connect()) {
+        session->change_state(http_connection_established::instance());
+        return;
+    }
+
+    session->write_to_server(session->get_response());
+    session->change_state(http_optimistic_connect::instance());
+
+    // Hold at most one read of early data, it is flushed once connected
+    if (session->input().empty()) {
+        session->context().server_read_pending = true;
+        session->read_from_server();
+    }
+}
+
+void http_reply_and_close::handle_server_write(http_session* session, io_buffer buffer)
+{
+    session->stop();
 }
 
 void http_connection_established::handle_client_connect(http_session* session, io_buffer buffer)
 {
-    // TODO
-    const std::string resp{session->get_response().begin(), session->get_response().end()};
-	if (resp == kHttpDone)
-		session->write_to_server(session->get_response());
-	else
-		session->write_to_client(session->get_response());
-	session->change_state(http_ready_to_transfer_data::instance());
+    if (session->get_response().empty()) {
+        session->read_from_client();
+        start_data_transfer(session);
+        return;
+    }
+
+    session->write_to_server(session->get_response());
+    session->change_state(http_ready_to_transfer_data::instance());
 }
 
-void http_ready_to_transfer_data::handle_client_write(http_session* session, io_buffer buffer)
+void http_optimistic_connect::handle_server_read(http_session* session, io_buffer buffer)
 {
-    session->read_from_server();
-    session->read_from_server();
-    session->change_state(http_data_transfer_mode::instance());
+    session->context().server_read_pending = false;
+    session->append_input(std::move(buffer));
+    if (session->context().client_connected)
+        start_data_transfer(session);
+}
+
+void http_optimistic_connect::handle_server_write(http_session* session, io_buffer buffer)
+{
+    if (session->context().client_connected)
+        session->read_from_client();
+}
+
+void http_optimistic_connect::handle_client_connect(http_session* session, io_buffer buffer)
+{
+    auto& ctx = session->context();
+    ctx.client_connected = true;
+
+    // Upstream reads start once the 200 is out, its completion does it otherwise
+    if (!ctx.server_write_pending)
+        session->read_from_client();
+
+    // A read still outstanding completes in data transfer mode, so does an upstream reply that
+    // comes before the client sends anything past the early data
+    if (ctx.server_read_pending)
+        session->change_state(http_data_transfer_mode::instance());
+    else
+        start_data_transfer(session);
 }
 
 void http_ready_to_transfer_data::handle_server_write(http_session* session, io_buffer buffer)
 {
-    session->read_from_server();
     session->read_from_client();
-    session->change_state(http_data_transfer_mode::instance());
+    start_data_transfer(session);
 }
 
 
@@ -129,16 +219,19 @@ void http_data_transfer_mode::handle_server_write(http_session* session, io_buff
 void http_data_transfer_mode::handle_server_read(http_session* session, io_buffer buffer)
 {
     session->update_bytes_sent_to_remote(buffer.size());
+    session->throttle_server_read(buffer.size());
     session->write_to_client(std::move(buffer));
 }
 
 void http_data_transfer_mode::handle_client_write(http_session* session, io_buffer buffer)
 {
-    session->read_from_server();
+    if (!flush_input(session))
+        session->read_from_server();
 }
 
 void http_data_transfer_mode::handle_client_read(http_session* session, io_buffer buffer)
 {
     session->update_bytes_sent_to_local(buffer.size());
+    session->throttle_client_read(buffer.size());
     session->write_to_server(std::move(buffer));
 }
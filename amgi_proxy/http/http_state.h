@@ -30,6 +30,14 @@ public:
     void handle_server_read(http_session *session, io_buffer event) override;
 };
 
+// An error reply is on its way, the session ends once it is written
+class http_reply_and_close final : public http_state
+{
+public:
+    static auto instance() { return std::make_unique<http_reply_and_close>(); }
+    void handle_server_write(http_session *session, io_buffer event) override;
+};
+
 class http_connection_established final : public http_state 
 {
 public:
@@ -37,11 +45,20 @@ public:
     void handle_client_connect(http_session *session, io_buffer event) override;
 };
 
+// CONNECT has already been answered, client data is held back until the upstream connect completes
+class http_optimistic_connect final : public http_state 
+{
+public:
+    static auto instance() { return std::make_unique<http_optimistic_connect>(); }
+    void handle_server_read(http_session *session, io_buffer event) override;
+    void handle_server_write(http_session *session, io_buffer event) override;
+    void handle_client_connect(http_session *session, io_buffer event) override;
+};
+
 class http_ready_to_transfer_data final : public http_state 
 {
 public:
     static auto instance() { return std::make_unique<http_ready_to_transfer_data>(); }
-    void handle_client_write(http_session* session, io_buffer event) override;
     void handle_server_write(http_session* session, io_buffer event) override;
 };
 
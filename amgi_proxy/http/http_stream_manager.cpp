@@ -1,5 +1,5 @@
 #include "http_stream_manager.h"
-#include "transport/tcp_client_stream.h"
+#include "transport/stream_factory.h"
 #include "logger/logger.h"
 
 #include <boost/format.hpp>
@@ -56,10 +56,15 @@ void http_stream_manager::on_accept(server_stream_ptr upstream)
     const auto id{upstream->id()};
     logger::trace((fmt("[%1%] session created") % id).str());
 
-    auto downstream = std::make_shared<tcp_client_stream>(shared_from_this(), id, upstream->context());
+    auto downstream = stream_factory::make_client(shared_from_this(), id, upstream->context(), options_);
 
-    http_session session{id, shared_from_this()};
-    http_pair pair{id, std::move(upstream), std::move(downstream), std::move(session)};
+    http_session session{id, shared_from_this(), options_.optimistic_connect};
+    session.set_client_address(upstream->remote_address());
+    session.set_relay_context(upstream->context());
+
+    auto& ctx = upstream->context();
+    http_pair pair{id, std::move(upstream), std::move(downstream), std::move(session),
+                 net::steady_timer{ctx}, net::steady_timer{ctx}, admission_control::ticket{}};
     sessions_.insert({id, std::move(pair)});
 }
 
@@ -81,6 +86,19 @@ void http_stream_manager::read_server(int id)
         it->second.server->read();
 }
 
+void http_stream_manager::defer_read_server(int id, std::chrono::steady_clock::duration delay)
+{
+    if (auto it = sessions_.find(id); it != sessions_.end()) {
+        auto& timer = it->second.server_read_timer;
+        timer.expires_after(delay);
+        timer.async_wait(
+            [this, self{shared_from_this()}, id](const net::error_code& ec) {
+                if (!ec)
+                    read_server(id);
+            });
+    }
+}
+
 void http_stream_manager::write_server(int id, io_buffer buffer)
 {
     if (auto it = sessions_.find(id); it != sessions_.end())
@@ -111,17 +129,31 @@ void http_stream_manager::read_client(int id)
         it->second.client->read();
 }
 
+void http_stream_manager::defer_read_client(int id, std::chrono::steady_clock::duration delay)
+{
+    if (auto it = sessions_.find(id); it != sessions_.end()) {
+        auto& timer = it->second.client_read_timer;
+        timer.expires_after(delay);
+        timer.async_wait(
+            [this, self{shared_from_this()}, id](const net::error_code& ec) {
+                if (!ec)
+                    read_client(id);
+            });
+    }
+}
+
 void http_stream_manager::write_client(int id, io_buffer buffer)
 {
     if (auto it = sessions_.find(id); it != sessions_.end())
         it->second.client->write(std::move(buffer));
 }
 
-void http_stream_manager::connect(int id, std::string host, std::string service)
+void http_stream_manager::connect(int id, std::string host, std::string service, io_buffer early_data)
 {
     if (auto it = sessions_.find(id); it != sessions_.end()) {
         it->second.client->set_host(std::move(host));
         it->second.client->set_service(std::move(service));
+        it->second.client->set_early_data(std::move(early_data));
         it->second.client->start();
     }
 }
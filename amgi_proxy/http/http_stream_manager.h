@@ -2,6 +2,8 @@
 #define HTTP_STREAM_MANAGER_H
 
 #include "transport/stream_manager.h"
+#include "transport/admission_control.h"
+#include "transport/client_options.h"
 #include "http_session.h"
 
 
@@ -10,7 +12,8 @@ class http_stream_manager final
     , public std::enable_shared_from_this<http_stream_manager> 
 {
 public:
-    http_stream_manager() = default;
+    explicit http_stream_manager(client_options options = {})
+        : options_{options} {}
     ~http_stream_manager() = default;
 
     http_stream_manager(const http_stream_manager& other) = delete;
@@ -25,6 +28,7 @@ public:
     void on_write(io_buffer event, server_stream_ptr stream) override;
     void on_error(net::error_code ec, server_stream_ptr stream) override;
     void read_server(int id) override;
+    void defer_read_server(int id, std::chrono::steady_clock::duration delay) override;
     void write_server(int id, io_buffer event) override;
 
     void on_connect(io_buffer event, client_stream_ptr stream) override;
@@ -32,8 +36,9 @@ public:
     void on_write(io_buffer event, client_stream_ptr stream) override;
     void on_error(net::error_code ec, client_stream_ptr stream) override;
     void read_client(int id) override;
+    void defer_read_client(int id, std::chrono::steady_clock::duration delay) override;
     void write_client(int id, io_buffer event) override;
-    void connect(int id, std::string host, std::string service) override;
+    void connect(int id, std::string host, std::string service, io_buffer early_data) override;
 
 private:
     struct http_pair {
@@ -41,9 +46,13 @@ private:
         server_stream_ptr server;
         client_stream_ptr client;
         http_session session;
+        net::steady_timer server_read_timer;
+        net::steady_timer client_read_timer;
+        admission_control::ticket ticket;
     };
 
     std::unordered_map<int, http_pair> sessions_;
+    client_options options_;
 };
 
 using http_stream_manager_ptr = std::shared_ptr<http_stream_manager>;
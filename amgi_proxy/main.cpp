@@ -1,7 +1,15 @@
 #include "transport/server.h"
 #include "transport/tls/tls_server.h"
+#include "transport/rate_limiter.h"
+#include "transport/relay_scheduler.h"
+#include "transport/memory_governor.h"
+#include "transport/admission_control.h"
+#include "transport/client_options.h"
+#include "transport/egress_pool.h"
+#include "transport/io_backend.h"
 #include "socks5/socks5_stream_manager.h"
 #include "http/http_stream_manager.h"
+#include "auth/credential_store.h"
 #include "logger/logger.h"
 
 #include <boost/program_options.hpp>
@@ -16,8 +24,16 @@ namespace
         std::string listen_port;
         std::string proxy_backend;
         std::string log_file_path;
+        std::string credentials_path;
         logger::level log_level;
+        client_options upstream_options;
+        egress_pool::options egress_options;
         tls_server::tls_options tls_options;
+        rate_limiter::options shaping_options;
+        relay_scheduler::options scheduling_options;
+        admission_control::options admission_options;
+        memory_governor::options governor_options;
+        server_options srv_options;
     };
 
     logger::level parse_log_level(std::string_view level_str)
@@ -44,6 +60,39 @@ namespace
         return level;
     }
 
+    // Starts from a preset and applies the explicitly given tuning options on top
+    socket_profile parse_socket_profile(const std::string& name, const po::variables_map& vm)
+    {
+        auto profile = socket_profile::preset(name);
+        if (!profile) {
+            std::cout << "Error: socket profile must be one of [" << socket_profile::preset_names << "]\n";
+            exit(EXIT_FAILURE);
+        }
+
+        if (vm.count("tcp-nodelay"))
+            profile->no_delay = vm["tcp-nodelay"].as<bool>();
+        if (vm.count("sndbuf"))
+            profile->send_buffer = vm["sndbuf"].as<int>();
+        if (vm.count("rcvbuf"))
+            profile->receive_buffer = vm["rcvbuf"].as<int>();
+        if (vm.count("notsent-lowat"))
+            profile->notsent_lowat = vm["notsent-lowat"].as<int>();
+        if (vm.count("keepalive-idle"))
+            profile->keepalive_idle = std::chrono::seconds(vm["keepalive-idle"].as<int>());
+        if (vm.count("keepalive-interval"))
+            profile->keepalive_interval = std::chrono::seconds(vm["keepalive-interval"].as<int>());
+        if (vm.count("keepalive-count"))
+            profile->keepalive_count = vm["keepalive-count"].as<int>();
+        if (vm.count("user-timeout"))
+            profile->user_timeout = std::chrono::milliseconds(vm["user-timeout"].as<int>());
+        if (vm.count("busy-poll"))
+            profile->busy_poll = std::chrono::microseconds(vm["busy-poll"].as<int>());
+        if (vm.count("prefer-busy-poll"))
+            profile->prefer_busy_poll = vm["prefer-busy-poll"].as<bool>();
+
+        return *profile;
+    }
+
     server_conf parse_command_line_arguments(int argc, char* argv[]) 
     {
         po::options_description all("Allowed options");
@@ -55,6 +104,8 @@ namespace
             ("mode,m", po::value<std::string>(&conf.proxy_backend)->default_value("http"), "proxy mode [http|socks5]")
             ("log_level,v", po::value<std::string>()->default_value("info"), "verbosity level of log messages [debug|trace|info|warning|error|fatal]")
             ("log_file,l", po::value<std::string>(&conf.log_file_path), "log file path")
+            ("backend", po::value<std::string>()->default_value(std::string{io_backend::reactor_name}), "socket I/O backend of plain TCP streams [epoll|uring]")
+            ("credentials,u", po::value<std::string>(&conf.credentials_path), "socks5 username/password file, lines of <user>:<hex salt>:<hex sha256(salt+password)>, reloaded on SIGHUP")
             ("help,h", "show help message");
 
         po::options_description tls("Tls tunnel options");
@@ -62,9 +113,62 @@ namespace
             ("tls,t", po::value<std::string>()->implicit_value("0"), "use tls tunnel mode")
             ("private-key,k", po::value<std::string>(&conf.tls_options.private_key)->default_value(""), "private key file path")
             ("server-cert,s", po::value<std::string>(&conf.tls_options.server_cert)->default_value(""), "server certificate file path")
-            ("ca-cert,c", po::value<std::string>(&conf.tls_options.ca_cert)->default_value(""), "CA certificate file path");
+            ("ca-cert,c", po::value<std::string>(&conf.tls_options.ca_cert)->default_value(""), "CA certificate file path")
+            ("tls-handshake-threads", po::value<std::size_t>(&conf.tls_options.handshake.threads)->default_value(2), "threads running tls handshakes off the io thread (0 - handshake on the io thread)")
+            ("tls-handshake-queue", po::value<std::size_t>(&conf.tls_options.handshake.max_queued)->default_value(1024), "handshake steps allowed to wait for a pool thread before running inline")
+            ("tls-ticket-rotation", po::value<std::size_t>()->default_value(3600), "seconds between session ticket key rotations, also the ticket lifetime (0 - no session resumption)")
+            ("tls-ktls", po::bool_switch(&conf.tls_options.ktls), "offload record encryption to kernel tls after the handshake, falls back to user space when unavailable")
+            ("tls-record-boost", po::value<std::size_t>(&conf.tls_options.record_boost)->default_value(0x20000), "bytes sent in single segment tls records at connection start and after idle before full records are used (0 - always full records)")
+            ("tls-compression", po::value<int>(&conf.tls_options.compression)->default_value(0), "zlib level (1-9) of link compression offered to tunnels, poorly compressing flows bypass it (0 - disabled)");
 
-        all.add(general).add(tls);
+        po::options_description shaping("Traffic shaping options");
+        shaping.add_options()
+            ("session-rate", po::value<std::uint64_t>(&conf.shaping_options.session_rate)->default_value(0), "per session bandwidth limit in bytes/sec (0 - unlimited)")
+            ("client-rate", po::value<std::uint64_t>(&conf.shaping_options.client_rate)->default_value(0), "per client ip bandwidth limit in bytes/sec (0 - unlimited)")
+            ("global-rate", po::value<std::uint64_t>(&conf.shaping_options.global_rate)->default_value(0), "total bandwidth limit in bytes/sec (0 - unlimited)")
+            ("fair-quantum", po::value<std::size_t>(&conf.scheduling_options.quantum)->default_value(0), "bytes a session may relay per deficit round robin round before yielding to the others (0 - no fair scheduling)")
+            ("bulk-threshold", po::value<std::size_t>(&conf.scheduling_options.bulk_bytes)->default_value(0x100000), "bytes relayed without a 100 ms pause after which a session is deprioritized as bulk")
+            ("bulk-share", po::value<std::size_t>(&conf.scheduling_options.bulk_share)->default_value(16), "bulk sessions get 1/N of the fair quantum");
+
+        po::options_description limits("Resource limit options");
+        limits.add_options()
+            ("max-sessions", po::value<std::size_t>(&conf.admission_options.max_sessions)->default_value(0), "maximum number of concurrent sessions (0 - unlimited)")
+            ("memory-budget", po::value<std::size_t>()->default_value(0), "memory budget for sessions in megabytes: accept pauses once an estimated per session footprint plus the bytes held in relay buffers reach it, relay buffers alone over it close the oldest slow consumers (0 - unlimited)")
+            ("session-watermark", po::value<std::size_t>(&conf.governor_options.session_watermark)->default_value(0), "bytes a session or tunnel link may hold in relay buffers before its reads pause (0 - unlimited)")
+            ("slow-consumer-timeout", po::value<std::size_t>()->default_value(5), "seconds a session may hold buffered bytes without draining any before it counts as a slow consumer")
+            ("metrics-interval", po::value<std::size_t>()->default_value(0), "interval in seconds between metrics log records (0 - disabled)");
+
+        po::options_description listener("Listener options");
+        listener.add_options()
+            ("listen-backlog", po::value<int>(&conf.srv_options.listen_backlog)->default_value(0), "listen queue length (0 - system maximum)")
+            ("accept-concurrency", po::value<std::size_t>(&conf.srv_options.accept_concurrency)->default_value(4), "number of outstanding accept operations")
+            ("defer-accept", po::value<std::size_t>()->default_value(0), "TCP_DEFER_ACCEPT timeout in seconds, wake up on client data only (0 - disabled)")
+            ("fastopen-queue", po::value<int>(&conf.srv_options.fastopen_queue)->default_value(0), "TCP_FASTOPEN queue length on the listener (0 - disabled)")
+            ("socket-profile", po::value<std::string>()->default_value("default"), "tuning of accepted connections [default|latency|throughput]")
+            ("spin-budget", po::value<std::size_t>()->default_value(0), "low latency mode: microseconds the io thread keeps polling without blocking after its last event before it sleeps (0 - always block)");
+
+        po::options_description upstream("Upstream options");
+        upstream.add_options()
+            ("optimistic-connect", po::bool_switch(&conf.upstream_options.optimistic_connect), "confirm socks5/http CONNECT requests before the upstream connect completes, saves a round trip")
+            ("fastopen-connect", po::bool_switch(&conf.upstream_options.fastopen), "use TCP fast open for upstream connects, client data received before the connect goes in the SYN")
+            ("upstream-profile", po::value<std::string>()->default_value("default"), "tuning of upstream connections [default|latency|throughput]")
+            ("egress-address", po::value<std::vector<std::string>>()->multitoken(), "source addresses for upstream connections, each adds its own ephemeral port range")
+            ("egress-policy", po::value<std::string>()->default_value("round-robin"), "egress address selection [round-robin|hash], hash keeps a destination on one address");
+
+        po::options_description tuning("Socket tuning options, override both profiles");
+        tuning.add_options()
+            ("tcp-nodelay", po::value<bool>(), "disable Nagle's algorithm (TCP_NODELAY)")
+            ("sndbuf", po::value<int>(), "socket send buffer size in bytes")
+            ("rcvbuf", po::value<int>(), "socket receive buffer size in bytes")
+            ("notsent-lowat", po::value<int>(), "TCP_NOTSENT_LOWAT, limit of unsent bytes queued in the kernel")
+            ("keepalive-idle", po::value<int>(), "seconds of idle time before keepalive probes start (0 - keepalive disabled)")
+            ("keepalive-interval", po::value<int>(), "seconds between keepalive probes")
+            ("keepalive-count", po::value<int>(), "unanswered keepalive probes before the connection is dropped")
+            ("user-timeout", po::value<int>(), "TCP_USER_TIMEOUT in milliseconds, limit for unacknowledged data")
+            ("busy-poll", po::value<int>(), "SO_BUSY_POLL in microseconds, receives spin on the device queue instead of waiting for an interrupt (raising it needs CAP_NET_ADMIN)")
+            ("prefer-busy-poll", po::value<bool>(), "SO_PREFER_BUSY_POLL, defer softirq processing to the busy polling application (needs CAP_NET_ADMIN)");
+
+        all.add(general).add(tls).add(listener).add(upstream).add(tuning).add(shaping).add(limits);
 
         po::variables_map vm;
         po::store(po::parse_command_line(argc, argv, all), vm);
@@ -81,6 +185,46 @@ namespace
             exit(EXIT_FAILURE);
         }
 
+        conf.admission_options.memory_budget = vm["memory-budget"].as<std::size_t>() * 1024 * 1024;
+        conf.governor_options.budget = conf.admission_options.memory_budget;
+        conf.governor_options.slow_after = std::chrono::seconds(vm["slow-consumer-timeout"].as<std::size_t>());
+        conf.srv_options.defer_accept = std::chrono::seconds(vm["defer-accept"].as<std::size_t>());
+        conf.srv_options.metrics_interval = std::chrono::seconds(vm["metrics-interval"].as<std::size_t>());
+        conf.srv_options.spin_budget = std::chrono::microseconds(vm["spin-budget"].as<std::size_t>());
+        conf.tls_options.ticket_rotation = std::chrono::seconds(vm["tls-ticket-rotation"].as<std::size_t>());
+        if (vm.count("egress-address")) {
+            for (const auto& str : vm["egress-address"].as<std::vector<std::string>>()) {
+                net::error_code ec;
+                const auto address = net::ip::make_address(str, ec);
+                if (ec) {
+                    std::cout << "Error: invalid egress address " << str << "\n";
+                    exit(EXIT_FAILURE);
+                }
+                conf.egress_options.sources.push_back(address);
+            }
+        }
+
+        if (const auto policy = vm["egress-policy"].as<std::string>(); policy == "hash")
+            conf.egress_options.selection = egress_pool::policy::hash;
+        else if (policy != "round-robin") {
+            std::cout << "Error: egress-policy value must be one of [round-robin|hash]\n";
+            exit(EXIT_FAILURE);
+        }
+
+        conf.srv_options.profile = parse_socket_profile(vm["socket-profile"].as<std::string>(), vm);
+        conf.upstream_options.profile = parse_socket_profile(vm["upstream-profile"].as<std::string>(), vm);
+
+        const auto backend = io_backend::parse(vm["backend"].as<std::string>());
+        if (!backend) {
+            std::cout << "Error: backend value must be one of [" << io_backend::reactor_name << "|uring]\n";
+            exit(EXIT_FAILURE);
+        }
+        if (std::string error; !io_backend::available(*backend, error)) {
+            std::cout << "Error: the " << io_backend::name(*backend) << " backend is unavailable, " << error << "\n";
+            exit(EXIT_FAILURE);
+        }
+        conf.srv_options.backend = conf.upstream_options.backend = *backend;
+
         if (vm.count("log_level"))
             conf.log_level = parse_log_level(vm["log_level"].as<std::string>());
 
@@ -112,24 +256,39 @@ int main(int argc, char* argv[])
         : logging::logger::output::file;
 
     logging::logger::initialize(conf.log_file_path, log_output, conf.log_level);
+    logging::logger::info(std::string{"io backend: "} + std::string{io_backend::name(conf.srv_options.backend)});
+    rate_limiter::configure(conf.shaping_options);
+    relay_scheduler::configure(conf.scheduling_options);
+    admission_control::configure(conf.admission_options);
+    memory_governor::configure(conf.governor_options);
+    egress_pool::configure(conf.egress_options);
+
+    auto srv_options = conf.srv_options;
+    if (!conf.credentials_path.empty()) {
+        if (!credential_store::get().load(conf.credentials_path)) {
+            std::cout << "Error: unable to load credentials from " << conf.credentials_path << "\n";
+            return EXIT_FAILURE;
+        }
+        srv_options.on_reload = [] { credential_store::get().reload(); };
+    }
 
     try {
         stream_manager_ptr proxy_backend;
         if (conf.proxy_backend == "http") {
             std::cout << "Proxy-mode: http/s\n";
-            proxy_backend = std::make_shared<http_stream_manager>();
+            proxy_backend = std::make_shared<http_stream_manager>(conf.upstream_options);
         } else {
             std::cout << "Proxy-mode: socks5\n";
-            proxy_backend = std::make_shared<socks5_stream_manager>();
+            proxy_backend = std::make_shared<socks5_stream_manager>(conf.upstream_options);
         }
 
         if (!conf.tls_options.private_key.empty()) {
             std::cout << "Start listening port: " << conf.listen_port << ", tls tunnel mode enabled\n";
-            tls_server srv(conf.listen_port, conf.tls_options, std::move(proxy_backend));
+            tls_server srv(conf.listen_port, srv_options, conf.tls_options, std::move(proxy_backend));
             srv.run();
         } else {
             std::cout << "Start listening port: " << conf.listen_port << ", tls tunnel mode disabled\n";
-            server srv(conf.listen_port, std::move(proxy_backend));
+            server srv(conf.listen_port, srv_options, std::move(proxy_backend));
             srv.run();
         }
     } catch (std::exception& ex) {
@@ -0,0 +1,46 @@
+#include "metrics.h"
+
+#include <sstream>
+
+namespace metrics
+{
+    registry& registry::get()
+    {
+        static registry instance;
+        return instance;
+    }
+
+    counter& registry::make_counter(const std::string& name)
+    {
+        std::lock_guard lock{mutex_};
+        auto& entry = counters_[name];
+        if (!entry)
+            entry = std::make_unique<counter>();
+        return *entry;
+    }
+
+    gauge& registry::make_gauge(const std::string& name)
+    {
+        std::lock_guard lock{mutex_};
+        auto& entry = gauges_[name];
+        if (!entry)
+            entry = std::make_unique<gauge>();
+        return *entry;
+    }
+
+    std::string registry::report() const
+    {
+        std::lock_guard lock{mutex_};
+
+        std::ostringstream ss;
+        for (const auto& [name, value] : counters_)
+            ss << name << '=' << value->value() << ' ';
+        for (const auto& [name, value] : gauges_)
+            ss << name << '=' << value->value() << ' ';
+
+        auto str = ss.str();
+        if (!str.empty())
+            str.pop_back();
+        return str;
+    }
+}
@@ -0,0 +1,61 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace metrics
+{
+    class counter
+    {
+    public:
+        void add(std::uint64_t value = 1) { value_.fetch_add(value, std::memory_order_relaxed); }
+        [[nodiscard]] std::uint64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+    private:
+        std::atomic<std::uint64_t> value_{0};
+    };
+
+    class gauge
+    {
+    public:
+        void add(std::int64_t value) { value_.fetch_add(value, std::memory_order_relaxed); }
+        void sub(std::int64_t value) { value_.fetch_sub(value, std::memory_order_relaxed); }
+        void set(std::int64_t value) { value_.store(value, std::memory_order_relaxed); }
+        [[nodiscard]] std::int64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+    private:
+        std::atomic<std::int64_t> value_{0};
+    };
+
+    // Named metrics live for the whole process, references handed out stay valid
+    class registry
+    {
+    public:
+        static registry& get();
+
+        counter& make_counter(const std::string& name);
+        gauge& make_gauge(const std::string& name);
+
+        [[nodiscard]] std::string report() const;
+
+        registry(const registry& other) = delete;
+        registry& operator=(const registry& other) = delete;
+
+    private:
+        registry() = default;
+
+        mutable std::mutex mutex_;
+        std::map<std::string, std::unique_ptr<counter>> counters_;
+        std::map<std::string, std::unique_ptr<gauge>> gauges_;
+    };
+
+    inline counter& make_counter(const std::string& name) { return registry::get().make_counter(name); }
+    inline gauge& make_gauge(const std::string& name) { return registry::get().make_gauge(name); }
+}
+
+#endif // METRICS_H
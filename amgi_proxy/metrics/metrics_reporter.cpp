@@ -0,0 +1,34 @@
+#include "metrics_reporter.h"
+#include "metrics.h"
+#include "logger/logger.h"
+
+namespace metrics
+{
+    reporter::reporter(net::io_context& ctx, std::chrono::seconds interval)
+        : timer_{ctx}, interval_{interval}
+    {}
+
+    void reporter::start()
+    {
+        if (interval_.count() > 0)
+            schedule();
+    }
+
+    void reporter::stop()
+    {
+        timer_.cancel();
+    }
+
+    void reporter::schedule()
+    {
+        timer_.expires_after(interval_);
+        timer_.async_wait(
+            [this](const net::error_code& ec) {
+                if (ec)
+                    return;
+
+                logging::logger::info("metrics: " + registry::get().report());
+                schedule();
+            });
+    }
+}
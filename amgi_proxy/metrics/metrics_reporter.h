@@ -0,0 +1,32 @@
+#ifndef METRICS_REPORTER_H
+#define METRICS_REPORTER_H
+
+#include <asio.hpp>
+
+#include <chrono>
+
+namespace net = asio;
+
+namespace metrics
+{
+    // Periodically writes all registered metrics to the log
+    class reporter
+    {
+    public:
+        reporter(net::io_context& ctx, std::chrono::seconds interval);
+
+        reporter(const reporter& other) = delete;
+        reporter& operator=(const reporter& other) = delete;
+
+        void start();
+        void stop();
+
+    private:
+        void schedule();
+
+        net::steady_timer timer_;
+        std::chrono::seconds interval_;
+    };
+}
+
+#endif // METRICS_REPORTER_H
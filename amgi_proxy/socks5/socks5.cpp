@@ -2,11 +2,56 @@
 
 #include <asio.hpp>
 
+#include <cstddef>
+
 namespace net = asio;
 
 using namespace proto;
 
-std::optional<std::string> socks5::is_socks5_auth_request(const std::uint8_t *buffer, std::size_t length) 
+std::size_t socks5::auth_request_length(const std::uint8_t* buffer, std::size_t length)
+{
+    if (!buffer || length < auth::kHeaderMinlength)
+        return 0;
+
+    const auto total = static_cast<std::size_t>(auth::kHeaderMinlength) + buffer[1];
+    return length >= total ? total : 0;
+}
+
+std::size_t socks5::user_pass_length(const std::uint8_t* buffer, std::size_t length)
+{
+    if (!buffer || length < 2)
+        return 0;
+
+    const std::size_t user_length = buffer[1];
+    if (length < 2 + user_length + 1)
+        return 0;
+
+    const auto total = 2 + user_length + 1 + buffer[2 + user_length];
+    return length >= total ? total : 0;
+}
+
+std::size_t socks5::request_length(const std::uint8_t* buffer, std::size_t length)
+{
+    const auto header_length = offsetof(request_header, data);
+    if (!buffer || length < header_length + 1)
+        return 0;
+
+    std::size_t total{0};
+    const auto* request = reinterpret_cast<const request_header*>(buffer);
+    if (request->type == ipv4)
+        total = header_length + ipv4_length + port_length;
+    else if (request->type == ipv6)
+        total = header_length + ipv6_length + port_length;
+    else if (request->type == dom)
+        total = header_length + dom_length_field_size + request->data[dom_length_field_offset] + port_length;
+    else
+        // Unknown address type, hand over what we have and let validation reject it
+        return length;
+
+    return length >= total ? total : 0;
+}
+
+std::optional<std::string> socks5::is_socks5_auth_request(const std::uint8_t *buffer, std::size_t length, std::uint8_t method) 
 {
     if (!buffer || length < auth::kHeaderMinlength)
         return "socks5 proto: bad initial request packet";
@@ -19,10 +64,30 @@ std::optional<std::string> socks5::is_socks5_auth_request(const std::uint8_t *bu
         return "socks5 proto: invalid authentication request length";
 
     for (std::size_t i=0; i<auth_header->number_of_methods; i++)
-        if (auth_header->methods[i] == auth::kNoAuth)
+        if (auth_header->methods[i] == method)
             return {};
 
-    return "authentication support is not implemented";
+    return method == auth::kUserPass
+        ? "socks5 proto: client does not offer username/password authentication"
+        : "socks5 proto: client does not offer no-authentication method";
+}
+
+bool socks5::get_user_pass(const std::uint8_t* buffer, std::size_t length, std::string_view& user, std::string_view& password)
+{
+    if (!buffer || length < auth::kUserPassMinLength || buffer[0] != auth::kUserPassVersion)
+        return false;
+
+    const std::size_t user_length = buffer[1];
+    if (!user_length || length < 2 + user_length + 1)
+        return false;
+
+    const std::size_t password_length = buffer[2 + user_length];
+    if (length < 3 + user_length + password_length)
+        return false;
+
+    user = {reinterpret_cast<const char*>(buffer + 2), user_length};
+    password = {reinterpret_cast<const char*>(buffer + 3 + user_length), password_length};
+    return true;
 }
 
 bool socks5::is_valid_request_packet(const std::uint8_t *buffer, std::size_t length) 
@@ -33,7 +98,7 @@ bool socks5::is_valid_request_packet(const std::uint8_t *buffer, std::size_t len
         if (request->version != proto::version)
             return false;
 
-        if (request->command != request::tcp_connection)
+        if (request->command != request::tcp_connection && request->command != request::udp_port)
             return false;
 
         if (!(request->type == proto::ipv4 || request->type == proto::ipv6 || request->type == proto::dom))
@@ -95,3 +160,86 @@ std::uint16_t socks5::get_port_from_binary(const std::uint8_t* buffer)
 
     return 0;
 }
+
+std::optional<socks5::udp_target> socks5::get_udp_target(const std::uint8_t* buffer, std::size_t length)
+{
+    if (!buffer || length < proto::udp_header_min_length)
+        return {};
+
+    const auto* hdr = reinterpret_cast<const udp_header*>(buffer);
+
+    // Fragment reassembly is optional per RFC 1928, fragmented datagrams are dropped
+    if (hdr->fragment != 0)
+        return {};
+
+    udp_target target{};
+    const auto data_offset = static_cast<std::size_t>(hdr->data - buffer);
+
+    if (hdr->type == ipv4) {
+        net::ip::address_v4::bytes_type bytes;
+        std::copy_n(hdr->data, ipv4_length, bytes.begin());
+        target.endpoint = {net::ip::address_v4{bytes}, get_port_from_binary(hdr->data + ipv4_length)};
+        target.header_length = data_offset + ipv4_length + port_length;
+    } else if (hdr->type == ipv6) {
+        if (length < data_offset + ipv6_length + port_length)
+            return {};
+        net::ip::address_v6::bytes_type bytes;
+        std::copy_n(hdr->data, ipv6_length, bytes.begin());
+        target.endpoint = {net::ip::address_v6{bytes}, get_port_from_binary(hdr->data + ipv6_length)};
+        target.header_length = data_offset + ipv6_length + port_length;
+    } else if (hdr->type == dom) {
+        const auto domain_length = static_cast<std::size_t>(hdr->data[dom_length_field_offset]);
+        if (!domain_length || length < data_offset + dom_length_field_size + domain_length + port_length)
+            return {};
+        target.domain.assign(reinterpret_cast<const char*>(&hdr->data[dom_field_offset]), domain_length);
+        target.endpoint.port(get_port_from_binary(hdr->data + dom_length_field_size + domain_length));
+        target.header_length = data_offset + dom_length_field_size + domain_length + port_length;
+    } else {
+        return {};
+    }
+
+    if (target.header_length > length)
+        return {};
+
+    return target;
+}
+
+std::size_t socks5::make_udp_header(const net::ip::udp::endpoint& ep, std::uint8_t* buffer)
+{
+    auto* hdr = reinterpret_cast<udp_header*>(buffer);
+    hdr->reserved[0] = hdr->reserved[1] = 0;
+    hdr->fragment = 0;
+
+    std::size_t addr_length{0};
+    if (ep.address().is_v4()) {
+        hdr->type = ipv4;
+        const auto bytes = ep.address().to_v4().to_bytes();
+        std::copy(bytes.begin(), bytes.end(), hdr->data);
+        addr_length = bytes.size();
+    } else {
+        hdr->type = ipv6;
+        const auto bytes = ep.address().to_v6().to_bytes();
+        std::copy(bytes.begin(), bytes.end(), hdr->data);
+        addr_length = bytes.size();
+    }
+
+    hdr->data[addr_length] = static_cast<std::uint8_t>(ep.port() >> 8);
+    hdr->data[addr_length + 1] = static_cast<std::uint8_t>(ep.port() & 0xff);
+
+    return static_cast<std::size_t>(hdr->data - buffer) + addr_length + port_length;
+}
+
+io_buffer socks5::make_reply(std::uint8_t code, const net::ip::udp::endpoint& bound)
+{
+    // The reply carries BND.ADDR/BND.PORT in the same layout as the udp datagram header
+    io_buffer reply(udp_header_max_ip_length, 0);
+    const auto length = make_udp_header(bound, reply.data());
+    reply.resize(length);
+
+    auto* hdr = reinterpret_cast<request_header*>(reply.data());
+    hdr->version = proto::version;
+    hdr->command = code;
+    hdr->reserved = reserved;
+
+    return reply;
+}
@@ -1,9 +1,14 @@
 #ifndef SOCKS5_HPP
 #define SOCKS5_HPP
 
+#include "transport/io_buffer.h"
+
+#include <asio/ip/udp.hpp>
+
 #include <iostream>
 #include <cstdint>
 #include <optional>
+#include <string_view>
 
 namespace proto {
     namespace auth {
@@ -16,6 +21,14 @@ namespace proto {
             kHeaderMinlength = 0x02,
         };
 
+        // RFC 1929 username/password sub-negotiation
+        enum : std::uint8_t {
+            kUserPassVersion = 0x01,
+            kUserPassSuccess = 0x00,
+            kUserPassFailure = 0x01,
+            kUserPassMinLength = 0x05,
+        };
+
         struct request {
             std::uint8_t version;
             std::uint8_t number_of_methods;
@@ -44,6 +57,8 @@ public:
         ipv6_length = 16,
 
         request_header_min_length = 10,
+        udp_header_min_length = 10,
+        udp_header_max_ip_length = 4 + ipv6_length + port_length,
         max_host_info_size = max_dom_length + dom_length_field_size + port_length
     };
 
@@ -73,13 +88,41 @@ public:
         std::uint8_t data[max_host_info_size];
     };
 
-    static std::optional<std::string> is_socks5_auth_request(const std::uint8_t* buffer, std::size_t length);
+    struct udp_header {
+        std::uint8_t reserved[2];
+        std::uint8_t fragment;
+        std::uint8_t type;
+        std::uint8_t data[max_host_info_size];
+    };
+
+    struct udp_target {
+        asio::ip::udp::endpoint endpoint;
+        std::string domain;
+        std::size_t header_length;
+    };
+
+    // Length of the complete message at the start of buffer, 0 while more bytes are needed
+    static std::size_t auth_request_length(const std::uint8_t* buffer, std::size_t length);
+    static std::size_t user_pass_length(const std::uint8_t* buffer, std::size_t length);
+    static std::size_t request_length(const std::uint8_t* buffer, std::size_t length);
+
+    static std::optional<std::string> is_socks5_auth_request(const std::uint8_t* buffer, std::size_t length, std::uint8_t method);
+
+    static bool get_user_pass(const std::uint8_t* buffer, std::size_t length, std::string_view& user, std::string_view& password);
 
     static bool is_valid_request_packet(const std::uint8_t* buffer, std::size_t length);
 
     static bool get_remote_address_info(const std::uint8_t* buffer, std::size_t length, std::string& host, std::string& port);
 
     static uint16_t get_port_from_binary(const std::uint8_t* buffer);
+
+    // Parses the header of a client datagram, for domain targets only the endpoint port is set
+    static std::optional<udp_target> get_udp_target(const std::uint8_t* buffer, std::size_t length);
+
+    // Writes the header for a datagram coming from ep, buffer must hold udp_header_max_ip_length bytes
+    static std::size_t make_udp_header(const asio::ip::udp::endpoint& ep, std::uint8_t* buffer);
+
+    static io_buffer make_reply(std::uint8_t code, const asio::ip::udp::endpoint& bound);
 };
 
 
@@ -1,11 +1,13 @@
 #include "socks5_session.h"
 #include "socks5_stream_manager.h"
 
+#include <algorithm>
 #include <utility>
 
-socks5_session::socks5_session(int id, stream_manager_ptr mgr)
+socks5_session::socks5_session(int id, stream_manager_ptr mgr, bool optimistic_connect)
     : context_{id}, manager_{std::move(mgr)} 
 {
+    context_.optimistic_connect = optimistic_connect;
     state_ = socks5_auth_request::instance();
 }
 
@@ -26,11 +28,21 @@ void socks5_session::handle_client_read(io_buffer event)
 
 void socks5_session::handle_server_write(io_buffer event)
 {
+    // Replies produced while a write was in flight go out together, states see a single completion
+    context().buffers.release(std::exchange(context().server_write_bytes, 0));
+    if (!context().queued_output.empty()) {
+        context().server_write_bytes = context().queued_output.size();
+        manager().write_server(id(), std::exchange(context().queued_output, {}));
+        return;
+    }
+
+    context().server_write_pending = false;
     state_->handle_server_write(this, std::move(event));
 }
 
 void socks5_session::handle_client_write(io_buffer event)
 {
+    context().buffers.release(std::exchange(context().client_write_bytes, 0));
     state_->handle_client_write(this, std::move(event));
 }
 
@@ -49,6 +61,36 @@ void socks5_session::handle_client_error(net::error_code ec)
     state_->handle_client_error(this, ec);
 }
 
+void socks5_session::append_input(io_buffer buffer)
+{
+    context().buffers.hold(buffer.size());
+
+    auto& input = context().input;
+    if (input.empty())
+        input = std::move(buffer);
+    else
+        input.insert(input.end(), buffer.begin(), buffer.end());
+}
+
+void socks5_session::consume_input(std::size_t count)
+{
+    auto& input = context().input;
+    count = std::min(count, input.size());
+    context().buffers.release(count);
+    input.erase(input.begin(), input.begin() + count);
+}
+
+io_buffer socks5_session::take_input()
+{
+    context().buffers.release(context().input.size());
+    return std::exchange(context().input, {});
+}
+
+void socks5_session::process_input()
+{
+    state_->handle_server_read(this, io_buffer{});
+}
+
 void socks5_session::update_bytes_sent_to_remote(std::size_t count)
 {
     context().transferred_bytes_to_remote += count;
@@ -59,37 +101,94 @@ void socks5_session::update_bytes_sent_to_local(std::size_t count)
     context().transferred_bytes_to_local += count;
 }
 
-stream_manager_ptr socks5_session::manager() 
+void socks5_session::set_client_address(const net::ip::address& address)
+{
+    context().limiter = session_limiter{address};
+}
+
+void socks5_session::set_relay_context(net::io_context& ctx)
+{
+    context().flow = relay_flow{ctx};
+    context().buffers = buffer_account{ctx, [manager{manager_}, id{id()}] { manager->stop(id); }};
+}
+
+void socks5_session::throttle_server_read(std::size_t count)
+{
+    context().server_read_delay = context().limiter.consume(count);
+    context().flow.charge(count);
+}
+
+void socks5_session::throttle_client_read(std::size_t count)
 {
-    return manager_;
+    context().client_read_delay = context().limiter.consume(count);
+    context().flow.charge(count);
+}
+
+stream_manager& socks5_session::manager() 
+{
+    return *manager_;
 }
 
 void socks5_session::connect()
 {
-	manager()->connect(id(), std::string{ host() }, std::string{ service() });
+    // Payload pipelined behind the request goes out with the connect, in the SYN when fast open is on
+    auto early_data = take_input();
+    update_bytes_sent_to_remote(early_data.size());
+    throttle_server_read(early_data.size());
+	manager().connect(id(), std::string{ host() }, std::string{ service() }, std::move(early_data));
+}
+
+net::ip::udp::endpoint socks5_session::associate_udp(std::uint16_t client_port)
+{
+    return manager().udp_associate(id(), client_port);
 }
 
 void socks5_session::stop()
 {
-    manager()->stop(id());
+    manager().stop(id());
 }
 
 void socks5_session::read_from_server()
 {
-    manager()->read_server(id());
+    if (const auto delay = std::exchange(context().server_read_delay, {}); delay > delay.zero())
+        manager().defer_read_server(id(), delay);
+    else if (!context().buffers.below_watermark())
+        context().buffers.wait_for_drain([manager{manager_}, id{id()}] { manager->read_server(id); });
+    else if (!context().flow.has_credit())
+        context().flow.wait_for_credit([manager{manager_}, id{id()}] { manager->read_server(id); });
+    else
+        manager().read_server(id());
 }
 
 void socks5_session::read_from_client()
 {
-    manager()->read_client(id());
+    if (const auto delay = std::exchange(context().client_read_delay, {}); delay > delay.zero())
+        manager().defer_read_client(id(), delay);
+    else if (!context().buffers.below_watermark())
+        context().buffers.wait_for_drain([manager{manager_}, id{id()}] { manager->read_client(id); });
+    else if (!context().flow.has_credit())
+        context().flow.wait_for_credit([manager{manager_}, id{id()}] { manager->read_client(id); });
+    else
+        manager().read_client(id());
 }
 
 void socks5_session::write_to_client(io_buffer buffer)
 {
-    manager()->write_client(id(), std::move(buffer)); 
+    context().client_write_bytes = buffer.size();
+    context().buffers.hold(buffer.size());
+    manager().write_client(id(), std::move(buffer)); 
 }
 
 void socks5_session::write_to_server(io_buffer buffer)
 {
-	manager()->write_server(id(), std::move(buffer));
+    context().buffers.hold(buffer.size());
+    if (context().server_write_pending) {
+        auto& queued = context().queued_output;
+        queued.insert(queued.end(), buffer.begin(), buffer.end());
+        return;
+    }
+
+    context().server_write_pending = true;
+    context().server_write_bytes = buffer.size();
+	manager().write_server(id(), std::move(buffer));
 }
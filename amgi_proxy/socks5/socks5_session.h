@@ -3,6 +3,9 @@
 
 #include "socks5.h"
 #include "socks5_state.h"
+#include "transport/rate_limiter.h"
+#include "transport/relay_scheduler.h"
+#include "transport/memory_governor.h"
 
 class stream_manager;
 using stream_manager_ptr = std::shared_ptr<stream_manager>;
@@ -16,6 +19,19 @@ class socks5_session
         std::string service;
         std::size_t transferred_bytes_to_remote;
         std::size_t transferred_bytes_to_local;
+        session_limiter limiter;
+        relay_flow flow;
+        buffer_account buffers;
+        std::size_t server_write_bytes;
+        std::size_t client_write_bytes;
+        std::chrono::steady_clock::duration server_read_delay;
+        std::chrono::steady_clock::duration client_read_delay;
+        io_buffer input;
+        io_buffer queued_output;
+        bool server_write_pending;
+        bool server_read_pending;
+        bool client_connected;
+        bool optimistic_connect;
 
         socks5::request_header* request_hdr() {
             return reinterpret_cast<socks5::request_header*>(response.data());
@@ -23,7 +39,7 @@ class socks5_session
     };
 
 public:
-    socks5_session(int id, stream_manager_ptr manager);
+    socks5_session(int id, stream_manager_ptr manager, bool optimistic_connect = false);
 
     void change_state(std::unique_ptr<socks5_state> state);
     void handle_server_read(io_buffer event);
@@ -34,9 +50,21 @@ public:
     void handle_server_error(net::error_code ec);
     void handle_client_error(net::error_code ec);
 
+    // Client bytes received during the handshake that no state has consumed yet
+    void append_input(io_buffer buffer);
+    void consume_input(std::size_t count);
+    io_buffer take_input();
+    const io_buffer& input() const { return context_.input; }
+    void process_input();
+
     void update_bytes_sent_to_remote(std::size_t count);
     void update_bytes_sent_to_local(std::size_t count);
 
+    void set_client_address(const net::ip::address& address);
+    void set_relay_context(net::io_context& ctx);
+    void throttle_server_read(std::size_t count);
+    void throttle_client_read(std::size_t count);
+
     auto& context() { return context_; }
     const auto& context() const { return context_; }
 
@@ -45,6 +73,7 @@ public:
     std::string_view service() const { return context().service; }
     std::uint64_t transfered_bytes_to_local() const { return context().transferred_bytes_to_local; }
     std::uint64_t transfered_bytes_to_remote() const { return context().transferred_bytes_to_remote; }
+    bool optimistic_connect() const { return context().optimistic_connect; }
 
     void set_response(std::uint8_t version, std::uint8_t auth_mode) {
         context().response.resize(2);
@@ -61,6 +90,7 @@ public:
     void set_response_error_code(std::uint8_t err_code) { context().request_hdr()->command = err_code; }
 
     void connect();
+    net::ip::udp::endpoint associate_udp(std::uint16_t client_port);
     void stop();
     void read_from_server();
     void read_from_client();
@@ -70,7 +100,7 @@ public:
 
     std::vector<std::uint8_t> response() const { return context().response; }
 
-   stream_manager_ptr manager();
+   stream_manager& manager();
 
 private:
     socks_ctx context_;
@@ -1,11 +1,16 @@
 #include "socks5.h"
 #include "socks5_state.h"
 #include "socks5_session.h"
+#include "auth/credential_store.h"
 #include "logger/logger.h"
+#include "transport/stream.h"
 #include "transport/stream_manager.h"
 
 #include <boost/format.hpp>
 
+#include <algorithm>
+#include <charconv>
+
 using fmt = boost::format;
 using logger = logging::logger;
 
@@ -54,6 +59,29 @@ namespace
             }
         }
     }
+
+    // Forwards payload pipelined behind the handshake in stream sized chunks, false once nothing is left
+    bool flush_input(socks5_session* session)
+    {
+        const auto& input = session->input();
+        if (input.empty())
+            return false;
+
+        const auto chunk = std::min<std::size_t>(input.size(), stream::max_buffer_size);
+        io_buffer data(input.begin(), input.begin() + chunk);
+        session->consume_input(chunk);
+        session->update_bytes_sent_to_remote(chunk);
+        session->throttle_server_read(chunk);
+        session->write_to_client(std::move(data));
+        return true;
+    }
+
+    void start_data_transfer(socks5_session* session)
+    {
+        session->change_state(socks5_data_transfer_mode::instance());
+        if (!flush_input(session))
+            session->read_from_server();
+    }
 }
 
 void socks5_state::handle_server_read(socks5_session *session, io_buffer buffer) {}
@@ -75,43 +103,135 @@ void socks5_state::handle_client_error(socks5_session* session, net::error_code
 }
 
 void socks5_auth_request::handle_server_read(socks5_session *session, io_buffer buffer) {
-    const auto error = socks5::is_socks5_auth_request(buffer.data(), buffer.size());
-    const auto auth_mode = error ? proto::auth::kNotSupported : proto::auth::kNoAuth;
+    session->append_input(std::move(buffer));
+    const auto& input = session->input();
+    const auto length = socks5::auth_request_length(input.data(), input.size());
+    if (!length) {
+        session->read_from_server();
+        return;
+    }
+
+    const std::uint8_t required = credential_store::get().enabled() ? proto::auth::kUserPass : proto::auth::kNoAuth;
+    const auto error = socks5::is_socks5_auth_request(input.data(), length, required);
+    const auto auth_mode = error ? proto::auth::kNotSupported : required;
+    session->consume_input(length);
 
     session->set_response(socks5::proto::version, auth_mode);
-    if (auth_mode == proto::auth::kNotSupported)
+    session->write_to_server(std::move(io_buffer{session->response()}));
+
+    if (auth_mode == proto::auth::kNotSupported) {
         logger::warning((fmt("[%1%] %2%") % session->id() % error.value_or("")).str());
+        session->change_state(socks5_reply_and_close::instance());
+        return;
+    }
 
-    session->write_to_server(std::move(io_buffer{session->response()}));
+    if (auth_mode == proto::auth::kUserPass)
+        session->change_state(socks5_user_pass_auth::instance());
+    else
+        session->change_state(socks5_connection_request::instance());
+
+    // A pipelining client may already have sent the next message
+    session->process_input();
+}
+
+void socks5_user_pass_auth::handle_server_read(socks5_session *session, io_buffer buffer) {
+    session->append_input(std::move(buffer));
+    const auto& input = session->input();
+    const auto length = socks5::user_pass_length(input.data(), input.size());
+    if (!length) {
+        session->read_from_server();
+        return;
+    }
+
+    std::string_view user, password;
+    const bool parsed = socks5::get_user_pass(input.data(), length, user, password);
+    const bool verified = parsed && credential_store::get().verify(user, password);
+
+    const auto status = verified ? proto::auth::kUserPassSuccess : proto::auth::kUserPassFailure;
+    session->write_to_server(io_buffer{proto::auth::kUserPassVersion, status});
+
+    if (!verified) {
+        if (parsed)
+            logger::warning((fmt("[%1%] socks5 auth: invalid credentials for user [%2%]") % session->id() % user).str());
+        else
+            logger::warning((fmt("[%1%] socks5 auth: bad username/password request") % session->id()).str());
+        session->change_state(socks5_reply_and_close::instance());
+        return;
+    }
+
+    logger::debug((fmt("[%1%] socks5 auth: user [%2%] authenticated") % session->id() % user).str());
+    session->consume_input(length);
     session->change_state(socks5_connection_request::instance());
+    session->process_input();
 }
 
-void socks5_connection_request::handle_server_write(socks5_session *session, io_buffer buffer) {
-    session->manager()->read_server(session->id());
+void socks5_reply_and_close::handle_server_write(socks5_session *session, io_buffer buffer) {
+    session->stop();
 }
 
 void socks5_connection_request::handle_server_read(socks5_session *session, io_buffer buffer) {
     const auto sid = session->id();
 
-    if (!socks5::is_valid_request_packet(buffer.data(), buffer.size())) {
+    session->append_input(std::move(buffer));
+    const auto& input = session->input();
+    const auto length = socks5::request_length(input.data(), input.size());
+    if (!length) {
+        session->read_from_server();
+        return;
+    }
+
+    if (!socks5::is_valid_request_packet(input.data(), length)) {
         logger::warning((fmt("[%1%] socks5 protocol: bad request packet") % sid).str());
         session->stop();
         return;
     }
 
     std::string host, service;
-    if (!socks5::get_remote_address_info(buffer.data(), buffer.size(), host, service)) {
+    if (!socks5::get_remote_address_info(input.data(), length, host, service)) {
         logger::warning((fmt("[%1%] socks5 protocol: bad remote address format") % sid).str());
         session->stop();
         return;
     }
 
     session->set_endpoint_info(host, service);
+    session->set_response(io_buffer(input.begin(), input.begin() + length));
+    session->consume_input(length);
+
+    if (session->context().request_hdr()->command == socks5::request::udp_port) {
+        std::uint16_t client_port{0};
+        std::from_chars(service.data(), service.data() + service.size(), client_port);
+
+        const auto bound = session->associate_udp(client_port);
+        if (!bound.port()) {
+            session->write_to_server(socks5::make_reply(socks5::responses::general_socks_server_failure, bound));
+            session->change_state(socks5_reply_and_close::instance());
+            return;
+        }
+
+        logger::info((fmt("[%1%] udp associate, relay bound to [%2%:%3%]") % sid % bound.address().to_string() % bound.port()).str());
+        session->take_input();
+        session->write_to_server(socks5::make_reply(socks5::responses::succeeded, bound));
+        session->change_state(socks5_udp_association::instance());
+        return;
+    }
 
     logger::info((fmt("[%1%] requested [%2%:%3%]") % sid % host % service).str());
-    session->set_response(std::move(buffer));
     session->connect();
-    session->change_state(socks5_connection_established::instance());
+
+    if (!session->optimistic_connect()) {
+        session->change_state(socks5_connection_established::instance());
+        return;
+    }
+
+    session->set_response_error_code(socks5::responses::succeeded);
+    session->write_to_server(std::move(io_buffer{session->response()}));
+    session->change_state(socks5_optimistic_connect::instance());
+
+    // Hold at most one read of early data, it is flushed as a single write once connected
+    if (session->input().empty()) {
+        session->context().server_read_pending = true;
+        session->read_from_server();
+    }
 }
 
 void socks5_connection_established::handle_client_connect(socks5_session *session, io_buffer buffer) {
@@ -124,18 +244,50 @@ void socks5_connection_established::handle_client_error(socks5_session* session,
 {
     session->set_response_error_code(get_response_error_code(ec));
     session->write_to_server(std::move(io_buffer{session->response()}));
+    session->change_state(socks5_reply_and_close::instance());
     logger::warning((fmt("[%1%] client side session error: %2%") % session->id() % ec.message()).str());
 }
 
-void socks5_connection_established::handle_server_write(socks5_session* session, io_buffer buffer)
-{
-    session->stop();
+void socks5_optimistic_connect::handle_server_read(socks5_session *session, io_buffer buffer) {
+    session->context().server_read_pending = false;
+    session->append_input(std::move(buffer));
+    if (session->context().client_connected)
+        start_data_transfer(session);
 }
 
-void socks5_ready_to_transfer_data::handle_server_write(socks5_session *session, io_buffer buffer) {
+void socks5_optimistic_connect::handle_server_write(socks5_session *session, io_buffer buffer) {
+    if (session->context().client_connected)
+        session->read_from_client();
+}
+
+void socks5_optimistic_connect::handle_client_connect(socks5_session *session, io_buffer buffer) {
+    auto& ctx = session->context();
+    ctx.client_connected = true;
+
+    // Upstream reads start once the success reply is out, its completion does it otherwise
+    if (!ctx.server_write_pending)
+        session->read_from_client();
+
+    // A read still outstanding completes in data transfer mode, so does an upstream reply that
+    // comes before the client sends anything past the early data
+    if (ctx.server_read_pending)
+        session->change_state(socks5_data_transfer_mode::instance());
+    else
+        start_data_transfer(session);
+}
+
+void socks5_udp_association::handle_server_write(socks5_session *session, io_buffer buffer) {
     session->read_from_server();
+}
+
+void socks5_udp_association::handle_server_read(socks5_session *session, io_buffer buffer) {
+    // The control connection carries no data, it only keeps the association alive until it closes
+    session->read_from_server();
+}
+
+void socks5_ready_to_transfer_data::handle_server_write(socks5_session *session, io_buffer buffer) {
     session->read_from_client();
-    session->change_state(socks5_data_transfer_mode::instance());
+    start_data_transfer(session);
 }
 
 void socks5_data_transfer_mode::handle_server_write(socks5_session *session, io_buffer buffer) {
@@ -144,14 +296,17 @@ void socks5_data_transfer_mode::handle_server_write(socks5_session *session, io_
 
 void socks5_data_transfer_mode::handle_server_read(socks5_session *session, io_buffer buffer) {
     session->update_bytes_sent_to_remote(buffer.size());
+    session->throttle_server_read(buffer.size());
     session->write_to_client(std::move(buffer));
 }
 
 void socks5_data_transfer_mode::handle_client_write(socks5_session *session, io_buffer buffer) {
-    session->read_from_server();
+    if (!flush_input(session))
+        session->read_from_server();
 }
 
 void socks5_data_transfer_mode::handle_client_read(socks5_session *session, io_buffer buffer) {
     session->update_bytes_sent_to_local(buffer.size());
+    session->throttle_client_read(buffer.size());
     session->write_to_server(std::move(buffer));
 }
@@ -29,12 +29,25 @@ public:
     void handle_server_read(socks5_session *session, io_buffer event) override;
 };
 
+class socks5_user_pass_auth final : public socks5_state 
+{
+public:
+    static auto instance() { return std::make_unique<socks5_user_pass_auth>(); }
+    void handle_server_read(socks5_session *session, io_buffer event) override;
+};
+
+class socks5_reply_and_close final : public socks5_state 
+{
+public:
+    static auto instance() { return std::make_unique<socks5_reply_and_close>(); }
+    void handle_server_write(socks5_session *session, io_buffer event) override;
+};
+
 class socks5_connection_request final : public socks5_state 
 {
 public:
     static auto instance() { return std::make_unique<socks5_connection_request>(); }
     void handle_server_read(socks5_session *session, io_buffer event) override;
-    void handle_server_write(socks5_session *session, io_buffer event) override;
 };
 
 class socks5_connection_established final : public socks5_state 
@@ -43,7 +56,24 @@ public:
     static auto instance() { return std::make_unique<socks5_connection_established>(); }
     void handle_client_connect(socks5_session *session, io_buffer event) override;
     void handle_client_error(socks5_session* session, net::error_code ec) override;
-    void handle_server_write(socks5_session* session, io_buffer event) override;
+};
+
+// Success has already been reported, client data is held back until the upstream connect completes
+class socks5_optimistic_connect final : public socks5_state 
+{
+public:
+    static auto instance() { return std::make_unique<socks5_optimistic_connect>(); }
+    void handle_server_read(socks5_session *session, io_buffer event) override;
+    void handle_server_write(socks5_session *session, io_buffer event) override;
+    void handle_client_connect(socks5_session *session, io_buffer event) override;
+};
+
+class socks5_udp_association final : public socks5_state 
+{
+public:
+    static auto instance() { return std::make_unique<socks5_udp_association>(); }
+    void handle_server_read(socks5_session *session, io_buffer event) override;
+    void handle_server_write(socks5_session *session, io_buffer event) override;
 };
 
 class socks5_ready_to_transfer_data final : public socks5_state 
@@ -1,5 +1,5 @@
 #include "socks5_stream_manager.h"
-#include "transport/tcp_client_stream.h"
+#include "transport/stream_factory.h"
 #include "logger/logger.h"
 
 #include <boost/format.hpp>
@@ -17,6 +17,8 @@ void socks5_stream_manager::stop(int id)
     if (auto it = sessions_.find(id); it != sessions_.end()) {
         it->second.client->stop();
         it->second.server->stop();
+        if (it->second.udp_relay)
+            it->second.udp_relay->stop();
 
         const auto& ses = it->second.session;
 
@@ -55,10 +57,15 @@ void socks5_stream_manager::on_accept(server_stream_ptr upstream)
     const auto id{upstream->id()};
     logger::trace((fmt("[%1%] session created") % id).str());
 
-    auto downstream = std::make_shared<tcp_client_stream>(shared_from_this(), id, upstream->context());
+    auto downstream = stream_factory::make_client(shared_from_this(), id, upstream->context(), options_);
 
-    socks5_session session{id, shared_from_this()};
-    socks_pair pair{id, std::move(upstream), std::move(downstream), std::move(session)};
+    socks5_session session{id, shared_from_this(), options_.optimistic_connect};
+    session.set_client_address(upstream->remote_address());
+    session.set_relay_context(upstream->context());
+
+    auto& ctx = upstream->context();
+    socks_pair pair{id, std::move(upstream), std::move(downstream), std::move(session),
+                 net::steady_timer{ctx}, net::steady_timer{ctx}, admission_control::ticket{}, nullptr};
     sessions_.insert({id, std::move(pair)});
 }
 
@@ -80,6 +87,19 @@ void socks5_stream_manager::read_server(int id)
         it->second.server->read();
 }
 
+void socks5_stream_manager::defer_read_server(int id, std::chrono::steady_clock::duration delay)
+{
+    if (auto it = sessions_.find(id); it != sessions_.end()) {
+        auto& timer = it->second.server_read_timer;
+        timer.expires_after(delay);
+        timer.async_wait(
+            [this, self{shared_from_this()}, id](const net::error_code& ec) {
+                if (!ec)
+                    read_server(id);
+            });
+    }
+}
+
 void socks5_stream_manager::write_server(int id, io_buffer buffer)
 {
     if (auto it = sessions_.find(id); it != sessions_.end())
@@ -110,18 +130,53 @@ void socks5_stream_manager::read_client(int id)
         it->second.client->read();
 }
 
+void socks5_stream_manager::defer_read_client(int id, std::chrono::steady_clock::duration delay)
+{
+    if (auto it = sessions_.find(id); it != sessions_.end()) {
+        auto& timer = it->second.client_read_timer;
+        timer.expires_after(delay);
+        timer.async_wait(
+            [this, self{shared_from_this()}, id](const net::error_code& ec) {
+                if (!ec)
+                    read_client(id);
+            });
+    }
+}
+
 void socks5_stream_manager::write_client(int id, io_buffer buffer)
 {
     if (auto it = sessions_.find(id); it != sessions_.end())
         it->second.client->write(std::move(buffer));
 }
 
-void socks5_stream_manager::connect(int id, std::string host, std::string service)
+void socks5_stream_manager::connect(int id, std::string host, std::string service, io_buffer early_data)
 {
     if (auto it = sessions_.find(id); it != sessions_.end()) {
         it->second.client->set_host(std::move(host));
         it->second.client->set_service(std::move(service));
+        it->second.client->set_early_data(std::move(early_data));
         it->second.client->start();
     }
 }
 
+
+net::ip::udp::endpoint socks5_stream_manager::udp_associate(int id, std::uint16_t client_port)
+{
+    auto it = sessions_.find(id);
+    if (it == sessions_.end())
+        return {};
+
+    const auto& server = it->second.server;
+    auto relay = std::make_shared<socks5_udp_relay>(id, server->context());
+
+    net::error_code ec;
+    const auto bound = relay->open(server->local_address(), {server->remote_address(), client_port}, ec);
+    if (ec) {
+        logger::warning((fmt("[%1%] udp relay open failed: %2%") % id % ec.message()).str());
+        return {};
+    }
+
+    relay->start();
+    it->second.udp_relay = std::move(relay);
+    return bound;
+}
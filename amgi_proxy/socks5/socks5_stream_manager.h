@@ -2,7 +2,10 @@
 #define SOCKS5_STREAM_MANAGER_H
 
 #include "transport/stream_manager.h"
+#include "transport/admission_control.h"
+#include "transport/client_options.h"
 #include "socks5_session.h"
+#include "socks5_udp_relay.h"
 
 
 class socks5_stream_manager final
@@ -10,7 +13,8 @@ class socks5_stream_manager final
     , public std::enable_shared_from_this<socks5_stream_manager> 
 {
 public:
-    socks5_stream_manager() = default;
+    explicit socks5_stream_manager(client_options options = {})
+        : options_{options} {}
     ~socks5_stream_manager() = default;
 
     socks5_stream_manager(const socks5_stream_manager& other) = delete;
@@ -25,6 +29,7 @@ public:
     void on_write(io_buffer buffer, server_stream_ptr stream) override;
     void on_error(net::error_code ec, server_stream_ptr stream) override;
     void read_server(int id) override;
+    void defer_read_server(int id, std::chrono::steady_clock::duration delay) override;
     void write_server(int id, io_buffer buffer) override;
 
     void on_connect(io_buffer buffer, client_stream_ptr stream) override;
@@ -32,8 +37,10 @@ public:
     void on_write(io_buffer buffer, client_stream_ptr stream) override;
     void on_error(net::error_code ec, client_stream_ptr stream) override;
     void read_client(int id) override;
+    void defer_read_client(int id, std::chrono::steady_clock::duration delay) override;
     void write_client(int id, io_buffer buffer) override;
-    void connect(int id, std::string host, std::string service) override;
+    void connect(int id, std::string host, std::string service, io_buffer early_data) override;
+    net::ip::udp::endpoint udp_associate(int id, std::uint16_t client_port) override;
 
 private:
     struct socks_pair {
@@ -41,9 +48,14 @@ private:
         server_stream_ptr server;
         client_stream_ptr client;
         socks5_session session;
+        net::steady_timer server_read_timer;
+        net::steady_timer client_read_timer;
+        admission_control::ticket ticket;
+        socks5_udp_relay_ptr udp_relay;
     };
 
     std::unordered_map<int, socks_pair> sessions_;
+    client_options options_;
 };
 
 using socks5_stream_manager_ptr = std::shared_ptr<socks5_stream_manager>;
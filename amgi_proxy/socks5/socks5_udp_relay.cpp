@@ -0,0 +1,436 @@
+#include "socks5_udp_relay.h"
+#include "logger/logger.h"
+#include "metrics/metrics.h"
+
+#include <boost/format.hpp>
+
+#if defined(__linux__)
+#include <sys/socket.h>
+#endif
+
+using fmt = boost::format;
+using logger = logging::logger;
+
+namespace
+{
+    auto& g_associations = metrics::make_gauge("udp.associations");
+    auto& g_datagrams_in = metrics::make_counter("udp.datagrams_in");
+    auto& g_datagrams_out = metrics::make_counter("udp.datagrams_out");
+    auto& g_datagrams_dropped = metrics::make_counter("udp.datagrams_dropped");
+    auto& g_datagrams_oversize = metrics::make_counter("udp.datagrams_oversize");
+    auto& g_batches = metrics::make_counter("udp.receive_batches");
+    auto& g_resolve_dropped = metrics::make_counter("udp.resolve_dropped");
+
+    // The resolver reports no record TTL, a fixed one keeps a moved domain from being pinned forever
+    constexpr auto kResolvedTtl = std::chrono::seconds(60);
+
+    // A dual stack socket sees v4 peers as v4 mapped v6 addresses, everything past the socket uses plain v4
+    net::ip::address unmapped(const net::ip::address& address)
+    {
+        if (address.is_v6() && address.to_v6().is_v4_mapped())
+            return net::ip::make_address_v4(net::ip::v4_mapped, address.to_v6());
+        return address;
+    }
+
+    udp::endpoint unmapped(const udp::endpoint& endpoint)
+    {
+        return {unmapped(endpoint.address()), endpoint.port()};
+    }
+}
+
+socks5_udp_relay::socks5_udp_relay(int id, net::io_context& ctx)
+    : id_{id}, socket_{ctx}, resolver_{ctx}, rx_buffers_(batch_size), rx_{}, headers_{}
+{
+    tx_.reserve(batch_size);
+}
+
+socks5_udp_relay::~socks5_udp_relay()
+{
+    logger::trace((fmt("[%1%] udp relay closed") % id_).str());
+}
+
+udp::endpoint socks5_udp_relay::open(const net::ip::address& local, const udp::endpoint& client, net::error_code& ec)
+{
+    // Dual stack needs the unspecified address, binding to the control connection's own address
+    // would tie the relay to that address's family
+    socket_.open(udp::v6(), ec);
+    if (!ec)
+        socket_.set_option(net::ip::v6_only(false), ec);
+    if (!ec)
+        socket_.bind({udp::v6(), 0}, ec);
+    dual_stack_ = !ec;
+
+    if (!dual_stack_) {
+        // No IPv6 on the host, the relay reaches targets of the control connection's family only
+        net::error_code ignored_ec;
+        socket_.close(ignored_ec);
+
+        const udp::endpoint ep{unmapped(local), 0};
+        socket_.open(ep.protocol(), ec);
+        if (!ec)
+            socket_.bind(ep, ec);
+    }
+
+    if (!ec)
+        socket_.non_blocking(true, ec);
+    if (ec)
+        return {};
+
+    const auto port = socket_.local_endpoint(ec).port();
+    if (ec)
+        return {};
+
+    client_ = unmapped(client);
+    g_associations.add(1);
+
+    // The client is told the address it already reaches the proxy on
+    return {unmapped(local), port};
+}
+
+void socks5_udp_relay::start()
+{
+    wait_read();
+}
+
+void socks5_udp_relay::stop()
+{
+    if (!socket_.is_open())
+        return;
+
+    net::error_code ignored_ec;
+    resolver_.cancel();
+    socket_.close(ignored_ec);
+    g_associations.sub(1);
+}
+
+void socks5_udp_relay::wait_read()
+{
+    socket_.async_wait(
+        udp::socket::wait_read,
+        [this, self{shared_from_this()}](const net::error_code& ec) {
+            if (!ec)
+                handle_read();
+        });
+}
+
+void socks5_udp_relay::handle_read()
+{
+    // Drain the socket a batch at a time, each batch costs one receive and one send syscall
+    for (;;) {
+        const auto count = receive_batch();
+        if (!count)
+            break;
+
+        g_batches.add();
+        g_datagrams_in.add(count);
+
+        tx_.clear();
+        for (std::size_t i = 0; i < count; ++i) {
+            if (!rx_[i].valid)
+                drop_oversize(rx_[i].peer);
+            else if (is_client(rx_[i].peer))
+                relay_from_client(i);
+            else
+                relay_to_client(i);
+        }
+        send_batch();
+
+        if (count < batch_size)
+            break;
+    }
+
+    if (socket_.is_open())
+        wait_read();
+}
+
+bool socks5_udp_relay::is_client(const udp::endpoint& peer)
+{
+    if (peer.address() != client_.address())
+        return false;
+
+    // The client may announce port 0 and let the first datagram pin its source port
+    if (client_.port() == 0)
+        client_.port(peer.port());
+
+    return peer.port() == client_.port();
+}
+
+void socks5_udp_relay::relay_from_client(std::size_t index)
+{
+    const auto* data = rx_buffers_[index].data();
+    const auto length = rx_[index].length;
+
+    auto target = socks5::get_udp_target(data, length);
+    if (!target) {
+        g_datagrams_dropped.add();
+        return;
+    }
+
+    if (!target->domain.empty()) {
+        const auto* address = find_resolved(target->domain);
+        if (!address) {
+            resolve(target->domain, target->endpoint.port(),
+                    io_buffer{data + target->header_length, data + length});
+            return;
+        }
+        target->endpoint.address(*address);
+    }
+
+    remember_peer(target->endpoint);
+    tx_.push_back({to_socket(target->endpoint), nullptr, 0, data + target->header_length, length - target->header_length});
+}
+
+void socks5_udp_relay::relay_to_client(std::size_t index)
+{
+    const auto& peer = rx_[index].peer;
+
+    // Only answers from destinations the client talked to are let through
+    if (peers_.find(peer) == peers_.end() || client_.port() == 0) {
+        g_datagrams_dropped.add();
+        return;
+    }
+
+    auto& header = headers_[index];
+    const auto header_length = socks5::make_udp_header(peer, header.data());
+    tx_.push_back({to_socket(client_), header.data(), header_length, rx_buffers_[index].data(), rx_[index].length});
+}
+
+void socks5_udp_relay::remember_peer(const udp::endpoint& peer)
+{
+    if (const auto it = peers_.find(peer); it != peers_.end()) {
+        peer_order_.splice(peer_order_.end(), peer_order_, it->second);
+        return;
+    }
+
+    // A client spraying destinations only forgets the one it talked to least recently
+    if (peers_.size() >= max_peers) {
+        peers_.erase(peer_order_.front());
+        peer_order_.pop_front();
+    }
+
+    peers_.emplace(peer, peer_order_.insert(peer_order_.end(), peer));
+}
+
+udp::endpoint socks5_udp_relay::to_socket(const udp::endpoint& peer) const
+{
+    if (dual_stack_ && peer.address().is_v4())
+        return {net::ip::make_address_v6(net::ip::v4_mapped, peer.address().to_v4()), peer.port()};
+    return peer;
+}
+
+void socks5_udp_relay::drop_oversize(const udp::endpoint& peer)
+{
+    g_datagrams_oversize.add();
+    g_datagrams_dropped.add();
+    logger::debug((fmt("[%1%] udp relay dropped an oversize datagram from [%2%:%3%]")
+        % id_ % peer.address().to_string() % peer.port()).str());
+}
+
+const net::ip::address* socks5_udp_relay::find_resolved(const std::string& domain)
+{
+    const auto it = resolved_.find(domain);
+    if (it == resolved_.end())
+        return nullptr;
+
+    if (std::chrono::steady_clock::now() >= it->second.expires) {
+        resolved_order_.erase(it->second.position);
+        resolved_.erase(it);
+        return nullptr;
+    }
+
+    resolved_order_.splice(resolved_order_.end(), resolved_order_, it->second.position);
+    return &it->second.address;
+}
+
+void socks5_udp_relay::remember_resolved(const std::string& domain, const net::ip::address& address)
+{
+    const auto expires = std::chrono::steady_clock::now() + kResolvedTtl;
+    if (const auto it = resolved_.find(domain); it != resolved_.end()) {
+        it->second.address = address;
+        it->second.expires = expires;
+        resolved_order_.splice(resolved_order_.end(), resolved_order_, it->second.position);
+        return;
+    }
+
+    // Like the peers, a client spraying domains only forgets the one it used least recently
+    if (resolved_.size() >= max_peers) {
+        resolved_.erase(resolved_order_.front());
+        resolved_order_.pop_front();
+    }
+
+    resolved_.emplace(domain, resolved_entry{address, expires, resolved_order_.insert(resolved_order_.end(), domain)});
+}
+
+void socks5_udp_relay::resolve(const std::string& domain, std::uint16_t port, io_buffer payload)
+{
+    auto it = pending_.find(domain);
+    if (it == pending_.end()) {
+        // Each pending domain holds datagrams and a lookup, a client spraying names can't pile them up
+        if (pending_.size() >= max_pending_domains) {
+            g_resolve_dropped.add();
+            g_datagrams_dropped.add();
+            return;
+        }
+        it = pending_.emplace(domain, std::vector<std::pair<std::uint16_t, io_buffer>>{}).first;
+    }
+
+    auto& queue = it->second;
+    if (queue.size() >= max_pending_per_domain) {
+        g_resolve_dropped.add();
+        g_datagrams_dropped.add();
+        return;
+    }
+
+    queue.emplace_back(port, std::move(payload));
+    if (queue.size() > 1)
+        return;
+
+    if (resolving_ >= max_resolves)
+        waiting_.push_back(domain);
+    else
+        start_resolve(domain);
+}
+
+void socks5_udp_relay::start_resolve(const std::string& domain)
+{
+    ++resolving_;
+    resolver_.async_resolve(
+        domain, "",
+        [this, self{shared_from_this()}, domain](const net::error_code& ec, const udp::resolver::results_type& results) {
+            --resolving_;
+            auto queue = std::move(pending_[domain]);
+            pending_.erase(domain);
+
+            if (socket_.is_open() && !waiting_.empty()) {
+                const auto next = std::move(waiting_.front());
+                waiting_.pop_front();
+                start_resolve(next);
+            }
+
+            if (ec || results.empty() || !socket_.is_open()) {
+                g_datagrams_dropped.add(queue.size());
+                return;
+            }
+
+            const auto address = results.begin()->endpoint().address();
+            remember_resolved(domain, address);
+
+            for (auto& [port, payload] : queue) {
+                const udp::endpoint target{unmapped(address), port};
+                remember_peer(target);
+
+                net::error_code send_ec;
+                socket_.send_to(net::buffer(payload), to_socket(target), 0, send_ec);
+                if (send_ec)
+                    g_datagrams_dropped.add();
+                else
+                    g_datagrams_out.add();
+            }
+        });
+}
+
+#if defined(__linux__)
+
+std::size_t socks5_udp_relay::receive_batch()
+{
+    std::array<mmsghdr, batch_size> msgs{};
+    std::array<iovec, batch_size> iovs{};
+    std::array<udp::endpoint, batch_size> peers{};
+
+    for (std::size_t i = 0; i < batch_size; ++i) {
+        iovs[i] = {rx_buffers_[i].data(), rx_buffers_[i].size()};
+        msgs[i].msg_hdr.msg_name = peers[i].data();
+        msgs[i].msg_hdr.msg_namelen = static_cast<socklen_t>(peers[i].capacity());
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    const auto count = ::recvmmsg(socket_.native_handle(), msgs.data(), batch_size, MSG_DONTWAIT, nullptr);
+    if (count <= 0)
+        return 0;
+
+    for (int i = 0; i < count; ++i) {
+        peers[i].resize(msgs[i].msg_hdr.msg_namelen);
+        const bool truncated = (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) != 0;
+        rx_[i] = {unmapped(peers[i]), msgs[i].msg_len, !truncated};
+    }
+
+    return static_cast<std::size_t>(count);
+}
+
+void socks5_udp_relay::send_batch()
+{
+    std::array<mmsghdr, batch_size> msgs{};
+    std::array<std::array<iovec, 2>, batch_size> iovs{};
+
+    for (std::size_t i = 0; i < tx_.size(); ++i) {
+        auto& out = tx_[i];
+        std::size_t iov_count{0};
+        if (out.header_length)
+            iovs[i][iov_count++] = {const_cast<std::uint8_t*>(out.header), out.header_length};
+        iovs[i][iov_count++] = {const_cast<std::uint8_t*>(out.payload), out.payload_length};
+
+        msgs[i].msg_hdr.msg_name = out.peer.data();
+        msgs[i].msg_hdr.msg_namelen = static_cast<socklen_t>(out.peer.size());
+        msgs[i].msg_hdr.msg_iov = iovs[i].data();
+        msgs[i].msg_hdr.msg_iovlen = iov_count;
+    }
+
+    std::size_t sent{0};
+    while (sent < tx_.size()) {
+        const auto count = ::sendmmsg(socket_.native_handle(), msgs.data() + sent,
+                                      static_cast<unsigned int>(tx_.size() - sent), MSG_DONTWAIT);
+        if (count <= 0) {
+            // Datagram semantics: a full send buffer or an unreachable peer just loses the datagram
+            if (count < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+                ++sent;
+                g_datagrams_dropped.add();
+                continue;
+            }
+            break;
+        }
+        sent += static_cast<std::size_t>(count);
+        g_datagrams_out.add(static_cast<std::uint64_t>(count));
+    }
+
+    g_datagrams_dropped.add(tx_.size() - sent);
+}
+
+#else
+
+std::size_t socks5_udp_relay::receive_batch()
+{
+    std::size_t received{0};
+    while (received < batch_size) {
+        net::error_code ec;
+        udp::endpoint peer;
+        const auto length = socket_.receive_from(net::buffer(rx_buffers_[received]), peer, 0, ec);
+        if (ec == net::error::message_size) {
+            rx_[received++] = {unmapped(peer), length, false};
+            continue;
+        }
+        if (ec)
+            break;
+        rx_[received++] = {unmapped(peer), length, true};
+    }
+    return received;
+}
+
+void socks5_udp_relay::send_batch()
+{
+    for (const auto& out : tx_) {
+        const std::array<net::const_buffer, 2> buffers{
+            net::buffer(out.header, out.header_length),
+            net::buffer(out.payload, out.payload_length)
+        };
+
+        net::error_code ec;
+        socket_.send_to(buffers, out.peer, 0, ec);
+        if (ec)
+            g_datagrams_dropped.add();
+        else
+            g_datagrams_out.add();
+    }
+}
+
+#endif
@@ -0,0 +1,114 @@
+#ifndef SOCKS5_UDP_RELAY_H
+#define SOCKS5_UDP_RELAY_H
+
+#include "socks5.h"
+#include "transport/io_buffer.h"
+
+#include <asio.hpp>
+
+#include <array>
+#include <chrono>
+#include <deque>
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace net = asio;
+using udp = asio::ip::udp;
+
+// Relay socket of one UDP ASSOCIATE, lives as long as the control tcp session
+class socks5_udp_relay final : public std::enable_shared_from_this<socks5_udp_relay>
+{
+public:
+    enum {
+        batch_size = 16,
+        // No UDP payload is larger, a datagram is never cut short on receive
+        max_datagram_size = 0xffff,
+        max_pending_per_domain = 8,
+        // Distinct domains with datagrams waiting and lookups running at once
+        max_pending_domains = 64,
+        max_resolves = 8,
+        max_peers = 1024
+    };
+
+    socks5_udp_relay(int id, net::io_context& ctx);
+    ~socks5_udp_relay();
+
+    socks5_udp_relay(const socks5_udp_relay& other) = delete;
+    socks5_udp_relay& operator=(const socks5_udp_relay& other) = delete;
+
+    // Binds the relay next to the control connection, client is the expected datagram source. The
+    // socket is dual stack where the host allows it, so any client reaches targets of either family
+    udp::endpoint open(const net::ip::address& local, const udp::endpoint& client, net::error_code& ec);
+    void start();
+    void stop();
+
+private:
+    struct datagram {
+        udp::endpoint peer;
+        std::size_t length;
+        bool valid;
+    };
+
+    struct resolved_entry {
+        net::ip::address address;
+        std::chrono::steady_clock::time_point expires;
+        std::list<std::string>::iterator position;
+    };
+
+    struct outgoing {
+        udp::endpoint peer;
+        const std::uint8_t* header;
+        std::size_t header_length;
+        const std::uint8_t* payload;
+        std::size_t payload_length;
+    };
+
+    void wait_read();
+    void handle_read();
+
+    std::size_t receive_batch();
+    void send_batch();
+
+    bool is_client(const udp::endpoint& peer);
+    void remember_peer(const udp::endpoint& peer);
+    // Destination in the socket's own family, v4 targets of a dual stack socket are v4 mapped
+    [[nodiscard]] udp::endpoint to_socket(const udp::endpoint& peer) const;
+    void drop_oversize(const udp::endpoint& peer);
+    void relay_from_client(std::size_t index);
+    void relay_to_client(std::size_t index);
+
+    [[nodiscard]] const net::ip::address* find_resolved(const std::string& domain);
+    void remember_resolved(const std::string& domain, const net::ip::address& address);
+    void resolve(const std::string& domain, std::uint16_t port, io_buffer payload);
+    void start_resolve(const std::string& domain);
+
+    int id_;
+    udp::socket socket_;
+    udp::resolver resolver_;
+    udp::endpoint client_;
+    bool dual_stack_{false};
+
+    std::vector<std::array<std::uint8_t, max_datagram_size>> rx_buffers_;
+    std::array<datagram, batch_size> rx_;
+    std::array<std::array<std::uint8_t, socks5::udp_header_max_ip_length>, batch_size> headers_;
+    std::vector<outgoing> tx_;
+
+    // Destinations the client sent to, least recently used first, the oldest goes at max_peers
+    std::list<udp::endpoint> peer_order_;
+    std::map<udp::endpoint, std::list<udp::endpoint>::iterator> peers_;
+    // Domains the client sent to, least recently used first, looked up again once expired
+    std::list<std::string> resolved_order_;
+    std::unordered_map<std::string, resolved_entry> resolved_;
+    std::unordered_map<std::string, std::vector<std::pair<std::uint16_t, io_buffer>>> pending_;
+    // Pending domains whose lookup waits for one of the max_resolves running ones to finish
+    std::deque<std::string> waiting_;
+    std::size_t resolving_{0};
+};
+
+using socks5_udp_relay_ptr = std::shared_ptr<socks5_udp_relay>;
+
+#endif // SOCKS5_UDP_RELAY_H
@@ -0,0 +1,162 @@
+#include "admission_control.h"
+#include "stream.h"
+#include "memory_governor.h"
+#include "metrics/metrics.h"
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    // Read buffers of both streams plus socket, session and bookkeeping overhead, the bytes
+    // queued on top of that are held in buffer accounts
+    constexpr std::size_t kSessionFootprint = 4 * stream::max_buffer_size + 0x1000;
+
+    auto& g_active_sessions = metrics::make_gauge("sessions.active");
+    auto& g_charged_memory = metrics::make_gauge("memory.charged_bytes");
+    auto& g_accept_paused = metrics::make_counter("accept.paused");
+    auto& g_rejected_fd = metrics::make_counter("accept.rejected_no_fd");
+}
+
+admission_control::ticket::ticket() : active_{true}
+{
+    admission_control::get().sessions_.fetch_add(1, std::memory_order_relaxed);
+    g_active_sessions.add(1);
+    g_charged_memory.add(static_cast<std::int64_t>(kSessionFootprint));
+}
+
+admission_control::ticket::~ticket()
+{
+    reset();
+}
+
+void admission_control::ticket::reset()
+{
+    if (!active_)
+        return;
+
+    admission_control::get().sessions_.fetch_sub(1, std::memory_order_relaxed);
+    g_active_sessions.sub(1);
+    g_charged_memory.sub(static_cast<std::int64_t>(kSessionFootprint));
+    active_ = false;
+}
+
+admission_control::ticket::ticket(ticket&& other) noexcept
+    : active_{other.active_}
+{
+    other.active_ = false;
+}
+
+admission_control::ticket& admission_control::ticket::operator=(ticket&& other) noexcept
+{
+    if (this != &other) {
+        reset();
+        active_ = std::exchange(other.active_, false);
+    }
+    return *this;
+}
+
+void admission_control::configure(const options& opts)
+{
+    get().options_ = opts;
+}
+
+admission_control& admission_control::get()
+{
+    static admission_control instance;
+    return instance;
+}
+
+std::size_t admission_control::memory() const
+{
+    return sessions() * kSessionFootprint + memory_governor::buffered();
+}
+
+bool admission_control::over_limit(double ratio) const
+{
+    if (options_.max_sessions && sessions() >= options_.max_sessions * ratio)
+        return true;
+
+    if (options_.memory_budget && memory() >= options_.memory_budget * ratio)
+        return true;
+
+    return false;
+}
+
+bool admission_control::can_accept()
+{
+    if (paused_.load(std::memory_order_relaxed)) {
+        if (over_limit(options_.resume_ratio))
+            return false;
+
+        paused_.store(false, std::memory_order_relaxed);
+        return true;
+    }
+
+    if (!over_limit(1.0))
+        return true;
+
+    if (!paused_.exchange(true, std::memory_order_relaxed))
+        g_accept_paused.add();
+
+    return false;
+}
+
+#if !defined(_WIN32)
+
+fd_reserve::fd_reserve() : fd_{-1} { open(); }
+
+fd_reserve::~fd_reserve() { close(); }
+
+void fd_reserve::open()
+{
+    if (fd_ < 0)
+        fd_ = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+}
+
+void fd_reserve::close()
+{
+    if (fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+}
+
+bool fd_reserve::reject_pending(tcp::acceptor& acceptor)
+{
+    if (fd_ < 0)
+        return false;
+
+    close();
+
+    bool rejected{false};
+    for (;;) {
+        const auto fd = ::accept4(acceptor.native_handle(), nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+            break;
+
+        ::close(fd);
+        g_rejected_fd.add();
+        rejected = true;
+    }
+
+    open();
+    return rejected;
+}
+
+#else
+
+fd_reserve::fd_reserve() : fd_{-1} {}
+
+fd_reserve::~fd_reserve() = default;
+
+void fd_reserve::open() {}
+
+void fd_reserve::close() {}
+
+bool fd_reserve::reject_pending(tcp::acceptor& /*acceptor*/) { return false; }
+
+#endif
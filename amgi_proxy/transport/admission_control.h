@@ -0,0 +1,80 @@
+#ifndef ADMISSION_CONTROL_H
+#define ADMISSION_CONTROL_H
+
+#include <asio.hpp>
+
+#include <atomic>
+#include <cstdint>
+
+namespace net = asio;
+using tcp = asio::ip::tcp;
+
+class admission_control
+{
+public:
+    struct options {
+        std::size_t max_sessions{0};
+        // Checked against memory(), zero - no limit
+        std::size_t memory_budget{0};
+        // Accept resumes once usage drops below this share of a limit
+        double resume_ratio{0.9};
+    };
+
+    // Holds a session slot for the session lifetime
+    class ticket
+    {
+    public:
+        ticket();
+        ~ticket();
+
+        ticket(ticket&& other) noexcept;
+        ticket& operator=(ticket&& other) noexcept;
+        ticket(const ticket& other) = delete;
+        ticket& operator=(const ticket& other) = delete;
+
+    private:
+        void reset();
+
+        bool active_;
+    };
+
+    static void configure(const options& opts);
+    static admission_control& get();
+
+    // Applies the limits with hysteresis, false means accept must pause
+    bool can_accept();
+
+    [[nodiscard]] std::size_t sessions() const { return sessions_.load(std::memory_order_relaxed); }
+    // An estimate: a fixed footprint per session plus the relay bytes the memory governor accounts
+    [[nodiscard]] std::size_t memory() const;
+
+private:
+    admission_control() = default;
+
+    bool over_limit(double ratio) const;
+
+    options options_;
+    std::atomic<std::size_t> sessions_{0};
+    std::atomic<bool> paused_{false};
+};
+
+// Spare descriptor given up to politely accept-and-close a pending connection on EMFILE
+class fd_reserve
+{
+public:
+    fd_reserve();
+    ~fd_reserve();
+
+    fd_reserve(const fd_reserve& other) = delete;
+    fd_reserve& operator=(const fd_reserve& other) = delete;
+
+    bool reject_pending(tcp::acceptor& acceptor);
+
+private:
+    void open();
+    void close();
+
+    int fd_;
+};
+
+#endif // ADMISSION_CONTROL_H
@@ -0,0 +1,18 @@
+#ifndef CLIENT_OPTIONS_H
+#define CLIENT_OPTIONS_H
+
+#include "io_backend.h"
+#include "common/socket_profile.h"
+
+struct client_options
+{
+    // Confirm CONNECT requests before the upstream handshake completes
+    bool optimistic_connect{false};
+    // TCP_FASTOPEN_CONNECT on upstream sockets, client data received before the connect rides in the SYN
+    bool fastopen{false};
+    socket_profile profile;
+    // Upstream connections run on it in every proxy mode
+    io_backend::kind backend{io_backend::kind::reactor};
+};
+
+#endif // CLIENT_OPTIONS_H
@@ -5,23 +5,26 @@
 
 #include <string>
 
-class client_stream
-    : public stream
-    , public std::enable_shared_from_this<client_stream>
+class client_stream;
+using client_stream_ptr = ref_ptr<client_stream>;
+
+class client_stream : public stream
 {
 public:
     client_stream(const stream_manager_ptr& smp, int id) : stream(smp, id) {}
+    client_stream_ptr ref_from_this() { return client_stream_ptr{this}; }
 
     void set_host(std::string host) { do_set_host(std::move(host)); }
     void set_service(std::string service) { do_set_service(std::move(service)); }
+    // Data to deliver as part of the connect, on_connect is reported once it has been sent
+    void set_early_data(io_buffer data) { do_set_early_data(std::move(data)); }
 
 private:
     virtual void do_set_host(std::string host) = 0;
     virtual void do_set_service(std::string service) = 0;
+    virtual void do_set_early_data(io_buffer data) = 0;
 };
 
-using client_stream_ptr = std::shared_ptr<client_stream>;
-
 
 
 #endif //CLIENT_STREAM_H
@@ -0,0 +1,130 @@
+#include "egress_pool.h"
+#include "logger/logger.h"
+#include "metrics/metrics.h"
+
+#if !defined(_WIN32)
+#include <netinet/in.h>
+#endif
+
+#include <functional>
+#include <string>
+#include <utility>
+
+namespace
+{
+#if defined(IP_BIND_ADDRESS_NO_PORT)
+    // Without it bind() reserves a port for the source address alone and the 4-tuple can't be shared
+    using bind_address_no_port = net::detail::socket_option::boolean<IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT>;
+#endif
+
+    auto& g_bind_errors = metrics::make_counter("egress.bind_errors");
+}
+
+egress_pool::lease::lease(const source* src) : source_{src}
+{
+    source_->ports_in_use.add(1);
+}
+
+egress_pool::lease::~lease()
+{
+    reset();
+}
+
+egress_pool::lease::lease(lease&& other) noexcept
+    : source_{std::exchange(other.source_, nullptr)}
+{}
+
+egress_pool::lease& egress_pool::lease::operator=(lease&& other) noexcept
+{
+    if (this != &other) {
+        reset();
+        source_ = std::exchange(other.source_, nullptr);
+    }
+    return *this;
+}
+
+void egress_pool::lease::reset()
+{
+    if (source_)
+        source_->ports_in_use.sub(1);
+    source_ = nullptr;
+}
+
+void egress_pool::lease::report_exhausted()
+{
+    if (source_)
+        source_->exhausted.add();
+}
+
+void egress_pool::configure(const options& opts)
+{
+    auto& pool = get();
+    pool.policy_ = opts.selection;
+    pool.sources_.clear();
+    pool.sources_.reserve(opts.sources.size());
+
+    for (const auto& address : opts.sources) {
+        const auto name = "egress." + address.to_string();
+        pool.sources_.push_back({address,
+                                 metrics::make_gauge(name + ".ports_in_use"),
+                                 metrics::make_counter(name + ".exhausted")});
+    }
+}
+
+egress_pool& egress_pool::get()
+{
+    static egress_pool instance;
+    return instance;
+}
+
+const egress_pool::source* egress_pool::select(const tcp::endpoint& destination)
+{
+    const auto v6 = destination.address().is_v6();
+
+    std::size_t candidates{0};
+    for (const auto& src : sources_)
+        candidates += src.address.is_v6() == v6;
+
+    if (!candidates)
+        return nullptr;
+
+    // Hashing pins a destination to one source, spreading the load happens across destinations
+    std::size_t pick = 0;
+    if (policy_ == policy::hash) {
+        net::error_code ignored_ec;
+        pick = std::hash<std::string>{}(destination.address().to_string(ignored_ec)) ^ destination.port();
+    } else {
+        pick = next_.fetch_add(1, std::memory_order_relaxed);
+    }
+    pick %= candidates;
+
+    for (const auto& src : sources_) {
+        if (src.address.is_v6() != v6)
+            continue;
+        if (pick-- == 0)
+            return &src;
+    }
+
+    return nullptr;
+}
+
+egress_pool::lease egress_pool::bind(tcp::socket& socket, const tcp::endpoint& destination)
+{
+    const auto* src = select(destination);
+    if (!src)
+        return {};
+
+    net::error_code ec;
+#if defined(IP_BIND_ADDRESS_NO_PORT)
+    socket.set_option(bind_address_no_port(true), ec);
+#endif
+
+    socket.bind(tcp::endpoint{src->address, 0}, ec);
+    if (ec) {
+        g_bind_errors.add();
+        logging::logger::warning("egress bind to " + src->address.to_string() + " failed: " + ec.message());
+        return {};
+    }
+
+    return lease{src};
+}
@@ -0,0 +1,79 @@
+#ifndef EGRESS_POOL_H
+#define EGRESS_POOL_H
+
+#include <asio.hpp>
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+namespace net = asio;
+using tcp = asio::ip::tcp;
+
+namespace metrics
+{
+    class counter;
+    class gauge;
+}
+
+// Source addresses upstream sockets are spread over, each one has its own ephemeral port range
+class egress_pool
+{
+    struct source {
+        net::ip::address address;
+        metrics::gauge& ports_in_use;
+        metrics::counter& exhausted;
+    };
+
+public:
+    enum class policy { round_robin, hash };
+
+    struct options {
+        std::vector<net::ip::address> sources;
+        policy selection{policy::round_robin};
+    };
+
+    // Accounts one port of a source for as long as an upstream socket is bound to it
+    class lease
+    {
+    public:
+        lease() = default;
+        ~lease();
+
+        lease(lease&& other) noexcept;
+        lease& operator=(lease&& other) noexcept;
+        lease(const lease& other) = delete;
+        lease& operator=(const lease& other) = delete;
+
+        // The connect failed with EADDRNOTAVAIL, the source ran out of ports for this destination
+        void report_exhausted();
+
+    private:
+        friend class egress_pool;
+        explicit lease(const source* src);
+
+        void reset();
+
+        const source* source_{nullptr};
+    };
+
+    // Must be called before any upstream connect
+    static void configure(const options& opts);
+    static egress_pool& get();
+
+    [[nodiscard]] bool enabled() const { return !sources_.empty(); }
+
+    // Binds an open socket to a source of the destination's family, the port is only picked at connect
+    lease bind(tcp::socket& socket, const tcp::endpoint& destination);
+
+private:
+    egress_pool() = default;
+
+    const source* select(const tcp::endpoint& destination);
+
+    std::vector<source> sources_;
+    policy policy_{policy::round_robin};
+    std::atomic<std::size_t> next_{0};
+};
+
+#endif // EGRESS_POOL_H
@@ -0,0 +1,21 @@
+#include "io_backend.h"
+
+#if defined(AMGI_PROXY_IO_URING)
+#include "uring/io_ring.h"
+#endif
+
+namespace io_backend
+{
+    bool available(kind backend, std::string& error)
+    {
+        if (backend == kind::reactor)
+            return true;
+
+#if defined(AMGI_PROXY_IO_URING)
+        return io_ring::probe(error);
+#else
+        error = "this build has no io_uring transport, rebuild with -DAMGI_PROXY_IO_URING=ON";
+        return false;
+#endif
+    }
+}
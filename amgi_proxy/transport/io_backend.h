@@ -0,0 +1,44 @@
+#ifndef IO_BACKEND_H
+#define IO_BACKEND_H
+
+#include <asio.hpp>
+
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace io_backend
+{
+    // Plain TCP streams either run on asio's reactor or, on Linux builds with AMGI_PROXY_IO_URING,
+    // on the proxy's own io_uring transport. TLS sockets always stay on the reactor
+    enum class kind { reactor, uring };
+
+#if defined(ASIO_HAS_IOCP)
+    inline constexpr std::string_view reactor_name = "iocp";
+#elif defined(ASIO_HAS_EPOLL)
+    inline constexpr std::string_view reactor_name = "epoll";
+#elif defined(ASIO_HAS_KQUEUE)
+    inline constexpr std::string_view reactor_name = "kqueue";
+#else
+    inline constexpr std::string_view reactor_name = "select";
+#endif
+
+    inline std::string_view name(kind backend)
+    {
+        return backend == kind::uring ? "uring" : reactor_name;
+    }
+
+    inline std::optional<kind> parse(std::string_view name)
+    {
+        if (name == reactor_name)
+            return kind::reactor;
+        if (name == "uring")
+            return kind::uring;
+        return std::nullopt;
+    }
+
+    // Whether streams can run on the backend in this build and on this kernel, why not otherwise
+    bool available(kind backend, std::string& error);
+}
+
+#endif // IO_BACKEND_H
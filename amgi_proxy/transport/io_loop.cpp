@@ -0,0 +1,42 @@
+#include "io_loop.h"
+#include "metrics/metrics.h"
+
+#include <thread>
+
+namespace
+{
+    auto& g_spin_handlers = metrics::make_counter("io.spin.handlers");
+    auto& g_spin_sleeps = metrics::make_counter("io.spin.sleeps");
+}
+
+namespace io_loop
+{
+    void run(net::io_context& ctx, std::chrono::microseconds spin_budget)
+    {
+        if (spin_budget.count() <= 0) {
+            ctx.run();
+            return;
+        }
+
+        using clock = std::chrono::steady_clock;
+        while (!ctx.stopped()) {
+            // poll() also asks the reactor for events, with a zero timeout
+            auto last_work = clock::now();
+            while (clock::now() - last_work < spin_budget) {
+                if (const auto handlers = ctx.poll()) {
+                    g_spin_handlers.add(handlers);
+                    last_work = clock::now();
+                } else {
+                    // Free on a dedicated core, on a shared one the peers we wait for get to run
+                    std::this_thread::yield();
+                }
+
+                if (ctx.stopped())
+                    return;
+            }
+
+            g_spin_sleeps.add();
+            ctx.run_one();
+        }
+    }
+}
@@ -0,0 +1,18 @@
+#ifndef IO_LOOP_H
+#define IO_LOOP_H
+
+#include <asio/io_context.hpp>
+
+#include <chrono>
+
+namespace net = asio;
+
+namespace io_loop
+{
+    // Runs the io context until it is stopped. With a spin budget the thread polls for ready handlers
+    // and socket events without blocking while they keep coming and only sleeps in the reactor once
+    // the budget passed without any, a core is traded for the wakeup latency
+    void run(net::io_context& ctx, std::chrono::microseconds spin_budget);
+}
+
+#endif // IO_LOOP_H
@@ -0,0 +1,175 @@
+#include "memory_governor.h"
+#include "stream.h"
+#include "logger/logger.h"
+#include "metrics/metrics.h"
+
+#include <asio/post.hpp>
+#include <boost/format.hpp>
+
+#include <algorithm>
+
+using fmt = boost::format;
+using logger = logging::logger;
+
+namespace
+{
+    // One relay buffer in flight per direction plus handshake input and a queued reply, a session
+    // held below this never waits on itself
+    constexpr std::size_t kMinWatermark = 4 * stream::max_buffer_size;
+
+    auto& g_buffered = metrics::make_gauge("memory.buffered_bytes");
+    auto& g_holding = metrics::make_gauge("memory.holding_sessions");
+    auto& g_paused_reads = metrics::make_counter("memory.paused_reads");
+    auto& g_shed = metrics::make_counter("memory.shed_sessions");
+}
+
+memory_governor::options memory_governor::options_{};
+std::atomic<std::size_t> memory_governor::buffered_{0};
+
+void memory_governor::configure(const options& opts)
+{
+    options_ = opts;
+    if (options_.session_watermark)
+        options_.session_watermark = std::max(options_.session_watermark, kMinWatermark);
+}
+
+memory_governor& memory_governor::local()
+{
+    static thread_local memory_governor instance;
+    return instance;
+}
+
+bool memory_governor::over_watermark(const account_state& account)
+{
+    return options_.session_watermark && account.held >= options_.session_watermark;
+}
+
+void memory_governor::add(account_state& account)
+{
+    account.position = accounts_.insert(accounts_.end(), &account);
+}
+
+void memory_governor::remove(account_state& account)
+{
+    // Nobody is left to resume
+    account.drain_waiters.clear();
+    release(account, account.held);
+    accounts_.erase(account.position);
+}
+
+void memory_governor::hold(account_state& account, std::size_t bytes)
+{
+    if (bytes == 0)
+        return;
+
+    // The slow consumer clock starts with the first byte held
+    if (account.held == 0) {
+        account.drained = clock::now();
+        g_holding.add(1);
+    }
+
+    account.held += bytes;
+    g_buffered.add(static_cast<std::int64_t>(bytes));
+    const auto total = buffered_.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+
+    if (options_.budget && total > options_.budget)
+        shed_slow_consumers();
+}
+
+void memory_governor::release(account_state& account, std::size_t bytes)
+{
+    bytes = std::min(bytes, account.held);
+    if (bytes == 0)
+        return;
+
+    account.held -= bytes;
+    account.drained = clock::now();
+    g_buffered.sub(static_cast<std::int64_t>(bytes));
+    buffered_.fetch_sub(bytes, std::memory_order_relaxed);
+
+    if (account.shedding)
+        shedding_bytes_ -= std::min(shedding_bytes_, bytes);
+
+    if (account.held == 0)
+        g_holding.sub(1);
+
+    if (account.drain_waiters.empty() || account.held > options_.session_watermark / 2)
+        return;
+
+    for (auto& resume : std::exchange(account.drain_waiters, {}))
+        net::post(account.ctx, std::move(resume));
+}
+
+void memory_governor::wait_for_drain(account_state& account, std::function<void()> resume)
+{
+    g_paused_reads.add();
+    account.drain_waiters.push_back(std::move(resume));
+}
+
+void memory_governor::shed_slow_consumers()
+{
+    const auto now = clock::now();
+    for (auto* account : accounts_) {
+        if (buffered() - std::min(buffered(), shedding_bytes_) <= options_.budget)
+            return;
+
+        if (account->shedding || account->held == 0 || now - account->drained < options_.slow_after)
+            continue;
+
+        logger::warning((fmt("memory budget exceeded: shedding a slow consumer holding %1% bytes, nothing drained for %2% ms")
+            % account->held
+            % std::chrono::duration_cast<std::chrono::milliseconds>(now - account->drained).count()).str());
+
+        account->shedding = true;
+        shedding_bytes_ += account->held;
+        g_shed.add();
+        net::post(account->ctx, account->shed);
+    }
+}
+
+buffer_account::buffer_account(net::io_context& ctx, std::function<void()> shed)
+    : state_{std::make_unique<memory_governor::account_state>(ctx, std::move(shed))}
+{
+    memory_governor::local().add(*state_);
+}
+
+buffer_account::~buffer_account()
+{
+    reset();
+}
+
+buffer_account& buffer_account::operator=(buffer_account&& other) noexcept
+{
+    if (this != &other) {
+        reset();
+        state_ = std::move(other.state_);
+    }
+    return *this;
+}
+
+void buffer_account::reset()
+{
+    if (state_)
+        memory_governor::local().remove(*state_);
+    state_.reset();
+}
+
+void buffer_account::hold(std::size_t bytes)
+{
+    if (state_)
+        memory_governor::local().hold(*state_, bytes);
+}
+
+void buffer_account::release(std::size_t bytes)
+{
+    if (state_)
+        memory_governor::local().release(*state_, bytes);
+}
+
+void buffer_account::wait_for_drain(std::function<void()> resume)
+{
+    if (state_)
+        memory_governor::local().wait_for_drain(*state_, std::move(resume));
+    else
+        resume();
+}
@@ -0,0 +1,97 @@
+#ifndef MEMORY_GOVERNOR_H
+#define MEMORY_GOVERNOR_H
+
+#include <asio/io_context.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <vector>
+
+namespace net = asio;
+
+// Accounts relay bytes held in user space per session and process wide. A session over its
+// watermark takes in no more data until it drains, over the global budget the oldest sessions
+// whose consumer stopped draining are shed
+class memory_governor
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    struct options {
+        // Bytes a session may hold before its reads pause, zero - no limit
+        std::size_t session_watermark{0};
+        // Bytes all sessions may hold before slow consumers are shed, zero - no limit
+        std::size_t budget{0};
+        // A session holding bytes that drained nothing for this long is a slow consumer
+        std::chrono::milliseconds slow_after{5000};
+    };
+
+    struct account_state {
+        account_state(net::io_context& context, std::function<void()> on_shed)
+            : ctx{context}, shed{std::move(on_shed)} {}
+
+        net::io_context& ctx;
+        std::function<void()> shed;
+        std::size_t held{0};
+        clock::time_point drained{};
+        std::vector<std::function<void()>> drain_waiters;
+        bool shedding{false};
+        std::list<account_state*>::iterator position;
+    };
+
+    // Must be called before any io thread starts relaying
+    static void configure(const options& opts);
+    static memory_governor& local();
+
+    [[nodiscard]] static std::size_t buffered() { return buffered_.load(std::memory_order_relaxed); }
+    [[nodiscard]] static bool over_watermark(const account_state& account);
+
+    void add(account_state& account);
+    void remove(account_state& account);
+    void hold(account_state& account, std::size_t bytes);
+    void release(account_state& account, std::size_t bytes);
+    void wait_for_drain(account_state& account, std::function<void()> resume);
+
+private:
+    void shed_slow_consumers();
+
+    static options options_;
+    static std::atomic<std::size_t> buffered_;
+
+    // Oldest first, shedding starts from the front
+    std::list<account_state*> accounts_;
+    std::size_t shedding_bytes_{0};
+};
+
+// Bytes one session holds, moves with the session and gives them back when destroyed
+class buffer_account
+{
+public:
+    buffer_account() = default;
+    // shed stops the session, it runs from the io context, never from inside hold
+    buffer_account(net::io_context& ctx, std::function<void()> shed);
+    ~buffer_account();
+
+    buffer_account(buffer_account&& other) noexcept = default;
+    buffer_account& operator=(buffer_account&& other) noexcept;
+
+    void hold(std::size_t bytes);
+    void release(std::size_t bytes);
+
+    [[nodiscard]] std::size_t held() const { return state_ ? state_->held : 0; }
+    [[nodiscard]] bool below_watermark() const { return !state_ || !memory_governor::over_watermark(*state_); }
+
+    // Runs resume once the session drained to half its watermark
+    void wait_for_drain(std::function<void()> resume);
+
+private:
+    void reset();
+
+    std::unique_ptr<memory_governor::account_state> state_;
+};
+
+#endif // MEMORY_GOVERNOR_H
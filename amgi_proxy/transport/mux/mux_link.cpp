@@ -0,0 +1,288 @@
+#include "mux_link.h"
+#include "mux_stream.h"
+#include "transport/admission_control.h"
+#include "logger/logger.h"
+#include "metrics/metrics.h"
+
+#include <boost/format.hpp>
+
+using fmt = boost::format;
+using logger = logging::logger;
+
+namespace
+{
+    constexpr auto kKeepaliveInterval = std::chrono::seconds(15);
+    // A link that stayed silent this long, pings included, is dead
+    constexpr auto kDeadInterval = 3 * kKeepaliveInterval;
+
+    auto& g_links = metrics::make_gauge("mux.links");
+    auto& g_channels = metrics::make_gauge("mux.channels");
+    auto& g_opened = metrics::make_counter("mux.channels_opened");
+    auto& g_refused = metrics::make_counter("mux.channels_refused");
+    auto& g_protocol_errors = metrics::make_counter("mux.protocol_errors");
+}
+
+mux_link::mux_link(server_stream_ptr transport, stream_manager_ptr backend, std::function<int()> next_id)
+    : transport_{std::move(transport)}
+    , backend_{std::move(backend)}
+    , next_id_{std::move(next_id)}
+    , written_bytes_{0}
+    , writing_{false}
+    , closed_{false}
+    , keepalive_timer_{transport_->context()}
+    , last_received_{clock::now()}
+{
+    g_links.add(1);
+}
+
+mux_link::~mux_link()
+{
+    g_links.sub(1);
+}
+
+void mux_link::start()
+{
+    logger::debug((fmt("[%1%] tls link switched to multiplexed mode") % transport_->id()).str());
+    // A tunnel client that stopped reading is shed like any slow session
+    buffers_ = buffer_account{transport_->context(), [weak{weak_from_this()}] {
+        if (auto link = weak.lock())
+            link->fail(net::error::timed_out);
+    }};
+
+    transport_->start();
+    arm_keepalive();
+}
+
+net::ip::address mux_link::local_address() const
+{
+    return transport_ ? transport_->local_address() : net::ip::address{};
+}
+
+void mux_link::send_data(std::uint32_t channel, const std::uint8_t* data, std::size_t size)
+{
+    send_frame(mux::frame_type::data, channel, data, size);
+}
+
+void mux_link::send_window(std::uint32_t channel, std::uint32_t increment)
+{
+    std::uint8_t payload[4];
+    mux::write_u32(payload, increment);
+    send_frame(mux::frame_type::window, channel, payload, sizeof(payload));
+}
+
+void mux_link::close_channel(std::uint32_t channel, bool notify_peer)
+{
+    if (channels_.erase(channel))
+        g_channels.sub(1);
+
+    if (notify_peer)
+        send_frame(mux::frame_type::close, channel, nullptr, 0);
+}
+
+void mux_link::stop(stream_ptr /*stream*/)
+{
+    fail(net::error::eof);
+}
+
+void mux_link::stop(int /*id*/)
+{
+    fail(net::error::eof);
+}
+
+void mux_link::on_close(stream_ptr /*stream*/)
+{
+    fail(net::error::eof);
+}
+
+void mux_link::on_accept(server_stream_ptr /*stream*/)
+{
+}
+
+void mux_link::on_read(io_buffer buffer, server_stream_ptr /*stream*/)
+{
+    last_received_ = clock::now();
+    input_.insert(input_.end(), buffer.begin(), buffer.end());
+    handle_frames();
+
+    // Channels pace themselves with their windows, the link itself always reads
+    if (!closed_)
+        transport_->read();
+}
+
+void mux_link::on_write(io_buffer /*buffer*/, server_stream_ptr /*stream*/)
+{
+    buffers_.release(std::exchange(written_bytes_, 0));
+    writing_ = false;
+    flush();
+}
+
+void mux_link::on_error(net::error_code ec, server_stream_ptr /*stream*/)
+{
+    fail(ec);
+}
+
+void mux_link::read_server(int /*id*/) {}
+void mux_link::defer_read_server(int /*id*/, std::chrono::steady_clock::duration /*delay*/) {}
+void mux_link::write_server(int /*id*/, io_buffer /*buffer*/) {}
+
+void mux_link::on_connect(io_buffer /*buffer*/, client_stream_ptr /*stream*/) {}
+void mux_link::on_read(io_buffer /*buffer*/, client_stream_ptr /*stream*/) {}
+void mux_link::on_write(io_buffer /*buffer*/, client_stream_ptr /*stream*/) {}
+void mux_link::on_error(net::error_code /*ec*/, client_stream_ptr /*stream*/) {}
+void mux_link::read_client(int /*id*/) {}
+void mux_link::defer_read_client(int /*id*/, std::chrono::steady_clock::duration /*delay*/) {}
+void mux_link::write_client(int /*id*/, io_buffer /*buffer*/) {}
+void mux_link::connect(int /*id*/, std::string /*host*/, std::string /*service*/, io_buffer /*early_data*/) {}
+
+void mux_link::handle_frames()
+{
+    std::size_t offset{0};
+    while (!closed_) {
+        const auto header = mux::parse_frame(input_.data() + offset, input_.size() - offset);
+        if (!header)
+            break;
+
+        handle_frame(*header, input_.data() + offset + mux::header_size);
+        offset += mux::header_size + header->length;
+    }
+
+    if (!closed_)
+        input_.erase(input_.begin(), input_.begin() + static_cast<std::ptrdiff_t>(offset));
+}
+
+void mux_link::handle_frame(const mux::frame_header& header, const std::uint8_t* payload)
+{
+    const auto it = channels_.find(header.channel);
+    switch (header.type) {
+    case mux::frame_type::open:
+        if (it != channels_.end()) {
+            g_protocol_errors.add();
+            fail(net::error::invalid_argument);
+            return;
+        }
+        open_channel(header.channel, payload, header.length);
+        break;
+    case mux::frame_type::data:
+        // Data racing with our own close is dropped
+        if (it != channels_.end() && !it->second->deliver(payload, header.length)) {
+            logger::warning((fmt("[%1%] mux protocol: channel %2% overran its receive window") % transport_->id() % header.channel).str());
+            g_protocol_errors.add();
+            fail(net::error::invalid_argument);
+            return;
+        }
+        break;
+    case mux::frame_type::close:
+        if (it != channels_.end()) {
+            auto channel = it->second;
+            channels_.erase(it);
+            g_channels.sub(1);
+            channel->remote_closed(net::error::eof);
+        }
+        break;
+    case mux::frame_type::window:
+        if (header.length < 4) {
+            g_protocol_errors.add();
+            fail(net::error::invalid_argument);
+            return;
+        }
+        if (it != channels_.end())
+            it->second->add_window(mux::read_u32(payload));
+        break;
+    case mux::frame_type::ping:
+        send_frame(mux::frame_type::pong, header.channel, payload, header.length);
+        break;
+    case mux::frame_type::pong:
+        break;
+    default:
+        g_protocol_errors.add();
+        fail(net::error::invalid_argument);
+        return;
+    }
+}
+
+void mux_link::open_channel(std::uint32_t channel, const std::uint8_t* payload, std::size_t size)
+{
+    // Same limits as a listener, a channel is refused where an accept would be paused
+    if (!admission_control::get().can_accept()) {
+        g_refused.add();
+        send_frame(mux::frame_type::close, channel, nullptr, 0);
+        return;
+    }
+
+    net::error_code ec;
+    auto client = net::ip::make_address(std::string{payload, payload + size}, ec);
+    if (ec)
+        client = transport_->remote_address();
+
+    auto stream = make_ref<mux_stream>(backend_, next_id_(), transport_->context(), shared_from_this(), channel, client);
+    channels_.emplace(channel, stream);
+    g_channels.add(1);
+    g_opened.add();
+
+    backend_->on_accept(stream);
+}
+
+void mux_link::send_frame(mux::frame_type type, std::uint32_t channel, const std::uint8_t* payload, std::size_t size)
+{
+    if (closed_)
+        return;
+
+    const auto queued = output_.size();
+    mux::append_frame(output_, type, channel, payload, size);
+    buffers_.hold(output_.size() - queued);
+    flush();
+}
+
+void mux_link::flush()
+{
+    if (writing_ || output_.empty() || closed_)
+        return;
+
+    // Everything queued since the last write goes out together
+    writing_ = true;
+    written_bytes_ = output_.size();
+    transport_->write(std::exchange(output_, {}));
+}
+
+void mux_link::arm_keepalive()
+{
+    keepalive_timer_.expires_after(kKeepaliveInterval);
+    keepalive_timer_.async_wait(
+        [this, self{shared_from_this()}](const net::error_code& ec) {
+            if (ec || closed_)
+                return;
+
+            if (clock::now() - last_received_ > kDeadInterval) {
+                logger::warning((fmt("[%1%] mux link timed out") % transport_->id()).str());
+                fail(net::error::timed_out);
+                return;
+            }
+
+            const std::uint8_t payload[8]{};
+            send_frame(mux::frame_type::ping, 0, payload, sizeof(payload));
+            arm_keepalive();
+        });
+}
+
+void mux_link::fail(const net::error_code& ec)
+{
+    if (closed_)
+        return;
+
+    closed_ = true;
+    keepalive_timer_.cancel();
+
+    logger::debug((fmt("[%1%] mux link closed: %2%, channels: %3%") % transport_->id() % ec.message() % channels_.size()).str());
+
+    auto channels = std::move(channels_);
+    channels_.clear();
+    g_channels.sub(static_cast<std::int64_t>(channels.size()));
+    for (auto& [id, channel] : channels)
+        channel->remote_closed(ec);
+
+    buffers_ = buffer_account{};
+
+    // The transport holds this link as its manager, dropping it here breaks the cycle
+    auto transport = std::move(transport_);
+    transport->stop();
+}
@@ -0,0 +1,96 @@
+#ifndef MUX_LINK_H
+#define MUX_LINK_H
+
+#include "transport/stream_manager.h"
+#include "common/mux_frame.h"
+#include "transport/memory_governor.h"
+
+#include <asio.hpp>
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+
+namespace net = asio;
+
+class mux_stream;
+
+// A long lived tunnel connection carrying many client connections. It owns the
+// transport stream and hands every channel opened by the tunnel to the backend
+// stream manager as a regular server stream
+class mux_link final
+    : public stream_manager
+    , public std::enable_shared_from_this<mux_link>
+{
+public:
+    mux_link(server_stream_ptr transport, stream_manager_ptr backend, std::function<int()> next_id);
+    ~mux_link();
+
+    mux_link(const mux_link& other) = delete;
+    mux_link& operator=(const mux_link& other) = delete;
+
+    void start();
+
+    net::ip::address local_address() const;
+
+    // Channel side
+    void send_data(std::uint32_t channel, const std::uint8_t* data, std::size_t size);
+    void send_window(std::uint32_t channel, std::uint32_t increment);
+    void close_channel(std::uint32_t channel, bool notify_peer);
+
+    // Frames queued behind the transport, channels hold their write completions while it is over the watermark
+    buffer_account& buffers() { return buffers_; }
+
+    // Transport side, the only stream this manager drives
+    void stop(stream_ptr stream) override;
+    void stop(int id) override;
+    void on_close(stream_ptr stream) override;
+
+    void on_accept(server_stream_ptr stream) override;
+    void on_read(io_buffer buffer, server_stream_ptr stream) override;
+    void on_write(io_buffer buffer, server_stream_ptr stream) override;
+    void on_error(net::error_code ec, server_stream_ptr stream) override;
+    void read_server(int id) override;
+    void defer_read_server(int id, std::chrono::steady_clock::duration delay) override;
+    void write_server(int id, io_buffer buffer) override;
+
+    void on_connect(io_buffer buffer, client_stream_ptr stream) override;
+    void on_read(io_buffer buffer, client_stream_ptr stream) override;
+    void on_write(io_buffer buffer, client_stream_ptr stream) override;
+    void on_error(net::error_code ec, client_stream_ptr stream) override;
+    void read_client(int id) override;
+    void defer_read_client(int id, std::chrono::steady_clock::duration delay) override;
+    void write_client(int id, io_buffer buffer) override;
+    void connect(int id, std::string host, std::string service, io_buffer early_data) override;
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    void handle_frames();
+    void handle_frame(const mux::frame_header& header, const std::uint8_t* payload);
+    void open_channel(std::uint32_t channel, const std::uint8_t* payload, std::size_t size);
+    void send_frame(mux::frame_type type, std::uint32_t channel, const std::uint8_t* payload, std::size_t size);
+    void flush();
+    void arm_keepalive();
+    void fail(const net::error_code& ec);
+
+    server_stream_ptr transport_;
+    stream_manager_ptr backend_;
+    std::function<int()> next_id_;
+    std::unordered_map<std::uint32_t, ref_ptr<mux_stream>> channels_;
+
+    io_buffer input_;
+    io_buffer output_;
+    std::size_t written_bytes_;
+    buffer_account buffers_;
+    bool writing_;
+    bool closed_;
+
+    net::steady_timer keepalive_timer_;
+    clock::time_point last_received_;
+};
+
+using mux_link_ptr = std::shared_ptr<mux_link>;
+
+#endif // MUX_LINK_H
@@ -0,0 +1,180 @@
+#include "mux_stream.h"
+#include "common/mux_frame.h"
+#include "mux_link.h"
+#include "transport/stream_manager.h"
+#include "logger/logger.h"
+
+#include <boost/format.hpp>
+
+#include <algorithm>
+
+using fmt = boost::format;
+using logger = logging::logger;
+
+mux_stream::mux_stream(const stream_manager_ptr& ptr, int id, net::io_context& ctx, const std::shared_ptr<mux_link>& link, std::uint32_t channel, net::ip::address client)
+    : server_stream{ptr, id}
+    , ctx_{ctx}
+    , link_{link}
+    , channel_{channel}
+    , client_{std::move(client)}
+    , local_{link->local_address()}
+    , consumed_{0}
+    , receive_window_{mux::initial_window}
+    , read_pending_{false}
+    , outbound_offset_{0}
+    , send_window_{mux::initial_window}
+    , write_pending_{false}
+    , drain_pending_{false}
+    , closed_{false}
+    , remote_closed_{false}
+{}
+
+mux_stream::~mux_stream()
+{
+    logger::trace((fmt("[%1%] mux stream closed, channel %2%") % id() % channel_).str());
+}
+
+net::io_context& mux_stream::context() { return ctx_; }
+
+net::ip::address mux_stream::remote_address() const { return client_; }
+
+net::ip::address mux_stream::local_address() const { return local_; }
+
+bool mux_stream::deliver(const std::uint8_t* data, std::size_t size)
+{
+    // The window is all that bounds inbound_, a peer ignoring it would grow it without limit
+    if (static_cast<std::int64_t>(size) > receive_window_)
+        return false;
+
+    receive_window_ -= static_cast<std::int64_t>(size);
+    inbound_.insert(inbound_.end(), data, data + size);
+    try_deliver();
+    return true;
+}
+
+void mux_stream::add_window(std::uint32_t increment)
+{
+    send_window_ += increment;
+    if (write_pending_)
+        write_frames();
+}
+
+void mux_stream::remote_closed(const net::error_code& ec)
+{
+    remote_closed_ = true;
+    close_ec_ = ec;
+    try_deliver();
+
+    // A write waiting for window will never get it
+    if (write_pending_) {
+        write_pending_ = false;
+        net::post(ctx_, [this, self{ref_from_this()}] { manager().on_error(close_ec_, ref_from_this()); });
+    }
+}
+
+void mux_stream::do_start()
+{
+    logger::debug((fmt("[%1%] incoming mux channel %2% from client: [%3%]") % id() % channel_ % client_.to_string()).str());
+    do_read();
+}
+
+void mux_stream::do_stop()
+{
+    if (closed_)
+        return;
+
+    closed_ = true;
+    if (auto link = link_.lock())
+        link->close_channel(channel_, !remote_closed_);
+}
+
+void mux_stream::do_read()
+{
+    read_pending_ = true;
+    try_deliver();
+}
+
+void mux_stream::do_write(io_buffer event)
+{
+    outbound_ = std::move(event);
+    outbound_offset_ = 0;
+    write_pending_ = true;
+    write_frames();
+}
+
+void mux_stream::try_deliver()
+{
+    if (!read_pending_ || closed_)
+        return;
+
+    if (!inbound_.empty()) {
+        // Relay buffers downstream are fixed size, hand over at most one of them
+        const auto size = std::min<std::size_t>(inbound_.size(), max_buffer_size);
+        io_buffer event{inbound_.begin(), inbound_.begin() + static_cast<std::ptrdiff_t>(size)};
+        inbound_.erase(inbound_.begin(), inbound_.begin() + static_cast<std::ptrdiff_t>(size));
+        read_pending_ = false;
+
+        // Grant the window back in batches, not per read
+        consumed_ += static_cast<std::uint32_t>(size);
+        if (consumed_ >= mux::initial_window / 2) {
+            if (auto link = link_.lock())
+                link->send_window(channel_, consumed_);
+            receive_window_ += consumed_;
+            consumed_ = 0;
+        }
+
+        net::post(ctx_, [this, self{ref_from_this()}, event{std::move(event)}]() mutable {
+            manager().on_read(std::move(event), ref_from_this());
+        });
+        return;
+    }
+
+    if (remote_closed_) {
+        read_pending_ = false;
+        net::post(ctx_, [this, self{ref_from_this()}] { manager().on_error(close_ec_, ref_from_this()); });
+    }
+}
+
+void mux_stream::write_frames()
+{
+    auto link = link_.lock();
+    if (!link || remote_closed_)
+        return;
+
+    while (outbound_offset_ < outbound_.size() && send_window_ > 0) {
+        const auto size = std::min({outbound_.size() - outbound_offset_, mux::max_payload, static_cast<std::size_t>(send_window_)});
+        link->send_data(channel_, outbound_.data() + outbound_offset_, size);
+        outbound_offset_ += size;
+        send_window_ -= static_cast<std::int64_t>(size);
+    }
+
+    // Completion waits for window, which is what paces a fast sender to a slow tunnel client
+    if (outbound_offset_ < outbound_.size())
+        return;
+
+    outbound_.clear();
+    outbound_offset_ = 0;
+
+    // Frames queued on the link behind a slow transport count against the watermark as well
+    if (!link->buffers().below_watermark()) {
+        if (!drain_pending_) {
+            drain_pending_ = true;
+            link->buffers().wait_for_drain([this, self{ref_from_this()}] {
+                drain_pending_ = false;
+                complete_write();
+            });
+        }
+        return;
+    }
+
+    complete_write();
+}
+
+void mux_stream::complete_write()
+{
+    if (!write_pending_)
+        return;
+
+    write_pending_ = false;
+    net::post(ctx_, [this, self{ref_from_this()}] { manager().on_write(io_buffer{}, ref_from_this()); });
+}
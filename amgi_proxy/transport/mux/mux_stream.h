@@ -0,0 +1,67 @@
+#ifndef MUX_STREAM_H
+#define MUX_STREAM_H
+
+#include "transport/server_stream.h"
+
+#include <asio.hpp>
+
+#include <cstdint>
+#include <memory>
+
+namespace net = asio;
+
+class mux_link;
+
+// One logical client connection carried by a multiplexed tunnel link, the proxy
+// sessions see it as any other accepted stream
+class mux_stream final : public server_stream
+{
+public:
+    mux_stream(const stream_manager_ptr& ptr, int id, net::io_context& ctx, const std::shared_ptr<mux_link>& link, std::uint32_t channel, net::ip::address client);
+    ~mux_stream() override;
+
+    net::io_context& context() override;
+    net::ip::address remote_address() const override;
+    net::ip::address local_address() const override;
+
+    // Called by the link, false when the peer sent beyond the window it was granted
+    [[nodiscard]] bool deliver(const std::uint8_t* data, std::size_t size);
+    void add_window(std::uint32_t increment);
+    void remote_closed(const net::error_code& ec);
+
+private:
+    void do_start() final;
+    void do_stop() final;
+    void do_read() final;
+    void do_write(io_buffer event) final;
+
+    void try_deliver();
+    void write_frames();
+    void complete_write();
+
+    net::io_context& ctx_;
+    std::weak_ptr<mux_link> link_;
+    std::uint32_t channel_;
+    net::ip::address client_;
+    net::ip::address local_;
+
+    // Received but not yet handed to the session
+    io_buffer inbound_;
+    // Handed to the session and not yet granted back to the peer
+    std::uint32_t consumed_;
+    // Bytes the peer may still send before it has to wait for a grant
+    std::int64_t receive_window_;
+    bool read_pending_;
+
+    io_buffer outbound_;
+    std::size_t outbound_offset_;
+    std::int64_t send_window_;
+    bool write_pending_;
+    bool drain_pending_;
+
+    bool closed_;
+    bool remote_closed_;
+    net::error_code close_ec_;
+};
+
+#endif // MUX_STREAM_H
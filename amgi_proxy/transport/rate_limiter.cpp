@@ -0,0 +1,169 @@
+#include "rate_limiter.h"
+
+#include <algorithm>
+
+namespace
+{
+    // Smallest amount of global credit a thread leases at once, keeps the shared pool lock cold
+    constexpr std::int64_t kMinLease = 0x10000;
+
+    template <typename Duration>
+    Duration to_delay(double debt, double rate)
+    {
+        if (debt <= 0 || rate <= 0)
+            return Duration::zero();
+
+        const std::chrono::duration<double> seconds{debt / rate};
+        return std::chrono::duration_cast<Duration>(seconds);
+    }
+}
+
+token_bucket::token_bucket(std::uint64_t rate, std::uint64_t burst)
+    : rate_{static_cast<double>(rate)}
+    , burst_{static_cast<double>(std::max(burst, rate))}
+    , tokens_{burst_}
+    , last_refill_{clock::now()}
+{}
+
+token_bucket::clock::duration token_bucket::consume(std::size_t bytes, clock::time_point now)
+{
+    if (unlimited())
+        return clock::duration::zero();
+
+    const std::chrono::duration<double> elapsed{now - last_refill_};
+    tokens_ = std::min(burst_, tokens_ + elapsed.count() * rate_);
+    last_refill_ = now;
+
+    tokens_ -= static_cast<double>(bytes);
+    return to_delay<clock::duration>(-tokens_, rate_);
+}
+
+rate_limiter::options rate_limiter::options_{};
+rate_limiter::shared_pool rate_limiter::global_pool_{};
+
+void rate_limiter::shared_pool::reset(std::uint64_t rate, std::uint64_t burst)
+{
+    std::lock_guard lock{mutex_};
+    rate_ = static_cast<double>(rate);
+    burst_ = static_cast<double>(std::max(burst, rate));
+    tokens_ = burst_;
+    last_refill_ = clock::now();
+}
+
+void rate_limiter::shared_pool::refill(clock::time_point now)
+{
+    const std::chrono::duration<double> elapsed{now - last_refill_};
+    if (elapsed.count() > 0) {
+        tokens_ = std::min(burst_, tokens_ + elapsed.count() * rate_);
+        last_refill_ = now;
+    }
+}
+
+std::int64_t rate_limiter::shared_pool::lease(std::int64_t wanted, clock::time_point now)
+{
+    std::lock_guard lock{mutex_};
+    refill(now);
+
+    const auto granted = std::min(static_cast<double>(wanted), std::max(tokens_, 0.0));
+    tokens_ -= granted;
+    return static_cast<std::int64_t>(granted);
+}
+
+void rate_limiter::shared_pool::give_back(std::int64_t tokens)
+{
+    std::lock_guard lock{mutex_};
+    tokens_ = std::min(burst_, tokens_ + static_cast<double>(tokens));
+}
+
+void rate_limiter::configure(const options& opts)
+{
+    options_ = opts;
+    global_pool_.reset(opts.global_rate, opts.global_rate);
+}
+
+rate_limiter& rate_limiter::local()
+{
+    static thread_local rate_limiter instance;
+    return instance;
+}
+
+bool rate_limiter::enabled() const
+{
+    return options_.session_rate || options_.client_rate || options_.global_rate;
+}
+
+token_bucket rate_limiter::make_session_bucket() const
+{
+    return token_bucket{options_.session_rate, options_.session_rate};
+}
+
+token_bucket_ptr rate_limiter::client_bucket(const net::ip::address& address)
+{
+    if (!options_.client_rate)
+        return {};
+
+    net::error_code ignored_ec;
+    auto& entry = clients_[address.to_string(ignored_ec)];
+    if (auto bucket = entry.lock())
+        return bucket;
+
+    auto bucket = std::make_shared<token_bucket>(options_.client_rate, options_.client_rate);
+    entry = bucket;
+    return bucket;
+}
+
+rate_limiter::clock::duration rate_limiter::consume_global(std::size_t bytes, clock::time_point now)
+{
+    if (now - last_rebalance_ >= options_.rebalance_interval)
+        rebalance(now);
+
+    if (!options_.global_rate)
+        return clock::duration::zero();
+
+    global_credit_ -= static_cast<std::int64_t>(bytes);
+    if (global_credit_ < 0)
+        global_credit_ += global_pool_.lease(std::max(kMinLease, -global_credit_), now);
+
+    return to_delay<clock::duration>(static_cast<double>(-global_credit_), static_cast<double>(options_.global_rate));
+}
+
+void rate_limiter::rebalance(clock::time_point now)
+{
+    last_rebalance_ = now;
+
+    // Hand unused credit back so idle threads don't sit on the global budget
+    if (global_credit_ > kMinLease) {
+        global_pool_.give_back(global_credit_ - kMinLease);
+        global_credit_ = kMinLease;
+    }
+
+    for (auto it = clients_.begin(); it != clients_.end();) {
+        if (it->second.expired())
+            it = clients_.erase(it);
+        else
+            ++it;
+    }
+}
+
+session_limiter::session_limiter(const net::ip::address& client)
+{
+    auto& limiter = rate_limiter::local();
+    enabled_ = limiter.enabled();
+    if (enabled_) {
+        session_ = limiter.make_session_bucket();
+        client_ = limiter.client_bucket(client);
+    }
+}
+
+session_limiter::clock::duration session_limiter::consume(std::size_t bytes)
+{
+    if (!enabled_)
+        return clock::duration::zero();
+
+    const auto now = clock::now();
+    auto delay = session_.consume(bytes, now);
+    if (client_)
+        delay = std::max(delay, client_->consume(bytes, now));
+
+    return std::max(delay, rate_limiter::local().consume_global(bytes, now));
+}
@@ -0,0 +1,106 @@
+#ifndef RATE_LIMITER_H
+#define RATE_LIMITER_H
+
+#include <asio/ip/address.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace net = asio;
+
+class token_bucket
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    token_bucket() = default;
+    token_bucket(std::uint64_t rate, std::uint64_t burst);
+
+    // Takes bytes that have already been read; the bucket may go into debt,
+    // the returned delay is the time until the debt is paid off
+    clock::duration consume(std::size_t bytes, clock::time_point now);
+
+    [[nodiscard]] bool unlimited() const { return rate_ == 0; }
+
+private:
+    double rate_{0};
+    double burst_{0};
+    double tokens_{0};
+    clock::time_point last_refill_{};
+};
+
+using token_bucket_ptr = std::shared_ptr<token_bucket>;
+
+class rate_limiter
+{
+public:
+    using clock = token_bucket::clock;
+
+    struct options {
+        std::uint64_t session_rate{0};
+        std::uint64_t client_rate{0};
+        std::uint64_t global_rate{0};
+        std::chrono::milliseconds rebalance_interval{100};
+    };
+
+    // Must be called before any io thread starts relaying
+    static void configure(const options& opts);
+    static rate_limiter& local();
+
+    [[nodiscard]] bool enabled() const;
+
+    token_bucket make_session_bucket() const;
+    token_bucket_ptr client_bucket(const net::ip::address& address);
+
+    clock::duration consume_global(std::size_t bytes, clock::time_point now);
+
+private:
+    class shared_pool
+    {
+    public:
+        void reset(std::uint64_t rate, std::uint64_t burst);
+        std::int64_t lease(std::int64_t wanted, clock::time_point now);
+        void give_back(std::int64_t tokens);
+
+    private:
+        void refill(clock::time_point now);
+
+        std::mutex mutex_;
+        double rate_{0};
+        double burst_{0};
+        double tokens_{0};
+        clock::time_point last_refill_{};
+    };
+
+    void rebalance(clock::time_point now);
+
+    static options options_;
+    static shared_pool global_pool_;
+
+    std::int64_t global_credit_{0};
+    clock::time_point last_rebalance_{};
+    std::unordered_map<std::string, std::weak_ptr<token_bucket>> clients_;
+};
+
+class session_limiter
+{
+public:
+    using clock = token_bucket::clock;
+
+    session_limiter() = default;
+    explicit session_limiter(const net::ip::address& client);
+
+    // Accounts relayed bytes, returns how long the next read of that direction must wait
+    clock::duration consume(std::size_t bytes);
+
+private:
+    bool enabled_{false};
+    token_bucket session_;
+    token_bucket_ptr client_;
+};
+
+#endif // RATE_LIMITER_H
@@ -0,0 +1,114 @@
+#ifndef REF_COUNTED_H
+#define REF_COUNTED_H
+
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+
+// Base of objects that live on one io thread. The reference count is a plain integer: a handle
+// may be moved to another thread and back, copying or dropping it there is a data race
+class ref_counted
+{
+public:
+    ref_counted(const ref_counted& other) = delete;
+    ref_counted& operator=(const ref_counted& other) = delete;
+
+protected:
+    ref_counted() = default;
+    virtual ~ref_counted() = default;
+
+private:
+    template <typename T>
+    friend class ref_ptr;
+
+    void add_ref() const noexcept { ++refs_; }
+
+    void release() const noexcept
+    {
+        if (--refs_ == 0)
+            delete this;
+    }
+
+    mutable std::size_t refs_{0};
+};
+
+// Owning handle of a ref_counted object; the count lives in the object, so a handle
+// can be made from a plain this pointer at any time
+template <typename T>
+class ref_ptr
+{
+public:
+    ref_ptr() noexcept = default;
+    ref_ptr(std::nullptr_t) noexcept {}
+
+    explicit ref_ptr(T* ptr) noexcept
+        : ptr_{ptr}
+    {
+        if (ptr_)
+            ptr_->add_ref();
+    }
+
+    ref_ptr(const ref_ptr& other) noexcept
+        : ref_ptr{other.ptr_}
+    {}
+
+    ref_ptr(ref_ptr&& other) noexcept
+        : ptr_{std::exchange(other.ptr_, nullptr)}
+    {}
+
+    template <typename U, typename = std::enable_if_t<std::is_convertible_v<U*, T*>>>
+    ref_ptr(const ref_ptr<U>& other) noexcept
+        : ref_ptr{other.get()}
+    {}
+
+    template <typename U, typename = std::enable_if_t<std::is_convertible_v<U*, T*>>>
+    ref_ptr(ref_ptr<U>&& other) noexcept
+        : ptr_{other.detach()}
+    {}
+
+    ~ref_ptr()
+    {
+        if (ptr_)
+            ptr_->release();
+    }
+
+    ref_ptr& operator=(ref_ptr other) noexcept
+    {
+        std::swap(ptr_, other.ptr_);
+        return *this;
+    }
+
+    void reset() noexcept { ref_ptr{}.swap(*this); }
+    void swap(ref_ptr& other) noexcept { std::swap(ptr_, other.ptr_); }
+
+    // Gives up ownership without touching the count
+    T* detach() noexcept { return std::exchange(ptr_, nullptr); }
+
+    [[nodiscard]] T* get() const noexcept { return ptr_; }
+    T& operator*() const noexcept { return *ptr_; }
+    T* operator->() const noexcept { return ptr_; }
+    explicit operator bool() const noexcept { return ptr_ != nullptr; }
+
+private:
+    T* ptr_{nullptr};
+};
+
+template <typename T, typename U>
+bool operator==(const ref_ptr<T>& lhs, const ref_ptr<U>& rhs) noexcept { return lhs.get() == rhs.get(); }
+
+template <typename T, typename U>
+bool operator!=(const ref_ptr<T>& lhs, const ref_ptr<U>& rhs) noexcept { return lhs.get() != rhs.get(); }
+
+template <typename T>
+bool operator==(const ref_ptr<T>& lhs, std::nullptr_t) noexcept { return !lhs; }
+
+template <typename T>
+bool operator!=(const ref_ptr<T>& lhs, std::nullptr_t) noexcept { return static_cast<bool>(lhs); }
+
+template <typename T, typename... Args>
+ref_ptr<T> make_ref(Args&&... args)
+{
+    return ref_ptr<T>{new T(std::forward<Args>(args)...)};
+}
+
+#endif // REF_COUNTED_H
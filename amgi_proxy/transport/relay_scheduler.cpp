@@ -0,0 +1,110 @@
+#include "relay_scheduler.h"
+#include "metrics/metrics.h"
+
+#include <asio/post.hpp>
+
+#include <algorithm>
+
+namespace
+{
+    auto& g_deferred_reads = metrics::make_counter("relay.scheduler.deferred_reads");
+    auto& g_rounds = metrics::make_counter("relay.scheduler.rounds");
+    auto& g_waiting = metrics::make_gauge("relay.scheduler.waiting");
+}
+
+relay_scheduler::options relay_scheduler::options_{};
+
+void relay_scheduler::configure(const options& opts)
+{
+    options_ = opts;
+    options_.bulk_share = std::max<std::size_t>(options_.bulk_share, 1);
+}
+
+relay_scheduler& relay_scheduler::local()
+{
+    static thread_local relay_scheduler instance;
+    return instance;
+}
+
+std::int64_t relay_scheduler::quantum(const flow_state& flow)
+{
+    const auto bulk = flow.burst_bytes >= options_.bulk_bytes;
+    return static_cast<std::int64_t>(bulk ? std::max<std::size_t>(options_.quantum / options_.bulk_share, 1) : options_.quantum);
+}
+
+void relay_scheduler::charge(flow_state& flow, std::size_t bytes)
+{
+    const auto now = clock::now();
+
+    // A session coming back from idle is interactive again and starts with a full quantum
+    if (now - flow.last_active > options_.bulk_idle) {
+        flow.burst_bytes = 0;
+        flow.deficit = quantum(flow);
+    }
+
+    flow.last_active = now;
+    flow.burst_bytes += bytes;
+    flow.deficit -= static_cast<std::int64_t>(bytes);
+}
+
+void relay_scheduler::wait(ref_ptr<flow_state> flow, std::function<void()> resume)
+{
+    g_deferred_reads.add();
+    g_waiting.add(1);
+
+    auto& ctx = flow->ctx;
+    waiting_.push_back({std::move(flow), std::move(resume)});
+    if (round_posted_)
+        return;
+
+    round_posted_ = true;
+    net::post(ctx, [this] { run_round(); });
+}
+
+void relay_scheduler::run_round()
+{
+    round_posted_ = false;
+    ++round_id_;
+    g_rounds.add();
+
+    // Sessions that ask again while the round runs wait for the next one
+    round_.swap(waiting_);
+    while (!round_.empty()) {
+        auto entry = std::move(round_.front());
+        round_.pop_front();
+
+        // Both directions of a session may wait, the flow is credited once per round
+        auto& flow = *entry.flow;
+        if (flow.credited_round != round_id_) {
+            flow.credited_round = round_id_;
+            flow.deficit = std::min(flow.deficit + quantum(flow), quantum(flow));
+        }
+
+        if (flow.deficit > 0) {
+            g_waiting.sub(1);
+            entry.resume();
+        } else {
+            waiting_.push_back(std::move(entry));
+        }
+    }
+
+    if (!waiting_.empty() && !round_posted_) {
+        round_posted_ = true;
+        net::post(waiting_.front().flow->ctx, [this] { run_round(); });
+    }
+}
+
+relay_flow::relay_flow(net::io_context& ctx)
+{
+    if (!relay_scheduler::enabled())
+        return;
+
+    // Nothing relayed yet counts as coming back from idle, the flow starts with a full quantum
+    state_ = make_ref<relay_scheduler::flow_state>(ctx);
+    relay_scheduler::charge(*state_, 0);
+}
+
+void relay_flow::wait_for_credit(std::function<void()> resume)
+{
+    relay_scheduler::local().wait(state_, std::move(resume));
+}
@@ -0,0 +1,92 @@
+#ifndef RELAY_SCHEDULER_H
+#define RELAY_SCHEDULER_H
+
+#include "ref_counted.h"
+
+#include <asio/io_context.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+
+namespace net = asio;
+
+// Deficit round robin between the sessions of one io thread. A session spends its quantum on
+// relayed bytes; once it is used up the next read waits for a round, which runs after everything
+// already queued on the io context, so bulk transfers can't keep interactive sessions waiting
+class relay_scheduler
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    struct options {
+        // Bytes a session may relay per round, zero - no scheduling
+        std::size_t quantum{0};
+        // Bytes relayed without an idle gap after which a session counts as bulk
+        std::size_t bulk_bytes{0x100000};
+        std::chrono::milliseconds bulk_idle{100};
+        // Bulk sessions get this fraction of the quantum
+        std::size_t bulk_share{16};
+    };
+
+    struct flow_state : ref_counted {
+        explicit flow_state(net::io_context& context) : ctx{context} {}
+
+        net::io_context& ctx;
+        std::int64_t deficit{0};
+        std::size_t burst_bytes{0};
+        clock::time_point last_active{};
+        std::uint64_t credited_round{0};
+    };
+
+    // Must be called before any io thread starts relaying
+    static void configure(const options& opts);
+    static relay_scheduler& local();
+
+    [[nodiscard]] static bool enabled() { return options_.quantum > 0; }
+    static void charge(flow_state& flow, std::size_t bytes);
+
+    void wait(ref_ptr<flow_state> flow, std::function<void()> resume);
+
+private:
+    struct waiter {
+        ref_ptr<flow_state> flow;
+        std::function<void()> resume;
+    };
+
+    static std::int64_t quantum(const flow_state& flow);
+
+    void run_round();
+
+    static options options_;
+
+    std::deque<waiter> waiting_;
+    std::deque<waiter> round_;
+    std::uint64_t round_id_{0};
+    bool round_posted_{false};
+};
+
+// A session's share of the scheduler, both directions charge the same flow
+class relay_flow
+{
+public:
+    relay_flow() = default;
+    explicit relay_flow(net::io_context& ctx);
+
+    void charge(std::size_t bytes)
+    {
+        if (state_)
+            relay_scheduler::charge(*state_, bytes);
+    }
+
+    [[nodiscard]] bool has_credit() const { return !state_ || state_->deficit > 0; }
+
+    // Runs resume once a round gave the flow credit again
+    void wait_for_credit(std::function<void()> resume);
+
+private:
+    ref_ptr<relay_scheduler::flow_state> state_;
+};
+
+#endif // RELAY_SCHEDULER_H
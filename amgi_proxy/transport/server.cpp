@@ -1,38 +1,58 @@
 #include "server.h"
-#include "tcp_server_stream.h"
+#include "stream_factory.h"
+#include "socket_options.h"
+#include "io_loop.h"
 #include "logger/logger.h"
+#include "metrics/metrics.h"
 
 #include <charconv>
+#include <algorithm>
 #include <memory>
 
-server::server(const std::string &port, stream_manager_ptr proxy_backend)
-    : signals_(ctx_), acceptor_(ctx_), stream_id_(0), stream_manager_(proxy_backend)
+namespace
+{
+    constexpr auto kAcceptRetryInterval = std::chrono::milliseconds(50);
+
+    auto& g_accept_errors = metrics::make_counter("accept.errors");
+}
+
+server::server(const std::string &port, server_options options, stream_manager_ptr proxy_backend)
+    : signals_(ctx_), reload_signals_(ctx_), acceptor_(ctx_), accept_timer_(ctx_), options_(options), pending_accepts_(0), reporter_(ctx_, options.metrics_interval)
+    , stream_manager_(std::move(proxy_backend)), stream_id_(0)
 {
     configure_signals();
     async_wait_signals();
+    async_wait_reload_signals();
 
     std::uint16_t listen_port{0};
     std::from_chars(port.data(), port.data() + port.size(), listen_port);
 
     tcp::endpoint ep{tcp::endpoint(tcp::v4(), listen_port)};
     acceptor_.open(ep.protocol());
-    acceptor_.set_option(tcp::acceptor::reuse_address(true));
+    socket_options::apply(acceptor_, options_);
     acceptor_.bind(ep);
-    acceptor_.listen();
+    acceptor_.listen(options_.listen_backlog > 0 ? options_.listen_backlog : net::socket_base::max_listen_connections);
+    // reject_pending accepts on the raw descriptor and must never block
+    acceptor_.non_blocking(true);
 
     logging::logger::info("proxy server starts on port: " + port);
+    reporter_.start();
     start_accept();
 }
 
 void server::run() 
 {
-    ctx_.run();
+    io_loop::run(ctx_, options_.spin_budget);
 }
 
 void server::configure_signals() 
 {
     signals_.add(SIGINT);
     signals_.add(SIGTERM);
+#if defined(SIGHUP)
+    if (options_.on_reload)
+        reload_signals_.add(SIGHUP);
+#endif
 }
 
 void server::async_wait_signals() 
@@ -41,17 +61,46 @@ void server::async_wait_signals()
         [this](net::error_code /*ec*/, int /*signno*/) {
             logging::logger::info("proxy server stopping");
             acceptor_.close();
+            accept_timer_.cancel();
+            reload_signals_.cancel();
+            reporter_.stop();
             ctx_.stop();
             logging::logger::info("proxy server stopped");
         });
 }
 
+void server::async_wait_reload_signals()
+{
+    reload_signals_.async_wait(
+        [this](const net::error_code& ec, int /*signo*/) {
+            if (ec)
+                return;
+
+            logging::logger::info("proxy server reloading configuration");
+            options_.on_reload();
+            async_wait_reload_signals();
+        });
+}
+
 void server::start_accept() 
 {
-    auto new_stream = std::make_shared<tcp_server_stream>(stream_manager_, ++stream_id_, ctx_);
+    while (pending_accepts_ < std::max<std::size_t>(options_.accept_concurrency, 1)) {
+        if (!admission_control::get().can_accept()) {
+            pause_accept();
+            return;
+        }
+
+        accept_one();
+    }
+}
+
+void server::accept_one()
+{
+    ++pending_accepts_;
     acceptor_.async_accept(
-        new_stream->socket(),
-        [this, new_stream](const net::error_code &ec) {
+        [this](const net::error_code& ec, tcp::socket socket) {
+            --pending_accepts_;
+
             if (!acceptor_.is_open()) {
                 logging::logger::trace("proxy server acceptor is closed");
                 if (ec) {
@@ -62,13 +111,44 @@ void server::start_accept()
                 return;
             }
 
-            if (!ec)
-                stream_manager_->on_accept(new_stream);
+            if (ec) {
+                handle_accept_error(ec);
+                return;
+            }
 
+            // The stream and its buffers only come to life once there is a client to serve
+            stream_manager_->on_accept(stream_factory::make_server(stream_manager_, ++stream_id_, ctx_, std::move(socket), options_));
             start_accept();
         });
 }
 
+void server::pause_accept()
+{
+    accept_timer_.expires_after(kAcceptRetryInterval);
+    accept_timer_.async_wait(
+        [this](const net::error_code& ec) {
+            if (!ec && acceptor_.is_open())
+                start_accept();
+        });
+}
+
+void server::handle_accept_error(const net::error_code& ec)
+{
+    g_accept_errors.add();
+
+    // Out of descriptors: the pending connection stays in the backlog, re-arming right away would spin
+    if (ec == net::error::no_descriptors || ec == net::error::no_buffer_space || ec == net::error::no_memory) {
+        if (reserve_fd_.reject_pending(acceptor_))
+            logging::logger::warning("proxy server is out of descriptors, pending connections rejected");
+        pause_accept();
+        return;
+    }
+
+    // Anything else may persist as well (e.g. EPERM from a seccomp or LSM denial), never re-arm in a hot loop
+    logging::logger::trace("proxy server accept error: " + ec.message());
+    pause_accept();
+}
+
 server::~server() 
 {
     logging::logger::trace("proxy server stopped");
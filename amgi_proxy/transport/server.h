@@ -2,6 +2,9 @@
 #define SERVER_H
 
 #include "stream_manager.h"
+#include "server_options.h"
+#include "admission_control.h"
+#include "metrics/metrics_reporter.h"
 
 #include <asio.hpp>
 
@@ -10,7 +13,7 @@ namespace net = asio;
 
 class server {
 public:
-    explicit server(const std::string& port, stream_manager_ptr proxy_backend);
+    explicit server(const std::string& port, server_options options, stream_manager_ptr proxy_backend);
     virtual ~server();
 
     server(const server& other) = delete;
@@ -20,14 +23,24 @@ public:
 private:
     net::io_context ctx_;
     net::signal_set signals_;
+    net::signal_set reload_signals_;
     tcp::acceptor acceptor_;
+    net::steady_timer accept_timer_;
+    fd_reserve reserve_fd_;
+    server_options options_;
+    std::size_t pending_accepts_;
+    metrics::reporter reporter_;
     stream_manager_ptr stream_manager_;
     int stream_id_;
 
     void configure_signals();
     void async_wait_signals();
+    void async_wait_reload_signals();
 
     void start_accept();
+    void accept_one();
+    void pause_accept();
+    void handle_accept_error(const net::error_code& ec);
 };
 
 
@@ -0,0 +1,35 @@
+#ifndef SERVER_OPTIONS_H
+#define SERVER_OPTIONS_H
+
+#include "io_backend.h"
+#include "common/socket_profile.h"
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+
+struct server_options
+{
+    // Listen queue length, 0 selects the system maximum (SOMAXCONN)
+    int listen_backlog{0};
+    // Number of async_accept operations kept outstanding on the acceptor
+    std::size_t accept_concurrency{4};
+    // TCP_DEFER_ACCEPT timeout, connections surface only once the client has sent data
+    std::chrono::seconds defer_accept{0};
+    // TCP_FASTOPEN queue length for pending SYNs carrying data, 0 disables fast open on the listener
+    int fastopen_queue{0};
+    // Tuning for accepted connections, buffer sizes are set on the listener so they are inherited
+    socket_profile profile;
+    // Accepted plain TCP connections run on it, TLS ones always stay on the reactor
+    io_backend::kind backend{io_backend::kind::reactor};
+    // Low latency mode: the io thread polls without blocking for this long after its last event
+    // before it sleeps in the reactor again, zero - always block
+    std::chrono::microseconds spin_budget{0};
+
+    std::chrono::seconds metrics_interval{0};
+
+    // Invoked on SIGHUP to re-read configuration files
+    std::function<void()> on_reload;
+};
+
+#endif // SERVER_OPTIONS_H
@@ -5,19 +5,22 @@
 #include "stream.h"
 
 #include <asio/executor.hpp>
+#include <asio/ip/address.hpp>
 
 namespace net = asio;
 
-class server_stream
-    : public stream
-    , public std::enable_shared_from_this<server_stream>
+class server_stream;
+using server_stream_ptr = ref_ptr<server_stream>;
+
+class server_stream : public stream
 {
 public:
     server_stream(const stream_manager_ptr& smp, int id) : stream(smp, id) {}
+    server_stream_ptr ref_from_this() { return server_stream_ptr{this}; }
     virtual net::io_context& context() = 0;
+    virtual net::ip::address remote_address() const = 0;
+    virtual net::ip::address local_address() const = 0;
 };
 
-using server_stream_ptr = std::shared_ptr<server_stream>;
-
 
 #endif //SERVER_STREAM_H
@@ -0,0 +1,170 @@
+#include "socket_options.h"
+#include "logger/logger.h"
+
+#include <cerrno>
+
+#if !defined(_WIN32)
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif
+
+namespace
+{
+    template <typename Option, typename Socket>
+    void set_option(Socket& socket, const Option& option, std::string_view name)
+    {
+        net::error_code ec;
+        socket.set_option(option, ec);
+        if (ec)
+            logging::logger::warning(std::string{"failed to set socket option "} + name.data() + ": " + ec.message());
+    }
+}
+
+namespace socket_options
+{
+#if defined(TCP_DEFER_ACCEPT)
+    using defer_accept = net::detail::socket_option::integer<IPPROTO_TCP, TCP_DEFER_ACCEPT>;
+#endif
+#if defined(TCP_FASTOPEN)
+    using fastopen = net::detail::socket_option::integer<IPPROTO_TCP, TCP_FASTOPEN>;
+#endif
+#if defined(TCP_FASTOPEN_CONNECT)
+    using fastopen_connect = net::detail::socket_option::boolean<IPPROTO_TCP, TCP_FASTOPEN_CONNECT>;
+#endif
+    using socket_error = net::detail::socket_option::integer<SOL_SOCKET, SO_ERROR>;
+#if defined(TCP_NOTSENT_LOWAT)
+    using notsent_lowat = net::detail::socket_option::integer<IPPROTO_TCP, TCP_NOTSENT_LOWAT>;
+#endif
+#if defined(TCP_KEEPIDLE)
+    using keepalive_idle = net::detail::socket_option::integer<IPPROTO_TCP, TCP_KEEPIDLE>;
+    using keepalive_interval = net::detail::socket_option::integer<IPPROTO_TCP, TCP_KEEPINTVL>;
+    using keepalive_count = net::detail::socket_option::integer<IPPROTO_TCP, TCP_KEEPCNT>;
+#endif
+#if defined(TCP_USER_TIMEOUT)
+    using user_timeout = net::detail::socket_option::integer<IPPROTO_TCP, TCP_USER_TIMEOUT>;
+#endif
+#if defined(SO_BUSY_POLL)
+    using busy_poll = net::detail::socket_option::integer<SOL_SOCKET, SO_BUSY_POLL>;
+#endif
+#if defined(SO_PREFER_BUSY_POLL)
+    using prefer_busy_poll = net::detail::socket_option::boolean<SOL_SOCKET, SO_PREFER_BUSY_POLL>;
+#endif
+
+    template <typename Socket>
+    void set_buffers(Socket& socket, const socket_profile& profile)
+    {
+        if (profile.send_buffer > 0)
+            set_option(socket, net::socket_base::send_buffer_size(profile.send_buffer), "SO_SNDBUF");
+        if (profile.receive_buffer > 0)
+            set_option(socket, net::socket_base::receive_buffer_size(profile.receive_buffer), "SO_RCVBUF");
+    }
+
+    void apply(tcp::acceptor& acceptor, const server_options& options)
+    {
+        set_option(acceptor, tcp::acceptor::reuse_address(true), "SO_REUSEADDR");
+
+#if defined(TCP_DEFER_ACCEPT)
+        if (options.defer_accept.count() > 0)
+            set_option(acceptor, defer_accept(static_cast<int>(options.defer_accept.count())), "TCP_DEFER_ACCEPT");
+#endif
+
+#if defined(TCP_FASTOPEN)
+        if (options.fastopen_queue > 0)
+            set_option(acceptor, fastopen(options.fastopen_queue), "TCP_FASTOPEN");
+#else
+        if (options.fastopen_queue > 0)
+            logging::logger::warning("TCP_FASTOPEN is not supported on this platform");
+#endif
+
+        set_buffers(acceptor, options.profile);
+    }
+
+    void apply(tcp::socket& socket, const socket_profile& profile)
+    {
+        if (profile.no_delay)
+            set_option(socket, tcp::no_delay(true), "TCP_NODELAY");
+
+#if defined(TCP_NOTSENT_LOWAT)
+        if (profile.notsent_lowat > 0)
+            set_option(socket, notsent_lowat(profile.notsent_lowat), "TCP_NOTSENT_LOWAT");
+#endif
+
+        if (profile.keepalive_idle.count() > 0) {
+            set_option(socket, net::socket_base::keep_alive(true), "SO_KEEPALIVE");
+#if defined(TCP_KEEPIDLE)
+            set_option(socket, keepalive_idle(static_cast<int>(profile.keepalive_idle.count())), "TCP_KEEPIDLE");
+            if (profile.keepalive_interval.count() > 0)
+                set_option(socket, keepalive_interval(static_cast<int>(profile.keepalive_interval.count())), "TCP_KEEPINTVL");
+            if (profile.keepalive_count > 0)
+                set_option(socket, keepalive_count(profile.keepalive_count), "TCP_KEEPCNT");
+#endif
+        }
+
+#if defined(TCP_USER_TIMEOUT)
+        if (profile.user_timeout.count() > 0)
+            set_option(socket, user_timeout(static_cast<int>(profile.user_timeout.count())), "TCP_USER_TIMEOUT");
+#endif
+
+#if defined(SO_BUSY_POLL)
+        if (profile.busy_poll.count() > 0)
+            set_option(socket, busy_poll(static_cast<int>(profile.busy_poll.count())), "SO_BUSY_POLL");
+#endif
+#if defined(SO_PREFER_BUSY_POLL)
+        if (profile.prefer_busy_poll)
+            set_option(socket, prefer_busy_poll(true), "SO_PREFER_BUSY_POLL");
+#endif
+    }
+
+    void apply_buffers(tcp::socket& socket, const socket_profile& profile)
+    {
+        set_buffers(socket, profile);
+    }
+
+    bool enable_fastopen_connect(tcp::socket& socket)
+    {
+#if defined(TCP_FASTOPEN_CONNECT)
+        net::error_code ec;
+        socket.set_option(fastopen_connect(true), ec);
+        return !ec;
+#else
+        return false;
+#endif
+    }
+
+    bool syn_data_acked(tcp::socket& socket)
+    {
+        return syn_data_acked(socket.native_handle());
+    }
+
+    bool syn_data_acked(tcp::socket::native_handle_type fd)
+    {
+#if defined(TCPI_OPT_SYN_DATA)
+        tcp_info info{};
+        socklen_t length = sizeof(info);
+        if (::getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &length) != 0)
+            return false;
+        return info.tcpi_options & TCPI_OPT_SYN_DATA;
+#else
+        return false;
+#endif
+    }
+
+    net::error_code pending_error(tcp::socket& socket)
+    {
+        socket_error error;
+        net::error_code ec;
+        socket.get_option(error, ec);
+        if (ec)
+            return ec;
+        return {error.value(), net::error::get_system_category()};
+    }
+
+    net::error_code pending_error(tcp::socket::native_handle_type fd)
+    {
+        int error{0};
+        socklen_t length = sizeof(error);
+        if (::getsockopt(fd, SOL_SOCKET, SO_ERROR, reinterpret_cast<char*>(&error), &length) != 0)
+            return {errno, net::error::get_system_category()};
+        return {error, net::error::get_system_category()};
+    }
+}
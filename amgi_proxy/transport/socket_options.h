@@ -0,0 +1,35 @@
+#ifndef SOCKET_OPTIONS_H
+#define SOCKET_OPTIONS_H
+
+#include "server_options.h"
+
+#include <asio.hpp>
+
+namespace net = asio;
+using tcp = asio::ip::tcp;
+
+namespace socket_options
+{
+    // Options that must be in place on the listening socket before listen()
+    void apply(tcp::acceptor& acceptor, const server_options& options);
+
+    // Per-connection tuning of a connected socket, buffer sizes excluded
+    void apply(tcp::socket& socket, const socket_profile& profile);
+
+    // Buffer sizes have to be set before connect or listen for the window scale to follow them
+    void apply_buffers(tcp::socket& socket, const socket_profile& profile);
+
+    // Defers the SYN of an unconnected socket to its first write, false where unsupported
+    bool enable_fastopen_connect(tcp::socket& socket);
+
+    // Checks whether the handshake of a connected socket carried data in the SYN
+    bool syn_data_acked(tcp::socket& socket);
+
+    net::error_code pending_error(tcp::socket& socket);
+
+    // Same checks for a descriptor no longer owned by an asio socket
+    bool syn_data_acked(tcp::socket::native_handle_type fd);
+    net::error_code pending_error(tcp::socket::native_handle_type fd);
+}
+
+#endif // SOCKET_OPTIONS_H
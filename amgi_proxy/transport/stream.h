@@ -2,13 +2,16 @@
 #define STREAM_H
 
 #include "io_buffer.h"
+#include "ref_counted.h"
 
 #include <memory>
 
 class stream_manager;
 using stream_manager_ptr = std::shared_ptr<stream_manager>;
 
-class stream
+// Owned through intrusive handles that stay on the stream's io thread. The stream keeps its
+// manager alive, callers only borrow it for the duration of a call
+class stream : public ref_counted
 {
 public:
     enum {
@@ -19,7 +22,7 @@ public:
         : stream_manager_(std::move(smp)), id_(id) {
     }
 
-    virtual ~stream() = default;
+    ~stream() override = default;
 
     void start() { do_start(); }
     void stop() { do_stop(); }
@@ -28,8 +31,11 @@ public:
 
     [[nodiscard]] int id() const { return id_; }
 
+    // Hands the stream to another owner, e.g. a tls link turned into a multiplexed one
+    void rebind(stream_manager_ptr smp) { stream_manager_ = std::move(smp); }
+
 protected:
-    stream_manager_ptr manager() { return stream_manager_; }
+    stream_manager& manager() { return *stream_manager_; }
 
 private:
     virtual void do_start() = 0;
@@ -41,7 +47,7 @@ private:
     int id_;
 };
 
-using stream_ptr = std::shared_ptr<stream>;
+using stream_ptr = ref_ptr<stream>;
 
 
 
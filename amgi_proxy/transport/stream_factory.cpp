@@ -0,0 +1,30 @@
+#include "stream_factory.h"
+#include "tcp_server_stream.h"
+#include "tcp_client_stream.h"
+
+#if defined(AMGI_PROXY_IO_URING)
+#include "uring/uring_server_stream.h"
+#include "uring/uring_client_stream.h"
+#endif
+
+namespace stream_factory
+{
+    server_stream_ptr make_server(const stream_manager_ptr& ptr, int id, net::io_context& ctx, tcp::socket socket,
+                                  const server_options& options)
+    {
+#if defined(AMGI_PROXY_IO_URING)
+        if (options.backend == io_backend::kind::uring)
+            return make_ref<uring_server_stream>(ptr, id, ctx, std::move(socket), options.profile);
+#endif
+        return make_ref<tcp_server_stream>(ptr, id, ctx, std::move(socket), options.profile);
+    }
+
+    client_stream_ptr make_client(const stream_manager_ptr& ptr, int id, net::io_context& ctx, const client_options& options)
+    {
+#if defined(AMGI_PROXY_IO_URING)
+        if (options.backend == io_backend::kind::uring)
+            return make_ref<uring_client_stream>(ptr, id, ctx, options);
+#endif
+        return make_ref<tcp_client_stream>(ptr, id, ctx, options);
+    }
+}
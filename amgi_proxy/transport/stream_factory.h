@@ -0,0 +1,22 @@
+#ifndef STREAM_FACTORY_H
+#define STREAM_FACTORY_H
+
+#include "server_stream.h"
+#include "client_stream.h"
+#include "client_options.h"
+#include "server_options.h"
+
+#include <asio.hpp>
+
+namespace net = asio;
+using tcp = asio::ip::tcp;
+
+// Plain TCP streams on the configured io backend
+namespace stream_factory
+{
+    server_stream_ptr make_server(const stream_manager_ptr& ptr, int id, net::io_context& ctx, tcp::socket socket,
+                                  const server_options& options);
+    client_stream_ptr make_client(const stream_manager_ptr& ptr, int id, net::io_context& ctx, const client_options& options);
+}
+
+#endif // STREAM_FACTORY_H
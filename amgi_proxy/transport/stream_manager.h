@@ -4,6 +4,10 @@
 #include "server_stream.h"
 #include "client_stream.h"
 
+#include <asio/ip/udp.hpp>
+
+#include <chrono>
+
 class stream_manager
 {
 public:
@@ -18,6 +22,7 @@ public:
     virtual void on_write(io_buffer event, server_stream_ptr stream) = 0;
     virtual void on_error(net::error_code ec, server_stream_ptr stream) = 0;
     virtual void read_server(int id) = 0;
+    virtual void defer_read_server(int id, std::chrono::steady_clock::duration delay) = 0;
     virtual void write_server(int id, io_buffer event) = 0;
 
     // Active session interface
@@ -26,8 +31,13 @@ public:
     virtual void on_write(io_buffer event, client_stream_ptr stream) = 0;
     virtual void on_error(net::error_code ec, client_stream_ptr stream) = 0;
     virtual void read_client(int id) = 0;
+    virtual void defer_read_client(int id, std::chrono::steady_clock::duration delay) = 0;
     virtual void write_client(int id, io_buffer event) = 0;
-    virtual void connect(int id, std::string host, std::string service) = 0;
+    virtual void connect(int id, std::string host, std::string service, io_buffer early_data) = 0;
+
+    // Only SOCKS5 sessions on a plain stream manager relay UDP. Managers that cannot (HTTP, mux
+    // links) keep this default, the unspecified endpoint makes the session refuse the association
+    virtual net::ip::udp::endpoint udp_associate(int /*id*/, std::uint16_t /*client_port*/) { return {}; }
 };
 
 using stream_manager_ptr = std::shared_ptr<stream_manager>;
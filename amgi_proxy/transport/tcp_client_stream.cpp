@@ -1,14 +1,21 @@
 #include "tcp_client_stream.h"
 #include "stream_manager.h"
+#include "socket_options.h"
 #include "logger/logger.h"
+#include "metrics/metrics.h"
 
 #include <boost/format.hpp>
 
+#include <system_error>
+
 using fmt = boost::format;
 using logger = logging::logger;
 
 namespace
 {
+    auto& g_fastopen_attempts = metrics::make_counter("upstream.fastopen_attempts");
+    auto& g_fastopen_syn_data = metrics::make_counter("upstream.fastopen_syn_data");
+
     enum : std::int32_t { eRemote, eLocal };
     std::string ep_to_str(const tcp::socket& sock, std::int32_t dir)
     {
@@ -30,10 +37,10 @@ namespace
     }
 }
 
-tcp_client_stream::tcp_client_stream(const stream_manager_ptr& ptr, int id, net::io_context& ctx)
+tcp_client_stream::tcp_client_stream(const stream_manager_ptr& ptr, int id, net::io_context& ctx, const client_options& options)
     : client_stream{ptr, id}
     , socket_{ctx}
-    , resolver_{ctx}, read_buffer_{}, write_buffer_{}
+    , resolver_{ctx}, options_{options}, read_buffer_{}, write_buffer_{}
 {}
 
 tcp_client_stream::~tcp_client_stream() 
@@ -46,7 +53,7 @@ void tcp_client_stream::do_start()
 {
     resolver_.async_resolve(
         host_, port_,
-        [this, self{shared_from_this()}] (const net::error_code& ec, tcp::resolver::results_type results) {
+        [this, self{ref_from_this()}] (const net::error_code& ec, tcp::resolver::results_type results) {
             if (!ec) {
                 do_connect(std::move(results));
             } else {
@@ -63,28 +70,115 @@ void tcp_client_stream::do_stop()
 
 void tcp_client_stream::do_connect(tcp::resolver::results_type&& results) 
 {
-    net::async_connect(
-        socket_, results,
-        [this, self{shared_from_this()}](const net::error_code& ec, const tcp::endpoint& ep) {
+    endpoints_ = std::move(results);
+    do_connect(endpoints_.begin(), net::error::host_unreachable);
+}
+
+void tcp_client_stream::do_connect(tcp::resolver::results_type::const_iterator it, net::error_code last_ec)
+{
+    if (it == endpoints_.end()) {
+        handle_error(last_ec);
+        return;
+    }
+
+    const auto ep = it->endpoint();
+    net::error_code ec;
+    socket_.close(ec);
+    socket_.open(ep.protocol(), ec);
+    if (ec) {
+        do_connect(std::next(it), ec);
+        return;
+    }
+
+    socket_options::apply_buffers(socket_, options_.profile);
+    egress_ = egress_pool::get().bind(socket_, ep);
+
+    // With TCP_FASTOPEN_CONNECT the connect completes at once and the first write sends the SYN,
+    // the socket turns writable again only when the handshake has finished
+    const bool fastopen = options_.fastopen && !early_data_.empty() && socket_options::enable_fastopen_connect(socket_);
+    if (fastopen)
+        g_fastopen_attempts.add();
+
+    socket_.async_connect(
+        ep,
+        [this, self{ref_from_this()}, it, fastopen](const net::error_code& ec) {
+            if (ec) {
+                if (ec == std::errc::address_not_available)
+                    egress_.report_exhausted();
+                do_connect(std::next(it), ec);
+                return;
+            }
+
+            socket_options::apply(socket_, options_.profile);
+            if (!fastopen) {
+                do_write_early_data();
+                return;
+            }
+
+            net::async_write(
+                socket_, net::buffer(early_data_),
+                [this, self, it](const net::error_code& ec, std::size_t) {
+                    if (ec) {
+                        do_connect(std::next(it), ec);
+                        return;
+                    }
+
+                    socket_.async_wait(
+                        tcp::socket::wait_write,
+                        [this, self, it](net::error_code ec) {
+                            if (!ec)
+                                ec = socket_options::pending_error(socket_);
+
+                            if (ec) {
+                                do_connect(std::next(it), ec);
+                                return;
+                            }
+
+                            if (socket_options::syn_data_acked(socket_))
+                                g_fastopen_syn_data.add();
+
+                            early_data_.clear();
+                            handle_connect();
+                        });
+                });
+        });
+}
+
+void tcp_client_stream::do_write_early_data()
+{
+    if (early_data_.empty()) {
+        handle_connect();
+        return;
+    }
+
+    net::async_write(
+        socket_, net::buffer(early_data_),
+        [this, self{ref_from_this()}](const net::error_code& ec, std::size_t) {
             if (!ec) {
-                logger::info((fmt("[%1%] connected to [%2%] --> [%3%]") % id() % host_ % ep_to_str(socket_, eRemote)));
-                logger::debug((fmt("[%1%] local address [%2%]") % id() % ep_to_str(socket_, eLocal)));
-                io_buffer event{};
-                manager()->on_connect(std::move(event), shared_from_this());
+                early_data_.clear();
+                handle_connect();
             } else {
                 handle_error(ec);
             }
         });
 }
 
+void tcp_client_stream::handle_connect()
+{
+    logger::info((fmt("[%1%] connected to [%2%] --> [%3%]") % id() % host_ % ep_to_str(socket_, eRemote)));
+    logger::debug((fmt("[%1%] local address [%2%]") % id() % ep_to_str(socket_, eLocal)));
+    io_buffer event{};
+    manager().on_connect(std::move(event), ref_from_this());
+}
+
 void tcp_client_stream::do_write(io_buffer event) 
 {
     std::copy(event.begin(), event.end(), write_buffer_.begin());
     net::async_write(
         socket_, net::buffer(write_buffer_, event.size()),
-        [this, self{shared_from_this()}] (const net::error_code& ec, std::size_t) {
+        [this, self{ref_from_this()}] (const net::error_code& ec, std::size_t) {
             if (!ec) {
-                manager()->on_write(std::move(io_buffer{}), shared_from_this());
+                manager().on_write(std::move(io_buffer{}), ref_from_this());
             } else {
                 handle_error(ec);
             }
@@ -95,10 +189,10 @@ void tcp_client_stream::do_read()
 {
     socket_.async_read_some(
         net::buffer(read_buffer_),
-        [this, self{shared_from_this()}] (const net::error_code& ec, const std::size_t length) {
+        [this, self{ref_from_this()}] (const net::error_code& ec, const std::size_t length) {
             if (!ec && length) {
                 io_buffer event{read_buffer_.data(), read_buffer_.data() + length};
-                manager()->on_read(std::move(event), shared_from_this());
+                manager().on_read(std::move(event), ref_from_this());
             } else {
                 handle_error(ec);
             }
@@ -107,9 +201,11 @@ void tcp_client_stream::do_read()
 
 void tcp_client_stream::handle_error(const net::error_code& ec) 
 {
-    manager()->on_error(ec, shared_from_this());
+    manager().on_error(ec, ref_from_this());
 }
 
 void tcp_client_stream::do_set_host(std::string host) { host_.swap(host); }
 
 void tcp_client_stream::do_set_service(std::string service) { port_.swap(service); }
+
+void tcp_client_stream::do_set_early_data(io_buffer data) { early_data_.swap(data); }
@@ -2,6 +2,8 @@
 #define TCP_CLIENT_STREAM_H
 
 #include "client_stream.h"
+#include "client_options.h"
+#include "egress_pool.h"
 
 #include <asio.hpp>
 
@@ -11,7 +13,7 @@ using tcp = asio::ip::tcp;
 class tcp_client_stream final : public client_stream
 {
 public:
-    tcp_client_stream(const stream_manager_ptr& ptr, int id, net::io_context& ctx);
+    tcp_client_stream(const stream_manager_ptr& ptr, int id, net::io_context& ctx, const client_options& options);
     ~tcp_client_stream() override;
 
 private:
@@ -19,6 +21,9 @@ private:
     void do_stop() final;
 
     void do_connect(tcp::resolver::results_type&& results);
+    void do_connect(tcp::resolver::results_type::const_iterator it, net::error_code last_ec);
+    void do_write_early_data();
+    void handle_connect();
 
     void do_read() final;
     void do_write(io_buffer event) final;
@@ -27,12 +32,17 @@ private:
 
     void do_set_host(std::string host) final;
     void do_set_service(std::string service) final;
+    void do_set_early_data(io_buffer data) final;
 
     tcp::socket socket_;
     tcp::resolver resolver_;
+    tcp::resolver::results_type endpoints_;
+    client_options options_;
+    egress_pool::lease egress_;
 
     std::string host_;
     std::string port_;
+    io_buffer early_data_;
 
     std::array<std::uint8_t, max_buffer_size> read_buffer_;
     std::array<std::uint8_t, max_buffer_size> write_buffer_;
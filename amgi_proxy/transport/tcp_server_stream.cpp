@@ -1,5 +1,6 @@
 #include "tcp_server_stream.h"
 #include "stream_manager.h"
+#include "socket_options.h"
 #include "logger/logger.h"
 
 #include <boost/format.hpp>
@@ -25,9 +26,10 @@ namespace
     }
 }
 
-tcp_server_stream::tcp_server_stream(const stream_manager_ptr& ptr, int id, net::io_context& ctx)
-    : server_stream{ptr, id}, ctx_{ctx}, socket_{ctx_}, read_buffer_{}, write_buffer_{} 
+tcp_server_stream::tcp_server_stream(const stream_manager_ptr& ptr, int id, net::io_context& ctx, tcp::socket socket, const socket_profile& profile)
+    : server_stream{ptr, id}, ctx_{ctx}, socket_{std::move(socket)}, read_buffer_{}, write_buffer_{} 
 {
+    socket_options::apply(socket_, profile);
 }
 
 tcp_server_stream::~tcp_server_stream() 
@@ -38,7 +40,17 @@ tcp_server_stream::~tcp_server_stream()
 
 net::io_context& tcp_server_stream::context() { return ctx_; }
 
-tcp::socket& tcp_server_stream::socket() { return socket_; }
+net::ip::address tcp_server_stream::remote_address() const
+{
+    net::error_code ignored_ec;
+    return socket_.remote_endpoint(ignored_ec).address();
+}
+
+net::ip::address tcp_server_stream::local_address() const
+{
+    net::error_code ignored_ec;
+    return socket_.local_endpoint(ignored_ec).address();
+}
 
 void tcp_server_stream::do_start() 
 {
@@ -59,9 +71,9 @@ void tcp_server_stream::do_write(io_buffer event)
     copy(event.begin(), event.end(), write_buffer_.begin());
     net::async_write(
             socket_, net::buffer(write_buffer_, event.size()),
-            [this, self{shared_from_this()}](const net::error_code &ec, size_t) {
+            [this, self{ref_from_this()}](const net::error_code &ec, size_t) {
                 if (!ec) {
-                    manager()->on_write(std::move(io_buffer{}), shared_from_this());
+                    manager().on_write(std::move(io_buffer{}), ref_from_this());
                 } else {
                     handle_error(ec);
                 }
@@ -72,10 +84,10 @@ void tcp_server_stream::do_read()
 {
     socket_.async_read_some(
             net::buffer(read_buffer_),
-            [this, self{shared_from_this()}](const net::error_code &ec, const size_t length) {
+            [this, self{ref_from_this()}](const net::error_code &ec, const size_t length) {
                 if (!ec) {
                     io_buffer event(read_buffer_.data(), read_buffer_.data() + length);
-                    manager()->on_read(std::move(event), shared_from_this());
+                    manager().on_read(std::move(event), ref_from_this());
                 } else {
                     handle_error(ec);
                 }
@@ -84,5 +96,5 @@ void tcp_server_stream::do_read()
 
 void tcp_server_stream::handle_error(const net::error_code& ec)
 {
-    manager()->on_error(ec, shared_from_this());
+    manager().on_error(ec, ref_from_this());
 }
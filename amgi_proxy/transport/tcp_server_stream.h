@@ -2,6 +2,7 @@
 #define TCP_SERVER_STREAM_H
 
 #include "server_stream.h"
+#include "common/socket_profile.h"
 
 #include <asio.hpp>
 
@@ -11,11 +12,12 @@ using tcp = asio::ip::tcp;
 class tcp_server_stream final : public server_stream
 {
 public:
-    tcp_server_stream(const stream_manager_ptr& ptr, int id, net::io_context& ctx);
+    tcp_server_stream(const stream_manager_ptr& ptr, int id, net::io_context& ctx, tcp::socket socket, const socket_profile& profile);
     ~tcp_server_stream() override;
 
     net::io_context& context() override;
-    tcp::socket& socket();
+    net::ip::address remote_address() const override;
+    net::ip::address local_address() const override;
 private:
     void do_start() final;
     void do_stop() final;
@@ -0,0 +1,59 @@
+#include "handshake_pool.h"
+#include "metrics/metrics.h"
+
+#include <chrono>
+
+namespace
+{
+    using clock = std::chrono::steady_clock;
+
+    auto& g_steps = metrics::make_counter("tls.handshake.steps");
+    auto& g_inline_steps = metrics::make_counter("tls.handshake.inline_steps");
+    auto& g_queue_time = metrics::make_counter("tls.handshake.queue_time_us");
+    auto& g_queued = metrics::make_gauge("tls.handshake.queued");
+}
+
+handshake_pool::handshake_pool(options opts)
+    : options_{opts}
+{
+    if (options_.threads)
+        pool_.emplace(options_.threads);
+}
+
+handshake_pool::~handshake_pool()
+{
+    stop();
+}
+
+void handshake_pool::post(std::function<void()> step)
+{
+    g_steps.add();
+
+    if (!pool_ || queued_.load(std::memory_order_relaxed) >= options_.max_queued) {
+        g_inline_steps.add();
+        step();
+        return;
+    }
+
+    queued_.fetch_add(1, std::memory_order_relaxed);
+    g_queued.add(1);
+
+    net::post(*pool_, [this, step{std::move(step)}, queued_at{clock::now()}] {
+        queued_.fetch_sub(1, std::memory_order_relaxed);
+        g_queued.sub(1);
+
+        const auto waited = std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - queued_at);
+        g_queue_time.add(static_cast<std::uint64_t>(waited.count()));
+        step();
+    });
+}
+
+void handshake_pool::stop()
+{
+    if (!pool_)
+        return;
+
+    pool_->stop();
+    pool_->join();
+    pool_.reset();
+}
@@ -0,0 +1,39 @@
+#ifndef HANDSHAKE_POOL_H
+#define HANDSHAKE_POOL_H
+
+#include <asio.hpp>
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <optional>
+
+namespace net = asio;
+
+// Runs TLS handshake steps off the io thread so key exchange and certificate
+// checks don't stall relaying of already established sessions
+class handshake_pool
+{
+public:
+    struct options {
+        std::size_t threads{2};
+        // Steps queued beyond this run inline on the io thread instead of waiting
+        std::size_t max_queued{1024};
+    };
+
+    explicit handshake_pool(options opts);
+    ~handshake_pool();
+
+    handshake_pool(const handshake_pool& other) = delete;
+    handshake_pool& operator=(const handshake_pool& other) = delete;
+
+    void post(std::function<void()> step);
+    void stop();
+
+private:
+    options options_;
+    std::optional<net::thread_pool> pool_;
+    std::atomic<std::size_t> queued_{0};
+};
+
+#endif // HANDSHAKE_POOL_H
@@ -0,0 +1,123 @@
+#include "socket_bio.h"
+
+#include <openssl/bio.h>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include <cerrno>
+#include <csignal>
+#include <ctime>
+#elif !defined(_WIN32)
+#include <sys/socket.h>
+#endif
+
+namespace
+{
+#if defined(__linux__)
+    // Linux has no per socket SIGPIPE switch, so a filter on top of the socket BIO sends with
+    // MSG_NOSIGNAL and leaves reads and controls, kernel TLS setup included, to the socket BIO
+
+    // With kernel TLS the socket BIO frames alerts as control records itself. Such a write runs
+    // with SIGPIPE blocked on this thread, a raised one is taken off before it is unblocked
+    int write_masked(BIO* next, const char* data, int length)
+    {
+        sigset_t pipe;
+        sigset_t previous;
+        sigemptyset(&pipe);
+        sigaddset(&pipe, SIGPIPE);
+        pthread_sigmask(SIG_BLOCK, &pipe, &previous);
+
+        const auto ret = BIO_write(next, data, length);
+        const auto error = errno;
+        if (ret <= 0 && error == EPIPE && !sigismember(&previous, SIGPIPE)) {
+            const timespec no_wait{};
+            sigtimedwait(&pipe, nullptr, &no_wait);
+        }
+
+        pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+        errno = error;
+        return ret;
+    }
+
+    int nosignal_write(BIO* bio, const char* data, int length)
+    {
+        BIO_clear_retry_flags(bio);
+        auto* next = BIO_next(bio);
+
+        if (BIO_get_ktls_send(next)) {
+            const auto ret = write_masked(next, data, length);
+            BIO_copy_next_retry(bio);
+            return ret;
+        }
+
+        const auto ret = ::send(static_cast<int>(BIO_get_fd(next, nullptr)), data, static_cast<std::size_t>(length), MSG_NOSIGNAL);
+        if (ret <= 0 && BIO_sock_should_retry(static_cast<int>(ret)))
+            BIO_set_retry_write(bio);
+        return static_cast<int>(ret);
+    }
+
+    int nosignal_read(BIO* bio, char* data, int length)
+    {
+        BIO_clear_retry_flags(bio);
+        const auto ret = BIO_read(BIO_next(bio), data, length);
+        BIO_copy_next_retry(bio);
+        return ret;
+    }
+
+    long nosignal_ctrl(BIO* bio, int cmd, long num, void* ptr)
+    {
+        return BIO_ctrl(BIO_next(bio), cmd, num, ptr);
+    }
+
+    int nosignal_create(BIO* bio)
+    {
+        BIO_set_init(bio, 1);
+        return 1;
+    }
+
+    const BIO_METHOD* nosignal_method()
+    {
+        static BIO_METHOD* const method = [] {
+            auto* m = BIO_meth_new(BIO_get_new_index() | BIO_TYPE_FILTER, "nosignal socket");
+            if (m) {
+                BIO_meth_set_write(m, nosignal_write);
+                BIO_meth_set_read(m, nosignal_read);
+                BIO_meth_set_ctrl(m, nosignal_ctrl);
+                BIO_meth_set_create(m, nosignal_create);
+            }
+            return m;
+        }();
+        return method;
+    }
+#endif
+}
+
+bool set_socket_bio(SSL* ssl, int fd)
+{
+#if defined(__linux__)
+    const auto* method = nosignal_method();
+    if (!method)
+        return false;
+
+    auto* socket = BIO_new_socket(fd, BIO_NOCLOSE);
+    auto* filter = BIO_new(method);
+    if (!socket || !filter) {
+        BIO_free(socket);
+        BIO_free(filter);
+        return false;
+    }
+
+    BIO_push(filter, socket);
+    // One reference for both directions, SSL_free releases the whole chain
+    SSL_set_bio(ssl, filter, filter);
+    return true;
+#else
+#if defined(SO_NOSIGPIPE)
+    const int on{1};
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+    return SSL_set_fd(ssl, fd) == 1;
+#endif
+}
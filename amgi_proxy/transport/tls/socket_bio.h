@@ -0,0 +1,11 @@
+#ifndef SOCKET_BIO_H
+#define SOCKET_BIO_H
+
+#include <openssl/ssl.h>
+
+// Attaches the socket to the SSL object like SSL_set_fd, except that writing to a peer that went
+// away fails with EPIPE instead of raising SIGPIPE. Only this socket is affected, the process
+// signal disposition is left alone
+bool set_socket_bio(SSL* ssl, int fd);
+
+#endif // SOCKET_BIO_H
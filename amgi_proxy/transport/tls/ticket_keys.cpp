@@ -0,0 +1,149 @@
+#include "ticket_keys.h"
+#include "metrics/metrics.h"
+
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#else
+#include <openssl/hmac.h>
+#endif
+
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+
+namespace
+{
+    auto& g_rotations = metrics::make_counter("tls.ticket_keys.rotations");
+    auto& g_unknown_keys = metrics::make_counter("tls.ticket_keys.unknown");
+}
+
+ticket_keys::ticket_keys()
+    : current_{generate()}
+{}
+
+ticket_keys::~ticket_keys()
+{
+    cleanse(current_);
+    if (previous_)
+        cleanse(*previous_);
+}
+
+void ticket_keys::install(SSL_CTX* ctx)
+{
+    SSL_CTX_set_ex_data(ctx, index(), this);
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, &ticket_keys::callback);
+#else
+    SSL_CTX_set_tlsext_ticket_key_cb(ctx, &ticket_keys::callback);
+#endif
+}
+
+void ticket_keys::rotate()
+{
+    auto next = generate();
+
+    {
+        std::unique_lock lock{mutex_};
+        // The expired key is overwritten in place, nothing of it stays behind in memory
+        if (previous_)
+            cleanse(*previous_);
+        previous_ = current_;
+        current_ = next;
+    }
+
+    cleanse(next);
+    g_rotations.add();
+}
+
+ticket_keys::key ticket_keys::generate()
+{
+    key k{};
+    if (RAND_bytes(k.name.data(), static_cast<int>(k.name.size())) != 1 ||
+        RAND_bytes(k.aes.data(), static_cast<int>(k.aes.size())) != 1 ||
+        RAND_bytes(k.hmac.data(), static_cast<int>(k.hmac.size())) != 1)
+        throw std::runtime_error("unable to generate tls ticket key");
+
+    return k;
+}
+
+void ticket_keys::cleanse(key& k)
+{
+    OPENSSL_cleanse(&k, sizeof(k));
+}
+
+int ticket_keys::index()
+{
+    static const int idx = SSL_CTX_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+    return idx;
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+int ticket_keys::callback(SSL* ssl, unsigned char* name, unsigned char* iv, EVP_CIPHER_CTX* cipher, EVP_MAC_CTX* mac, int enc)
+#else
+int ticket_keys::callback(SSL* ssl, unsigned char* name, unsigned char* iv, EVP_CIPHER_CTX* cipher, HMAC_CTX* mac, int enc)
+#endif
+{
+    auto* self = static_cast<ticket_keys*>(SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), index()));
+    if (!self)
+        return -1;
+
+    key k{};
+    int result = 1;
+    {
+        std::shared_lock lock{self->mutex_};
+        if (enc) {
+            k = self->current_;
+        } else if (std::equal(name, name + k.name.size(), self->current_.name.begin())) {
+            k = self->current_;
+        } else if (self->previous_ && std::equal(name, name + k.name.size(), self->previous_->name.begin())) {
+            // Still valid, ask OpenSSL to hand out a ticket under the current key
+            k = *self->previous_;
+            result = 2;
+        } else {
+            g_unknown_keys.add();
+            return 0;
+        }
+    }
+
+    // The copy taken under the lock is wiped as soon as the contexts are keyed
+    const auto applied = apply(k, name, iv, cipher, mac, enc);
+    cleanse(k);
+    return applied ? result : -1;
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+bool ticket_keys::apply(key& k, unsigned char* name, unsigned char* iv, EVP_CIPHER_CTX* cipher, EVP_MAC_CTX* mac, int enc)
+#else
+bool ticket_keys::apply(key& k, unsigned char* name, unsigned char* iv, EVP_CIPHER_CTX* cipher, HMAC_CTX* mac, int enc)
+#endif
+{
+    if (enc) {
+        std::memcpy(name, k.name.data(), k.name.size());
+        if (RAND_bytes(iv, EVP_MAX_IV_LENGTH) != 1)
+            return false;
+        if (EVP_EncryptInit_ex(cipher, EVP_aes_256_cbc(), nullptr, k.aes.data(), iv) != 1)
+            return false;
+    } else if (EVP_DecryptInit_ex(cipher, EVP_aes_256_cbc(), nullptr, k.aes.data(), iv) != 1) {
+        return false;
+    }
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    char digest[] = "SHA256";
+    const OSSL_PARAM params[] = {
+        OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, k.hmac.data(), k.hmac.size()),
+        OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, digest, 0),
+        OSSL_PARAM_construct_end()
+    };
+    if (EVP_MAC_CTX_set_params(mac, params) != 1)
+        return false;
+#else
+    if (HMAC_Init_ex(mac, k.hmac.data(), static_cast<int>(k.hmac.size()), EVP_sha256(), nullptr) != 1)
+        return false;
+#endif
+
+    return true;
+}
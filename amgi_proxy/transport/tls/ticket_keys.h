@@ -0,0 +1,50 @@
+#ifndef TICKET_KEYS_H
+#define TICKET_KEYS_H
+
+#include <openssl/ssl.h>
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <shared_mutex>
+
+// In-memory keys for stateless TLS 1.3 session tickets. The previous key keeps
+// decrypting after a rotation so tickets stay usable for up to two periods
+class ticket_keys
+{
+public:
+    ticket_keys();
+    ~ticket_keys();
+
+    ticket_keys(const ticket_keys& other) = delete;
+    ticket_keys& operator=(const ticket_keys& other) = delete;
+
+    void install(SSL_CTX* ctx);
+    void rotate();
+
+private:
+    struct key {
+        std::array<std::uint8_t, 16> name;
+        std::array<std::uint8_t, 32> aes;
+        std::array<std::uint8_t, 32> hmac;
+    };
+
+    static key generate();
+    static void cleanse(key& k);
+    static int index();
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    static int callback(SSL* ssl, unsigned char* name, unsigned char* iv, EVP_CIPHER_CTX* cipher, EVP_MAC_CTX* mac, int enc);
+    static bool apply(key& k, unsigned char* name, unsigned char* iv, EVP_CIPHER_CTX* cipher, EVP_MAC_CTX* mac, int enc);
+#else
+    static int callback(SSL* ssl, unsigned char* name, unsigned char* iv, EVP_CIPHER_CTX* cipher, HMAC_CTX* mac, int enc);
+    static bool apply(key& k, unsigned char* name, unsigned char* iv, EVP_CIPHER_CTX* cipher, HMAC_CTX* mac, int enc);
+#endif
+
+    // Handshakes run on the handshake pool, rotation on the io thread
+    std::shared_mutex mutex_;
+    key current_;
+    std::optional<key> previous_;
+};
+
+#endif // TICKET_KEYS_H
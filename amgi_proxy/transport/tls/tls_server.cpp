@@ -1,16 +1,51 @@
 #include "tls_server.h"
 #include "tls_server_stream.h"
+#include "transport/socket_options.h"
+#include "transport/io_loop.h"
+#include "transport/mux/mux_link.h"
+#include "common/stream_codec.h"
 #include "logger/logger.h"
+#include "metrics/metrics.h"
+
+#include <boost/format.hpp>
 
 #include <charconv>
+#include <algorithm>
+#include <fstream>
 #include <memory>
 
-tls_server::tls_server(const std::string& port, tls_options settings, stream_manager_ptr proxy_backend)
+using fmt = boost::format;
+
+namespace
+{
+    constexpr auto kAcceptRetryInterval = std::chrono::milliseconds(50);
+
+    auto& g_accept_errors = metrics::make_counter("accept.errors");
+
+    bool kernel_tls_loaded()
+    {
+        std::ifstream ulps{"/proc/sys/net/ipv4/tcp_available_ulp"};
+        std::string ulp;
+        while (ulps >> ulp) {
+            if (ulp == "tls")
+                return true;
+        }
+        return false;
+    }
+}
+
+tls_server::tls_server(const std::string& port, server_options options, tls_options settings, stream_manager_ptr proxy_backend)
     : ssl_ctx_{net::ssl::context::tlsv13_server}
-    , signals_(ctx_), acceptor_(ctx_), stream_manager_{std::move(proxy_backend)}, stream_id_(0)
+    , signals_(ctx_), reload_signals_(ctx_), acceptor_(ctx_), accept_timer_(ctx_), ticket_timer_(ctx_), options_(options), pending_accepts_(0), reporter_(ctx_, options.metrics_interval)
+    , stream_manager_{std::move(proxy_backend)}, stream_id_(0)
+    , handshake_pool_{settings.handshake}
+    , ticket_rotation_{settings.ticket_rotation}
+    , record_boost_{settings.record_boost}
+    , compression_{settings.compression}
 {
     configure_signals();
     async_wait_signals();
+    async_wait_reload_signals();
 
     ssl_ctx_.set_options(net::ssl::context::default_workarounds | 
                          net::ssl::context::no_tlsv1_1 |
@@ -30,33 +65,42 @@ tls_server::tls_server(const std::string& port, tls_options settings, stream_man
 
     //ssl_ctx_.set_options(boost::asio::ssl::context::single_dh_use);
     //SSL_CTX_set_ecdh_auto(ssl_ctx_.native_handle(), 1);
-    //SSL_CTX_set_options(ssl_ctx_.native_handle(), SSL_OP_NO_TICKET);
-    //SSL_CTX_set_session_cache_mode(ssl_ctx_.native_handle(), SSL_SESS_CACHE_OFF);
     //SSL_CTX_set_mode(ssl_ctx_.native_handle(), SSL_MODE_AUTO_RETRY);
     //ssl_ctx_.use_tmp_dh_file("dh4096.pem");
 
+    configure_resumption();
+    configure_ktls(settings.ktls);
+    configure_alpn();
+
     uint16_t listen_port{0};
     std::from_chars(port.data(), port.data() + port.size(), listen_port);
 
     tcp::endpoint ep{tcp::endpoint(tcp::v4(), listen_port)};
     acceptor_.open(ep.protocol());
-    acceptor_.set_option(tcp::acceptor::reuse_address(true));
+    socket_options::apply(acceptor_, options_);
     acceptor_.bind(ep);
-    acceptor_.listen();
+    acceptor_.listen(options_.listen_backlog > 0 ? options_.listen_backlog : net::socket_base::max_listen_connections);
+    // reject_pending accepts on the raw descriptor and must never block
+    acceptor_.non_blocking(true);
 
     logging::logger::info("socks5-proxy tls_server starts on port: " + port);
+    reporter_.start();
     start_accept();
 }
 
 void tls_server::run() 
 {
-    ctx_.run();
+    io_loop::run(ctx_, options_.spin_budget);
 }
 
 void tls_server::configure_signals() 
 {
     signals_.add(SIGINT);
     signals_.add(SIGTERM);
+#if defined(SIGHUP)
+    if (options_.on_reload)
+        reload_signals_.add(SIGHUP);
+#endif
 }
 
 void tls_server::async_wait_signals() 
@@ -65,17 +109,120 @@ void tls_server::async_wait_signals()
         [this](net::error_code /*ec*/, int /*signno*/) {
             logging::logger::info("socks5-proxy tls_server stopping");
             acceptor_.close();
+            accept_timer_.cancel();
+            ticket_timer_.cancel();
+            reload_signals_.cancel();
+            reporter_.stop();
+            handshake_pool_.stop();
             ctx_.stop();
             logging::logger::info("socks5-proxy tls_server stopped");
         });
 }
 
+void tls_server::async_wait_reload_signals()
+{
+    reload_signals_.async_wait(
+        [this](const net::error_code& ec, int /*signo*/) {
+            if (ec)
+                return;
+
+            logging::logger::info("tls proxy server reloading configuration");
+            options_.on_reload();
+            async_wait_reload_signals();
+        });
+}
+
+void tls_server::configure_resumption()
+{
+    auto* native = ssl_ctx_.native_handle();
+
+    // Required once client certificates are verified, resumption fails without it
+    static constexpr unsigned char sid_context[] = "amgi_proxy";
+    SSL_CTX_set_session_id_context(native, sid_context, sizeof(sid_context) - 1);
+
+    if (ticket_rotation_.count() <= 0) {
+        SSL_CTX_set_options(native, SSL_OP_NO_TICKET);
+        SSL_CTX_set_session_cache_mode(native, SSL_SESS_CACHE_OFF);
+        return;
+    }
+
+    // Stateless tickets: the session, client certificate included, travels with the client
+    // and nothing is cached here. Resumed handshakes skip certificate verification
+    SSL_CTX_set_session_cache_mode(native, SSL_SESS_CACHE_SERVER | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_set_timeout(native, static_cast<long>(ticket_rotation_.count()));
+    ticket_keys_.install(native);
+    rotate_ticket_keys();
+}
+
+void tls_server::configure_ktls(bool enable)
+{
+    if (!enable)
+        return;
+
+#if defined(SSL_OP_ENABLE_KTLS)
+    // OpenSSL enables it per connection once the traffic keys are known and silently
+    // stays in user space when the suite or the kernel can't do it
+    SSL_CTX_set_options(ssl_ctx_.native_handle(), SSL_OP_ENABLE_KTLS);
+    if (!kernel_tls_loaded())
+        logging::logger::warning("kernel tls module is not loaded, connections will fall back to user space tls");
+#else
+    logging::logger::warning("openssl is built without kernel tls support, ktls option ignored");
+#endif
+}
+
+void tls_server::configure_alpn()
+{
+    // Tunnels offering the multiplexed protocol get it, then compression if enabled, anything else stays a plain link
+    alpn_protocols_ = std::string{mux::alpn_protocol};
+    if (compression_ > 0)
+        alpn_protocols_ += codec::alpn_zlib;
+
+    SSL_CTX_set_alpn_select_cb(ssl_ctx_.native_handle(),
+        [](SSL* /*ssl*/, const unsigned char** out, unsigned char* outlen, const unsigned char* in, unsigned int inlen, void* arg) {
+            const auto* protocols = static_cast<const std::string*>(arg);
+            unsigned char* selected{nullptr};
+            const auto* supported = reinterpret_cast<const unsigned char*>(protocols->data());
+            if (SSL_select_next_proto(&selected, outlen, supported, static_cast<unsigned int>(protocols->size()), in, inlen) != OPENSSL_NPN_NEGOTIATED)
+                return SSL_TLSEXT_ERR_NOACK;
+
+            *out = selected;
+            return SSL_TLSEXT_ERR_OK;
+        }, &alpn_protocols_);
+}
+
+void tls_server::rotate_ticket_keys()
+{
+    ticket_timer_.expires_after(ticket_rotation_);
+    ticket_timer_.async_wait(
+        [this](const net::error_code& ec) {
+            if (ec)
+                return;
+
+            ticket_keys_.rotate();
+            logging::logger::trace("tls session ticket keys rotated");
+            rotate_ticket_keys();
+        });
+}
+
 void tls_server::start_accept() 
 {
-    auto new_stream = std::make_shared<tls_server_stream>(stream_manager_, ++stream_id_, ctx_, ssl_ctx_);
+    while (pending_accepts_ < std::max<std::size_t>(options_.accept_concurrency, 1)) {
+        if (!admission_control::get().can_accept()) {
+            pause_accept();
+            return;
+        }
+
+        accept_one();
+    }
+}
+
+void tls_server::accept_one()
+{
+    ++pending_accepts_;
     acceptor_.async_accept(
-        new_stream->socket(),
-        [this, new_stream](const net::error_code& ec) {
+        [this](const net::error_code& ec, tcp::socket socket) {
+            --pending_accepts_;
+
             if (!acceptor_.is_open()) {
                 logging::logger::trace("tls proxy server acceptor is closed");
                 if (ec) {
@@ -86,13 +233,72 @@ void tls_server::start_accept()
                 return;
             }
 
-            if (!ec)
-                stream_manager_->on_accept(new_stream);
+            if (ec) {
+                handle_accept_error(ec);
+                return;
+            }
 
+            // The stream and its buffers only come to life once there is a client to serve
+            auto stream = make_ref<tls_server_stream>(stream_manager_, ++stream_id_, ctx_, std::move(socket), ssl_ctx_, options_.profile, handshake_pool_, record_boost_);
+            // The stream keeps the callback and calls it while alive, a handle of its own would never let go
+            stream->handshake(
+                [this, raw{stream.get()}](const net::error_code& ec) {
+                    on_handshake(ref_ptr<tls_server_stream>{raw}, ec);
+                });
             start_accept();
         });
 }
 
+void tls_server::on_handshake(const ref_ptr<tls_server_stream>& stream, const net::error_code& ec)
+{
+    if (ec) {
+        logging::logger::warning((fmt("[%1%] tls handshake failed: %2%") % stream->id() % ec.message()).str());
+        stream->stop();
+        return;
+    }
+
+    if (!stream->multiplexed()) {
+        stream->enable_compression(compression_);
+        stream_manager_->on_accept(stream);
+        return;
+    }
+
+    // Small frames of many channels share the link, Nagle would hold them back
+    stream->set_no_delay(true);
+
+    // Every channel of the link becomes a stream of its own with an id from the same sequence
+    auto link = std::make_shared<mux_link>(stream, stream_manager_, [this] { return ++stream_id_; });
+    stream->rebind(link);
+    link->start();
+}
+
+void tls_server::pause_accept()
+{
+    accept_timer_.expires_after(kAcceptRetryInterval);
+    accept_timer_.async_wait(
+        [this](const net::error_code& ec) {
+            if (!ec && acceptor_.is_open())
+                start_accept();
+        });
+}
+
+void tls_server::handle_accept_error(const net::error_code& ec)
+{
+    g_accept_errors.add();
+
+    // Out of descriptors: the pending connection stays in the backlog, re-arming right away would spin
+    if (ec == net::error::no_descriptors || ec == net::error::no_buffer_space || ec == net::error::no_memory) {
+        if (reserve_fd_.reject_pending(acceptor_))
+            logging::logger::warning("tls proxy server is out of descriptors, pending connections rejected");
+        pause_accept();
+        return;
+    }
+
+    // Anything else may persist as well (e.g. EPERM from a seccomp or LSM denial), never re-arm in a hot loop
+    logging::logger::trace("tls proxy server accept error: " + ec.message());
+    pause_accept();
+}
+
 tls_server::~tls_server() 
 {
     logging::logger::trace("tls proxy server stopped");
@@ -2,6 +2,11 @@
 #define TLS_SERVER_H
 
 #include "transport/stream_manager.h"
+#include "transport/server_options.h"
+#include "transport/admission_control.h"
+#include "transport/tls/handshake_pool.h"
+#include "transport/tls/ticket_keys.h"
+#include "metrics/metrics_reporter.h"
 
 #include <asio.hpp>
 #include <asio/ssl.hpp>
@@ -12,6 +17,8 @@ namespace net = asio;
 using tcp = net::ip::tcp;
 namespace fs = std::filesystem;
 
+class tls_server_stream;
+
 class tls_server 
 {
 public:
@@ -19,9 +26,18 @@ public:
         std::string private_key;
         std::string server_cert;
         std::string ca_cert;
+        handshake_pool::options handshake;
+        // Session ticket key lifetime, zero disables resumption
+        std::chrono::seconds ticket_rotation{3600};
+        // Hand record encryption to the kernel after the handshake when it can take it
+        bool ktls{false};
+        // Bytes sent in small records after connect or idle before switching to full ones, zero - always full
+        std::size_t record_boost{0x20000};
+        // zlib level of the link compression offered to tunnels, zero - never compress
+        int compression{0};
     };
 
-    explicit tls_server(const std::string& port, tls_options settings, stream_manager_ptr proxy_backend);
+    explicit tls_server(const std::string& port, server_options options, tls_options settings, stream_manager_ptr proxy_backend);
     virtual ~tls_server();
 
     tls_server(const tls_server& other) = delete;
@@ -32,14 +48,37 @@ private:
     net::io_context ctx_;
     net::ssl::context ssl_ctx_;
     net::signal_set signals_;
+    net::signal_set reload_signals_;
     tcp::acceptor acceptor_;
+    net::steady_timer accept_timer_;
+    net::steady_timer ticket_timer_;
+    fd_reserve reserve_fd_;
+    server_options options_;
+    std::size_t pending_accepts_;
+    metrics::reporter reporter_;
     stream_manager_ptr stream_manager_;
     int stream_id_;
+    handshake_pool handshake_pool_;
+    ticket_keys ticket_keys_;
+    std::chrono::seconds ticket_rotation_;
+    std::size_t record_boost_;
+    int compression_;
+    // ALPN protocols the listener picks from, in order of preference
+    std::string alpn_protocols_;
 
     void configure_signals();
     void async_wait_signals();
+    void async_wait_reload_signals();
+    void configure_resumption();
+    void configure_ktls(bool enable);
+    void configure_alpn();
+    void rotate_ticket_keys();
 
     void start_accept();
+    void accept_one();
+    void on_handshake(const ref_ptr<tls_server_stream>& stream, const net::error_code& ec);
+    void pause_accept();
+    void handle_accept_error(const net::error_code& ec);
 };
 
 
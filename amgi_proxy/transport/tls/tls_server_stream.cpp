@@ -1,37 +1,122 @@
 #include "tls_server_stream.h"
+#include "socket_bio.h"
 #include "transport/stream_manager.h"
+#include "transport/socket_options.h"
 #include "logger/logger.h"
+#include "metrics/metrics.h"
+#include "common/mux_frame.h"
 
 #include <boost/format.hpp>
 
+#include <algorithm>
+
 using fmt = boost::format;
 using logger = logging::logger;
 
 namespace
 {
-    std::string ep_to_str(const ssl_socket& sock)
+    using clock = std::chrono::steady_clock;
+
+    // Fits one TCP segment with TLS 1.3 framing, the client can decrypt it as soon as it arrives
+    constexpr std::size_t kSmallRecord = 1360;
+    constexpr std::size_t kFullRecord = 16384;
+    // The session is told its write is done while no more than this waits to be flushed
+    constexpr std::size_t kMaxPending = 2 * stream::max_buffer_size;
+    constexpr auto kIdleReset = std::chrono::seconds(1);
+    constexpr auto kLingerTimeout = std::chrono::seconds(10);
+
+    auto& g_full_handshakes = metrics::make_counter("tls.handshake.full");
+    auto& g_resumed_handshakes = metrics::make_counter("tls.handshake.resumed");
+    auto& g_full_handshake_time = metrics::make_counter("tls.handshake.full_us");
+    auto& g_resumed_handshake_time = metrics::make_counter("tls.handshake.resumed_us");
+    auto& g_ktls_send = metrics::make_counter("tls.ktls.send");
+    auto& g_ktls_recv = metrics::make_counter("tls.ktls.recv");
+    auto& g_records = metrics::make_counter("tls.records.written");
+    auto& g_record_bytes = metrics::make_counter("tls.records.bytes");
+    auto& g_small_records = metrics::make_counter("tls.records.small");
+    auto& g_compressed_in = metrics::make_counter("tls.compression.in_bytes");
+    auto& g_compressed_out = metrics::make_counter("tls.compression.out_bytes");
+    auto& g_bypassed = metrics::make_counter("tls.compression.bypassed_bytes");
+    auto& g_decompressed = metrics::make_counter("tls.compression.decoded_bytes");
+    auto& g_corrupt = metrics::make_counter("tls.compression.corrupt");
+
+    // Every link's compressor reports straight into the process wide counters
+    class compression_metrics final : public codec::observer
+    {
+    public:
+        void compressed(std::size_t in, std::size_t out) override { g_compressed_in.add(in); g_compressed_out.add(out); }
+        void bypassed(std::size_t size) override { g_bypassed.add(size); }
+        void decoded(std::size_t size) override { g_decompressed.add(size); }
+        void corrupt() override { g_corrupt.add(); }
+    };
+
+    compression_metrics g_compression_metrics;
+
+    std::string ep_to_str(const tcp::socket& sock)
     {
-        if (!sock.lowest_layer().is_open())
+        if (!sock.is_open())
             return "socket not opened";
 
         net::error_code ec;
-        const auto rep = sock.lowest_layer().remote_endpoint(ec);
+        const auto rep = sock.remote_endpoint(ec);
         if (ec)
             return { "remote_endpoint failed: " + ec.message() };
 
         net::error_code ignored_ec;
         return { rep.address().to_string(ignored_ec) + ":" + std::to_string(rep.port()) };
     }
+
+    net::error_code to_error_code(int result, unsigned long error)
+    {
+        if (result == SSL_ERROR_ZERO_RETURN)
+            return net::error::eof;
+
+#if defined(SSL_R_UNEXPECTED_EOF_WHILE_READING)
+        if (ERR_GET_REASON(error) == SSL_R_UNEXPECTED_EOF_WHILE_READING)
+            return net::error::eof;
+#endif
+        if (error)
+            return {static_cast<int>(error), net::error::get_ssl_category()};
+
+        // SSL_ERROR_SYSCALL without a queued error is the peer going away mid record
+        return net::error::eof;
+    }
 }
 
-tls_server_stream::tls_server_stream(const stream_manager_ptr& ptr, int id, net::io_context& ctx, net::ssl::context& ssl_ctx)
+tls_server_stream::tls_server_stream(const stream_manager_ptr& ptr, int id, net::io_context& ctx, tcp::socket socket, net::ssl::context& ssl_ctx, const socket_profile& profile, handshake_pool& pool, std::size_t record_boost)
     : server_stream{ptr, id}
     , ctx_{ctx}
-    , ssl_ctx_{ssl_ctx}
-    , socket_{ctx_, ssl_ctx_}
+    , socket_{std::move(socket)}
+    , ssl_{SSL_new(ssl_ctx.native_handle())}
+    , pool_{pool}
+    , handshake_running_{false}
+    , stop_pending_{false}
+    , ssl_failed_{false}
+    , ktls_send_{false}
+    , flushing_{false}
+    , write_waiting_{false}
+    , handshake_time_{}
+    , record_{0}
+    , record_boost_{record_boost}
+    , boosted_bytes_{0}
+    , last_write_{}
+    , linger_timer_{ctx}
     , read_buffer_{}
-    , write_buffer_{} 
-{}
+    , draining_{false}
+{
+    socket_options::apply(socket_, profile);
+
+    net::error_code ignored_ec;
+    socket_.non_blocking(true, ignored_ec);
+    // OpenSSL writes to the socket itself, a peer that resets mid-write must not raise SIGPIPE
+    if (ssl_ && !set_socket_bio(ssl_.get(), static_cast<int>(socket_.native_handle())))
+        ssl_.reset();
+    if (ssl_) {
+        SSL_set_accept_state(ssl_.get());
+        // pending_ may grow while a record waits for the socket
+        SSL_set_mode(ssl_.get(), SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+    }
+}
 
 tls_server_stream::~tls_server_stream() 
 {
@@ -41,86 +126,382 @@ tls_server_stream::~tls_server_stream()
 
 net::io_context& tls_server_stream::context() { return ctx_; }
 
-tcp::socket& tls_server_stream::socket() 
-{ 
-    return socket_.next_layer();
+net::ip::address tls_server_stream::remote_address() const
+{
+    net::error_code ignored_ec;
+    return socket_.remote_endpoint(ignored_ec).address();
+}
+
+net::ip::address tls_server_stream::local_address() const
+{
+    net::error_code ignored_ec;
+    return socket_.local_endpoint(ignored_ec).address();
 }
 
-void tls_server_stream::do_start() 
+void tls_server_stream::handshake(std::function<void(const net::error_code&)> done)
 {
     const auto str{(fmt("[%1%] incoming connection from client: [%2%]")
                    % id() % ep_to_str(socket_)).str()};
     logger::debug(str);
-    do_handshake();
+
+    on_handshake_ = std::move(done);
+    if (!ssl_) {
+        net::post(ctx_, [this, self{ref_from_this()}] { handle_error(net::error::no_memory); });
+        return;
+    }
+
+    // Nothing to compute until the ClientHello is in, don't spend a pool hop on it
+    socket_.async_wait(tcp::socket::wait_read,
+        [this, self{ref_from_this()}](const net::error_code& ec) {
+            if (!ec)
+                do_handshake();
+            else
+                handle_error(ec);
+        });
+}
+
+bool tls_server_stream::multiplexed() const
+{
+    const unsigned char* protocol{nullptr};
+    unsigned int length{0};
+    SSL_get0_alpn_selected(ssl_.get(), &protocol, &length);
+
+    const auto expected = mux::alpn_protocol.substr(1);
+    return length == expected.size() && std::equal(expected.begin(), expected.end(), protocol);
+}
+
+bool tls_server_stream::enable_compression(int level)
+{
+    const unsigned char* protocol{nullptr};
+    unsigned int length{0};
+    SSL_get0_alpn_selected(ssl_.get(), &protocol, &length);
+
+    compressor_ = stream_compressor::negotiate({reinterpret_cast<const char*>(protocol), length}, level, g_compression_metrics);
+    if (!compressor_)
+        return false;
+
+    decoded_.resize(max_buffer_size);
+    logger::debug((fmt("[%1%] link compression enabled") % id()).str());
+    return true;
+}
+
+void tls_server_stream::set_no_delay(bool enable)
+{
+    net::error_code ignored_ec;
+    socket_.set_option(tcp::no_delay(enable), ignored_ec);
+}
+
+void tls_server_stream::do_start() 
+{
+    // pending_ outlives the session's write, it is charged here until it is in the socket. The
+    // handle in the shed callback is let go by close()
+    buffers_ = buffer_account{ctx_, [this, self{ref_from_this()}] {
+        if (!socket_.is_open())
+            return;
+
+        // A shed client doesn't get its pending data, there's no linger and no close_notify
+        ssl_failed_ = true;
+        close();
+        fail(net::error::timed_out);
+    }};
+
+    do_read();
 }
 
 void tls_server_stream::do_stop() 
 {
-    if (!socket_.lowest_layer().is_open())
+    if (!socket_.is_open())
         return;
 
-    net::error_code ignored_ec;
-    socket_.lowest_layer().cancel(ignored_ec);
+    if (handshake_running_) {
+        // The pool still owns the SSL object, the socket is closed once the step comes back
+        stop_pending_ = true;
+        net::error_code ignored_ec;
+        socket_.shutdown(tcp::socket::shutdown_both, ignored_ec);
+        return;
+    }
 
-    socket_.async_shutdown(
-        [this, self{shared_from_this()}](const net::error_code& ec) {
-            if (ec)
-                handle_error(ec);
-            socket_.lowest_layer().close();
-        });
+    if (flushing_ && !ssl_failed_) {
+        // The session already counts pending_ as written, it still has to reach the client
+        stop_pending_ = true;
+        linger_timer_.expires_after(kLingerTimeout);
+        linger_timer_.async_wait(
+            [this, self{ref_from_this()}](const net::error_code& ec) {
+                if (!ec)
+                    close();
+            });
+        return;
+    }
 
-    net::async_write(
-        socket_, net::null_buffers{},
-        [this, self{shared_from_this()}](const net::error_code& ec, std::size_t trans_bytes) {
-            if (ec)
-                handle_error(ec);
-            socket_.lowest_layer().close();
-        });
+    close();
+}
+
+void tls_server_stream::close()
+{
+    linger_timer_.cancel();
+    buffers_ = buffer_account{};
+
+    // Best effort close_notify, the socket is non-blocking and nobody waits for the peer's reply
+    if (ssl_ && !ssl_failed_ && SSL_is_init_finished(ssl_.get())) {
+        ERR_clear_error();
+        SSL_shutdown(ssl_.get());
+    }
+
+    // Unread input turns the close into a reset, which can overtake the last alert we sent. One
+    // read is all that is spent on it, a peer that keeps sending gets the reset
+    net::error_code ec;
+    if (socket_.available(ec) > 0 && !ec)
+        socket_.read_some(net::buffer(read_buffer_), ec);
+
+    net::error_code ignored_ec;
+    socket_.close(ignored_ec);
 }
 
 void tls_server_stream::do_handshake()
 {
-    socket_.async_handshake(
-        net::ssl::stream_base::server,
-        [this, self{shared_from_this()}](const net::error_code& ec) {
-        if (!ec) {
-            do_read();
+    handshake_running_ = true;
+    // The handle only moves through the pool thread, its count is never touched there
+    pool_.post([this, self{ref_from_this()}]() mutable {
+        const auto started = clock::now();
+        ERR_clear_error();
+        const auto result = SSL_get_error(ssl_.get(), SSL_do_handshake(ssl_.get()));
+        handshake_time_ += clock::now() - started;
+        // The OpenSSL error queue is per thread, it has to travel back with the result
+        const auto error = ERR_get_error();
+        net::post(ctx_, [this, self{std::move(self)}, result, error] { handle_handshake(result, error); });
+    });
+}
+
+void tls_server_stream::handle_handshake(int result, unsigned long error)
+{
+    handshake_running_ = false;
+    if (stop_pending_) {
+        close();
+        return;
+    }
+
+    if (result == SSL_ERROR_NONE) {
+        const auto us = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(handshake_time_).count());
+        if (SSL_session_reused(ssl_.get())) {
+            g_resumed_handshakes.add();
+            g_resumed_handshake_time.add(us);
         } else {
-            handle_error(ec);
+            g_full_handshakes.add();
+            g_full_handshake_time.add(us);
         }
-    });
+
+        ktls_send_ = BIO_get_ktls_send(SSL_get_wbio(ssl_.get())) != 0;
+        if (ktls_send_)
+            g_ktls_send.add();
+        if (BIO_get_ktls_recv(SSL_get_rbio(ssl_.get())) != 0)
+            g_ktls_recv.add();
+
+        std::exchange(on_handshake_, {})(net::error_code{});
+        return;
+    }
+
+    if (!wait_ready(result, [this] { do_handshake(); })) {
+        ssl_failed_ = true;
+        handle_error(to_error_code(result, error));
+    }
 }
 
 void tls_server_stream::do_write(io_buffer event) 
 {
-    copy(event.begin(), event.end(), write_buffer_.begin());
-    net::async_write(
-            socket_, net::buffer(write_buffer_, event.size()),
-            [this, self{shared_from_this()}](const net::error_code &ec, size_t) {
-                if (!ec) {
-                    manager()->on_write(std::move(io_buffer{}), shared_from_this());
-                } else {
-                    handle_error(ec);
-                }
-            });
+    // Write-behind: while the socket keeps up every write goes out at once, when it backs up
+    // the chunks relayed meanwhile are coalesced and leave as full records
+    const auto queued = pending_.size();
+    if (!compressor_) {
+        pending_.insert(pending_.end(), event.begin(), event.end());
+    } else if (!compressor_->encode(event.data(), event.size(), pending_)) {
+        fail(net::error::invalid_argument);
+        return;
+    }
+    buffers_.hold(pending_.size() - queued);
+
+    if (pending_.size() <= kMaxPending)
+        complete_write();
+    else
+        write_waiting_ = true;
+
+    if (!flushing_)
+        flush();
+}
+
+void tls_server_stream::flush()
+{
+    flushing_ = false;
+    while (!pending_.empty()) {
+        if (!record_)
+            record_ = std::min(pending_.size(), next_record_size());
+
+        std::size_t written{0};
+        int result{SSL_ERROR_NONE};
+        if (ktls_send_) {
+            // Each write closes a kernel record, so the sizing works the same way
+            net::error_code ec;
+            written = socket_.write_some(net::buffer(pending_.data(), record_), ec);
+            if (ec == net::error::would_block || ec == net::error::try_again) {
+                result = SSL_ERROR_WANT_WRITE;
+            } else if (ec) {
+                fail(ec);
+                return;
+            }
+        } else {
+            ERR_clear_error();
+            const auto ret = SSL_write(ssl_.get(), pending_.data(), static_cast<int>(record_));
+            if (ret > 0)
+                written = static_cast<std::size_t>(ret);
+            else
+                result = SSL_get_error(ssl_.get(), ret);
+        }
+
+        if (result != SSL_ERROR_NONE) {
+            if (wait_ready(result, [this] { flush(); }))
+                flushing_ = true;
+            else
+                handle_ssl_error(result, ERR_get_error());
+            return;
+        }
+
+        g_records.add();
+        g_record_bytes.add(written);
+        if (written <= kSmallRecord)
+            g_small_records.add();
+
+        boosted_bytes_ += written;
+        record_ = 0;
+        pending_.erase(pending_.begin(), pending_.begin() + static_cast<std::ptrdiff_t>(written));
+        buffers_.release(written);
+
+        if (write_waiting_ && pending_.size() <= kMaxPending) {
+            write_waiting_ = false;
+            complete_write();
+        }
+    }
+
+    if (stop_pending_)
+        close();
+}
+
+std::size_t tls_server_stream::next_record_size()
+{
+    // Small records at the start and after an idle period keep the first bytes
+    // decryptable early, bulk transfers then switch to full records
+    const auto now = clock::now();
+    if (now - last_write_ > kIdleReset)
+        boosted_bytes_ = 0;
+    last_write_ = now;
+
+    if (!record_boost_ || boosted_bytes_ >= record_boost_)
+        return kFullRecord;
+    return kSmallRecord;
+}
+
+void tls_server_stream::complete_write()
+{
+    net::post(ctx_, [this, self{ref_from_this()}] { manager().on_write(io_buffer{}, ref_from_this()); });
 }
 
 void tls_server_stream::do_read() 
 {
-    socket_.async_read_some(
-            net::buffer(read_buffer_),
-            [this, self{shared_from_this()}](const net::error_code &ec, const size_t length) {
-                if (!ec) {
-                    io_buffer event(read_buffer_.data(), read_buffer_.data() + length);
-                    manager()->on_read(std::move(event), shared_from_this());
-                } else {
-                    handle_error(ec);
-                }
-            });
+    if (draining_) {
+        deliver_decoded();
+        return;
+    }
+
+    ERR_clear_error();
+    const auto ret = SSL_read(ssl_.get(), read_buffer_.data(), static_cast<int>(read_buffer_.size()));
+    if (ret > 0 && compressor_) {
+        compressor_->feed(read_buffer_.data(), static_cast<std::size_t>(ret));
+        draining_ = true;
+        deliver_decoded();
+        return;
+    }
+
+    if (ret > 0) {
+        // Completions never run inline, the manager is free to issue the next read from on_read
+        net::post(ctx_, [this, self{ref_from_this()}, length{static_cast<std::size_t>(ret)}] {
+            io_buffer event(read_buffer_.data(), read_buffer_.data() + length);
+            manager().on_read(std::move(event), ref_from_this());
+        });
+        return;
+    }
+
+    const auto result = SSL_get_error(ssl_.get(), ret);
+    if (!wait_ready(result, [this] { do_read(); }))
+        handle_ssl_error(result, ERR_get_error());
 }
 
-void tls_server_stream::handle_error(const net::error_code& ec) 
+// One record may expand to many reads' worth, the manager gets it a buffer at a time
+void tls_server_stream::deliver_decoded()
 {
-    manager()->on_error(ec, shared_from_this());
+    const auto decoded = compressor_->pull(decoded_.data(), decoded_.size());
+    if (!decoded) {
+        draining_ = false;
+        fail(net::error::invalid_argument);
+        return;
+    }
+
+    if (*decoded == 0) {
+        draining_ = false;
+        do_read();
+        return;
+    }
+
+    net::post(ctx_, [this, self{ref_from_this()}, length{*decoded}] {
+        io_buffer event(decoded_.data(), decoded_.data() + length);
+        manager().on_read(std::move(event), ref_from_this());
+    });
 }
 
+template <typename Operation>
+bool tls_server_stream::wait_ready(int result, Operation&& op)
+{
+    tcp::socket::wait_type type;
+    if (result == SSL_ERROR_WANT_READ)
+        type = tcp::socket::wait_read;
+    else if (result == SSL_ERROR_WANT_WRITE)
+        type = tcp::socket::wait_write;
+    else
+        return false;
+
+    socket_.async_wait(type,
+        [this, self{ref_from_this()}, op{std::forward<Operation>(op)}](const net::error_code& ec) {
+            if (!ec)
+                op();
+            else
+                handle_error(ec);
+        });
+    return true;
+}
+
+void tls_server_stream::handle_ssl_error(int result, unsigned long error)
+{
+    if (result != SSL_ERROR_ZERO_RETURN)
+        ssl_failed_ = true;
+
+    fail(to_error_code(result, error));
+}
+
+void tls_server_stream::fail(const net::error_code& ec)
+{
+    // Nobody listens once the session is gone, a lingering flush just ends
+    if (stop_pending_) {
+        close();
+        return;
+    }
+
+    net::post(ctx_, [this, self{ref_from_this()}, ec] { handle_error(ec); });
+}
+
+void tls_server_stream::handle_error(const net::error_code& ec) 
+{
+    // No manager knows the stream until the handshake is through
+    if (on_handshake_) {
+        std::exchange(on_handshake_, {})(ec);
+        return;
+    }
+
+    manager().on_error(ec, ref_from_this());
+}
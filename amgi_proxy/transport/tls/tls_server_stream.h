@@ -2,37 +2,97 @@
 #define TLS_SERVER_STREAM_H
 
 #include "transport/server_stream.h"
+#include "transport/memory_governor.h"
+#include "common/socket_profile.h"
+#include "transport/tls/handshake_pool.h"
+#include "common/stream_codec.h"
 
 #include <asio.hpp>
 #include <asio/ssl.hpp>
 
+#include <chrono>
+#include <functional>
+#include <memory>
+
 namespace net = asio;
 using tcp = asio::ip::tcp;
-using ssl_socket = net::ssl::stream<net::ip::tcp::socket>;
 
+// OpenSSL works straight on the non-blocking socket and the io thread only waits
+// for readiness, which lets handshake steps run on the handshake pool
 class tls_server_stream final : public server_stream 
 {
 public:
-    tls_server_stream(const stream_manager_ptr& ptr, int id, net::io_context& ctx, net::ssl::context& ssl_ctx);
+    tls_server_stream(const stream_manager_ptr& ptr, int id, net::io_context& ctx, tcp::socket socket, net::ssl::context& ssl_ctx, const socket_profile& profile, handshake_pool& pool, std::size_t record_boost);
     ~tls_server_stream() override;
 
     net::io_context& context() override;
-    tcp::socket& socket();
+    net::ip::address remote_address() const override;
+    net::ip::address local_address() const override;
+
+    // Runs before the stream goes to a manager, start() then only begins reading
+    void handshake(std::function<void(const net::error_code&)> done);
+    // The tunnel negotiated the multiplexed link protocol
+    [[nodiscard]] bool multiplexed() const;
+    void set_no_delay(bool enable);
+    // Compresses the link if the tunnel negotiated it, level zero - never
+    bool enable_compression(int level);
 private:
+    struct ssl_deleter {
+        void operator()(SSL* ssl) const { SSL_free(ssl); }
+    };
+
     void do_handshake();
+    void handle_handshake(int result, unsigned long error);
     void do_start() final;
     void do_stop() final;
     void do_read() final;
     void do_write(io_buffer event) final;
 
+    void deliver_decoded();
+    void flush();
+    std::size_t next_record_size();
+    void complete_write();
+    void fail(const net::error_code& ec);
+    // Re-runs the operation once the socket is ready in the direction OpenSSL asked for
+    template <typename Operation>
+    bool wait_ready(int result, Operation&& op);
+    void close();
+
     void handle_error(const net::error_code& ec);
+    void handle_ssl_error(int result, unsigned long error);
 
     net::io_context& ctx_;
-    net::ssl::context& ssl_ctx_;
-    ssl_socket socket_;
+    tcp::socket socket_;
+    std::unique_ptr<SSL, ssl_deleter> ssl_;
+    handshake_pool& pool_;
+    std::function<void(const net::error_code&)> on_handshake_;
+    bool handshake_running_;
+    bool stop_pending_;
+    bool ssl_failed_;
+    // The kernel encrypts outgoing records, plain socket writes are enough
+    bool ktls_send_;
+    bool flushing_;
+    bool write_waiting_;
+    // Time spent inside SSL_do_handshake, the crypto cost of this handshake
+    std::chrono::steady_clock::duration handshake_time_;
+
+    // Plaintext accepted from the session, not yet written as a record
+    io_buffer pending_;
+    buffer_account buffers_;
+    // Length of the record OpenSSL asked to retry, it must not change until written
+    std::size_t record_;
+    // Records stay small until this many bytes went out since the last idle period
+    std::size_t record_boost_;
+    std::size_t boosted_bytes_;
+    std::chrono::steady_clock::time_point last_write_;
+    net::steady_timer linger_timer_;
 
     std::array<std::uint8_t, max_buffer_size> read_buffer_;
-    std::array<std::uint8_t, max_buffer_size> write_buffer_;
+
+    std::unique_ptr<stream_compressor> compressor_;
+    // read_buffer_ holds compressed input until the codec has decoded all of it
+    io_buffer decoded_;
+    bool draining_;
 };
 
 #endif //TLS_SERVER_STREAM_H
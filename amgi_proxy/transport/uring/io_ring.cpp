@@ -0,0 +1,526 @@
+#include "io_ring.h"
+#include "transport/stream.h"
+#include "logger/logger.h"
+#include "metrics/metrics.h"
+
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <limits>
+#include <system_error>
+
+namespace
+{
+    constexpr std::uint32_t kEntries = 1024;
+    constexpr std::uint32_t kCompletions = 8 * kEntries;
+    // Only buffers holding completed, not yet handled reads are out of the ring, it is refilled
+    // as soon as each read has been handed over
+    constexpr std::uint32_t kReadBuffers = 256;
+    constexpr std::uint16_t kReadGroup = 0;
+    // Pinned memory counts against RLIMIT_MEMLOCK, 1 MiB stays within the usual default
+    constexpr std::uint32_t kWriteBuffers = 64;
+    constexpr std::uint32_t kNoOperation = std::numeric_limits<std::uint32_t>::max();
+    constexpr std::size_t kBufferSize = stream::max_buffer_size;
+
+    auto& g_submits = metrics::make_counter("uring.submits");
+    auto& g_completions = metrics::make_counter("uring.completions");
+    auto& g_starved_reads = metrics::make_counter("uring.starved_reads");
+    auto& g_zero_copy_sends = metrics::make_counter("uring.zero_copy_sends");
+    auto& g_zero_copy_copied = metrics::make_counter("uring.zero_copy_copied");
+
+    int io_uring_setup(std::uint32_t entries, io_uring_params& params)
+    {
+        return static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+    }
+
+    int io_uring_enter(int fd, std::uint32_t submit, std::uint32_t flags)
+    {
+        return static_cast<int>(::syscall(__NR_io_uring_enter, fd, submit, 0, flags, nullptr, 0));
+    }
+
+    int io_uring_register(int fd, unsigned opcode, const void* arg, unsigned count)
+    {
+        return static_cast<int>(::syscall(__NR_io_uring_register, fd, opcode, arg, count));
+    }
+
+    void* map(std::size_t size, int fd = -1, off_t offset = 0)
+    {
+        void* area = fd < 0
+            ? ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)
+            : ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+        if (area == MAP_FAILED)
+            throw std::system_error(errno, std::system_category(), "io_uring mmap");
+        return area;
+    }
+
+    template <typename T>
+    std::atomic<T>* at(void* ring, std::uint32_t offset)
+    {
+        return reinterpret_cast<std::atomic<T>*>(static_cast<std::uint8_t*>(ring) + offset);
+    }
+}
+
+net::execution_context::id io_ring::id;
+
+io_ring::io_ring(net::io_context& ctx)
+    : net::execution_context::service{ctx}
+    , ctx_{ctx}
+    , event_{ctx}
+{
+    setup();
+    setup_read_buffers();
+    setup_write_buffers();
+
+    const int event = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (event < 0 || io_uring_register(ring_fd_, IORING_REGISTER_EVENTFD, &event, 1) < 0)
+        throw std::system_error(errno, std::system_category(), "io_uring eventfd");
+    event_.assign(event);
+    wait_completions();
+}
+
+io_ring::~io_ring()
+{
+    // The kernel cancels whatever is still in flight and lets go of the buffers with the ring
+    if (ring_fd_ >= 0)
+        ::close(ring_fd_);
+    if (sqes_)
+        ::munmap(sqes_, sqes_size_);
+    if (cq_ring_ && cq_ring_ != sq_ring_)
+        ::munmap(cq_ring_, cq_ring_size_);
+    if (sq_ring_)
+        ::munmap(sq_ring_, sq_ring_size_);
+    if (read_ring_)
+        ::munmap(read_ring_, read_ring_size_);
+    if (read_buffers_)
+        ::munmap(read_buffers_, kReadBuffers * kBufferSize);
+    if (write_buffers_)
+        ::munmap(write_buffers_, kWriteBuffers * kBufferSize);
+}
+
+bool io_ring::probe(std::string& error)
+{
+    io_uring_params params{};
+    const int fd = io_uring_setup(4, params);
+    if (fd < 0) {
+        error = std::string{"io_uring_setup failed: "} + std::strerror(errno);
+        return false;
+    }
+
+    struct opcode {
+        std::uint8_t code;
+        const char* name;
+    };
+    constexpr opcode required[] = {
+        {IORING_OP_RECV, "recv"}, {IORING_OP_SEND, "send"}, {IORING_OP_SEND_ZC, "zero copy send"},
+        {IORING_OP_CONNECT, "connect"}, {IORING_OP_POLL_ADD, "poll"}};
+
+    std::vector<std::uint8_t> storage(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op));
+    auto* ops = reinterpret_cast<io_uring_probe*>(storage.data());
+    const bool listed = io_uring_register(fd, IORING_REGISTER_PROBE, ops, 256) == 0;
+    for (const auto& op : required) {
+        if (!listed || op.code > ops->last_op || !(ops->ops[op.code].flags & IO_URING_OP_SUPPORTED)) {
+            error = std::string{"the kernel lacks io_uring "} + op.name + " (Linux 6.0 or later)";
+            ::close(fd);
+            return false;
+        }
+    }
+
+    // Provided buffer rings came after the opcodes above
+    io_uring_buf_reg reg{};
+    void* ring = ::mmap(nullptr, sizeof(io_uring_buf), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    reg.ring_addr = reinterpret_cast<std::uint64_t>(ring);
+    reg.ring_entries = 1;
+    const bool provided = ring != MAP_FAILED && io_uring_register(fd, IORING_REGISTER_PBUF_RING, &reg, 1) == 0;
+    if (!provided)
+        error = std::string{"the kernel lacks io_uring provided buffer rings: "} + std::strerror(errno);
+
+    ::close(fd);
+    if (ring != MAP_FAILED)
+        ::munmap(ring, sizeof(io_uring_buf));
+    return provided;
+}
+
+void io_ring::shutdown()
+{
+    // Pending handlers hold their streams, which must go before the context does
+    net::error_code ignored_ec;
+    event_.close(ignored_ec);
+    starved_.clear();
+    operations_.clear();
+    free_operation_ = kNoOperation;
+}
+
+void io_ring::setup()
+{
+    io_uring_params params{};
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL;
+    params.cq_entries = kCompletions;
+    ring_fd_ = io_uring_setup(kEntries, params);
+    if (ring_fd_ < 0 && errno == EINVAL) {
+        params = io_uring_params{};
+        params.flags = IORING_SETUP_CQSIZE;
+        params.cq_entries = kCompletions;
+        ring_fd_ = io_uring_setup(kEntries, params);
+    }
+    if (ring_fd_ < 0)
+        throw std::system_error(errno, std::system_category(), "io_uring_setup");
+
+    sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(std::uint32_t);
+    cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    const bool single_map = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_map)
+        sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+
+    sq_ring_ = map(sq_ring_size_, ring_fd_, IORING_OFF_SQ_RING);
+    cq_ring_ = single_map ? sq_ring_ : map(cq_ring_size_, ring_fd_, IORING_OFF_CQ_RING);
+    sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+    sqes_ = static_cast<io_uring_sqe*>(map(sqes_size_, ring_fd_, IORING_OFF_SQES));
+
+    sq_head_ = at<std::uint32_t>(sq_ring_, params.sq_off.head);
+    sq_tail_ = at<std::uint32_t>(sq_ring_, params.sq_off.tail);
+    sq_flags_ = at<std::uint32_t>(sq_ring_, params.sq_off.flags);
+    sq_mask_ = at<std::uint32_t>(sq_ring_, params.sq_off.ring_mask)->load(std::memory_order_relaxed);
+    sq_entries_ = params.sq_entries;
+    sq_local_tail_ = sq_tail_->load(std::memory_order_relaxed);
+
+    // Entries are always used in ring order, the indirection array stays the identity
+    auto* array = reinterpret_cast<std::uint32_t*>(static_cast<std::uint8_t*>(sq_ring_) + params.sq_off.array);
+    for (std::uint32_t i = 0; i < sq_entries_; ++i)
+        array[i] = i;
+
+    cq_head_ = at<std::uint32_t>(cq_ring_, params.cq_off.head);
+    cq_tail_ = at<std::uint32_t>(cq_ring_, params.cq_off.tail);
+    cq_mask_ = at<std::uint32_t>(cq_ring_, params.cq_off.ring_mask)->load(std::memory_order_relaxed);
+    cqes_ = reinterpret_cast<io_uring_cqe*>(static_cast<std::uint8_t*>(cq_ring_) + params.cq_off.cqes);
+
+    free_operation_ = kNoOperation;
+}
+
+void io_ring::setup_read_buffers()
+{
+    read_ring_size_ = kReadBuffers * sizeof(io_uring_buf);
+    read_ring_ = static_cast<io_uring_buf_ring*>(map(read_ring_size_));
+    read_buffers_ = static_cast<std::uint8_t*>(map(kReadBuffers * kBufferSize));
+
+    io_uring_buf_reg reg{};
+    reg.ring_addr = reinterpret_cast<std::uint64_t>(read_ring_);
+    reg.ring_entries = kReadBuffers;
+    reg.bgid = kReadGroup;
+    if (io_uring_register(ring_fd_, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+        throw std::system_error(errno, std::system_category(), "io_uring provided buffer ring");
+
+    for (std::uint16_t buffer = 0; buffer < kReadBuffers; ++buffer)
+        recycle(buffer);
+}
+
+void io_ring::setup_write_buffers()
+{
+    write_buffers_ = static_cast<std::uint8_t*>(map(kWriteBuffers * kBufferSize));
+
+    std::vector<iovec> buffers(kWriteBuffers);
+    for (std::uint32_t i = 0; i < kWriteBuffers; ++i)
+        buffers[i] = iovec{write_buffers_ + i * kBufferSize, kBufferSize};
+
+    if (io_uring_register(ring_fd_, IORING_REGISTER_BUFFERS, buffers.data(), kWriteBuffers) < 0) {
+        logging::logger::warning(std::string{"io_uring buffers not registered, zero copy sends disabled: "} + std::strerror(errno));
+        ::munmap(write_buffers_, kWriteBuffers * kBufferSize);
+        write_buffers_ = nullptr;
+        return;
+    }
+
+    for (int i = static_cast<int>(kWriteBuffers) - 1; i >= 0; --i)
+        free_write_buffers_.push_back(i);
+}
+
+void io_ring::recv(int fd, read_handler done)
+{
+    const auto index = allocate(operation::kind::read, fd);
+    operations_[index].read = std::move(done);
+    prepare_recv(index);
+}
+
+void io_ring::prepare_recv(std::uint32_t index)
+{
+    auto* sqe = prepare(index, IORING_OP_RECV, operations_[index].fd);
+    sqe->len = kBufferSize;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = kReadGroup;
+}
+
+void io_ring::send(int fd, const std::uint8_t* data, std::size_t size, handler done)
+{
+    const auto index = allocate(operation::kind::write, fd);
+    operations_[index].done = std::move(done);
+
+    // Stream sockets go on sending after a partial write, so a short result means failure
+    auto* sqe = prepare(index, IORING_OP_SEND, fd);
+    sqe->addr = reinterpret_cast<std::uint64_t>(data);
+    sqe->len = static_cast<std::uint32_t>(size);
+    sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+}
+
+bool io_ring::send_zero_copy(int fd, const std::uint8_t* data, std::size_t size, handler done, release_handler released)
+{
+    if (size > kBufferSize || free_write_buffers_.empty())
+        return false;
+
+    const auto registered = free_write_buffers_.back();
+    free_write_buffers_.pop_back();
+    auto* buffer = write_buffers_ + registered * kBufferSize;
+    std::memcpy(buffer, data, size);
+
+    const auto index = allocate(operation::kind::zero_copy, fd);
+    auto& op = operations_[index];
+    op.done = std::move(done);
+    op.released = std::move(released);
+    op.registered = registered;
+
+    auto* sqe = prepare(index, IORING_OP_SEND_ZC, fd);
+    sqe->addr = reinterpret_cast<std::uint64_t>(buffer);
+    sqe->len = static_cast<std::uint32_t>(size);
+    sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+    sqe->ioprio = IORING_RECVSEND_FIXED_BUF | IORING_SEND_ZC_REPORT_USAGE;
+    sqe->buf_index = static_cast<std::uint16_t>(registered);
+    g_zero_copy_sends.add();
+    return true;
+}
+
+void io_ring::connect(int fd, const sockaddr* address, socklen_t length, handler done, bool link)
+{
+    // A chain split over two submissions would let the linked operation run on its own
+    if (link && sq_entries_ - (sq_local_tail_ - sq_head_->load(std::memory_order_acquire)) < 2)
+        submit();
+
+    const auto index = allocate(operation::kind::write, fd);
+    operations_[index].done = std::move(done);
+
+    auto* sqe = prepare(index, IORING_OP_CONNECT, fd);
+    sqe->addr = reinterpret_cast<std::uint64_t>(address);
+    sqe->off = length;
+    if (link)
+        sqe->flags = IOSQE_IO_LINK;
+}
+
+void io_ring::poll(int fd, std::uint32_t events, handler done)
+{
+    const auto index = allocate(operation::kind::write, fd);
+    operations_[index].done = std::move(done);
+
+    auto* sqe = prepare(index, IORING_OP_POLL_ADD, fd);
+    sqe->poll32_events = events;
+}
+
+std::uint32_t io_ring::allocate(operation::kind type, int fd)
+{
+    std::uint32_t index = free_operation_;
+    if (index == kNoOperation) {
+        index = static_cast<std::uint32_t>(operations_.size());
+        operations_.emplace_back();
+    } else {
+        free_operation_ = operations_[index].next_free;
+    }
+
+    auto& op = operations_[index];
+    op.type = type;
+    op.fd = fd;
+    return index;
+}
+
+void io_ring::free(std::uint32_t index)
+{
+    auto& op = operations_[index];
+    op = operation{};
+    op.next_free = free_operation_;
+    free_operation_ = index;
+}
+
+io_uring_sqe* io_ring::prepare(std::uint32_t index, std::uint8_t opcode, int fd)
+{
+    while (sq_local_tail_ - sq_head_->load(std::memory_order_acquire) == sq_entries_)
+        submit();
+
+    auto* sqe = &sqes_[sq_local_tail_ & sq_mask_];
+    std::memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->user_data = index;
+
+    ++sq_local_tail_;
+    ++unsubmitted_;
+    schedule_submit();
+    return sqe;
+}
+
+void io_ring::schedule_submit()
+{
+    if (submit_scheduled_)
+        return;
+
+    // Everything prepared until the loop gets to this goes in with one system call
+    submit_scheduled_ = true;
+    net::post(ctx_, [this] {
+        submit_scheduled_ = false;
+        submit();
+    });
+}
+
+void io_ring::submit()
+{
+    if (!unsubmitted_)
+        return;
+
+    sq_tail_->store(sq_local_tail_, std::memory_order_release);
+    const int submitted = io_uring_enter(ring_fd_, unsubmitted_, 0);
+    g_submits.add();
+    if (submitted < 0) {
+        // The completion queue is full, the kernel takes more once it has been drained
+        if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+            logging::logger::error(std::string{"io_uring_enter failed: "} + std::strerror(errno));
+        reap();
+        schedule_submit();
+        return;
+    }
+
+    unsubmitted_ -= static_cast<std::uint32_t>(submitted);
+    if (unsubmitted_)
+        schedule_submit();
+
+    // Sends to sockets with room in their buffers have completed already
+    reap();
+}
+
+void io_ring::wait_completions()
+{
+    event_.async_wait(
+        net::posix::stream_descriptor::wait_read,
+        [this](const net::error_code& ec) {
+            if (ec)
+                return;
+
+            std::uint64_t count{0};
+            [[maybe_unused]] const auto ret = ::read(event_.native_handle(), &count, sizeof(count));
+            reap();
+            wait_completions();
+        });
+}
+
+void io_ring::reap()
+{
+    // A handler may fill the submission queue and submit, which reaps again
+    if (reaping_)
+        return;
+
+    reaping_ = true;
+    for (;;) {
+        auto head = cq_head_->load(std::memory_order_relaxed);
+        const auto tail = cq_tail_->load(std::memory_order_acquire);
+        if (head == tail) {
+            if (!(sq_flags_->load(std::memory_order_relaxed) & IORING_SQ_CQ_OVERFLOW))
+                break;
+
+            // Completions the full queue didn't take wait in the kernel until asked for
+            io_uring_enter(ring_fd_, 0, IORING_ENTER_GETEVENTS);
+            continue;
+        }
+
+        g_completions.add(tail - head);
+        for (; head != tail; ++head) {
+            const auto cqe = cqes_[head & cq_mask_];
+            cq_head_->store(head + 1, std::memory_order_release);
+            complete(cqe);
+        }
+    }
+
+    // Every buffer is back in the ring once its read has been handled, starved reads retry now
+    while (!starved_.empty()) {
+        const auto index = starved_.front();
+        starved_.pop_front();
+        prepare_recv(index);
+    }
+    reaping_ = false;
+}
+
+void io_ring::complete(const io_uring_cqe& cqe)
+{
+    const auto index = static_cast<std::uint32_t>(cqe.user_data);
+    if (index >= operations_.size())
+        return;
+
+    // Handlers prepare new operations and may move this one, nothing is touched after the call
+    auto& op = operations_[index];
+    switch (op.type) {
+        case operation::kind::read: {
+            if (cqe.res == -ENOBUFS) {
+                g_starved_reads.add();
+                starved_.push_back(index);
+                return;
+            }
+
+            auto done = std::move(op.read);
+            free(index);
+            if (!(cqe.flags & IORING_CQE_F_BUFFER)) {
+                done(cqe.res, nullptr);
+                return;
+            }
+
+            const auto buffer = static_cast<std::uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+            done(cqe.res, read_buffers_ + buffer * kBufferSize);
+            recycle(buffer);
+            return;
+        }
+        case operation::kind::write: {
+            auto done = std::move(op.done);
+            free(index);
+            done(cqe.res);
+            return;
+        }
+        case operation::kind::zero_copy: {
+            // The send completes first, the buffer is only free once the notification follows
+            if (cqe.flags & IORING_CQE_F_NOTIF) {
+                const bool copied = static_cast<std::uint32_t>(cqe.res) & IORING_NOTIF_USAGE_ZC_COPIED;
+                if (copied)
+                    g_zero_copy_copied.add();
+
+                auto released = std::move(op.released);
+                free_write_buffers_.push_back(op.registered);
+                free(index);
+                released(copied);
+                return;
+            }
+
+            auto done = std::move(op.done);
+            if (!(cqe.flags & IORING_CQE_F_MORE)) {
+                auto released = std::move(op.released);
+                free_write_buffers_.push_back(op.registered);
+                free(index);
+                done(cqe.res);
+                released(false);
+                return;
+            }
+
+            done(cqe.res);
+            return;
+        }
+        case operation::kind::idle:
+            return;
+    }
+}
+
+void io_ring::recycle(std::uint16_t buffer)
+{
+    // The header's flexible array doesn't sit at offset zero in C++, the ring is indexed directly
+    auto& entry = reinterpret_cast<io_uring_buf*>(read_ring_)[read_tail_ & (kReadBuffers - 1)];
+    entry.addr = reinterpret_cast<std::uint64_t>(read_buffers_ + buffer * kBufferSize);
+    entry.len = kBufferSize;
+    entry.bid = buffer;
+    ++read_tail_;
+    reinterpret_cast<std::atomic<std::uint16_t>*>(&read_ring_->tail)->store(read_tail_, std::memory_order_release);
+}
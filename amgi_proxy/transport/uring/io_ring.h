@@ -0,0 +1,130 @@
+#ifndef IO_RING_H
+#define IO_RING_H
+
+#include <asio.hpp>
+
+#include <sys/socket.h>
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace net = asio;
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct io_uring_buf_ring;
+
+// One io_uring per io_context, driving the sockets taken out of the asio reactor. The ring's
+// eventfd is waited on by the reactor, so ring completions run on the io thread between asio
+// handlers, and everything prepared during a loop iteration is submitted with one system call.
+// Reads pick their buffer from a provided buffer ring, writes of relay sized chunks go out zero
+// copy from registered buffers
+class io_ring final : public net::execution_context::service
+{
+public:
+    // Result as the system call would return it, -errno on failure
+    using handler = std::function<void(int result)>;
+    // The data is only valid during the call, its buffer goes back to the kernel afterwards
+    using read_handler = std::function<void(int result, const std::uint8_t* data)>;
+    // Zero copy send done with its buffer, copied - the kernel had to copy after all (loopback)
+    using release_handler = std::function<void(bool copied)>;
+
+    static net::execution_context::id id;
+
+    explicit io_ring(net::io_context& ctx);
+    ~io_ring() override;
+
+    io_ring(const io_ring& other) = delete;
+    io_ring& operator=(const io_ring& other) = delete;
+
+    static io_ring& get(net::io_context& ctx) { return net::use_service<io_ring>(ctx); }
+
+    // Checks that the kernel has everything the ring uses, what is missing otherwise
+    static bool probe(std::string& error);
+
+    void recv(int fd, read_handler done);
+    // Sends all of it unless failing, the data must stay untouched until done runs
+    void send(int fd, const std::uint8_t* data, std::size_t size, handler done);
+    // Copies into a registered buffer and sends from there without another copy in the kernel.
+    // False when the data doesn't fit or every buffer is in flight, nothing is submitted then
+    bool send_zero_copy(int fd, const std::uint8_t* data, std::size_t size, handler done, release_handler released);
+    // With link the next prepared operation only starts once the connect has succeeded and is
+    // cancelled otherwise. The address is read at submission, within this io loop iteration
+    void connect(int fd, const sockaddr* address, socklen_t length, handler done, bool link);
+    void poll(int fd, std::uint32_t events, handler done);
+
+private:
+    struct operation {
+        enum class kind : std::uint8_t { idle, read, write, zero_copy };
+
+        kind type{kind::idle};
+        int fd{-1};
+        handler done;
+        read_handler read;
+        release_handler released;
+        int registered{-1};
+        std::uint32_t next_free{0};
+    };
+
+    void shutdown() override;
+
+    void setup();
+    void setup_read_buffers();
+    void setup_write_buffers();
+
+    io_uring_sqe* prepare(std::uint32_t index, std::uint8_t opcode, int fd);
+    std::uint32_t allocate(operation::kind type, int fd);
+    void free(std::uint32_t index);
+    void prepare_recv(std::uint32_t index);
+
+    void schedule_submit();
+    void submit();
+    void wait_completions();
+    void reap();
+    void complete(const io_uring_cqe& cqe);
+    void recycle(std::uint16_t buffer);
+
+    net::io_context& ctx_;
+    int ring_fd_{-1};
+    net::posix::stream_descriptor event_;
+    bool submit_scheduled_{false};
+    bool reaping_{false};
+
+    // Submission and completion queues shared with the kernel
+    void* sq_ring_{nullptr};
+    std::size_t sq_ring_size_{0};
+    void* cq_ring_{nullptr};
+    std::size_t cq_ring_size_{0};
+    io_uring_sqe* sqes_{nullptr};
+    std::size_t sqes_size_{0};
+    std::atomic<std::uint32_t>* sq_head_{nullptr};
+    std::atomic<std::uint32_t>* sq_tail_{nullptr};
+    std::atomic<std::uint32_t>* sq_flags_{nullptr};
+    std::uint32_t sq_mask_{0};
+    std::uint32_t sq_entries_{0};
+    std::uint32_t sq_local_tail_{0};
+    std::uint32_t unsubmitted_{0};
+    std::atomic<std::uint32_t>* cq_head_{nullptr};
+    std::atomic<std::uint32_t>* cq_tail_{nullptr};
+    std::uint32_t cq_mask_{0};
+    io_uring_cqe* cqes_{nullptr};
+
+    std::vector<operation> operations_;
+    std::uint32_t free_operation_{0};
+    // Reads that found the buffer ring empty, resubmitted once the completions are handled
+    std::deque<std::uint32_t> starved_;
+
+    io_uring_buf_ring* read_ring_{nullptr};
+    std::size_t read_ring_size_{0};
+    std::uint8_t* read_buffers_{nullptr};
+    std::uint16_t read_tail_{0};
+
+    std::uint8_t* write_buffers_{nullptr};
+    std::vector<int> free_write_buffers_;
+};
+
+#endif // IO_RING_H
@@ -0,0 +1,217 @@
+#include "uring_client_stream.h"
+#include "transport/stream_manager.h"
+#include "transport/socket_options.h"
+#include "logger/logger.h"
+#include "metrics/metrics.h"
+
+#include <boost/format.hpp>
+
+#include <poll.h>
+
+#include <cerrno>
+
+using fmt = boost::format;
+using logger = logging::logger;
+
+namespace
+{
+    auto& g_fastopen_attempts = metrics::make_counter("upstream.fastopen_attempts");
+    auto& g_fastopen_syn_data = metrics::make_counter("upstream.fastopen_syn_data");
+
+    enum : std::int32_t { eRemote, eLocal };
+    std::string ep_to_str(const uring_socket& sock, std::int32_t dir)
+    {
+        if (!sock.is_open())
+            return "socket not opened";
+
+        net::error_code ec;
+        const auto& rep = (dir == eRemote) ? sock.remote_endpoint(ec) : sock.local_endpoint(ec);
+        if (ec)
+        {
+            std::stringstream ss;
+            ss << ((dir == eRemote) ? "remote_endpoint failed: " : "local_endpoint failed: ");
+            ss << ec.message();
+            return ss.str();
+        }
+
+        net::error_code ignored_ec;
+        return { rep.address().to_string(ignored_ec) + ":" + std::to_string(rep.port()) };
+    }
+}
+
+uring_client_stream::uring_client_stream(const stream_manager_ptr& ptr, int id, net::io_context& ctx, const client_options& options)
+    : client_stream{ptr, id}
+    , ctx_{ctx}, socket_{ctx}
+    , resolver_{ctx}, options_{options}
+{}
+
+uring_client_stream::~uring_client_stream()
+{
+    auto str = (fmt("[%1%] uring client stream closed (%2%:%3%)") % id() % host_ % port_).str();
+    logger::trace(str);
+}
+
+void uring_client_stream::do_start()
+{
+    resolver_.async_resolve(
+        host_, port_,
+        [this, self{ref_from_this()}] (const net::error_code& ec, tcp::resolver::results_type results) {
+            if (!ec) {
+                do_connect(std::move(results));
+            } else {
+                handle_error(ec);
+            }
+        });
+}
+
+void uring_client_stream::do_stop()
+{
+    socket_.shutdown();
+}
+
+void uring_client_stream::do_connect(tcp::resolver::results_type&& results)
+{
+    endpoints_ = std::move(results);
+    do_connect(endpoints_.begin(), net::error::host_unreachable);
+}
+
+void uring_client_stream::do_connect(tcp::resolver::results_type::const_iterator it, net::error_code last_ec)
+{
+    if (it == endpoints_.end()) {
+        handle_error(last_ec);
+        return;
+    }
+
+    // The socket is set up through asio as usual and leaves the reactor before the connect
+    endpoint_ = it->endpoint();
+    tcp::socket socket{ctx_};
+    net::error_code ec;
+    socket.open(endpoint_.protocol(), ec);
+    if (ec) {
+        do_connect(std::next(it), ec);
+        return;
+    }
+
+    socket_options::apply_buffers(socket, options_.profile);
+    egress_ = egress_pool::get().bind(socket, endpoint_);
+    socket_options::apply(socket, options_.profile);
+
+    // With TCP_FASTOPEN_CONNECT the connect completes at once and the linked send carries the SYN
+    const bool fastopen = options_.fastopen && !early_data_.empty() && socket_options::enable_fastopen_connect(socket);
+    if (fastopen)
+        g_fastopen_attempts.add();
+
+    socket_.assign(socket);
+    const auto attempt = ++attempt_;
+    const bool linked = !early_data_.empty();
+
+    socket_.ring().connect(
+        socket_.native_handle(), endpoint_.data(), static_cast<socklen_t>(endpoint_.size()),
+        [this, self{ref_from_this()}, it, attempt, linked](int result) {
+            if (attempt != attempt_)
+                return;
+
+            if (result < 0) {
+                if (result == -EADDRNOTAVAIL)
+                    egress_.report_exhausted();
+                do_connect(std::next(it), uring_socket::error(result));
+                return;
+            }
+
+            if (!linked)
+                handle_connect();
+        },
+        linked);
+
+    if (!linked)
+        return;
+
+    // Early data rides in the same submission, linked so it only goes out once connected
+    socket_.ring().send(
+        socket_.native_handle(), early_data_.data(), early_data_.size(),
+        [this, self{ref_from_this()}, it, attempt, fastopen](int result) {
+            if (attempt != attempt_)
+                return;
+
+            if (result < 0 || static_cast<std::size_t>(result) < early_data_.size()) {
+                do_connect(std::next(it), result < 0 ? uring_socket::error(result) : net::error::broken_pipe);
+                return;
+            }
+
+            if (fastopen) {
+                do_confirm_fastopen(it);
+                return;
+            }
+
+            early_data_.clear();
+            handle_connect();
+        });
+}
+
+void uring_client_stream::do_confirm_fastopen(tcp::resolver::results_type::const_iterator it)
+{
+    // The socket turns writable again only when the handshake has finished
+    socket_.ring().poll(
+        socket_.native_handle(), POLLOUT,
+        [this, self{ref_from_this()}, it, attempt{attempt_}](int result) {
+            if (attempt != attempt_)
+                return;
+
+            auto ec = result < 0 ? uring_socket::error(result) : socket_options::pending_error(socket_.native_handle());
+            if (ec) {
+                do_connect(std::next(it), ec);
+                return;
+            }
+
+            if (socket_options::syn_data_acked(socket_.native_handle()))
+                g_fastopen_syn_data.add();
+
+            early_data_.clear();
+            handle_connect();
+        });
+}
+
+void uring_client_stream::handle_connect()
+{
+    logger::info((fmt("[%1%] connected to [%2%] --> [%3%]") % id() % host_ % ep_to_str(socket_, eRemote)));
+    logger::debug((fmt("[%1%] local address [%2%]") % id() % ep_to_str(socket_, eLocal)));
+    io_buffer event{};
+    manager().on_connect(std::move(event), ref_from_this());
+}
+
+void uring_client_stream::do_write(io_buffer event)
+{
+    socket_.async_write(
+        std::move(event),
+        [this, self{ref_from_this()}] (const net::error_code& ec) {
+            if (!ec) {
+                manager().on_write(io_buffer{}, ref_from_this());
+            } else {
+                handle_error(ec);
+            }
+        });
+}
+
+void uring_client_stream::do_read()
+{
+    socket_.async_read_some(
+        [this, self{ref_from_this()}] (const net::error_code& ec, const std::uint8_t* data, std::size_t length) {
+            if (!ec) {
+                io_buffer event{data, data + length};
+                manager().on_read(std::move(event), ref_from_this());
+            } else {
+                handle_error(ec);
+            }
+        });
+}
+
+void uring_client_stream::handle_error(const net::error_code& ec)
+{
+    manager().on_error(ec, ref_from_this());
+}
+
+void uring_client_stream::do_set_host(std::string host) { host_.swap(host); }
+
+void uring_client_stream::do_set_service(std::string service) { port_.swap(service); }
+
+void uring_client_stream::do_set_early_data(io_buffer data) { early_data_.swap(data); }
@@ -0,0 +1,56 @@
+#ifndef URING_CLIENT_STREAM_H
+#define URING_CLIENT_STREAM_H
+
+#include "uring_socket.h"
+#include "transport/client_stream.h"
+#include "transport/client_options.h"
+#include "transport/egress_pool.h"
+
+#include <asio.hpp>
+
+#include <cstdint>
+
+namespace net = asio;
+using tcp = asio::ip::tcp;
+
+class uring_client_stream final : public client_stream
+{
+public:
+    uring_client_stream(const stream_manager_ptr& ptr, int id, net::io_context& ctx, const client_options& options);
+    ~uring_client_stream() override;
+
+private:
+    void do_start() final;
+    void do_stop() final;
+
+    void do_connect(tcp::resolver::results_type&& results);
+    void do_connect(tcp::resolver::results_type::const_iterator it, net::error_code last_ec);
+    void do_confirm_fastopen(tcp::resolver::results_type::const_iterator it);
+    void handle_connect();
+
+    void do_read() final;
+    void do_write(io_buffer event) final;
+
+    void handle_error(const net::error_code& ec);
+
+    void do_set_host(std::string host) final;
+    void do_set_service(std::string service) final;
+    void do_set_early_data(io_buffer data) final;
+
+    net::io_context& ctx_;
+    uring_socket socket_;
+    tcp::resolver resolver_;
+    tcp::resolver::results_type endpoints_;
+    // Read by the kernel when the connect is submitted
+    tcp::endpoint endpoint_;
+    // Completions of an abandoned attempt, a send cancelled with its connect, are ignored
+    std::uint32_t attempt_{0};
+    client_options options_;
+    egress_pool::lease egress_;
+
+    std::string host_;
+    std::string port_;
+    io_buffer early_data_;
+};
+
+#endif //URING_CLIENT_STREAM_H
@@ -0,0 +1,98 @@
+#include "uring_server_stream.h"
+#include "transport/stream_manager.h"
+#include "transport/socket_options.h"
+#include "logger/logger.h"
+
+#include <boost/format.hpp>
+
+using fmt = boost::format;
+using logger = logging::logger;
+
+namespace
+{
+    std::string ep_to_str(const uring_socket& sock)
+    {
+        if (!sock.is_open())
+            return "socket not opened";
+
+        net::error_code ec;
+        const auto& rep = sock.remote_endpoint(ec);
+
+        if (ec)
+            return std::string{"remote_endpoint failed: " + ec.message()};
+
+        net::error_code ignored_ec;
+        return { rep.address().to_string(ignored_ec) + ":" + std::to_string(rep.port()) };
+    }
+}
+
+uring_server_stream::uring_server_stream(const stream_manager_ptr& ptr, int id, net::io_context& ctx, tcp::socket socket, const socket_profile& profile)
+    : server_stream{ptr, id}, ctx_{ctx}, socket_{ctx}
+{
+    socket_options::apply(socket, profile);
+    socket_.assign(socket);
+}
+
+uring_server_stream::~uring_server_stream()
+{
+    auto str = (fmt("[%1%] uring server stream closed") % id()).str();
+    logger::trace(str);
+}
+
+net::io_context& uring_server_stream::context() { return ctx_; }
+
+net::ip::address uring_server_stream::remote_address() const
+{
+    net::error_code ignored_ec;
+    return socket_.remote_endpoint(ignored_ec).address();
+}
+
+net::ip::address uring_server_stream::local_address() const
+{
+    net::error_code ignored_ec;
+    return socket_.local_endpoint(ignored_ec).address();
+}
+
+void uring_server_stream::do_start()
+{
+    const auto str{(fmt("[%1%] incoming connection from client: [%2%]")
+                   % id() % ep_to_str(socket_)).str()};
+    logger::debug(str);
+    do_read();
+}
+
+void uring_server_stream::do_stop()
+{
+    socket_.shutdown();
+}
+
+void uring_server_stream::do_write(io_buffer event)
+{
+    socket_.async_write(
+            std::move(event),
+            [this, self{ref_from_this()}](const net::error_code& ec) {
+                if (!ec) {
+                    manager().on_write(io_buffer{}, ref_from_this());
+                } else {
+                    handle_error(ec);
+                }
+            });
+}
+
+void uring_server_stream::do_read()
+{
+    socket_.async_read_some(
+            [this, self{ref_from_this()}](const net::error_code& ec, const std::uint8_t* data, std::size_t length) {
+                if (!ec) {
+                    io_buffer event(data, data + length);
+                    manager().on_read(std::move(event), ref_from_this());
+                } else {
+                    handle_error(ec);
+                }
+            });
+}
+
+void uring_server_stream::handle_error(const net::error_code& ec)
+{
+    manager().on_error(ec, ref_from_this());
+}
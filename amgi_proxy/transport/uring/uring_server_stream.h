@@ -0,0 +1,34 @@
+#ifndef URING_SERVER_STREAM_H
+#define URING_SERVER_STREAM_H
+
+#include "uring_socket.h"
+#include "transport/server_stream.h"
+#include "common/socket_profile.h"
+
+#include <asio.hpp>
+
+namespace net = asio;
+using tcp = asio::ip::tcp;
+
+class uring_server_stream final : public server_stream
+{
+public:
+    uring_server_stream(const stream_manager_ptr& ptr, int id, net::io_context& ctx, tcp::socket socket, const socket_profile& profile);
+    ~uring_server_stream() override;
+
+    net::io_context& context() override;
+    net::ip::address remote_address() const override;
+    net::ip::address local_address() const override;
+private:
+    void do_start() final;
+    void do_stop() final;
+    void do_read() final;
+    void do_write(io_buffer event) final;
+
+    void handle_error(const net::error_code& ec);
+
+    net::io_context& ctx_;
+    uring_socket socket_;
+};
+
+#endif //URING_SERVER_STREAM_H
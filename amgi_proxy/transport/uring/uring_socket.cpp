@@ -0,0 +1,131 @@
+#include "uring_socket.h"
+#include "transport/stream.h"
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+
+namespace
+{
+    // Below this the copy into a registered buffer and the extra notification cost more than the
+    // kernel copy they save
+    constexpr std::size_t kZeroCopyMin = stream::max_buffer_size / 2;
+
+    tcp::endpoint socket_name(int fd, bool peer, net::error_code& ec)
+    {
+        tcp::endpoint ep;
+        auto length = static_cast<socklen_t>(ep.capacity());
+        const int ret = peer ? ::getpeername(fd, ep.data(), &length) : ::getsockname(fd, ep.data(), &length);
+        if (ret != 0) {
+            ec.assign(errno, net::error::get_system_category());
+            return {};
+        }
+
+        ec = {};
+        ep.resize(length);
+        return ep;
+    }
+}
+
+uring_socket::uring_socket(net::io_context& ctx)
+    : ring_{io_ring::get(ctx)}
+{}
+
+uring_socket::~uring_socket()
+{
+    close();
+}
+
+void uring_socket::assign(tcp::socket& socket)
+{
+    close();
+    net::error_code ignored_ec;
+    fd_ = socket.release(ignored_ec);
+}
+
+void uring_socket::close()
+{
+    if (fd_ >= 0)
+        ::close(fd_);
+    fd_ = -1;
+}
+
+tcp::endpoint uring_socket::remote_endpoint(net::error_code& ec) const
+{
+    return socket_name(fd_, true, ec);
+}
+
+tcp::endpoint uring_socket::local_endpoint(net::error_code& ec) const
+{
+    return socket_name(fd_, false, ec);
+}
+
+void uring_socket::async_read_some(read_handler done)
+{
+    ring_.recv(
+        fd_,
+        [done{std::move(done)}](int result, const std::uint8_t* data) {
+            if (result > 0)
+                done({}, data, static_cast<std::size_t>(result));
+            else
+                done(result == 0 ? net::error_code{net::error::eof} : error(result), nullptr, 0);
+        });
+}
+
+void uring_socket::async_write(io_buffer data, write_handler done)
+{
+    write_buffer_ = std::move(data);
+
+    if (zero_copy_ && write_buffer_.size() >= kZeroCopyMin) {
+        // The buffer is only released after the write has completed, the handler's copy keeps
+        // the owning stream and so this socket alive until then
+        auto keep = done;
+        const bool sent = ring_.send_zero_copy(
+            fd_, write_buffer_.data(), write_buffer_.size(),
+            [this, done](int result) { handle_write(result, 0, done); },
+            [this, keep{std::move(keep)}](bool copied) {
+                if (copied)
+                    zero_copy_ = false;
+            });
+        if (sent)
+            return;
+    }
+
+    write_some(0, std::move(done));
+}
+
+void uring_socket::write_some(std::size_t offset, write_handler done)
+{
+    ring_.send(
+        fd_, write_buffer_.data() + offset, write_buffer_.size() - offset,
+        [this, offset, done{std::move(done)}](int result) { handle_write(result, offset, done); });
+}
+
+void uring_socket::handle_write(int result, std::size_t offset, write_handler done)
+{
+    if (result < 0) {
+        done(error(result));
+        return;
+    }
+
+    // A signal can cut a waiting send short, the rest goes out with the next one
+    offset += static_cast<std::size_t>(result);
+    if (offset < write_buffer_.size() && result > 0) {
+        write_some(offset, std::move(done));
+        return;
+    }
+
+    done(offset < write_buffer_.size() ? net::error_code{net::error::broken_pipe} : net::error_code{});
+}
+
+void uring_socket::shutdown()
+{
+    if (fd_ >= 0)
+        ::shutdown(fd_, SHUT_RDWR);
+}
+
+net::error_code uring_socket::error(int result)
+{
+    return {-result, net::error::get_system_category()};
+}
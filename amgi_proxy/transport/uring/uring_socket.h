@@ -0,0 +1,57 @@
+#ifndef URING_SOCKET_H
+#define URING_SOCKET_H
+
+#include "io_ring.h"
+#include "transport/io_buffer.h"
+
+#include <asio.hpp>
+
+#include <functional>
+
+namespace net = asio;
+using tcp = asio::ip::tcp;
+
+// A TCP socket taken out of the asio reactor and driven by the io thread's io_ring
+class uring_socket
+{
+public:
+    using read_handler = std::function<void(const net::error_code& ec, const std::uint8_t* data, std::size_t length)>;
+    using write_handler = std::function<void(const net::error_code& ec)>;
+
+    explicit uring_socket(net::io_context& ctx);
+    ~uring_socket();
+
+    uring_socket(const uring_socket& other) = delete;
+    uring_socket& operator=(const uring_socket& other) = delete;
+
+    // Takes over the descriptor of an open socket, the previous one is closed
+    void assign(tcp::socket& socket);
+    void close();
+
+    [[nodiscard]] bool is_open() const { return fd_ >= 0; }
+    [[nodiscard]] int native_handle() const { return fd_; }
+    io_ring& ring() { return ring_; }
+
+    tcp::endpoint remote_endpoint(net::error_code& ec) const;
+    tcp::endpoint local_endpoint(net::error_code& ec) const;
+
+    // The data is only valid during the call, an orderly close comes as net::error::eof
+    void async_read_some(read_handler done);
+    // Writes all of data, kept until then. Relay sized chunks go out zero copy until the kernel
+    // reports having copied them anyway, as it does for loopback peers
+    void async_write(io_buffer data, write_handler done);
+    void shutdown();
+
+    static net::error_code error(int result);
+
+private:
+    void write_some(std::size_t offset, write_handler done);
+    void handle_write(int result, std::size_t offset, write_handler done);
+
+    io_ring& ring_;
+    int fd_{-1};
+    io_buffer write_buffer_;
+    bool zero_copy_{true};
+};
+
+#endif // URING_SOCKET_H
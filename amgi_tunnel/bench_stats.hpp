@@ -0,0 +1,41 @@
+#ifndef BENCH_STATS_H
+#define BENCH_STATS_H
+
+#if defined(AMGI_TUNNEL_BENCH_STATS)
+
+#include <atomic>
+#include <cstdint>
+#include <sstream>
+#include <string>
+
+#if !defined(_WIN32)
+#include <sys/resource.h>
+#endif
+
+// Process wide cost of relaying for comparing the session engines under the same load,
+// main.cpp replaces the global operator new to count heap allocations
+namespace bench
+{
+    inline std::atomic<std::uint64_t> allocations{0};
+
+    inline std::string report(std::uint64_t relayed_chunks)
+    {
+        const auto count = allocations.load(std::memory_order_relaxed);
+
+        std::ostringstream ss;
+        ss << "heap allocations: " << count;
+        if (relayed_chunks)
+            ss << ", per relayed chunk: " << static_cast<double>(count) / static_cast<double>(relayed_chunks);
+
+#if !defined(_WIN32)
+        rusage usage{};
+        if (getrusage(RUSAGE_SELF, &usage) == 0)
+            ss << ", context switches: " << usage.ru_nvcsw << " voluntary, " << usage.ru_nivcsw << " involuntary";
+#endif
+        return ss.str();
+    }
+}
+
+#endif // AMGI_TUNNEL_BENCH_STATS
+
+#endif // BENCH_STATS_H
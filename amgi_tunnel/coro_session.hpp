@@ -0,0 +1,324 @@
+#ifndef CORO_SESSION_H
+#define CORO_SESSION_H
+
+#if defined(AMGI_TUNNEL_COROUTINES)
+
+#include "session.hpp"
+
+#include <asio.hpp>
+#include <asio/ssl.hpp>
+
+#include <iostream>
+#include <algorithm>
+#include <array>
+#include <chrono>
+
+using tcp = asio::ip::tcp;
+namespace net = asio;
+
+// The classic session written as coroutines: the connect sequence is straight line code and each
+// direction is one loop. Asio recycles the coroutine frames and the operation states per thread,
+// so a relayed chunk costs no allocation and no handler copies. Whichever loop ends first closes
+// both sockets, the pending operation of the other one then completes with an error and it ends too
+class coro_session
+    : public session_base
+    , public link_relay
+    , public std::enable_shared_from_this<coro_session>
+{
+    tcp::resolver resolver_;
+    tcp::socket local_sock_;
+    net::ssl::stream<tcp::socket> remote_sock_;
+    session_manager& manager_;
+    tls_session_cache& session_cache_;
+    const socket_options& sock_options_;
+
+    std::string remote_host_;
+    std::string remote_service_;
+    std::string remote_ep_;
+    std::string remote_resolved_ep_;
+
+    std::string client_ep_;
+
+    bool warm_{false};
+    bool closed_{false};
+
+    upstream_lease lease_;
+
+    buffer_type local_buffer_{};
+    buffer_type remote_buffer_{};
+
+    coro_session(net::io_context& ios,
+                 net::ssl::context& ctx,
+                 session_manager& mgr,
+                 tls_session_cache& session_cache,
+                 const socket_options& sock_options,
+                 std::string_view remote_host,
+                 std::string_view remote_service,
+                 const link_options& link,
+                 upstream_lease lease)
+        : link_relay{link}
+        , resolver_{ios}
+        , local_sock_{ios}
+        , remote_sock_{ios, ctx}
+        , manager_{mgr}
+        , session_cache_{session_cache}
+        , sock_options_{sock_options}
+        , remote_host_{remote_host}
+        , remote_service_{remote_service}
+        , lease_{std::move(lease)}
+    {
+        remote_ep_ = remote_host_ + ':' + remote_service_;
+        remote_sock_.set_verify_mode(net::ssl::verify_peer);
+    }
+
+    coro_session(net::io_context& ios,
+                 net::ssl::stream<tcp::socket>&& remote,
+                 session_manager& mgr,
+                 tls_session_cache& session_cache,
+                 const socket_options& sock_options,
+                 std::string_view remote_host,
+                 std::string_view remote_service,
+                 const link_options& link,
+                 upstream_lease lease)
+        : link_relay{link}
+        , resolver_{ios}
+        , local_sock_{ios}
+        , remote_sock_{std::move(remote)}
+        , manager_{mgr}
+        , session_cache_{session_cache}
+        , sock_options_{sock_options}
+        , remote_host_{remote_host}
+        , remote_service_{remote_service}
+        , warm_{true}
+        , lease_{std::move(lease)}
+    {
+        remote_ep_ = remote_host_ + ':' + remote_service_;
+    }
+
+public:
+    ~coro_session() override
+    {
+        report_closed(manager_, client_ep_, remote_ep_ + remote_resolved_ep_);
+    }
+
+    using pointer = std::shared_ptr<coro_session>;
+
+    tcp::socket& socket() { return local_sock_; }
+
+    static pointer create(net::io_context& io_context,
+                          net::ssl::context& ctx,
+                          session_manager& mgr,
+                          tls_session_cache& session_cache,
+                          const socket_options& sock_options,
+                          std::string_view remote_host,
+                          std::string_view remote_port,
+                          const link_options& link,
+                          upstream_lease lease = {})
+    {
+        return pointer(new coro_session(io_context, ctx, mgr, session_cache, sock_options, remote_host, remote_port, link, std::move(lease)));
+    }
+
+    static pointer create(net::io_context& io_context,
+                          net::ssl::stream<tcp::socket>&& remote,
+                          session_manager& mgr,
+                          tls_session_cache& session_cache,
+                          const socket_options& sock_options,
+                          std::string_view remote_host,
+                          std::string_view remote_port,
+                          const link_options& link,
+                          upstream_lease lease = {})
+    {
+        return pointer(new coro_session(io_context, std::move(remote), mgr, session_cache, sock_options, remote_host, remote_port, link, std::move(lease)));
+    }
+
+    void start()
+    {
+        manager_.join(shared_from_this());
+        client_ep_ = ep_to_str(local_sock_, eRemote);
+        apply_profile(local_sock_, sock_options_.profile);
+
+        auto& stats = manager_.stats();
+        session_stats::bump(stats.opened);
+        std::cout
+            << "accepted connection from " << client_ep_
+            << " , sescnt: " << manager_.ses_count() << ", scnt: " << stats.live() << std::endl;
+
+        net::co_spawn(local_sock_.get_executor(), run(shared_from_this()), net::detached);
+    }
+
+    void stop() override
+    {
+        close();
+    }
+
+private:
+    // Leaving the manager drops its reference, the frames of both loops hold the rest
+    void close()
+    {
+        if (closed_)
+            return;
+        closed_ = true;
+
+        net::error_code ignored_ec;
+        if (local_sock_.is_open()) {
+            local_sock_.shutdown(net::socket_base::shutdown_both, ignored_ec);
+            local_sock_.close(ignored_ec);
+        }
+
+        if (remote_sock_.lowest_layer().is_open()) {
+            remote_sock_.lowest_layer().cancel(ignored_ec);
+            remote_sock_.async_shutdown(
+                [self{shared_from_this()}](const net::error_code& ec) {
+                    if (ec && ec != net::error::operation_aborted && ec.category() == net::error::get_ssl_category())
+                        std::cout << ec.message() << " value: " << ec.value() << std::endl;
+
+                    net::error_code ignored_ec;
+                    self->remote_sock_.lowest_layer().close(ignored_ec);
+                });
+        }
+    }
+
+    net::awaitable<void> run(pointer self)
+    {
+        if (warm_) {
+            remote_resolved_ep_ = '(' + ep_to_str(remote_sock_, eRemote) + ')';
+        } else {
+            const auto connected = co_await connect();
+            if (!connected) {
+                lease_.failed();
+                manager_.leave(self);
+                co_return;
+            }
+        }
+        negotiate_compression(remote_sock_.native_handle());
+
+        net::co_spawn(local_sock_.get_executor(), relay_from_remote(self), net::detached);
+        co_await relay_from_local();
+        manager_.leave(self);
+    }
+
+    // Endpoints are tried one by one so the socket can be tuned before each connect
+    net::awaitable<bool> connect()
+    {
+        const auto connect_started = clock::now();
+        net::error_code ec;
+        const auto eps = co_await resolver_.async_resolve(remote_host_, remote_service_, net::redirect_error(net::use_awaitable, ec));
+        if (ec) {
+            std::cout << '[' << remote_ep_ << "] " << ec.message() << std::endl;
+            co_return false;
+        }
+
+        auto& sock = remote_sock_.lowest_layer();
+        for (const auto& entry : eps) {
+            sock.close(ec);
+            sock.open(entry.endpoint().protocol(), ec);
+            if (ec)
+                continue;
+
+            apply_buffers(sock, sock_options_.profile);
+            if (sock_options_.fastopen_connect)
+                enable_fastopen_connect(sock);
+
+            co_await sock.async_connect(entry.endpoint(), net::redirect_error(net::use_awaitable, ec));
+            if (ec) {
+                std::cout << ec.message() << std::endl;
+                continue;
+            }
+
+            remote_resolved_ep_ = '(' + ep_to_str(remote_sock_, eRemote) + ')';
+            std::cout << "connection from " << client_ep_ << " to "
+                << remote_ep_ << remote_resolved_ep_ << " established\n";
+            apply_profile(sock, sock_options_.profile);
+
+            session_cache_.prepare(remote_sock_.native_handle(), remote_ep_);
+            const auto started = tls_session_cache::clock::now();
+            co_await remote_sock_.async_handshake(net::ssl::stream_base::client, net::redirect_error(net::use_awaitable, ec));
+            if (ec) {
+                std::cout << "Handshake failed: " << ec.message() << "\n";
+                co_return false;
+            }
+
+            session_cache_.record(remote_sock_.native_handle(), tls_session_cache::clock::now() - started);
+            lease_.connected(clock::now() - connect_started);
+            co_return true;
+        }
+
+        std::cout << "connection from " << client_ep_ << " to " << remote_ep_ << " failed" << std::endl;
+        co_return false;
+    }
+
+    net::awaitable<void> relay_from_local()
+    {
+        net::error_code ec;
+        for (;;) {
+            auto size = co_await local_sock_.async_read_some(net::buffer(local_buffer_), net::redirect_error(net::use_awaitable, ec));
+            if (ec || size == 0)
+                co_return;
+            size += coalesce_local(local_sock_, local_buffer_, size);
+            session_stats::bump(manager_.stats().relayed_chunks);
+
+            const std::uint8_t* data = local_buffer_.data();
+            if (compressor_) {
+                encoded_.clear();
+                if (!compressor_->encode(data, size, encoded_))
+                    co_return;
+                data = encoded_.data();
+                size = encoded_.size();
+            }
+
+            // Each async_write of at most one record's worth becomes a single TLS record
+            for (std::size_t offset = 0; offset < size;) {
+                const auto record = std::min(size - offset, next_record_size());
+                const auto written = co_await net::async_write(remote_sock_, net::buffer(data + offset, record), net::redirect_error(net::use_awaitable, ec));
+                if (ec || written == 0)
+                    co_return;
+
+                record_written(manager_.stats(), written);
+                offset += written;
+            }
+        }
+    }
+
+    net::awaitable<void> relay_from_remote(pointer self)
+    {
+        net::error_code ec;
+        for (;;) {
+            const auto size = co_await remote_sock_.async_read_some(net::buffer(remote_buffer_), net::redirect_error(net::use_awaitable, ec));
+            if (ec || size == 0)
+                break;
+            session_stats::bump(manager_.stats().relayed_chunks);
+
+            if (!compressor_) {
+                co_await net::async_write(local_sock_, net::buffer(remote_buffer_.data(), size), net::redirect_error(net::use_awaitable, ec));
+                if (ec)
+                    break;
+                continue;
+            }
+
+            // One compressed read may expand to many writes, the next read waits until its input is used up
+            compressor_->feed(remote_buffer_.data(), size);
+            for (;;) {
+                const auto decoded = compressor_->pull(decoded_.data(), decoded_.size());
+                if (!decoded) {
+                    std::cout << "corrupt compressed stream from " << remote_ep_ << std::endl;
+                    ec = net::error::invalid_argument;
+                    break;
+                }
+                if (*decoded == 0)
+                    break;
+
+                co_await net::async_write(local_sock_, net::buffer(decoded_.data(), *decoded), net::redirect_error(net::use_awaitable, ec));
+                if (ec)
+                    break;
+            }
+            if (ec)
+                break;
+        }
+
+        manager_.leave(self);
+    }
+};
+
+#endif // AMGI_TUNNEL_COROUTINES
+
+#endif // CORO_SESSION_H
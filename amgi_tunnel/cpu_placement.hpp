@@ -0,0 +1,114 @@
+#ifndef CPU_PLACEMENT_H
+#define CPU_PLACEMENT_H
+
+#if defined(__linux__)
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <charconv>
+#include <cstddef>
+#include <iostream>
+#include <optional>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+// Which cpu every worker runs on. A pinned worker is also built on its cpu with a node local
+// memory policy, so its io context, pools and the sessions it allocates later stay on that node
+class cpu_placement
+{
+public:
+    cpu_placement() = default;
+
+    cpu_placement(std::vector<int> cpus, bool steer_accepts)
+        : cpus_{std::move(cpus)}
+        , steer_accepts_{steer_accepts && !cpus_.empty()}
+    {}
+
+    // "0-3,8,10-11" style list as taskset and numactl take it
+    static std::optional<std::vector<int>> parse_list(std::string_view list)
+    {
+        std::vector<int> cpus;
+        while (!list.empty()) {
+            const auto comma = list.find(',');
+            const auto item = list.substr(0, comma);
+            list = comma == std::string_view::npos ? std::string_view{} : list.substr(comma + 1);
+
+            const auto dash = item.find('-');
+            int first{-1};
+            int last{-1};
+            if (!parse_cpu(item.substr(0, dash), first))
+                return std::nullopt;
+            if (dash == std::string_view::npos)
+                last = first;
+            else if (!parse_cpu(item.substr(dash + 1), last) || last < first)
+                return std::nullopt;
+
+            for (int cpu = first; cpu <= last; ++cpu)
+                cpus.push_back(cpu);
+        }
+        return cpus;
+    }
+
+    [[nodiscard]] bool enabled() const { return !cpus_.empty(); }
+    [[nodiscard]] std::size_t size() const { return cpus_.size(); }
+
+    // Workers beyond the list wrap around it
+    [[nodiscard]] int cpu(std::size_t worker) const { return cpus_.empty() ? -1 : cpus_[worker % cpus_.size()]; }
+
+    // Cpu the worker's listener asks for connections of, -1 - any
+    [[nodiscard]] int incoming_cpu(std::size_t worker) const { return steer_accepts_ ? cpu(worker) : -1; }
+
+    // Moves the calling thread to the worker's cpu, allocations made from here on come from its node
+    bool enter(std::size_t worker) const
+    {
+        if (cpus_.empty())
+            return true;
+
+#if defined(__linux__)
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu(worker), &set);
+        if (const auto err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set)) {
+            std::cout << "failed to pin worker " << worker << " to cpu " << cpu(worker) << ": " << std::system_category().message(err) << std::endl;
+            return false;
+        }
+
+        // Overrides an inherited policy, e.g. numactl --interleave
+        if (syscall(SYS_set_mempolicy, MPOL_LOCAL, nullptr, 0) != 0)
+            std::cout << "failed to set a node local memory policy for worker " << worker << std::endl;
+
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    // Node of the cpu the calling thread runs on, -1 when unknown
+    static int current_node()
+    {
+#if defined(__linux__) && defined(SYS_getcpu)
+        unsigned cpu{0};
+        unsigned node{0};
+        if (syscall(SYS_getcpu, &cpu, &node, nullptr) == 0)
+            return static_cast<int>(node);
+#endif
+        return -1;
+    }
+
+private:
+    static bool parse_cpu(std::string_view str, int& cpu)
+    {
+        const auto [end, ec] = std::from_chars(str.data(), str.data() + str.size(), cpu);
+        return ec == std::errc{} && end == str.data() + str.size() && cpu >= 0;
+    }
+
+    std::vector<int> cpus_;
+    bool steer_accepts_{false};
+};
+
+#endif // CPU_PLACEMENT_H
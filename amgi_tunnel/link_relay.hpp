@@ -0,0 +1,128 @@
+#ifndef LINK_RELAY_H
+#define LINK_RELAY_H
+
+#include "manager.hpp"
+#include "common/stream_codec.h"
+
+#include <asio.hpp>
+#include <asio/ssl.hpp>
+
+#include <iostream>
+#include <array>
+#include <chrono>
+#include <memory>
+#include <string_view>
+
+using tcp = asio::ip::tcp;
+namespace net = asio;
+
+// How classic sessions use their TLS connection to the target
+struct link_options
+{
+    // Bytes sent in small records after connect or idle before switching to full ones, zero - always full
+    std::size_t record_boost{0x20000};
+    // zlib level offered to the proxy, zero - no compression
+    int compression{0};
+};
+
+// What the callback and the coroutine sessions share about relaying over their link: record
+// sizing, compression and the report when the session ends. Only the flow of operations differs
+class link_relay
+{
+protected:
+    enum { max_buff_size = 0x4000 };
+    using buffer_type = std::array<std::uint8_t, max_buff_size>;
+    using clock = std::chrono::steady_clock;
+
+    // Fits one TCP segment with TLS 1.3 framing, the target decrypts it as soon as it arrives
+    static constexpr std::size_t small_record = 1360;
+    static constexpr auto idle_reset = std::chrono::seconds(1);
+
+    explicit link_relay(const link_options& link)
+        : link_{link}
+    {}
+
+    // Small writes that queued up while the last record went out join this one
+    static std::size_t coalesce_local(tcp::socket& sock, buffer_type& buffer, std::size_t filled)
+    {
+        net::error_code ec;
+        if (filled == buffer.size() || sock.available(ec) == 0 || ec)
+            return 0;
+
+        const auto n = sock.read_some(net::buffer(buffer.data() + filled, buffer.size() - filled), ec);
+        return ec ? 0 : n;
+    }
+
+    // Small records at the start and after an idle period keep the first bytes
+    // decryptable early, bulk transfers then switch to full records
+    std::size_t next_record_size()
+    {
+        const auto now = clock::now();
+        if (now - last_write_ > idle_reset)
+            boosted_bytes_ = 0;
+        last_write_ = now;
+
+        if (!link_.record_boost || boosted_bytes_ >= link_.record_boost)
+            return max_buff_size;
+        return small_record;
+    }
+
+    void record_written(session_stats& stats, std::size_t written)
+    {
+        session_stats::bump(stats.records);
+        session_stats::bump(stats.record_bytes, written);
+        if (written <= small_record)
+            session_stats::bump(stats.small_records);
+        boosted_bytes_ += written;
+    }
+
+    void negotiate_compression(SSL* ssl)
+    {
+        const unsigned char* protocol{nullptr};
+        unsigned int length{0};
+        SSL_get0_alpn_selected(ssl, &protocol, &length);
+
+        compressor_ = stream_compressor::negotiate({reinterpret_cast<const char*>(protocol), length}, link_.compression, compression_);
+        if (compressor_)
+            decoded_.resize(max_buff_size);
+    }
+
+    // Called from the session's destructor, while its endpoints are still around
+    void report_closed(session_manager& manager, std::string_view client_ep, std::string_view remote_ep) const
+    {
+        auto& stats = manager.stats();
+        if (compressor_) {
+            session_stats::bump(stats.compressed_in, compression_.in);
+            session_stats::bump(stats.compressed_out, compression_.out);
+            session_stats::bump(stats.compression_bypassed, compression_.bypassed_bytes);
+        }
+
+        session_stats::bump(stats.closed);
+        std::cout
+            << "connection from "
+            << client_ep << " to " << remote_ep
+            << " closed, sescnt: " << manager.ses_count() << ", scnt: " << stats.live() << std::endl;
+    }
+
+    link_options link_;
+    std::size_t boosted_bytes_{0};
+    clock::time_point last_write_{};
+
+    // Added to the manager's totals once the session closes
+    struct compression_counters final : codec::observer {
+        void compressed(std::size_t size, std::size_t written) override { in += size; out += written; }
+        void bypassed(std::size_t size) override { bypassed_bytes += size; }
+
+        std::uint64_t in{0};
+        std::uint64_t out{0};
+        std::uint64_t bypassed_bytes{0};
+    };
+
+    compression_counters compression_;
+    // Set when the proxy agreed to compress the link
+    std::unique_ptr<stream_compressor> compressor_;
+    codec::buffer encoded_;
+    codec::buffer decoded_;
+};
+
+#endif // LINK_RELAY_H
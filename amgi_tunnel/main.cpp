@@ -1,16 +1,45 @@
 #include "server.hpp"
 
 #include <cli_parser.h>
+#include <charconv>
+#include <cstdlib>
 #include <iostream>
+#include <new>
+#include <thread>
+
+#if defined(AMGI_TUNNEL_BENCH_STATS)
+// Every C++ allocation of the process goes through here, OpenSSL's own mallocs are not counted
+void* operator new(std::size_t size)
+{
+    bench::allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* ptr = std::malloc(size ? size : 1))
+        return ptr;
+    throw std::bad_alloc{};
+}
+
+void operator delete(void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+#endif
 
 namespace
 {
     struct server_conf 
     {
         std::string listen_port;
-        std::string target_port;
-        std::string target_host;
+        std::vector<upstream_target> targets;
+        upstream_group::options balance;
         server::tls_options tls_options;
+        socket_options sock_options;
+        std::size_t threads{1};
+        cpu_placement placement;
+        std::chrono::seconds report_interval{0};
     };
 
     server_conf parse_command_line_arguments_new(int argc, char* argv[])
@@ -28,7 +57,23 @@ namespace
             .add_parameter(Param("d,target-host").required().default_value("127.0.0.1").description("tls forwarder target host"))
             .add_parameter(Param("p,private-key").required().description("private key file path (pem format)"))
             .add_parameter(Param("s,client-cert").required().description("client certificate file path (pem format)"))
-            .add_parameter(Param("c,ca-cert").required().description("CA certificate file path (pem format)"));
+            .add_parameter(Param("c,ca-cert").required().description("CA certificate file path (pem format)"))
+            .add_parameter(Param("u,targets").default_value("").description("comma separated host:port list of targets, replaces target-host and target-port"))
+            .add_parameter(Param("r,balance").default_value("round-robin").description("target selection [round-robin|least-active|latency|client-hash]"))
+            .add_parameter(Param("e,probe-interval").default_value("5").description("seconds between tcp and tls health probes of every target (0 - passive failure detection only)"))
+            .add_parameter(Param("f,fastopen").default_value("0").description("TCP fast open queue length, also enables fast open towards the target (0 - disabled)"))
+            .add_parameter(Param("b,record-boost").default_value("131072").description("bytes sent in single segment tls records at connection start and after idle before full records are used (0 - always full records)"))
+            .add_parameter(Param("m,mux-links").default_value("0").description("number of long lived tls links client connections are multiplexed over (0 - a tls connection per client)"))
+            .add_parameter(Param("w,warm-min").default_value("0").description("handshaked target connections kept ready for new clients, ignored with mux links (0 - disabled)"))
+            .add_parameter(Param("x,warm-max").default_value("0").description("upper bound of ready target connections (not less than warm-min)"))
+            .add_parameter(Param("a,warm-max-age").default_value("30").description("seconds a ready target connection may stay idle before it is replaced"))
+            .add_parameter(Param("n,threads").default_value("1").description("io threads, each with its own listener on the port (0 - one per core, or per listed cpu)"))
+            .add_parameter(Param("g,cpus").default_value("").description("cpu list io threads are pinned to in order, e.g. 0-3,8, each allocates from its cpu's numa node (empty - no pinning)"))
+            .add_parameter(Param("q,incoming-cpu").default_value("0").description("steer each accepted connection to the io thread pinned to the cpu that received it (SO_INCOMING_CPU), needs cpus"))
+            .add_parameter(Param("z,compression").default_value("0").description("zlib level (1-9) of link compression offered to the proxy, poorly compressing flows bypass it (0 - disabled)"))
+            .add_parameter(Param("k,coroutines").default_value("0").description("relay plain links with coroutine sessions, needs a build with AMGI_TUNNEL_COROUTINES (0 - callback sessions)"))
+            .add_parameter(Param("o,socket-profile").default_value("default").description("socket tuning of both legs [default|latency|throughput]"))
+            .add_parameter(Param("i,report-interval").default_value("0").description("seconds between reports of target health, tls resumption and session counters (0 - report at exit only)"));
 
         if (const auto msg = argParser.parse(argc, argv)) {
             std::cout << *msg << std::endl;
@@ -38,8 +83,74 @@ namespace
             srv_conf.tls_options.client_cert = argParser.arg("s").get_value_as_str();
             srv_conf.tls_options.ca_cert = argParser.arg("c").get_value_as_str();
             srv_conf.listen_port = argParser.arg("l").get_value_as_str();
-            srv_conf.target_host = argParser.arg("d").get_value_as_str();
-            srv_conf.target_port = argParser.arg("t").get_value_as_str();
+
+            srv_conf.targets = upstream_target::parse_list(argParser.arg("u").get_value_as_str());
+            if (srv_conf.targets.empty())
+                srv_conf.targets.push_back({argParser.arg("d").get_value_as_str(), argParser.arg("t").get_value_as_str()});
+
+            if (const auto policy = parse_balance_policy(argParser.arg("r").get_value_as_str()))
+                srv_conf.balance.policy = *policy;
+            else
+                std::cout << "unknown balance policy, using round-robin" << std::endl;
+
+            const auto probe_interval = argParser.arg("e").get_value_as_str();
+            std::size_t probe_interval_sec{5};
+            std::from_chars(probe_interval.data(), probe_interval.data() + probe_interval.size(), probe_interval_sec);
+            srv_conf.balance.probe_interval = std::chrono::seconds(probe_interval_sec);
+
+            const auto fastopen = argParser.arg("f").get_value_as_str();
+            std::from_chars(fastopen.data(), fastopen.data() + fastopen.size(), srv_conf.sock_options.fastopen_queue);
+            srv_conf.sock_options.fastopen_connect = srv_conf.sock_options.fastopen_queue > 0;
+
+            const auto boost = argParser.arg("b").get_value_as_str();
+            std::from_chars(boost.data(), boost.data() + boost.size(), srv_conf.tls_options.record_boost);
+
+            const auto mux_links = argParser.arg("m").get_value_as_str();
+            std::from_chars(mux_links.data(), mux_links.data() + mux_links.size(), srv_conf.tls_options.mux_links);
+
+            const auto warm_min = argParser.arg("w").get_value_as_str();
+            std::from_chars(warm_min.data(), warm_min.data() + warm_min.size(), srv_conf.tls_options.warm.min_idle);
+
+            const auto warm_max = argParser.arg("x").get_value_as_str();
+            std::from_chars(warm_max.data(), warm_max.data() + warm_max.size(), srv_conf.tls_options.warm.max_idle);
+
+            const auto warm_age = argParser.arg("a").get_value_as_str();
+            std::size_t warm_age_sec{30};
+            std::from_chars(warm_age.data(), warm_age.data() + warm_age.size(), warm_age_sec);
+            srv_conf.tls_options.warm.max_age = std::chrono::seconds(warm_age_sec);
+
+            const auto compression = argParser.arg("z").get_value_as_str();
+            std::from_chars(compression.data(), compression.data() + compression.size(), srv_conf.tls_options.compression);
+
+            const auto coroutines = argParser.arg("k").get_value_as_str();
+            srv_conf.tls_options.coroutines = !coroutines.empty() && coroutines != "0";
+#if !defined(AMGI_TUNNEL_COROUTINES)
+            if (srv_conf.tls_options.coroutines)
+                std::cout << "built without coroutine sessions, using callback sessions" << std::endl;
+#endif
+
+            const auto cpus = cpu_placement::parse_list(argParser.arg("g").get_value_as_str());
+            if (!cpus)
+                std::cout << "bad cpu list, io threads are not pinned" << std::endl;
+            const auto incoming_cpu = argParser.arg("q").get_value_as_str();
+            srv_conf.placement = cpu_placement{cpus.value_or(std::vector<int>{}), !incoming_cpu.empty() && incoming_cpu != "0"};
+
+            const auto threads = argParser.arg("n").get_value_as_str();
+            std::from_chars(threads.data(), threads.data() + threads.size(), srv_conf.threads);
+            if (srv_conf.threads == 0)
+                srv_conf.threads = srv_conf.placement.enabled() ? srv_conf.placement.size() : std::max(1u, std::thread::hardware_concurrency());
+
+            const auto profile = socket_profile::preset(argParser.arg("o").get_value_as_str());
+            if (!profile) {
+                std::cout << "Error: socket profile must be one of [" << socket_profile::preset_names << "]" << std::endl;
+                exit(EXIT_FAILURE);
+            }
+            srv_conf.sock_options.profile = *profile;
+
+            const auto report_interval = argParser.arg("i").get_value_as_str();
+            std::size_t report_interval_sec{0};
+            std::from_chars(report_interval.data(), report_interval.data() + report_interval.size(), report_interval_sec);
+            srv_conf.report_interval = std::chrono::seconds(report_interval_sec);
         }
 
         return srv_conf;
@@ -53,7 +164,8 @@ int main(int argc, char* argv[])
     std::locale::global(std::locale(""));
 
     try {
-        server srv(conf.listen_port, conf.target_host, conf.target_port, conf.tls_options);
+        server srv(conf.listen_port, conf.targets, conf.balance, conf.tls_options, conf.sock_options, conf.threads, conf.placement,
+                   conf.report_interval);
         srv.run();
     } catch (const std::exception& ex) {
         std::cerr << ex.what() << std::endl;
@@ -1,8 +1,12 @@
 #ifndef MANAGER_H
 #define MANAGER_H
 
+#include <atomic>
+#include <cstdint>
 #include <set>
 #include <memory>
+#include <sstream>
+#include <string>
 
 class session_base 
 {
@@ -13,6 +17,67 @@ public:
 
 using session_base_ptr = std::shared_ptr<session_base>;
 
+// Counters of one io thread. Only the owning thread writes them, so a bump is a plain
+// load and store; readers on other threads sum them up across workers
+struct session_stats
+{
+    std::atomic<std::uint64_t> opened{0};
+    std::atomic<std::uint64_t> closed{0};
+    std::atomic<std::uint64_t> records{0};
+    std::atomic<std::uint64_t> record_bytes{0};
+    std::atomic<std::uint64_t> small_records{0};
+    std::atomic<std::uint64_t> compressed_in{0};
+    std::atomic<std::uint64_t> compressed_out{0};
+    std::atomic<std::uint64_t> compression_bypassed{0};
+    // Reads passed on in either direction
+    std::atomic<std::uint64_t> relayed_chunks{0};
+
+    static void bump(std::atomic<std::uint64_t>& counter, std::uint64_t n = 1)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    std::uint64_t live() const
+    {
+        return opened.load(std::memory_order_relaxed) - closed.load(std::memory_order_relaxed);
+    }
+};
+
+struct session_totals
+{
+    std::uint64_t opened{0};
+    std::uint64_t records{0};
+    std::uint64_t record_bytes{0};
+    std::uint64_t small_records{0};
+    std::uint64_t compressed_in{0};
+    std::uint64_t compressed_out{0};
+    std::uint64_t compression_bypassed{0};
+    std::uint64_t relayed_chunks{0};
+
+    session_totals& operator+=(const session_stats& stats)
+    {
+        opened += stats.opened.load(std::memory_order_relaxed);
+        records += stats.records.load(std::memory_order_relaxed);
+        record_bytes += stats.record_bytes.load(std::memory_order_relaxed);
+        small_records += stats.small_records.load(std::memory_order_relaxed);
+        compressed_in += stats.compressed_in.load(std::memory_order_relaxed);
+        compressed_out += stats.compressed_out.load(std::memory_order_relaxed);
+        compression_bypassed += stats.compression_bypassed.load(std::memory_order_relaxed);
+        relayed_chunks += stats.relayed_chunks.load(std::memory_order_relaxed);
+        return *this;
+    }
+
+    std::string report() const
+    {
+        std::ostringstream ss;
+        ss << "sessions: " << opened << ", relayed chunks: " << relayed_chunks << ", tls records: " << records << ", small: " << small_records
+           << ", avg size: " << (records ? record_bytes / records : 0) << " bytes";
+        if (compressed_in || compression_bypassed)
+            ss << ", compressed: " << compressed_in << " -> " << compressed_out << " bytes, bypassed: " << compression_bypassed << " bytes";
+        return ss.str();
+    }
+};
+
 class session_manager 
 {
 public:
@@ -28,8 +93,12 @@ public:
     }
 
     std::size_t ses_count() { return sessions_.size(); }
+
+    session_stats& stats() { return stats_; }
+    const session_stats& stats() const { return stats_; }
 private:
     std::set<session_base_ptr> sessions_;
+    session_stats stats_;
 };
 
 
@@ -0,0 +1,411 @@
+#ifndef MUX_LINK_H
+#define MUX_LINK_H
+
+#include "socket_options.hpp"
+#include "tls_session_cache.hpp"
+#include "common/mux_frame.h"
+
+#include <asio.hpp>
+#include <asio/ssl.hpp>
+
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+using tcp = asio::ip::tcp;
+namespace net = asio;
+
+namespace mux
+{
+    using buffer = std::vector<std::uint8_t>;
+
+    // A local connection carried by a link
+    class channel
+    {
+    public:
+        virtual ~channel() = default;
+        // False when the data overran the channel's receive window
+        [[nodiscard]] virtual bool on_data(const std::uint8_t* data, std::size_t size) = 0;
+        virtual void on_window(std::uint32_t increment) = 0;
+        virtual void on_close() = 0;
+    };
+}
+
+// One long lived TLS connection to the proxy carrying many local connections,
+// it takes channels once the handshake agreed on the protocol
+class mux_link : public std::enable_shared_from_this<mux_link>
+{
+    using clock = std::chrono::steady_clock;
+
+    static constexpr auto keepalive_interval = std::chrono::seconds(15);
+    static constexpr auto dead_interval = 3 * keepalive_interval;
+
+public:
+    enum class state { connecting, ready, failed, refused };
+
+    mux_link(net::io_context& ioc, net::ssl::context& ctx, tls_session_cache& session_cache, const socket_options& sock_options,
+             std::string_view remote_host, std::string_view remote_service)
+        : resolver_{ioc}
+        , remote_sock_{ioc, ctx}
+        , keepalive_timer_{ioc}
+        , session_cache_{session_cache}
+        , sock_options_{sock_options}
+        , remote_host_{remote_host}
+        , remote_service_{remote_service}
+        , remote_ep_{remote_host_ + ':' + remote_service_}
+    {
+        remote_sock_.set_verify_mode(net::ssl::verify_peer);
+        SSL_set_alpn_protos(remote_sock_.native_handle(),
+                            reinterpret_cast<const unsigned char*>(mux::alpn_protocol.data()),
+                            static_cast<unsigned int>(mux::alpn_protocol.size()));
+    }
+
+    void start()
+    {
+        resolver_.async_resolve(
+            remote_host_, remote_service_,
+            [this, self{shared_from_this()}](const net::error_code& ec, const tcp::resolver::results_type& eps) {
+                if (ec) {
+                    std::cout << "mux link [" << remote_ep_ << "] " << ec.message() << std::endl;
+                    fail();
+                    return;
+                }
+                do_connect(eps, eps.begin());
+            });
+    }
+
+    [[nodiscard]] bool alive() const { return state_ == state::connecting || state_ == state::ready; }
+    [[nodiscard]] bool ready() const { return state_ == state::ready; }
+    [[nodiscard]] bool refused() const { return state_ == state::refused; }
+    [[nodiscard]] std::size_t channels() const { return channels_.size(); }
+
+    std::uint32_t open(std::shared_ptr<mux::channel> channel, const std::string& client)
+    {
+        const auto id = next_channel_;
+        next_channel_ += 2;
+        channels_.emplace(id, std::move(channel));
+        send_frame(mux::frame_type::open, id, reinterpret_cast<const std::uint8_t*>(client.data()), client.size());
+        return id;
+    }
+
+    void send_data(std::uint32_t channel, const std::uint8_t* data, std::size_t size)
+    {
+        send_frame(mux::frame_type::data, channel, data, size);
+    }
+
+    void send_window(std::uint32_t channel, std::uint32_t increment)
+    {
+        std::uint8_t payload[4];
+        mux::write_u32(payload, increment);
+        send_frame(mux::frame_type::window, channel, payload, sizeof(payload));
+    }
+
+    void close_channel(std::uint32_t channel, bool notify_peer)
+    {
+        channels_.erase(channel);
+        if (notify_peer)
+            send_frame(mux::frame_type::close, channel, nullptr, 0);
+    }
+
+private:
+    void do_connect(const tcp::resolver::results_type& eps, tcp::resolver::results_type::const_iterator it)
+    {
+        if (it == eps.end()) {
+            std::cout << "mux link to " << remote_ep_ << " failed" << std::endl;
+            fail();
+            return;
+        }
+
+        auto& sock = remote_sock_.lowest_layer();
+        net::error_code ec;
+        sock.close(ec);
+        sock.open(it->endpoint().protocol(), ec);
+        if (ec) {
+            do_connect(eps, std::next(it));
+            return;
+        }
+
+        apply_buffers(sock, sock_options_.profile);
+        sock.async_connect(
+            it->endpoint(),
+            [this, self{shared_from_this()}, eps, it](const net::error_code& ec) {
+                if (ec) {
+                    do_connect(eps, std::next(it));
+                    return;
+                }
+
+                apply_profile(remote_sock_.lowest_layer(), sock_options_.profile);
+                // Small frames of many channels share the link, Nagle would hold them back
+                net::error_code ignored_ec;
+                remote_sock_.lowest_layer().set_option(tcp::no_delay(true), ignored_ec);
+                handshake();
+            });
+    }
+
+    void handshake()
+    {
+        session_cache_.prepare(remote_sock_.native_handle(), remote_ep_);
+        remote_sock_.async_handshake(
+            net::ssl::stream_base::client,
+            [this, self{shared_from_this()}, started{clock::now()}](const net::error_code& ec) {
+                if (ec) {
+                    std::cout << "mux link handshake failed: " << ec.message() << std::endl;
+                    fail();
+                    return;
+                }
+
+                session_cache_.record(remote_sock_.native_handle(), clock::now() - started);
+
+                const unsigned char* protocol{nullptr};
+                unsigned int length{0};
+                SSL_get0_alpn_selected(remote_sock_.native_handle(), &protocol, &length);
+                if (length + 1 != mux::alpn_protocol.size() || std::memcmp(protocol, mux::alpn_protocol.data() + 1, length) != 0) {
+                    std::cout << "proxy at " << remote_ep_ << " does not support multiplexing" << std::endl;
+                    fail(state::refused);
+                    return;
+                }
+
+                std::cout << "mux link to " << remote_ep_ << " established" << std::endl;
+                state_ = state::ready;
+                last_received_ = clock::now();
+                do_read();
+                flush();
+                arm_keepalive();
+            });
+    }
+
+    void do_read()
+    {
+        remote_sock_.async_read_some(
+            net::buffer(read_buffer_),
+            [this, self{shared_from_this()}](const net::error_code& ec, std::size_t bytes_transferred) {
+                if (ec) {
+                    fail();
+                    return;
+                }
+
+                last_received_ = clock::now();
+                input_.insert(input_.end(), read_buffer_.begin(), read_buffer_.begin() + bytes_transferred);
+                handle_frames();
+                if (alive())
+                    do_read();
+            });
+    }
+
+    void handle_frames()
+    {
+        std::size_t offset{0};
+        while (alive()) {
+            const auto header = mux::parse_frame(input_.data() + offset, input_.size() - offset);
+            if (!header)
+                break;
+
+            handle_frame(*header, input_.data() + offset + mux::header_size);
+            offset += mux::header_size + header->length;
+        }
+
+        if (alive())
+            input_.erase(input_.begin(), input_.begin() + static_cast<std::ptrdiff_t>(offset));
+    }
+
+    void handle_frame(const mux::frame_header& header, const std::uint8_t* payload)
+    {
+        const auto length = header.length;
+        const auto it = channels_.find(header.channel);
+        switch (header.type) {
+        case mux::frame_type::data:
+            // Data racing with our own close is dropped
+            if (it != channels_.end() && !it->second->on_data(payload, length)) {
+                std::cout << "mux link protocol error, channel " << header.channel << " overran its receive window" << std::endl;
+                fail();
+            }
+            break;
+        case mux::frame_type::window:
+            if (length < 4) {
+                std::cout << "mux link protocol error, short window frame" << std::endl;
+                fail();
+                break;
+            }
+            if (it != channels_.end())
+                it->second->on_window(mux::read_u32(payload));
+            break;
+        case mux::frame_type::close:
+            if (it != channels_.end()) {
+                auto ch = it->second;
+                channels_.erase(it);
+                ch->on_close();
+            }
+            break;
+        case mux::frame_type::ping:
+            send_frame(mux::frame_type::pong, header.channel, payload, length);
+            break;
+        case mux::frame_type::pong:
+            break;
+        default:
+            std::cout << "mux link protocol error, frame type " << static_cast<int>(header.type) << std::endl;
+            fail();
+            break;
+        }
+    }
+
+    void send_frame(mux::frame_type type, std::uint32_t channel, const std::uint8_t* payload, std::size_t size)
+    {
+        if (!alive())
+            return;
+
+        mux::append_frame(output_, type, channel, payload, size);
+        flush();
+    }
+
+    void flush()
+    {
+        if (state_ != state::ready || writing_ || output_.empty())
+            return;
+
+        // Everything queued since the last write goes out together
+        writing_ = true;
+        std::swap(output_, in_flight_);
+        output_.clear();
+        net::async_write(
+            remote_sock_, net::buffer(in_flight_),
+            [this, self{shared_from_this()}](const net::error_code& ec, std::size_t) {
+                writing_ = false;
+                if (ec) {
+                    fail();
+                    return;
+                }
+                flush();
+            });
+    }
+
+    void arm_keepalive()
+    {
+        keepalive_timer_.expires_after(keepalive_interval);
+        keepalive_timer_.async_wait(
+            [this, self{shared_from_this()}](const net::error_code& ec) {
+                if (ec || !alive())
+                    return;
+
+                if (clock::now() - last_received_ > dead_interval) {
+                    std::cout << "mux link to " << remote_ep_ << " timed out" << std::endl;
+                    fail();
+                    return;
+                }
+
+                const std::uint8_t payload[8]{};
+                send_frame(mux::frame_type::ping, 0, payload, sizeof(payload));
+                arm_keepalive();
+            });
+    }
+
+    void fail(state reason = state::failed)
+    {
+        if (!alive())
+            return;
+
+        state_ = reason;
+        keepalive_timer_.cancel();
+
+        auto channels = std::move(channels_);
+        channels_.clear();
+        for (auto& [id, channel] : channels)
+            channel->on_close();
+
+        net::error_code ignored_ec;
+        remote_sock_.lowest_layer().shutdown(net::socket_base::shutdown_both, ignored_ec);
+        remote_sock_.lowest_layer().close(ignored_ec);
+    }
+
+    tcp::resolver resolver_;
+    net::ssl::stream<tcp::socket> remote_sock_;
+    net::steady_timer keepalive_timer_;
+    tls_session_cache& session_cache_;
+    const socket_options& sock_options_;
+
+    std::string remote_host_;
+    std::string remote_service_;
+    std::string remote_ep_;
+
+    state state_{state::connecting};
+    std::uint32_t next_channel_{1};
+    std::unordered_map<std::uint32_t, std::shared_ptr<mux::channel>> channels_;
+
+    std::array<std::uint8_t, 0x4000> read_buffer_{};
+    mux::buffer input_;
+    mux::buffer output_;
+    mux::buffer in_flight_;
+    bool writing_{false};
+    clock::time_point last_received_{};
+};
+
+// A fixed number of links, the least loaded established one takes a new connection.
+// Links that went down are replaced on demand
+class mux_pool
+{
+public:
+    mux_pool(std::size_t size, net::io_context& ioc, net::ssl::context& ctx, tls_session_cache& session_cache,
+             const socket_options& sock_options, std::string_view remote_host, std::string_view remote_service)
+        : links_(size)
+        , ioc_{ioc}
+        , ctx_{ctx}
+        , session_cache_{session_cache}
+        , sock_options_{sock_options}
+        , remote_host_{remote_host}
+        , remote_service_{remote_service}
+    {}
+
+    // Links start connecting right away so the first clients don't wait for them
+    void start()
+    {
+        for (auto& link : links_)
+            replace(link);
+    }
+
+    // No link when multiplexing is off, the proxy turned it down or no link is through its
+    // handshake yet. The connection then goes the plain way, so a client never waits on a link
+    // that may still fail or be refused
+    std::shared_ptr<mux_link> pick()
+    {
+        if (links_.empty() || refused_)
+            return nullptr;
+
+        std::shared_ptr<mux_link> best;
+        for (auto& link : links_) {
+            if (link && link->refused()) {
+                refused_ = true;
+                return nullptr;
+            }
+
+            if (!link || !link->alive())
+                replace(link);
+
+            if (link->ready() && (!best || link->channels() < best->channels()))
+                best = link;
+        }
+        return best;
+    }
+
+private:
+    void replace(std::shared_ptr<mux_link>& link)
+    {
+        link = std::make_shared<mux_link>(ioc_, ctx_, session_cache_, sock_options_, remote_host_, remote_service_);
+        link->start();
+    }
+
+    std::vector<std::shared_ptr<mux_link>> links_;
+    net::io_context& ioc_;
+    net::ssl::context& ctx_;
+    tls_session_cache& session_cache_;
+    const socket_options& sock_options_;
+    std::string remote_host_;
+    std::string remote_service_;
+    bool refused_{false};
+};
+
+#endif // MUX_LINK_H
@@ -0,0 +1,177 @@
+#ifndef MUX_SESSION_H
+#define MUX_SESSION_H
+
+#include "manager.hpp"
+#include "mux_link.hpp"
+#include "socket_options.hpp"
+#include "upstream.hpp"
+
+#include <asio.hpp>
+
+#include <algorithm>
+#include <array>
+#include <deque>
+#include <iostream>
+
+using tcp = asio::ip::tcp;
+namespace net = asio;
+
+// A local connection relayed as a channel of a multiplexed link, there is no
+// connect or handshake of its own so the client's first bytes leave at once
+class mux_session
+    : public session_base
+    , public mux::channel
+    , public std::enable_shared_from_this<mux_session>
+{
+public:
+    using pointer = std::shared_ptr<mux_session>;
+
+    static pointer create(tcp::socket socket, session_manager& mgr, std::shared_ptr<mux_link> link, const socket_options& sock_options,
+                          upstream_lease lease = {})
+    {
+        return pointer(new mux_session(std::move(socket), mgr, std::move(link), sock_options, std::move(lease)));
+    }
+
+    void start()
+    {
+        manager_.join(shared_from_this());
+        apply_profile(local_sock_, sock_options_.profile);
+
+        net::error_code ec;
+        const auto client = local_sock_.remote_endpoint(ec).address().to_string(ec);
+        channel_ = link_->open(shared_from_this(), client);
+        do_read_from_local();
+    }
+
+    void stop() override
+    {
+        if (closed_)
+            return;
+
+        closed_ = true;
+        link_->close_channel(channel_, !remote_closed_);
+
+        net::error_code ignored_ec;
+        local_sock_.shutdown(net::socket_base::shutdown_both, ignored_ec);
+        local_sock_.close(ignored_ec);
+    }
+
+    bool on_data(const std::uint8_t* data, std::size_t size) override
+    {
+        // The window is all that bounds to_local_, a proxy ignoring it would grow it without limit
+        if (static_cast<std::int64_t>(size) > receive_window_)
+            return false;
+
+        receive_window_ -= static_cast<std::int64_t>(size);
+        to_local_.emplace_back(data, data + size);
+        if (!writing_local_)
+            do_write_to_local();
+        return true;
+    }
+
+    void on_window(std::uint32_t increment) override
+    {
+        send_window_ += increment;
+        if (waiting_window_) {
+            waiting_window_ = false;
+            do_read_from_local();
+        }
+    }
+
+    void on_close() override
+    {
+        remote_closed_ = true;
+        // Whatever the proxy sent before closing still goes to the client
+        if (!writing_local_)
+            manager_.leave(shared_from_this());
+    }
+
+private:
+    mux_session(tcp::socket socket, session_manager& mgr, std::shared_ptr<mux_link> link, const socket_options& sock_options,
+                upstream_lease lease)
+        : local_sock_{std::move(socket)}
+        , manager_{mgr}
+        , link_{std::move(link)}
+        , sock_options_{sock_options}
+        , lease_{std::move(lease)}
+    {}
+
+    void do_read_from_local()
+    {
+        if (closed_ || remote_closed_)
+            return;
+
+        // Paced by the proxy's window, a stalled channel stops reading its client
+        if (send_window_ <= 0) {
+            waiting_window_ = true;
+            return;
+        }
+
+        const auto size = std::min<std::size_t>(local_buffer_.size(), static_cast<std::size_t>(send_window_));
+        local_sock_.async_read_some(
+            net::buffer(local_buffer_.data(), size),
+            [this, self{shared_from_this()}](const net::error_code& ec, std::size_t bytes_transferred) {
+                if (ec || bytes_transferred == 0) {
+                    manager_.leave(shared_from_this());
+                    return;
+                }
+
+                link_->send_data(channel_, local_buffer_.data(), bytes_transferred);
+                send_window_ -= static_cast<std::int64_t>(bytes_transferred);
+                do_read_from_local();
+            });
+    }
+
+    void do_write_to_local()
+    {
+        if (to_local_.empty()) {
+            if (remote_closed_)
+                manager_.leave(shared_from_this());
+            return;
+        }
+
+        writing_local_ = true;
+        net::async_write(
+            local_sock_, net::buffer(to_local_.front()),
+            [this, self{shared_from_this()}](const net::error_code& ec, std::size_t bytes_transferred) {
+                writing_local_ = false;
+                if (ec) {
+                    manager_.leave(shared_from_this());
+                    return;
+                }
+
+                to_local_.pop_front();
+
+                // Grant the window back in batches once the client took the data
+                consumed_ += static_cast<std::uint32_t>(bytes_transferred);
+                if (consumed_ >= mux::initial_window / 2 && !remote_closed_) {
+                    link_->send_window(channel_, consumed_);
+                    receive_window_ += consumed_;
+                    consumed_ = 0;
+                }
+
+                do_write_to_local();
+            });
+    }
+
+    tcp::socket local_sock_;
+    session_manager& manager_;
+    std::shared_ptr<mux_link> link_;
+    const socket_options& sock_options_;
+    upstream_lease lease_;
+    std::uint32_t channel_{0};
+
+    std::array<std::uint8_t, mux::max_payload> local_buffer_{};
+    std::int64_t send_window_{mux::initial_window};
+    bool waiting_window_{false};
+
+    std::deque<mux::buffer> to_local_;
+    std::int64_t receive_window_{mux::initial_window};
+    bool writing_local_{false};
+    std::uint32_t consumed_{0};
+
+    bool closed_{false};
+    bool remote_closed_{false};
+};
+
+#endif // MUX_SESSION_H
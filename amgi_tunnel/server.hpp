@@ -1,89 +1,99 @@
 #ifndef SERVER_H
 #define SERVER_H
 
-#include "session.hpp"
+#include "bench_stats.hpp"
+#include "cpu_placement.hpp"
+#include "worker.hpp"
 
 #include <asio.hpp>
-#include <asio/ssl.hpp>
 
-#include <charconv>
+#include <chrono>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
 
 using tcp = asio::ip::tcp;
 namespace net = asio;
 
+// Thread per worker, each with its own listener on the shared port; the first worker
+// runs on the calling thread and also handles signals
 class server 
 {
 public:
-    struct tls_options {
-        std::string private_key;
-        std::string client_cert;
-        std::string ca_cert;
-    };
-
-    server(std::string_view listen_port, std::string_view target_host, std::string_view target_service, tls_options settings)
-        : signals_(ioc_)
-        , acceptor_{ioc_}
-        , remote_host_(target_host)
-        , remote_service_(target_service)
-        , ssl_ctx_{net::ssl::context::tlsv13_client}
+    using tls_options = worker::tls_options;
+
+    server(std::string_view listen_port, std::vector<upstream_target> targets, upstream_group::options balance, tls_options settings,
+           socket_options sock_options, std::size_t threads = 1, cpu_placement placement = {},
+           std::chrono::seconds report_interval = {})
+        : upstreams_{std::move(targets), balance}
+        , placement_{std::move(placement)}
+        , workers_{make_workers(listen_port, settings, sock_options, std::max<std::size_t>(threads, 1))}
+        , signals_(workers_.front()->context())
+        , report_timer_{workers_.front()->context()}
+        , report_interval_{report_interval}
     {
         configure_signals();
         start_wait_signals();
-        configure_tls(settings);
-
-        uint16_t port{ 0 };
-        std::from_chars(listen_port.data(), listen_port.data() + listen_port.size(), port);
-
-        tcp::endpoint ep{tcp::endpoint(tcp::v4(), port)};
-        acceptor_.open(ep.protocol());
-        acceptor_.set_option(tcp::acceptor::reuse_address(true));
-        acceptor_.bind(ep);
-        acceptor_.listen();
-
-        start_accept();
+        upstreams_.start_probes(workers_.front()->context(), workers_.front()->ssl_context());
+        start_report_timer();
     }
 
-    void start_accept() 
+    void run()
     {
-        auto new_session = session::create(ioc_, ssl_ctx_, manager_, remote_host_, remote_service_);
-
-        acceptor_.async_accept(
-            new_session->socket(),
-            [this, new_session](const net::error_code& ec) {
-                if (!ec) {
-                    new_session->start();
-                } else {
-                    std::cout << ec.message() << std::endl;
-                }
-
-                start_accept();
-            });
+        std::vector<std::thread> threads;
+        for (std::size_t i = 1; i < workers_.size(); ++i) {
+            threads.emplace_back(
+                [this, i]() {
+                    placement_.enter(i);
+                    try {
+                        workers_[i]->run();
+                    } catch (const std::exception& ex) {
+                        std::cerr << "worker " << i << ": " << ex.what() << std::endl;
+                        stop();
+                    }
+                });
+        }
+
+        workers_.front()->run();
+        for (auto& thread : threads)
+            thread.join();
+
+        // Counters are summed once every worker is done with them
+        report();
     }
 
-    void run()
+private:
+    std::vector<std::unique_ptr<worker>> make_workers(std::string_view listen_port, const tls_options& settings,
+                                                      const socket_options& sock_options, std::size_t threads)
     {
-        ioc_.run();
+        if (upstreams_.size() == 0)
+            throw std::invalid_argument("no targets to forward to");
+
+        // A pinned worker is built on its own cpu, first touch puts its memory on that cpu's node
+        std::vector<std::unique_ptr<worker>> workers;
+        for (std::size_t i = 0; i < threads; ++i) {
+            if (placement_.enter(i) && placement_.enabled())
+                std::cout << "worker " << i << " pinned to cpu " << placement_.cpu(i) << ", node " << cpu_placement::current_node() << std::endl;
+
+            workers.push_back(std::make_unique<worker>(listen_port, upstreams_, settings, sock_options, session_cache_, threads > 1,
+                                                       placement_.incoming_cpu(i)));
+        }
+
+        // The calling thread goes on to run the first worker
+        placement_.enter(0);
+
+        if (threads > 1)
+            std::cout << "running " << threads << " workers" << std::endl;
+        return workers;
     }
 
-private:
     void configure_signals() 
     {
         signals_.add(SIGINT);
         signals_.add(SIGTERM);
     }
 
-    void configure_tls(tls_options settings)
-    {
-        ssl_ctx_.set_options(
-            net::ssl::context::default_workarounds | 
-            net::ssl::context::no_tlsv1_1 | 
-            net::ssl::context::no_tlsv1_2);
-
-        ssl_ctx_.load_verify_file(settings.ca_cert);
-        ssl_ctx_.use_private_key_file(settings.private_key, net::ssl::context::pem);
-        ssl_ctx_.use_certificate_file(settings.client_cert, net::ssl::context::pem);
-    }
-
     void start_wait_signals() 
     {
         signals_.async_wait(
@@ -91,19 +101,75 @@ private:
                 if (ec)
                     std::cout << ec.message() << std::endl;
 
-                acceptor_.close();
-                ioc_.stop();
+                stop();
             });
     }
 
-    net::io_context ioc_;
+    void start_report_timer()
+    {
+        if (report_interval_.count() == 0)
+            return;
+
+        report_timer_.expires_after(report_interval_);
+        report_timer_.async_wait(
+            [this](const net::error_code& ec) {
+                if (ec)
+                    return;
+
+                report_running();
+                start_report_timer();
+            });
+    }
+
+    void stop()
+    {
+        net::post(workers_.front()->context(),
+            [this]() {
+                upstreams_.stop_probes();
+                report_timer_.cancel();
+            });
+        for (auto& w : workers_)
+            w->stop();
+    }
+
+    // Target health, resumption and session counters are atomic or locked, safe to read while workers run
+    session_totals report_running() const
+    {
+        session_totals sessions;
+        for (const auto& w : workers_)
+            sessions += w->stats();
+
+        std::cout << upstreams_.report() << std::endl;
+        std::cout << session_cache_.report() << std::endl;
+        std::cout << sessions.report() << std::endl;
+        return sessions;
+    }
+
+    void report() const
+    {
+        const auto sessions = report_running();
+
+        // Warm pool counters belong to their worker's thread, only summed once every worker is done
+        warm_pool::counters warm;
+        for (const auto& w : workers_)
+            warm += w->warm_stats();
+
+        if (workers_.front()->warm_enabled())
+            std::cout << warm.report() << std::endl;
+#if defined(AMGI_TUNNEL_BENCH_STATS)
+        std::cout << bench::report(sessions.relayed_chunks) << std::endl;
+#endif
+    }
+
+    // Shared by all workers, tickets one thread received resume handshakes on the others
+    tls_session_cache session_cache_;
+    upstream_group upstreams_;
+    cpu_placement placement_;
+    std::vector<std::unique_ptr<worker>> workers_;
     net::signal_set signals_;
-    tcp::acceptor acceptor_;
-    session_manager manager_;
-    std::string remote_host_;
-    std::string remote_service_;
-    net::ssl::context ssl_ctx_;
+    net::steady_timer report_timer_;
+    std::chrono::seconds report_interval_;
 };
 
 
-#endif //SERVER_H
\ No newline at end of file
+#endif //SERVER_H
@@ -1,13 +1,20 @@
 #ifndef SESSION_H
 #define SESSION_H
 
+#include "link_relay.hpp"
 #include "manager.hpp"
+#include "socket_options.hpp"
+#include "tls_session_cache.hpp"
+#include "upstream.hpp"
 
 #include <asio.hpp>
 #include <asio/ssl.hpp>
 
 #include <iostream>
+#include <algorithm>
 #include <array>
+#include <chrono>
+#include <sstream>
 
 using tcp = asio::ip::tcp;
 namespace net = asio;
@@ -17,8 +24,6 @@ namespace
     using std::placeholders::_1;
     using std::placeholders::_2;
 
-    size_t g_scount = 0;
-
     enum : std::int32_t { eRemote, eLocal };
     std::string ep_to_str(const tcp::socket& sock, std::int32_t dir)
     {
@@ -61,15 +66,15 @@ namespace
 
 class session 
     : public session_base
+    , public link_relay
     , public std::enable_shared_from_this<session>
 {
-    enum { max_buff_size = 0x4000 };
-    using buffer_type = std::array<std::uint8_t, max_buff_size>;
-
     tcp::resolver resolver_;
     tcp::socket local_sock_;
     net::ssl::stream<tcp::socket> remote_sock_;
     session_manager& manager_;
+    tls_session_cache& session_cache_;
+    const socket_options& sock_options_;
 
     std::string remote_host_;
     std::string remote_service_;
@@ -78,33 +83,68 @@ class session
 
     std::string client_ep_;
 
+    // The target connection came handshaked from the warm pool
+    bool warm_{false};
+
+    upstream_lease lease_;
+    clock::time_point connect_started_{};
+
     buffer_type local_buffer_{};
     buffer_type remote_buffer_{};
 
     session(net::io_context& ios, 
             net::ssl::context& ctx, 
             session_manager& mgr, 
+            tls_session_cache& session_cache,
+            const socket_options& sock_options,
             std::string_view remote_host, 
-            std::string_view remote_service)
-        : resolver_{ios}
+            std::string_view remote_service,
+            const link_options& link,
+            upstream_lease lease)
+        : link_relay{link}
+        , resolver_{ios}
         , local_sock_{ios}
         , remote_sock_{ios, ctx}
         , manager_{mgr}
+        , session_cache_{session_cache}
+        , sock_options_{sock_options}
         , remote_host_{remote_host}
         , remote_service_{remote_service} 
+        , lease_{std::move(lease)}
     {
         remote_ep_ = remote_host_ + ':' + remote_service_;
         remote_sock_.set_verify_mode(net::ssl::verify_peer);
         remote_sock_.set_verify_callback(std::bind(&session::verify_certificate, this, _1, _2));
     }
 
+    session(net::io_context& ios,
+            net::ssl::stream<tcp::socket>&& remote,
+            session_manager& mgr,
+            tls_session_cache& session_cache,
+            const socket_options& sock_options,
+            std::string_view remote_host,
+            std::string_view remote_service,
+            const link_options& link,
+            upstream_lease lease)
+        : link_relay{link}
+        , resolver_{ios}
+        , local_sock_{ios}
+        , remote_sock_{std::move(remote)}
+        , manager_{mgr}
+        , session_cache_{session_cache}
+        , sock_options_{sock_options}
+        , remote_host_{remote_host}
+        , remote_service_{remote_service}
+        , warm_{true}
+        , lease_{std::move(lease)}
+    {
+        remote_ep_ = remote_host_ + ':' + remote_service_;
+    }
+
 public:
     ~session() override
     {
-        std::cout 
-            << "connection from " 
-            << client_ep_ << " to " << remote_ep_ << remote_resolved_ep_ 
-            << " closed, sescnt: " << manager_.ses_count() << ", scnt: " << --g_scount << std::endl;
+        report_closed(manager_, client_ep_, remote_ep_ + remote_resolved_ep_);
     }
 
     using pointer = std::shared_ptr<session>;
@@ -114,20 +154,46 @@ public:
     static pointer create(net::io_context& io_context, 
                           net::ssl::context& ctx,
                           session_manager& mgr,
+                          tls_session_cache& session_cache,
+                          const socket_options& sock_options,
                           std::string_view remote_host, 
-                          std::string_view remote_port) 
+                          std::string_view remote_port,
+                          const link_options& link,
+                          upstream_lease lease = {})
+    {
+        return pointer(new session(io_context, ctx, mgr, session_cache, sock_options, remote_host, remote_port, link, std::move(lease)));
+    }
+
+    static pointer create(net::io_context& io_context,
+                          net::ssl::stream<tcp::socket>&& remote,
+                          session_manager& mgr,
+                          tls_session_cache& session_cache,
+                          const socket_options& sock_options,
+                          std::string_view remote_host,
+                          std::string_view remote_port,
+                          const link_options& link,
+                          upstream_lease lease = {})
     {
-        return pointer(new session(io_context, ctx, mgr, remote_host, remote_port));
+        return pointer(new session(io_context, std::move(remote), mgr, session_cache, sock_options, remote_host, remote_port, link, std::move(lease)));
     }
 
     void start() 
     {
         manager_.join(shared_from_this());
         client_ep_ = ep_to_str(local_sock_, eRemote);
+        apply_profile(local_sock_, sock_options_.profile);
         std::cout 
             << "accepted connection from " << client_ep_ 
-            << " , sescnt: " << manager_.ses_count() << ", scnt: " << ++g_scount << std::endl;
-        do_resolve();
+            << " , sescnt: " << manager_.ses_count() << ", scnt: " << opened_count() << std::endl;
+
+        if (warm_) {
+            remote_resolved_ep_ = '(' + ep_to_str(remote_sock_, eRemote) + ')';
+            negotiate_compression(remote_sock_.native_handle());
+            do_read_from_local();
+            do_read_from_remote();
+        } else {
+            do_resolve();
+        }
     }
 
     void stop() override 
@@ -192,6 +258,13 @@ private:
         }
     }
 
+    // Live sessions of this io thread
+    std::uint64_t opened_count()
+    {
+        session_stats::bump(manager_.stats().opened);
+        return manager_.stats().live();
+    }
+
     bool verify_certificate(bool preverified, net::ssl::verify_context& ctx)
     {
         return preverified;
@@ -200,15 +273,20 @@ private:
     void handshake()
     {
         //std::cout << "start handshake with: " << remote_resolved_ep_ << std::endl;
+        session_cache_.prepare(remote_sock_.native_handle(), remote_ep_);
         remote_sock_.async_handshake(
             net::ssl::stream_base::client,
-            [this, self{shared_from_this()}](const net::error_code& error) {
+            [this, self{shared_from_this()}, started{tls_session_cache::clock::now()}](const net::error_code& error) {
                 if (!error) {
                     //std::cout << "handshake ok: " << remote_resolved_ep_ << std::endl;
+                    session_cache_.record(remote_sock_.native_handle(), tls_session_cache::clock::now() - started);
+                    lease_.connected(clock::now() - connect_started_);
+                    negotiate_compression(remote_sock_.native_handle());
                     do_read_from_local();
                     do_read_from_remote();
                 } else {
                     std::cout << "Handshake failed: " << error.message() << "\n";
+                    lease_.failed();
                     manager_.leave(shared_from_this());
                 }
             });
@@ -216,6 +294,7 @@ private:
 
     void do_resolve() 
     {
+        connect_started_ = clock::now();
         resolver_.async_resolve(
             remote_host_, remote_service_,
             [this, self{shared_from_this()}](const net::error_code& ec, const tcp::resolver::results_type& eps) {
@@ -223,24 +302,56 @@ private:
                     do_connect(eps);
                 } else {
                     std::cout << '[' << remote_ep_ << "] " << ec.message() << std::endl;
+                    lease_.failed();
                     manager_.leave(shared_from_this());
                 }
             });
     }
 
     void do_connect(const tcp::resolver::results_type& eps) {
-        net::async_connect(
-            remote_sock_.lowest_layer(), eps,
-            [this, self{shared_from_this()}](const net::error_code& ec, const tcp::endpoint& /*ep*/) {
-                remote_resolved_ep_ = '(' + ep_to_str(remote_sock_, eRemote) + ')';
-                std::cout << "connection from " << client_ep_ << " to "
-                    << remote_ep_ << remote_resolved_ep_ << " established\n";
-                if (!ec) {
-                    handshake();
-                } else {
+        do_connect(eps, eps.begin());
+    }
+
+    // Endpoints are tried one by one so the socket can be tuned before each connect. With fast open
+    // the connect completes immediately and the handshake's first write sends the SYN with the ClientHello,
+    // a refused connection then surfaces as a handshake error
+    void do_connect(const tcp::resolver::results_type& eps, tcp::resolver::results_type::const_iterator it) {
+        if (it == eps.end()) {
+            std::cout << "connection from " << client_ep_ << " to " << remote_ep_ << " failed" << std::endl;
+            lease_.failed();
+            manager_.leave(shared_from_this());
+            return;
+        }
+
+        auto& sock = remote_sock_.lowest_layer();
+        net::error_code ec;
+        sock.close(ec);
+        sock.open(it->endpoint().protocol(), ec);
+        if (ec) {
+            do_connect(eps, std::next(it));
+            return;
+        }
+
+        apply_buffers(sock, sock_options_.profile);
+        if (sock_options_.fastopen_connect)
+            enable_fastopen_connect(sock);
+
+        sock.async_connect(
+            it->endpoint(),
+            [this, self{shared_from_this()}, eps, it](const net::error_code& ec) {
+                if (ec) {
                     std::cout << ec.message() << std::endl;
-                    manager_.leave(shared_from_this());
+                    do_connect(eps, std::next(it));
+                    return;
                 }
+
+                net::error_code ignored_ec;
+                remote_resolved_ep_ = '(' + it->endpoint().address().to_string(ignored_ec) + ':' + std::to_string(it->endpoint().port()) + ')';
+                std::cout << "connection from " << client_ep_ << " to "
+                    << remote_ep_ << remote_resolved_ep_ << " established\n";
+
+                apply_profile(remote_sock_.lowest_layer(), sock_options_.profile);
+                handshake();
             });
     }
 
@@ -249,7 +360,18 @@ private:
             net::buffer(local_buffer_),
             [this, self{shared_from_this()}](const net::error_code& ec, std::size_t bytes_transferred) {
                 if (!ec && bytes_transferred > 0) {
-                    do_write_to_remote(bytes_transferred);
+                    bytes_transferred += coalesce_local(local_sock_, local_buffer_, bytes_transferred);
+                    session_stats::bump(manager_.stats().relayed_chunks);
+                    if (!compressor_) {
+                        do_write_to_remote(0, bytes_transferred);
+                        return;
+                    }
+
+                    encoded_.clear();
+                    if (compressor_->encode(local_buffer_.data(), bytes_transferred, encoded_))
+                        do_write_to_remote(0, encoded_.size());
+                    else
+                        manager_.leave(shared_from_this());
                 } else {
                     manager_.leave(shared_from_this());
                 }
@@ -261,31 +383,63 @@ private:
             net::buffer(remote_buffer_),
             [this, self{shared_from_this()}](const net::error_code& ec, std::size_t bytes_transferred) {
                 if (!ec && bytes_transferred > 0) {
-                    do_write_to_local(bytes_transferred);
+                    session_stats::bump(manager_.stats().relayed_chunks);
+                    if (compressor_) {
+                        compressor_->feed(remote_buffer_.data(), bytes_transferred);
+                        do_decode_remote();
+                    } else {
+                        do_write_to_local(remote_buffer_.data(), bytes_transferred);
+                    }
                 } else {
                     manager_.leave(shared_from_this());
                 }
             });
     }
 
-    void do_write_to_remote(std::size_t bytes_transferred) {
+    // One compressed read may expand to many writes, the next read waits until its input is used up
+    void do_decode_remote() {
+        const auto decoded = compressor_->pull(decoded_.data(), decoded_.size());
+        if (!decoded) {
+            std::cout << "corrupt compressed stream from " << remote_ep_ << std::endl;
+            manager_.leave(shared_from_this());
+            return;
+        }
+
+        if (*decoded == 0)
+            do_read_from_remote();
+        else
+            do_write_to_local(decoded_.data(), *decoded);
+    }
+
+    // Each async_write of at most one record's worth becomes a single TLS record
+    void do_write_to_remote(std::size_t offset, std::size_t size) {
+        const auto record = std::min(size - offset, next_record_size());
+        const auto* data = compressor_ ? encoded_.data() : local_buffer_.data();
         net::async_write(
-            remote_sock_, net::buffer(local_buffer_.data(), bytes_transferred),
-            [this, self{shared_from_this()}](const net::error_code& ec, std::size_t bytes_transferred) {
-                if (!ec && bytes_transferred > 0) {
-                    do_read_from_local();
-                } else {
+            remote_sock_, net::buffer(data + offset, record),
+            [this, self{shared_from_this()}, offset, size](const net::error_code& ec, std::size_t bytes_transferred) {
+                if (ec || bytes_transferred == 0) {
                     manager_.leave(shared_from_this());
+                    return;
                 }
+
+                record_written(manager_.stats(), bytes_transferred);
+                if (offset + bytes_transferred < size)
+                    do_write_to_remote(offset + bytes_transferred, size);
+                else
+                    do_read_from_local();
             });
     }
 
-    void do_write_to_local(std::size_t bytes_transferred) {
+    void do_write_to_local(const std::uint8_t* data, std::size_t size) {
         net::async_write(
-            local_sock_, net::buffer(remote_buffer_.data(), bytes_transferred),
+            local_sock_, net::buffer(data, size),
             [this, self{shared_from_this()}](const net::error_code& ec, std::size_t bytes_transferred) {
                 if (!ec && bytes_transferred > 0) {
-                    do_read_from_remote();
+                    if (compressor_)
+                        do_decode_remote();
+                    else
+                        do_read_from_remote();
                 } else {
                     manager_.leave(shared_from_this());
                 }
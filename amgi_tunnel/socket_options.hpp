@@ -0,0 +1,133 @@
+#ifndef SOCKET_OPTIONS_H
+#define SOCKET_OPTIONS_H
+
+#include "common/socket_profile.h"
+
+#include <asio.hpp>
+
+#if !defined(_WIN32)
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif
+
+#include <iostream>
+
+using tcp = asio::ip::tcp;
+namespace net = asio;
+
+struct socket_options
+{
+    // TCP_FASTOPEN queue length on the listener, 0 disables fast open for accepted connections
+    int fastopen_queue{0};
+    // TCP_FASTOPEN_CONNECT towards the target, the TLS ClientHello rides in the SYN
+    bool fastopen_connect{false};
+    socket_profile profile;
+};
+
+namespace detail
+{
+    template <typename Socket, typename Option>
+    void set_option(Socket& socket, const Option& option, const char* name)
+    {
+        net::error_code ec;
+        socket.set_option(option, ec);
+        if (ec)
+            std::cout << "failed to set " << name << ": " << ec.message() << std::endl;
+    }
+}
+
+// Buffer sizes have to be set before connect or listen for the window scale to follow them
+template <typename Socket>
+void apply_buffers(Socket& socket, const socket_profile& profile)
+{
+    if (profile.send_buffer > 0)
+        detail::set_option(socket, net::socket_base::send_buffer_size(profile.send_buffer), "SO_SNDBUF");
+    if (profile.receive_buffer > 0)
+        detail::set_option(socket, net::socket_base::receive_buffer_size(profile.receive_buffer), "SO_RCVBUF");
+}
+
+template <typename Socket>
+void apply_profile(Socket& socket, const socket_profile& profile)
+{
+    if (profile.no_delay)
+        detail::set_option(socket, tcp::no_delay(true), "TCP_NODELAY");
+
+#if defined(TCP_NOTSENT_LOWAT)
+    if (profile.notsent_lowat > 0)
+        detail::set_option(socket, net::detail::socket_option::integer<IPPROTO_TCP, TCP_NOTSENT_LOWAT>(profile.notsent_lowat), "TCP_NOTSENT_LOWAT");
+#endif
+
+    if (profile.keepalive_idle.count() > 0) {
+        detail::set_option(socket, net::socket_base::keep_alive(true), "SO_KEEPALIVE");
+#if defined(TCP_KEEPIDLE)
+        detail::set_option(socket, net::detail::socket_option::integer<IPPROTO_TCP, TCP_KEEPIDLE>(static_cast<int>(profile.keepalive_idle.count())), "TCP_KEEPIDLE");
+        if (profile.keepalive_interval.count() > 0)
+            detail::set_option(socket, net::detail::socket_option::integer<IPPROTO_TCP, TCP_KEEPINTVL>(static_cast<int>(profile.keepalive_interval.count())), "TCP_KEEPINTVL");
+        if (profile.keepalive_count > 0)
+            detail::set_option(socket, net::detail::socket_option::integer<IPPROTO_TCP, TCP_KEEPCNT>(profile.keepalive_count), "TCP_KEEPCNT");
+#endif
+    }
+
+#if defined(TCP_USER_TIMEOUT)
+    if (profile.user_timeout.count() > 0)
+        detail::set_option(socket, net::detail::socket_option::integer<IPPROTO_TCP, TCP_USER_TIMEOUT>(static_cast<int>(profile.user_timeout.count())), "TCP_USER_TIMEOUT");
+#endif
+}
+
+inline void apply_listener_options(tcp::acceptor& acceptor, const socket_options& options)
+{
+#if defined(TCP_FASTOPEN)
+    if (options.fastopen_queue > 0) {
+        net::error_code ec;
+        acceptor.set_option(net::detail::socket_option::integer<IPPROTO_TCP, TCP_FASTOPEN>(options.fastopen_queue), ec);
+        if (ec)
+            std::cout << "failed to set TCP_FASTOPEN: " << ec.message() << std::endl;
+    }
+#endif
+
+    apply_buffers(acceptor, options.profile);
+}
+
+// Every io thread binds a listener of its own to the port and the kernel spreads connections between them
+inline bool enable_reuse_port(tcp::acceptor& acceptor)
+{
+#if defined(SO_REUSEPORT)
+    net::error_code ec;
+    acceptor.set_option(net::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>(true), ec);
+    if (ec)
+        std::cout << "failed to set SO_REUSEPORT: " << ec.message() << std::endl;
+    return !ec;
+#else
+    return false;
+#endif
+}
+
+// Prefers this listener of the reuse port group for connections whose packets arrive on the cpu,
+// so an accepted connection stays on the core its receive queue interrupts (Linux 6.2 and later)
+inline bool set_incoming_cpu(tcp::acceptor& acceptor, int cpu)
+{
+#if defined(SO_INCOMING_CPU)
+    net::error_code ec;
+    acceptor.set_option(net::detail::socket_option::integer<SOL_SOCKET, SO_INCOMING_CPU>(cpu), ec);
+    if (ec)
+        std::cout << "failed to set SO_INCOMING_CPU: " << ec.message() << std::endl;
+    return !ec;
+#else
+    return false;
+#endif
+}
+
+// Defers the SYN of an unconnected socket until its first write
+template <typename Socket>
+bool enable_fastopen_connect(Socket& socket)
+{
+#if defined(TCP_FASTOPEN_CONNECT)
+    net::error_code ec;
+    socket.set_option(net::detail::socket_option::boolean<IPPROTO_TCP, TCP_FASTOPEN_CONNECT>(true), ec);
+    return !ec;
+#else
+    return false;
+#endif
+}
+
+#endif //SOCKET_OPTIONS_H
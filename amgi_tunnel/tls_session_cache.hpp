@@ -0,0 +1,139 @@
+#ifndef TLS_SESSION_CACHE_H
+#define TLS_SESSION_CACHE_H
+
+#include <openssl/ssl.h>
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+
+// Client side TLS sessions keyed by target. TLS 1.3 tickets are meant to be used once,
+// a connection takes one and the server sends fresh ones right after the handshake
+class tls_session_cache
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    explicit tls_session_cache(std::size_t per_target = 4)
+        : per_target_{per_target}
+    {}
+
+    ~tls_session_cache()
+    {
+        for (auto& [target, sessions] : sessions_)
+            for (auto* session : sessions)
+                SSL_SESSION_free(session);
+    }
+
+    tls_session_cache(const tls_session_cache& other) = delete;
+    tls_session_cache& operator=(const tls_session_cache& other) = delete;
+
+    void install(SSL_CTX* ctx)
+    {
+        SSL_CTX_set_ex_data(ctx, cache_index(), this);
+        SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+        SSL_CTX_sess_set_new_cb(ctx, &tls_session_cache::on_new_session);
+    }
+
+    // The target string must outlive the connection, tickets arrive after the handshake
+    void prepare(SSL* ssl, const std::string& target)
+    {
+        SSL_set_ex_data(ssl, target_index(), const_cast<std::string*>(&target));
+
+        SSL_SESSION* session = nullptr;
+        {
+            std::lock_guard lock{mutex_};
+            auto it = sessions_.find(target);
+            while (it != sessions_.end() && !it->second.empty() && !session) {
+                session = it->second.front();
+                it->second.pop_front();
+                if (!SSL_SESSION_is_resumable(session)) {
+                    SSL_SESSION_free(session);
+                    session = nullptr;
+                }
+            }
+        }
+
+        if (session) {
+            SSL_set_session(ssl, session);
+            SSL_SESSION_free(session);
+        }
+    }
+
+    void record(SSL* ssl, clock::duration elapsed)
+    {
+        const auto us = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+
+        std::lock_guard lock{mutex_};
+        if (SSL_session_reused(ssl)) {
+            ++resumed_;
+            resumed_time_ += us;
+        } else {
+            ++full_;
+            full_time_ += us;
+        }
+    }
+
+    std::string report() const
+    {
+        std::lock_guard lock{mutex_};
+        const auto total = full_ + resumed_;
+        const auto full_avg = full_ ? full_time_ / full_ : 0;
+        const auto resumed_avg = resumed_ ? resumed_time_ / resumed_ : 0;
+
+        std::ostringstream ss;
+        ss << "tls handshakes: " << total << ", resumed: " << resumed_
+           << " (" << (total ? resumed_ * 100 / total : 0) << "%)"
+           << ", avg full: " << full_avg << "us, avg resumed: " << resumed_avg << "us";
+        if (full_ && resumed_ && full_avg > resumed_avg)
+            ss << ", saved: " << (full_avg - resumed_avg) * resumed_ / 1000 << "ms";
+        return ss.str();
+    }
+
+private:
+    static int cache_index()
+    {
+        static const int idx = SSL_CTX_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+        return idx;
+    }
+
+    static int target_index()
+    {
+        static const int idx = SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+        return idx;
+    }
+
+    static int on_new_session(SSL* ssl, SSL_SESSION* session)
+    {
+        auto* self = static_cast<tls_session_cache*>(SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), cache_index()));
+        const auto* target = static_cast<const std::string*>(SSL_get_ex_data(ssl, target_index()));
+        if (!self || !target)
+            return 0;
+
+        std::lock_guard lock{self->mutex_};
+        auto& sessions = self->sessions_[*target];
+        if (sessions.size() >= self->per_target_) {
+            SSL_SESSION_free(sessions.front());
+            sessions.pop_front();
+        }
+
+        // Returning 1 keeps the reference OpenSSL handed over
+        sessions.push_back(session);
+        return 1;
+    }
+
+    std::size_t per_target_;
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, std::deque<SSL_SESSION*>> sessions_;
+
+    std::uint64_t full_{0};
+    std::uint64_t resumed_{0};
+    std::uint64_t full_time_{0};
+    std::uint64_t resumed_time_{0};
+};
+
+#endif // TLS_SESSION_CACHE_H
@@ -0,0 +1,456 @@
+#ifndef UPSTREAM_H
+#define UPSTREAM_H
+
+#include <asio.hpp>
+#include <asio/ssl.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+using tcp = asio::ip::tcp;
+namespace net = asio;
+
+struct upstream_target
+{
+    std::string host;
+    std::string service;
+
+    std::string name() const { return host + ':' + service; }
+
+    // "host:port[,host:port...]"
+    static std::vector<upstream_target> parse_list(std::string_view list)
+    {
+        std::vector<upstream_target> targets;
+        while (!list.empty()) {
+            const auto comma = list.find(',');
+            const auto item = list.substr(0, comma);
+            const auto colon = item.rfind(':');
+            if (colon != std::string_view::npos && colon > 0 && colon + 1 < item.size())
+                targets.push_back({std::string{item.substr(0, colon)}, std::string{item.substr(colon + 1)}});
+            else if (!item.empty())
+                std::cout << "ignoring malformed target: " << item << std::endl;
+
+            list = comma == std::string_view::npos ? std::string_view{} : list.substr(comma + 1);
+        }
+        return targets;
+    }
+};
+
+enum class balance_policy { round_robin, least_active, latency, client_hash };
+
+inline std::optional<balance_policy> parse_balance_policy(std::string_view name)
+{
+    if (name == "round-robin")
+        return balance_policy::round_robin;
+    if (name == "least-active")
+        return balance_policy::least_active;
+    if (name == "latency")
+        return balance_policy::latency;
+    if (name == "client-hash")
+        return balance_policy::client_hash;
+    return std::nullopt;
+}
+
+// Targets the tunnel spreads sessions over. Health and stats are shared by all workers, so they are
+// atomics; a target leaves rotation when its active probe fails or when sessions keep failing to
+// connect to it, in which case it is ejected for a backoff that doubles with every repeated ejection
+class upstream_group
+{
+    using clock = std::chrono::steady_clock;
+
+    static constexpr auto probe_timeout = std::chrono::seconds(3);
+    static constexpr std::size_t ring_points = 64;
+    static constexpr double ewma_weight = 0.3;
+
+public:
+    struct options {
+        balance_policy policy{balance_policy::round_robin};
+        // Interval of TCP and TLS handshake probes, zero - passive detection only
+        std::chrono::seconds probe_interval{5};
+        // Consecutive connect failures that eject a target
+        std::uint32_t max_failures{3};
+        std::chrono::seconds base_ejection{1};
+        std::chrono::seconds max_ejection{60};
+    };
+
+    upstream_group(std::vector<upstream_target> targets, options opts)
+        : options_{opts}
+        , states_(targets.size())
+    {
+        for (std::size_t i = 0; i < targets.size(); ++i)
+            states_[i].target = std::move(targets[i]);
+
+        for (std::size_t i = 0; i < states_.size(); ++i)
+            for (std::size_t point = 0; point < ring_points; ++point)
+                ring_.emplace_back(hash(states_[i].target.name() + '#' + std::to_string(point)), i);
+        std::sort(ring_.begin(), ring_.end());
+    }
+
+    upstream_group(const upstream_group& other) = delete;
+    upstream_group& operator=(const upstream_group& other) = delete;
+
+    std::size_t size() const { return states_.size(); }
+    const upstream_target& target(std::size_t index) const { return states_[index].target; }
+
+    // With every target out of rotation all of them are candidates again, a guess beats refusing the client
+    std::size_t pick(const net::ip::address& client)
+    {
+        const auto now = clock::now();
+        bool any = false;
+        for (std::size_t i = 0; i < states_.size() && !any; ++i)
+            any = available(states_[i], now);
+
+        const auto candidate = [&](std::size_t i) { return !any || available(states_[i], now); };
+        const auto start = next_.fetch_add(1, std::memory_order_relaxed);
+
+        switch (options_.policy) {
+        case balance_policy::round_robin:
+            for (std::size_t n = 0; n < states_.size(); ++n) {
+                const auto i = (start + n) % states_.size();
+                if (candidate(i))
+                    return i;
+            }
+            break;
+        case balance_policy::least_active:
+        case balance_policy::latency: {
+            // Rotating the scan start spreads ties
+            std::optional<std::size_t> best;
+            double best_score = 0;
+            for (std::size_t n = 0; n < states_.size(); ++n) {
+                const auto i = (start + n) % states_.size();
+                if (!candidate(i))
+                    continue;
+
+                const auto& state = states_[i];
+                const double active = static_cast<double>(state.active.load(std::memory_order_relaxed)) + 1;
+                const double score = options_.policy == balance_policy::least_active
+                    ? active
+                    : active * (static_cast<double>(state.latency_us.load(std::memory_order_relaxed)) + 1);
+                if (!best || score < best_score) {
+                    best = i;
+                    best_score = score;
+                }
+            }
+            if (best)
+                return *best;
+            break;
+        }
+        case balance_policy::client_hash: {
+            // A client stays on its target while that target is healthy, only its share moves otherwise
+            net::error_code ignored_ec;
+            const auto key = hash(client.to_string(ignored_ec));
+            auto it = std::lower_bound(ring_.begin(), ring_.end(), std::make_pair(key, std::size_t{0}));
+            for (std::size_t n = 0; n < ring_.size(); ++n, ++it) {
+                if (it == ring_.end())
+                    it = ring_.begin();
+                if (candidate(it->second))
+                    return it->second;
+            }
+            break;
+        }
+        }
+
+        return start % states_.size();
+    }
+
+    // False while the target is ejected or its probe finds it down
+    bool in_rotation(std::size_t index) const { return available(states_[index], clock::now()); }
+
+    void acquire(std::size_t index) { states_[index].active.fetch_add(1, std::memory_order_relaxed); }
+    void release(std::size_t index) { states_[index].active.fetch_sub(1, std::memory_order_relaxed); }
+
+    void connected(std::size_t index, clock::duration elapsed)
+    {
+        auto& state = states_[index];
+        state.connects.fetch_add(1, std::memory_order_relaxed);
+        state.consecutive_failures.store(0, std::memory_order_relaxed);
+        state.ejection_streak.store(0, std::memory_order_relaxed);
+        sample_latency(state, elapsed);
+    }
+
+    void failed(std::size_t index)
+    {
+        auto& state = states_[index];
+        state.failures.fetch_add(1, std::memory_order_relaxed);
+        if (state.consecutive_failures.fetch_add(1, std::memory_order_relaxed) + 1 < options_.max_failures)
+            return;
+
+        const auto now = clock::now();
+        if (now.time_since_epoch().count() < state.ejected_until.load(std::memory_order_relaxed))
+            return;
+
+        const auto streak = std::min<std::uint32_t>(state.ejection_streak.fetch_add(1, std::memory_order_relaxed), 16);
+        const auto backoff = std::min<std::chrono::seconds>(options_.base_ejection * (1u << streak), options_.max_ejection);
+        state.ejected_until.store((now + backoff).time_since_epoch().count(), std::memory_order_relaxed);
+        state.consecutive_failures.store(0, std::memory_order_relaxed);
+        state.ejections.fetch_add(1, std::memory_order_relaxed);
+        std::cout << "target " << state.target.name() << " ejected for " << backoff.count() << "s" << std::endl;
+    }
+
+    // Probes run on one io context, the caller's worker
+    void start_probes(net::io_context& ioc, net::ssl::context& ctx)
+    {
+        if (options_.probe_interval.count() <= 0)
+            return;
+
+        for (std::size_t i = 0; i < states_.size(); ++i) {
+            auto probe = std::make_shared<health_probe>(*this, i, ioc, ctx);
+            probes_.push_back(probe);
+            probe->run();
+        }
+    }
+
+    void stop_probes()
+    {
+        for (auto& probe : probes_)
+            probe->stop();
+        probes_.clear();
+    }
+
+    std::string report() const
+    {
+        const auto now = clock::now();
+        std::ostringstream ss;
+        for (std::size_t i = 0; i < states_.size(); ++i) {
+            const auto& state = states_[i];
+            if (i)
+                ss << '\n';
+            ss << "target " << state.target.name()
+               << (available(state, now) ? " up" : " down")
+               << ", active: " << state.active.load(std::memory_order_relaxed)
+               << ", connects: " << state.connects.load(std::memory_order_relaxed)
+               << ", failures: " << state.failures.load(std::memory_order_relaxed)
+               << ", ejections: " << state.ejections.load(std::memory_order_relaxed)
+               << ", probe failures: " << state.probe_failures.load(std::memory_order_relaxed)
+               << ", latency: " << state.latency_us.load(std::memory_order_relaxed) << "us";
+        }
+        return ss.str();
+    }
+
+private:
+    struct target_state {
+        upstream_target target;
+
+        std::atomic<std::int64_t> active{0};
+        std::atomic<std::uint64_t> latency_us{0};
+        std::atomic<bool> probe_down{false};
+        std::atomic<clock::rep> ejected_until{0};
+        std::atomic<std::uint32_t> consecutive_failures{0};
+        std::atomic<std::uint32_t> ejection_streak{0};
+
+        std::atomic<std::uint64_t> connects{0};
+        std::atomic<std::uint64_t> failures{0};
+        std::atomic<std::uint64_t> ejections{0};
+        std::atomic<std::uint64_t> probe_failures{0};
+    };
+
+    // Connect and handshake from scratch, no resumption, so the probe exercises what a new session needs
+    class health_probe : public std::enable_shared_from_this<health_probe>
+    {
+    public:
+        health_probe(upstream_group& group, std::size_t index, net::io_context& ioc, net::ssl::context& ctx)
+            : group_{group}
+            , index_{index}
+            , ioc_{ioc}
+            , ctx_{ctx}
+            , resolver_{ioc}
+            , timer_{ioc}
+            , deadline_{ioc}
+        {}
+
+        void run()
+        {
+            if (stopped_)
+                return;
+
+            stream_ = std::make_shared<net::ssl::stream<tcp::socket>>(ioc_, ctx_);
+            stream_->set_verify_mode(net::ssl::verify_peer);
+            started_ = clock::now();
+
+            deadline_.expires_after(probe_timeout);
+            deadline_.async_wait(
+                [self{shared_from_this()}, stream{stream_}](const net::error_code& ec) {
+                    if (!ec) {
+                        net::error_code ignored_ec;
+                        stream->lowest_layer().close(ignored_ec);
+                    }
+                });
+
+            const auto& target = group_.target(index_);
+            resolver_.async_resolve(
+                target.host, target.service,
+                [self{shared_from_this()}, stream{stream_}](const net::error_code& ec, const tcp::resolver::results_type& eps) {
+                    if (ec) {
+                        self->done(ec);
+                        return;
+                    }
+
+                    net::async_connect(stream->lowest_layer(), eps,
+                        [self, stream](const net::error_code& ec, const tcp::endpoint&) {
+                            if (ec) {
+                                self->done(ec);
+                                return;
+                            }
+
+                            stream->async_handshake(
+                                net::ssl::stream_base::client,
+                                [self, stream](const net::error_code& ec) {
+                                    self->done(ec);
+                                });
+                        });
+                });
+        }
+
+        void stop()
+        {
+            stopped_ = true;
+            net::error_code ignored_ec;
+            timer_.cancel(ignored_ec);
+            deadline_.cancel(ignored_ec);
+            resolver_.cancel();
+            if (stream_)
+                stream_->lowest_layer().close(ignored_ec);
+        }
+
+    private:
+        void done(const net::error_code& ec)
+        {
+            net::error_code ignored_ec;
+            deadline_.cancel(ignored_ec);
+            if (stopped_)
+                return;
+
+            auto& state = group_.states_[index_];
+            const bool was_down = state.probe_down.load(std::memory_order_relaxed);
+            if (!ec) {
+                group_.sample_latency(state, clock::now() - started_);
+                state.probe_down.store(false, std::memory_order_relaxed);
+                if (was_down)
+                    std::cout << "target " << state.target.name() << " is back" << std::endl;
+            } else {
+                state.probe_failures.fetch_add(1, std::memory_order_relaxed);
+                state.probe_down.store(true, std::memory_order_relaxed);
+                if (!was_down)
+                    std::cout << "target " << state.target.name() << " probe failed: " << ec.message() << std::endl;
+            }
+
+            stream_->lowest_layer().close(ignored_ec);
+            stream_.reset();
+
+            timer_.expires_after(group_.options_.probe_interval);
+            timer_.async_wait(
+                [self{shared_from_this()}](const net::error_code& ec) {
+                    if (!ec)
+                        self->run();
+                });
+        }
+
+        upstream_group& group_;
+        std::size_t index_;
+        net::io_context& ioc_;
+        net::ssl::context& ctx_;
+        tcp::resolver resolver_;
+        net::steady_timer timer_;
+        net::steady_timer deadline_;
+        std::shared_ptr<net::ssl::stream<tcp::socket>> stream_;
+        clock::time_point started_{};
+        bool stopped_{false};
+    };
+
+    static bool available(const target_state& state, clock::time_point now)
+    {
+        return !state.probe_down.load(std::memory_order_relaxed) &&
+            now.time_since_epoch().count() >= state.ejected_until.load(std::memory_order_relaxed);
+    }
+
+    // Racing updates from two workers may drop a sample, which an average shrugs off
+    void sample_latency(target_state& state, clock::duration elapsed)
+    {
+        const auto us = static_cast<double>(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+        const auto prev = static_cast<double>(state.latency_us.load(std::memory_order_relaxed));
+        const auto next = prev > 0 ? prev + ewma_weight * (us - prev) : us;
+        state.latency_us.store(static_cast<std::uint64_t>(next), std::memory_order_relaxed);
+    }
+
+    // FNV-1a, stable across platforms and runs so clients keep their targets after a restart
+    static std::uint32_t hash(std::string_view key)
+    {
+        std::uint32_t h = 2166136261u;
+        for (const auto c : key) {
+            h ^= static_cast<std::uint8_t>(c);
+            h *= 16777619u;
+        }
+        return h;
+    }
+
+    options options_;
+    std::vector<target_state> states_;
+    std::vector<std::pair<std::uint32_t, std::size_t>> ring_;
+    std::atomic<std::size_t> next_{0};
+    std::vector<std::shared_ptr<health_probe>> probes_;
+};
+
+// A session's claim on its target: counts towards the target's active sessions for as long
+// as it lives and carries the outcome of connecting back to the group
+class upstream_lease
+{
+public:
+    upstream_lease() = default;
+
+    upstream_lease(upstream_group& group, std::size_t index)
+        : group_{&group}
+        , index_{index}
+    {
+        group_->acquire(index_);
+    }
+
+    upstream_lease(upstream_lease&& other) noexcept
+        : group_{std::exchange(other.group_, nullptr)}
+        , index_{other.index_}
+    {}
+
+    upstream_lease& operator=(upstream_lease&& other) noexcept
+    {
+        if (this != &other) {
+            reset();
+            group_ = std::exchange(other.group_, nullptr);
+            index_ = other.index_;
+        }
+        return *this;
+    }
+
+    ~upstream_lease() { reset(); }
+
+    void connected(std::chrono::steady_clock::duration elapsed)
+    {
+        if (group_)
+            group_->connected(index_, elapsed);
+    }
+
+    void failed()
+    {
+        if (group_)
+            group_->failed(index_);
+    }
+
+private:
+    void reset()
+    {
+        if (group_)
+            group_->release(index_);
+        group_ = nullptr;
+    }
+
+    upstream_group* group_{nullptr};
+    std::size_t index_{0};
+};
+
+#endif // UPSTREAM_H
@@ -0,0 +1,296 @@
+#ifndef WARM_POOL_H
+#define WARM_POOL_H
+
+#include "socket_options.hpp"
+#include "tls_session_cache.hpp"
+#include "upstream.hpp"
+
+#include <asio.hpp>
+#include <asio/ssl.hpp>
+
+#include <array>
+#include <chrono>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <sstream>
+
+#if !defined(_WIN32)
+#include <poll.h>
+#endif
+
+using tcp = asio::ip::tcp;
+namespace net = asio;
+
+// Connections to the target that already went through connect and the mTLS handshake,
+// an accepted client takes one instead of waiting for DNS, TCP and TLS
+class warm_pool
+{
+    using clock = std::chrono::steady_clock;
+    using ssl_stream = net::ssl::stream<tcp::socket>;
+
+    static constexpr auto maintenance_interval = std::chrono::seconds(5);
+
+public:
+    struct options {
+        std::size_t min_idle{0};
+        std::size_t max_idle{0};
+        // Idle connections older than this are dropped, the proxy or a middlebox may have forgotten them
+        std::chrono::seconds max_age{30};
+    };
+
+    struct counters {
+        std::size_t hits{0};
+        std::size_t misses{0};
+        std::size_t stale{0};
+
+        counters& operator+=(const counters& other)
+        {
+            hits += other.hits;
+            misses += other.misses;
+            stale += other.stale;
+            return *this;
+        }
+
+        std::string report() const
+        {
+            std::ostringstream ss;
+            ss << "warm pool hits: " << hits << ", misses: " << misses << ", stale: " << stale;
+            return ss.str();
+        }
+    };
+
+    // Connects to the group's target at index and reports every outcome back to the group
+    warm_pool(options opts, net::io_context& ioc, net::ssl::context& ctx, tls_session_cache& session_cache,
+              const socket_options& sock_options, upstream_group& upstreams, std::size_t index)
+        : ioc_{ioc}
+        , ctx_{ctx}
+        , session_cache_{session_cache}
+        , sock_options_{sock_options}
+        , upstreams_{upstreams}
+        , index_{index}
+        , resolver_{ioc}
+        , timer_{ioc}
+        , remote_host_{upstreams.target(index).host}
+        , remote_service_{upstreams.target(index).service}
+        , remote_ep_{remote_host_ + ':' + remote_service_}
+        , options_{opts}
+    {
+        options_.max_idle = std::max(options_.max_idle, options_.min_idle);
+    }
+
+    [[nodiscard]] bool enabled() const { return options_.min_idle > 0; }
+
+    void start()
+    {
+        if (!enabled())
+            return;
+
+        refill(options_.min_idle);
+        arm_maintenance();
+    }
+
+    void stop()
+    {
+        timer_.cancel();
+        idle_.clear();
+    }
+
+    // A ready connection or nothing, the caller then connects the usual way
+    std::unique_ptr<ssl_stream> take()
+    {
+        std::unique_ptr<ssl_stream> stream;
+        while (!idle_.empty() && !stream) {
+            auto entry = std::move(idle_.front());
+            idle_.pop_front();
+            if (healthy(entry))
+                stream = std::move(entry.stream);
+        }
+
+        // A miss means demand outran the pool, grow towards max_idle until it calms down
+        if (stream) {
+            ++counters_.hits;
+        } else {
+            ++counters_.misses;
+            missed_ = true;
+        }
+
+        refill(missed_ ? options_.max_idle : options_.min_idle);
+        return stream;
+    }
+
+    const counters& stats() const { return counters_; }
+
+private:
+    struct idle_connection {
+        std::unique_ptr<ssl_stream> stream;
+        clock::time_point since;
+    };
+
+    void refill(std::size_t target)
+    {
+        // An ejected or probed down target gets no connections, maintenance refills once it is back
+        if (!enabled() || !upstreams_.in_rotation(index_))
+            return;
+
+        while (idle_.size() + connecting_ < target)
+            connect_one();
+    }
+
+    void connect_one()
+    {
+        ++connecting_;
+        auto stream = std::make_shared<ssl_stream>(ioc_, ctx_);
+        stream->set_verify_mode(net::ssl::verify_peer);
+
+        resolver_.async_resolve(
+            remote_host_, remote_service_,
+            [this, stream, started{clock::now()}](const net::error_code& ec, const tcp::resolver::results_type& eps) {
+                if (ec) {
+                    failed(ec);
+                    return;
+                }
+
+                connect(stream, eps, eps.begin(), started);
+            });
+    }
+
+    void connect(const std::shared_ptr<ssl_stream>& stream, const tcp::resolver::results_type& eps,
+                 tcp::resolver::results_type::const_iterator it, clock::time_point started)
+    {
+        if (it == eps.end()) {
+            failed(net::error::host_unreachable);
+            return;
+        }
+
+        auto& sock = stream->lowest_layer();
+        net::error_code ec;
+        sock.close(ec);
+        sock.open(it->endpoint().protocol(), ec);
+        if (ec) {
+            connect(stream, eps, std::next(it), started);
+            return;
+        }
+
+        apply_buffers(sock, sock_options_.profile);
+        sock.async_connect(
+            it->endpoint(),
+            [this, stream, eps, it, started](const net::error_code& ec) {
+                if (ec) {
+                    connect(stream, eps, std::next(it), started);
+                    return;
+                }
+
+                apply_profile(stream->lowest_layer(), sock_options_.profile);
+                handshake(stream, started);
+            });
+    }
+
+    void handshake(const std::shared_ptr<ssl_stream>& stream, clock::time_point connect_started)
+    {
+        session_cache_.prepare(stream->native_handle(), remote_ep_);
+        stream->async_handshake(
+            net::ssl::stream_base::client,
+            [this, stream, connect_started, started{clock::now()}](const net::error_code& ec) {
+                if (ec) {
+                    failed(ec);
+                    return;
+                }
+
+                session_cache_.record(stream->native_handle(), clock::now() - started);
+                upstreams_.connected(index_, clock::now() - connect_started);
+                --connecting_;
+                if (idle_.size() < options_.max_idle)
+                    idle_.push_back({std::make_unique<ssl_stream>(std::move(*stream)), clock::now()});
+            });
+    }
+
+    void failed(const net::error_code& ec)
+    {
+        // The next take() or maintenance round retries, a dead target doesn't spin here and enough
+        // failures take it out of rotation for the sessions as well
+        --connecting_;
+        upstreams_.failed(index_);
+        std::cout << "warm connection to " << remote_ep_ << " failed: " << ec.message() << std::endl;
+    }
+
+    // The proxy sends TLS tickets right after the handshake, so unread data doesn't mean the
+    // connection is alive; where the platform can tell, look for the peer's FIN behind it
+    bool healthy(idle_connection& entry)
+    {
+        if (clock::now() - entry.since > options_.max_age) {
+            ++counters_.stale;
+            return false;
+        }
+
+        auto& sock = entry.stream->next_layer();
+#if defined(POLLRDHUP)
+        pollfd pfd{sock.native_handle(), POLLRDHUP, 0};
+        if (::poll(&pfd, 1, 0) == 0)
+            return true;
+#else
+        net::error_code ec;
+        net::error_code ignored_ec;
+        sock.non_blocking(true, ignored_ec);
+
+        std::array<std::uint8_t, 1> probe{};
+        const auto n = sock.receive(net::buffer(probe), net::socket_base::message_peek, ec);
+        sock.non_blocking(false, ignored_ec);
+
+        if (ec == net::error::would_block || ec == net::error::try_again || (!ec && n > 0))
+            return true;
+#endif
+
+        ++counters_.stale;
+        return false;
+    }
+
+    void arm_maintenance()
+    {
+        timer_.expires_after(maintenance_interval);
+        timer_.async_wait(
+            [this](const net::error_code& ec) {
+                if (ec)
+                    return;
+
+                for (auto it = idle_.begin(); it != idle_.end();) {
+                    if (healthy(*it))
+                        ++it;
+                    else
+                        it = idle_.erase(it);
+                }
+
+                // A quiet interval gives the surplus back to the proxy
+                if (!missed_) {
+                    while (idle_.size() > options_.min_idle)
+                        idle_.pop_back();
+                }
+
+                missed_ = false;
+                refill(options_.min_idle);
+                arm_maintenance();
+            });
+    }
+
+    net::io_context& ioc_;
+    net::ssl::context& ctx_;
+    tls_session_cache& session_cache_;
+    const socket_options& sock_options_;
+    upstream_group& upstreams_;
+    std::size_t index_;
+    tcp::resolver resolver_;
+    net::steady_timer timer_;
+
+    std::string remote_host_;
+    std::string remote_service_;
+    std::string remote_ep_;
+    options options_;
+
+    std::deque<idle_connection> idle_;
+    std::size_t connecting_{0};
+    bool missed_{false};
+
+    counters counters_;
+};
+
+#endif // WARM_POOL_H
@@ -0,0 +1,199 @@
+#ifndef WORKER_H
+#define WORKER_H
+
+#include "session.hpp"
+#include "coro_session.hpp"
+#include "mux_session.hpp"
+#include "upstream.hpp"
+#include "warm_pool.hpp"
+
+#include <asio.hpp>
+#include <asio/ssl.hpp>
+
+#include <charconv>
+#include <memory>
+#include <vector>
+
+using tcp = asio::ip::tcp;
+namespace net = asio;
+
+// One io thread of the tunnel with everything its sessions touch: the io context, a listener
+// of its own, the TLS context, the session registry and the upstream pools. Nothing here
+// is shared with other workers except the thread safe TLS session cache and target health
+class worker
+{
+public:
+    struct tls_options {
+        std::string private_key;
+        std::string client_cert;
+        std::string ca_cert;
+        // Bytes sent in small records after connect or idle before switching to full ones, zero - always full
+        std::size_t record_boost{0x20000};
+        // Long lived links client connections are multiplexed over, per worker, zero - a connection per client
+        std::size_t mux_links{0};
+        // Handshaked connections kept ready for accepted clients when not multiplexing, per worker
+        warm_pool::options warm;
+        // zlib level of plain links offered to the proxy, zero - no compression
+        int compression{0};
+        // Plain links are relayed by coroutine sessions, needs a build with AMGI_TUNNEL_COROUTINES
+        bool coroutines{false};
+    };
+
+    worker(std::string_view listen_port, upstream_group& upstreams, const tls_options& settings,
+           const socket_options& sock_options, tls_session_cache& session_cache, bool reuse_port, int incoming_cpu = -1)
+        : ioc_{1}
+        , acceptor_{ioc_}
+        , upstreams_{upstreams}
+        , session_cache_{session_cache}
+        , ssl_ctx_{net::ssl::context::tlsv13_client}
+        , sock_options_{sock_options}
+        , link_{settings.record_boost, settings.compression}
+        , coroutines_{settings.coroutines}
+    {
+        configure_tls(settings);
+
+        const auto warm = settings.mux_links ? warm_pool::options{} : settings.warm;
+        for (std::size_t i = 0; i < upstreams_.size(); ++i) {
+            const auto& target = upstreams_.target(i);
+            pools_.push_back(std::unique_ptr<target_pools>(new target_pools{
+                mux_pool{settings.mux_links, ioc_, ssl_ctx_, session_cache_, sock_options_, target.host, target.service},
+                warm_pool{warm, ioc_, ssl_ctx_, session_cache_, sock_options_, upstreams_, i}}));
+        }
+
+        uint16_t port{ 0 };
+        std::from_chars(listen_port.data(), listen_port.data() + listen_port.size(), port);
+
+        tcp::endpoint ep{tcp::endpoint(tcp::v4(), port)};
+        acceptor_.open(ep.protocol());
+        acceptor_.set_option(tcp::acceptor::reuse_address(true));
+        if (reuse_port)
+            enable_reuse_port(acceptor_);
+        if (incoming_cpu >= 0)
+            set_incoming_cpu(acceptor_, incoming_cpu);
+        apply_listener_options(acceptor_, sock_options_);
+        acceptor_.bind(ep);
+        acceptor_.listen();
+
+        for (auto& pools : pools_) {
+            pools->mux.start();
+            pools->warm.start();
+        }
+        start_accept();
+    }
+
+    worker(const worker& other) = delete;
+    worker& operator=(const worker& other) = delete;
+
+    net::io_context& context() { return ioc_; }
+    net::ssl::context& ssl_context() { return ssl_ctx_; }
+
+    void run()
+    {
+        ioc_.run();
+    }
+
+    // Safe to call from any thread
+    void stop()
+    {
+        net::post(ioc_,
+            [this]() {
+                acceptor_.close();
+                for (auto& pools : pools_)
+                    pools->warm.stop();
+                ioc_.stop();
+            });
+    }
+
+    const session_stats& stats() const { return manager_.stats(); }
+
+    warm_pool::counters warm_stats() const
+    {
+        warm_pool::counters counters;
+        for (const auto& pools : pools_)
+            counters += pools->warm.stats();
+        return counters;
+    }
+
+    bool warm_enabled() const { return !pools_.empty() && pools_.front()->warm.enabled(); }
+
+private:
+    void start_accept()
+    {
+        acceptor_.async_accept(
+            [this](const net::error_code& ec, tcp::socket socket) {
+                if (!ec) {
+                    net::error_code ignored_ec;
+                    const auto index = upstreams_.pick(socket.remote_endpoint(ignored_ec).address());
+                    const auto& target = upstreams_.target(index);
+                    auto& pools = *pools_[index];
+                    upstream_lease lease{upstreams_, index};
+
+                    // Multiplexed while the proxy takes it, a warm connection if one is ready, a connection of its own otherwise
+                    if (auto link = pools.mux.pick()) {
+                        mux_session::create(std::move(socket), manager_, std::move(link), sock_options_, std::move(lease))->start();
+#if defined(AMGI_TUNNEL_COROUTINES)
+                    } else if (coroutines_) {
+                        start_session<coro_session>(std::move(socket), pools.warm.take(), target, std::move(lease));
+#endif
+                    } else {
+                        start_session<session>(std::move(socket), pools.warm.take(), target, std::move(lease));
+                    }
+                } else if (ec == net::error::operation_aborted) {
+                    return;
+                } else {
+                    std::cout << ec.message() << std::endl;
+                }
+
+                start_accept();
+            });
+    }
+
+    template <typename Session>
+    void start_session(tcp::socket socket, std::unique_ptr<net::ssl::stream<tcp::socket>> remote, const upstream_target& target, upstream_lease lease)
+    {
+        auto new_session = remote
+            ? Session::create(ioc_, std::move(*remote), manager_, session_cache_, sock_options_, target.host, target.service, link_, std::move(lease))
+            : Session::create(ioc_, ssl_ctx_, manager_, session_cache_, sock_options_, target.host, target.service, link_, std::move(lease));
+        new_session->socket() = std::move(socket);
+        new_session->start();
+    }
+
+    // Every worker builds its own context from the same settings, handshakes never contend on it
+    void configure_tls(const tls_options& settings)
+    {
+        ssl_ctx_.set_options(
+            net::ssl::context::default_workarounds | 
+            net::ssl::context::no_tlsv1_1 | 
+            net::ssl::context::no_tlsv1_2);
+
+        ssl_ctx_.load_verify_file(settings.ca_cert);
+        ssl_ctx_.use_private_key_file(settings.private_key, net::ssl::context::pem);
+        ssl_ctx_.use_certificate_file(settings.client_cert, net::ssl::context::pem);
+        session_cache_.install(ssl_ctx_.native_handle());
+
+        // Mux links replace the offer with their own protocol, every other connection carries it
+        if (settings.compression > 0) {
+            const auto& protocol = codec::alpn_zlib;
+            SSL_CTX_set_alpn_protos(ssl_ctx_.native_handle(), reinterpret_cast<const unsigned char*>(protocol.data()), static_cast<unsigned int>(protocol.size()));
+        }
+    }
+
+    // Mux links and warm connections of one target
+    struct target_pools {
+        mux_pool mux;
+        warm_pool warm;
+    };
+
+    net::io_context ioc_;
+    tcp::acceptor acceptor_;
+    session_manager manager_;
+    upstream_group& upstreams_;
+    tls_session_cache& session_cache_;
+    net::ssl::context ssl_ctx_;
+    socket_options sock_options_;
+    link_options link_;
+    bool coroutines_{false};
+    std::vector<std::unique_ptr<target_pools>> pools_;
+};
+
+#endif // WORKER_H
@@ -0,0 +1,85 @@
+#ifndef AMGI_COMMON_MUX_FRAME_H
+#define AMGI_COMMON_MUX_FRAME_H
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+// Framing of the multiplexed tunnel link, negotiated with ALPN. Shared by the proxy and the
+// tunnel, so both ends always agree on it. Every frame is an 8 byte header: type, flags,
+// payload length and channel, big endian
+namespace mux
+{
+    // ALPN wire format, length prefixed
+    constexpr std::string_view alpn_protocol{"\x0a" "amgi-mux/1", 11};
+
+    enum class frame_type : std::uint8_t {
+        open = 1,       // payload: client address as text, may be empty
+        data = 2,
+        close = 3,
+        window = 4,     // payload: 4 byte window increment
+        ping = 5,       // payload: 8 opaque bytes echoed back by pong
+        pong = 6
+    };
+
+    constexpr std::size_t header_size = 8;
+    // A full data frame fills one 16 KB relay buffer and TLS record
+    constexpr std::size_t max_payload = 0x4000 - header_size;
+    // Bytes either side may send on a channel before the peer grants more
+    constexpr std::uint32_t initial_window = 0x40000;
+
+    struct frame_header {
+        frame_type type;
+        std::uint16_t length;
+        std::uint32_t channel;
+    };
+
+    inline void append_frame(std::vector<std::uint8_t>& out, frame_type type, std::uint32_t channel, const std::uint8_t* payload, std::size_t length)
+    {
+        const std::uint8_t header[header_size] = {
+            static_cast<std::uint8_t>(type), 0,
+            static_cast<std::uint8_t>(length >> 8), static_cast<std::uint8_t>(length),
+            static_cast<std::uint8_t>(channel >> 24), static_cast<std::uint8_t>(channel >> 16),
+            static_cast<std::uint8_t>(channel >> 8), static_cast<std::uint8_t>(channel)
+        };
+        out.insert(out.end(), header, header + header_size);
+        if (length)
+            out.insert(out.end(), payload, payload + length);
+    }
+
+    // Header of the next frame once it is complete in the buffer
+    inline std::optional<frame_header> parse_frame(const std::uint8_t* data, std::size_t size)
+    {
+        if (size < header_size)
+            return std::nullopt;
+
+        frame_header header{
+            static_cast<frame_type>(data[0]),
+            static_cast<std::uint16_t>((data[2] << 8) | data[3]),
+            (static_cast<std::uint32_t>(data[4]) << 24) | (static_cast<std::uint32_t>(data[5]) << 16) |
+            (static_cast<std::uint32_t>(data[6]) << 8) | static_cast<std::uint32_t>(data[7])
+        };
+
+        if (size < header_size + header.length)
+            return std::nullopt;
+        return header;
+    }
+
+    inline std::uint32_t read_u32(const std::uint8_t* data)
+    {
+        return (static_cast<std::uint32_t>(data[0]) << 24) | (static_cast<std::uint32_t>(data[1]) << 16) |
+               (static_cast<std::uint32_t>(data[2]) << 8) | static_cast<std::uint32_t>(data[3]);
+    }
+
+    inline void write_u32(std::uint8_t* data, std::uint32_t value)
+    {
+        data[0] = static_cast<std::uint8_t>(value >> 24);
+        data[1] = static_cast<std::uint8_t>(value >> 16);
+        data[2] = static_cast<std::uint8_t>(value >> 8);
+        data[3] = static_cast<std::uint8_t>(value);
+    }
+}
+
+#endif // AMGI_COMMON_MUX_FRAME_H
@@ -0,0 +1,51 @@
+#ifndef AMGI_COMMON_SOCKET_PROFILE_H
+#define AMGI_COMMON_SOCKET_PROFILE_H
+
+#include <chrono>
+#include <optional>
+#include <string_view>
+
+// Per-connection TCP tuning, zero values keep the system defaults. Shared by the proxy and the
+// tunnel, so a preset name means the same on both ends of a link
+struct socket_profile
+{
+    bool no_delay{false};
+    int send_buffer{0};
+    int receive_buffer{0};
+    // Bound on written but unsent bytes, keeps kernel queueing and so latency under control
+    int notsent_lowat{0};
+    // Keepalive probing is enabled by a non-zero idle time
+    std::chrono::seconds keepalive_idle{0};
+    std::chrono::seconds keepalive_interval{0};
+    int keepalive_count{0};
+    // TCP_USER_TIMEOUT, how long sent data may stay unacknowledged before the connection is dropped
+    std::chrono::milliseconds user_timeout{0};
+    // SO_BUSY_POLL, how long a receive spins on the device queue before sleeping, raising it needs CAP_NET_ADMIN
+    std::chrono::microseconds busy_poll{0};
+    // SO_PREFER_BUSY_POLL, keeps softirq processing off the device while the application busy polls
+    bool prefer_busy_poll{false};
+
+    // Names preset() accepts, for usage and error messages
+    static constexpr std::string_view preset_names{"default|latency|throughput"};
+
+    // Unknown names give nothing, callers reject them rather than guess
+    static std::optional<socket_profile> preset(std::string_view name)
+    {
+        using namespace std::chrono_literals;
+
+        if (name == "default")
+            return socket_profile{};
+
+        // Interactive traffic: no Nagle, little queued in the kernel, dead peers noticed quickly
+        if (name == "latency")
+            return socket_profile{true, 0, 0, 0x4000, 30s, 5s, 4, 30000ms};
+
+        // Bulk transfers: large windows, queueing bounded well above the relay buffer size
+        if (name == "throughput")
+            return socket_profile{false, 0x400000, 0x400000, 0x40000, 60s, 10s, 6, 0ms};
+
+        return std::nullopt;
+    }
+};
+
+#endif // AMGI_COMMON_SOCKET_PROFILE_H
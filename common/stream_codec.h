@@ -0,0 +1,219 @@
+#ifndef AMGI_COMMON_STREAM_CODEC_H
+#define AMGI_COMMON_STREAM_CODEC_H
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+// Compression of a plain (not multiplexed) tunnel link. The codec is picked by ALPN, both ends
+// compress what they send and decompress what they receive as one continuous stream. Shared by
+// the proxy and the tunnel, each hooks its own metrics in through codec::observer
+namespace codec
+{
+    // ALPN wire format, length prefixed
+    inline constexpr std::string_view alpn_zlib{"\x08" "amgi-z/1"};
+
+    using buffer = std::vector<std::uint8_t>;
+
+    // Told about every encoded and decoded chunk
+    class observer
+    {
+    public:
+        virtual ~observer() = default;
+        virtual void compressed(std::size_t in, std::size_t out) {}
+        virtual void bypassed(std::size_t size) {}
+        virtual void decoded(std::size_t size) {}
+        virtual void corrupt() {}
+    };
+}
+
+class stream_codec
+{
+public:
+    virtual ~stream_codec() = default;
+
+    // Appends data to out, flushed so the peer can decode everything so far. With compress
+    // off the codec only frames the data, cheaply, and the peer's decoder doesn't notice
+    virtual bool encode(const std::uint8_t* data, std::size_t size, bool compress, codec::buffer& out) = 0;
+
+    // Input must stay untouched until pull() has drained it
+    virtual void feed(const std::uint8_t* data, std::size_t size) = 0;
+    // Decoded bytes written to out, zero once the input is used up, nothing on corrupt input
+    virtual std::optional<std::size_t> pull(std::uint8_t* out, std::size_t capacity) = 0;
+};
+
+// Raw deflate, TLS already guards integrity so the zlib header and checksum are dead weight
+class zlib_codec final : public stream_codec
+{
+public:
+    explicit zlib_codec(int level)
+        : level_{std::clamp(level, Z_BEST_SPEED, Z_BEST_COMPRESSION)}
+        , current_level_{level_}
+    {
+        deflateInit2(&deflate_, level_, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+        inflateInit2(&inflate_, -MAX_WBITS);
+    }
+
+    ~zlib_codec() override
+    {
+        deflateEnd(&deflate_);
+        inflateEnd(&inflate_);
+    }
+
+    zlib_codec(const zlib_codec& other) = delete;
+    zlib_codec& operator=(const zlib_codec& other) = delete;
+
+    bool encode(const std::uint8_t* data, std::size_t size, bool compress, codec::buffer& out) override
+    {
+        auto produced = out.size();
+        out.resize(produced + deflateBound(&deflate_, static_cast<uLong>(size)) + 16);
+        deflate_.next_out = out.data() + produced;
+        deflate_.avail_out = static_cast<uInt>(out.size() - produced);
+
+        // Level zero emits stored blocks, a copy with five bytes of framing
+        const int level = compress ? level_ : Z_NO_COMPRESSION;
+        if (level != current_level_) {
+            if (deflateParams(&deflate_, level, Z_DEFAULT_STRATEGY) != Z_OK)
+                return false;
+            current_level_ = level;
+        }
+
+        deflate_.next_in = const_cast<Bytef*>(data);
+        deflate_.avail_in = static_cast<uInt>(size);
+        do {
+            if (deflate_.avail_out == 0) {
+                produced = out.size();
+                out.resize(produced + 0x1000);
+                deflate_.next_out = out.data() + produced;
+                deflate_.avail_out = 0x1000;
+            }
+
+            const auto ret = deflate(&deflate_, Z_SYNC_FLUSH);
+            if (ret != Z_OK && ret != Z_BUF_ERROR)
+                return false;
+        } while (deflate_.avail_out == 0);
+
+        out.resize(out.size() - deflate_.avail_out);
+        return true;
+    }
+
+    void feed(const std::uint8_t* data, std::size_t size) override
+    {
+        inflate_.next_in = const_cast<Bytef*>(data);
+        inflate_.avail_in = static_cast<uInt>(size);
+    }
+
+    std::optional<std::size_t> pull(std::uint8_t* out, std::size_t capacity) override
+    {
+        inflate_.next_out = out;
+        inflate_.avail_out = static_cast<uInt>(capacity);
+
+        // Block headers and sync markers decode to nothing and a long match may still be
+        // copying out of the window with no input left, so fill until zlib can't progress
+        while (inflate_.avail_out > 0) {
+            const auto ret = inflate(&inflate_, Z_SYNC_FLUSH);
+            if (ret == Z_BUF_ERROR)
+                break;
+            if (ret != Z_OK)
+                return std::nullopt;
+        }
+
+        return capacity - inflate_.avail_out;
+    }
+
+private:
+    int level_;
+    int current_level_;
+    z_stream deflate_{};
+    z_stream inflate_{};
+};
+
+// Compresses while it pays off. Flows that barely shrink, already compressed media or TLS
+// inside the tunnel, go through uncompressed for a while before the next sample
+class stream_compressor
+{
+    // Output below this share of the input keeps compression on
+    static constexpr double worthwhile_ratio = 0.9;
+    static constexpr std::size_t sample_window = 0x10000;
+    static constexpr std::size_t min_bypass = 0x100000;
+    static constexpr std::size_t max_bypass = 0x4000000;
+
+public:
+    stream_compressor(std::unique_ptr<stream_codec> codec, codec::observer& observer)
+        : codec_{std::move(codec)}
+        , observer_{observer}
+    {}
+
+    // The compressor for a negotiated ALPN protocol, none if it isn't a compression protocol
+    static std::unique_ptr<stream_compressor> negotiate(std::string_view alpn, int level, codec::observer& observer)
+    {
+        if (level > 0 && alpn == codec::alpn_zlib.substr(1))
+            return std::make_unique<stream_compressor>(std::make_unique<zlib_codec>(level), observer);
+        return nullptr;
+    }
+
+    bool encode(const std::uint8_t* data, std::size_t size, codec::buffer& out)
+    {
+        const auto before = out.size();
+        if (!codec_->encode(data, size, compress_, out))
+            return false;
+
+        const auto written = out.size() - before;
+        if (!compress_) {
+            observer_.bypassed(size);
+            bypass_left_ -= std::min(bypass_left_, size);
+            if (!bypass_left_) {
+                compress_ = true;
+                window_in_ = window_out_ = 0;
+            }
+            return true;
+        }
+
+        observer_.compressed(size, written);
+        window_in_ += size;
+        window_out_ += written;
+        if (window_in_ < sample_window)
+            return true;
+
+        // A poor window backs off for longer each time, a good one forgives past ones
+        if (static_cast<double>(window_out_) > worthwhile_ratio * static_cast<double>(window_in_)) {
+            compress_ = false;
+            bypass_left_ = bypass_length_;
+            bypass_length_ = std::min(bypass_length_ * 2, max_bypass);
+        } else {
+            bypass_length_ = min_bypass;
+        }
+
+        window_in_ = window_out_ = 0;
+        return true;
+    }
+
+    void feed(const std::uint8_t* data, std::size_t size) { codec_->feed(data, size); }
+
+    std::optional<std::size_t> pull(std::uint8_t* out, std::size_t capacity)
+    {
+        const auto decoded = codec_->pull(out, capacity);
+        if (decoded)
+            observer_.decoded(*decoded);
+        else
+            observer_.corrupt();
+        return decoded;
+    }
+
+private:
+    std::unique_ptr<stream_codec> codec_;
+    codec::observer& observer_;
+    bool compress_{true};
+    // Bytes of the current sample window or bypass period
+    std::size_t window_in_{0};
+    std::size_t window_out_{0};
+    std::size_t bypass_left_{0};
+    std::size_t bypass_length_{min_bypass};
+};
+
+#endif // AMGI_COMMON_STREAM_CODEC_H